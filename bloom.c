@@ -0,0 +1,483 @@
+/*
+ * bloom.c: changed-path Bloom filters
+ *
+ * The file $GIT_OBJECT_DIRECTORY/info/bloom-filters looks like this
+ * (integers are in network byte order):
+ *
+ *   header: "BLMF", the 4-byte version (1) and the 4-byte number of
+ *           hash functions per key (BLOOM_KEY_HASHES)
+ *   fanout: 256 4-byte numbers, the n-th being the number of commits
+ *           whose object name starts with a byte <= n
+ *   names:  the object names of the commits, sorted
+ *   ends:   for each commit, the 4-byte offset (from the start of the
+ *           filter data) of the end of its filter
+ *   filter data
+ *   trailer: the SHA-1 of everything above
+ *
+ * A filter of length zero means the commit changed nothing.  A commit
+ * that changed more than MAX_FILTER_PATHS paths gets a one-byte filter
+ * with all bits set, which answers "maybe" to everything; such commits
+ * are cheaper to diff than to store.  Key i of a path is
+ * h0 + i * h1, where h0 and h1 are the 32-bit murmur3 hashes of the
+ * path with two fixed seeds, and it sets bit (key % number of bits),
+ * counting from the least significant bit of the first byte.
+ */
+#include "cache.h"
+#include "bloom.h"
+#include "commit.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "dir.h"
+#include "refs.h"
+#include "revision.h"
+#include "progress.h"
+#include "string-list.h"
+
+#define BLOOM_SIGNATURE "BLMF"
+#define BLOOM_VERSION 1
+#define HEADER_SIZE 12
+#define FANOUT_SIZE (256 * 4)
+#define BITS_PER_PATH 10
+#define MAX_FILTER_PATHS 512
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, 4);
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+static uint32_t murmur3_32(uint32_t seed, const char *data, int len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const uint32_t c1 = 0xcc9e2d51, c2 = 0x1b873593;
+	uint32_t h = seed, k;
+	int i;
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		k = p[i] | p[i + 1] << 8 | p[i + 2] << 16 |
+			(uint32_t)p[i + 3] << 24;
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		h ^= k;
+		h = rotl32(h, 13);
+		h = h * 5 + 0xe6546b64;
+	}
+	k = 0;
+	switch (len & 3) {
+	case 3:
+		k ^= p[i + 2] << 16;
+		/* fallthrough */
+	case 2:
+		k ^= p[i + 1] << 8;
+		/* fallthrough */
+	case 1:
+		k ^= p[i];
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		h ^= k;
+	}
+	h ^= len;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+void fill_bloom_key(const char *path, int len, struct bloom_key *key)
+{
+	uint32_t h0 = murmur3_32(0x293ae76f, path, len);
+	uint32_t h1 = murmur3_32(0x7e646e2c, path, len);
+	int i;
+
+	for (i = 0; i < BLOOM_KEY_HASHES; i++)
+		key->hash[i] = h0 + i * h1;
+}
+
+static void add_key(unsigned char *filter, uint32_t len,
+		    const struct bloom_key *key)
+{
+	uint64_t bits = (uint64_t)len * 8;
+	int i;
+
+	for (i = 0; i < BLOOM_KEY_HASHES; i++) {
+		uint64_t bit = key->hash[i] % bits;
+		filter[bit >> 3] |= 1 << (bit & 7);
+	}
+}
+
+static int has_key(const unsigned char *filter, uint32_t len,
+		   const struct bloom_key *key)
+{
+	uint64_t bits = (uint64_t)len * 8;
+	int i;
+
+	if (!len)
+		return 0;
+	for (i = 0; i < BLOOM_KEY_HASHES; i++) {
+		uint64_t bit = key->hash[i] % bits;
+		if (!(filter[bit >> 3] & (1 << (bit & 7))))
+			return 0;
+	}
+	return 1;
+}
+
+static struct bloom_file {
+	unsigned char *map;
+	size_t size;
+	uint32_t nr;
+	const unsigned char *fanout;
+	const unsigned char *names;
+	const unsigned char *ends;
+	const unsigned char *data;
+	uint32_t data_size;
+} *bloom_file;
+static int bloom_file_tried;
+
+static char *bloom_file_path(void)
+{
+	return mkpathdup("%s/info/bloom-filters", get_object_directory());
+}
+
+static int has_replace_ref(const char *refname, const unsigned char *sha1,
+			   int flags, void *cb_data)
+{
+	return 1;
+}
+
+/*
+ * The filters describe the parents recorded in the commit objects,
+ * which is not what the rest of git sees when history is rewritten.
+ */
+static int history_is_rewritten(void)
+{
+	return is_repository_shallow() ||
+		file_exists(get_graft_file()) ||
+		(read_replace_refs && for_each_replace_ref(has_replace_ref, NULL));
+}
+
+static struct bloom_file *open_bloom_file(void)
+{
+	char *path = bloom_file_path();
+	struct bloom_file *bf;
+	struct stat st;
+	size_t size;
+	uint32_t i, prev = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			error("unable to open '%s': %s", path, strerror(errno));
+		free(path);
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		error("unable to stat '%s': %s", path, strerror(errno));
+		close(fd);
+		free(path);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < HEADER_SIZE + FANOUT_SIZE + 20) {
+		close(fd);
+		goto corrupt;
+	}
+	bf = xcalloc(1, sizeof(*bf));
+	bf->size = size;
+	bf->map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (memcmp(bf->map, BLOOM_SIGNATURE, 4) ||
+	    get_be32(bf->map + 4) != BLOOM_VERSION ||
+	    get_be32(bf->map + 8) != BLOOM_KEY_HASHES)
+		goto corrupt_map;
+	bf->fanout = bf->map + HEADER_SIZE;
+	for (i = 0; i < 256; i++) {
+		uint32_t n = get_be32(bf->fanout + 4 * i);
+		if (n < prev)
+			goto corrupt_map;
+		prev = n;
+	}
+	bf->nr = prev;
+	if ((size - HEADER_SIZE - FANOUT_SIZE - 20) / 24 < bf->nr)
+		goto corrupt_map;
+	bf->names = bf->fanout + FANOUT_SIZE;
+	bf->ends = bf->names + 20 * (size_t)bf->nr;
+	bf->data = bf->ends + 4 * (size_t)bf->nr;
+	bf->data_size = bf->map + size - 20 - bf->data;
+	if (bf->nr && get_be32(bf->ends + 4 * (bf->nr - 1)) > bf->data_size)
+		goto corrupt_map;
+	free(path);
+	return bf;
+
+corrupt_map:
+	munmap(bf->map, bf->size);
+	free(bf);
+corrupt:
+	error("ignoring corrupt changed-path filters '%s'", path);
+	free(path);
+	return NULL;
+}
+
+static void close_bloom_file(void)
+{
+	if (bloom_file) {
+		munmap(bloom_file->map, bloom_file->size);
+		free(bloom_file);
+		bloom_file = NULL;
+	}
+	bloom_file_tried = 0;
+}
+
+static struct bloom_file *get_bloom_file(void)
+{
+	if (!bloom_file_tried) {
+		bloom_file_tried = 1;
+		if (!history_is_rewritten())
+			bloom_file = open_bloom_file();
+	}
+	return bloom_file;
+}
+
+static int find_filter(struct bloom_file *bf, const unsigned char *sha1,
+		       const unsigned char **filter, uint32_t *len)
+{
+	uint32_t lo = sha1[0] ? get_be32(bf->fanout + 4 * (sha1[0] - 1)) : 0;
+	uint32_t hi = get_be32(bf->fanout + 4 * sha1[0]);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, bf->names + 20 * (size_t)mi);
+		if (!cmp) {
+			uint32_t start = mi ? get_be32(bf->ends + 4 * (mi - 1)) : 0;
+			uint32_t end = get_be32(bf->ends + 4 * mi);
+			if (end < start || end > bf->data_size)
+				return 0;
+			*filter = bf->data + start;
+			*len = end - start;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+int bloom_filter_may_contain(const unsigned char *commit_sha1,
+			     const struct bloom_key *keys, int nr)
+{
+	struct bloom_file *bf = get_bloom_file();
+	const unsigned char *filter;
+	uint32_t len;
+	int i;
+
+	if (!bf || !find_filter(bf, commit_sha1, &filter, &len))
+		return -1;
+	for (i = 0; i < nr; i++)
+		if (has_key(filter, len, &keys[i]))
+			return 1;
+	return 0;
+}
+
+struct filter_entry {
+	unsigned char sha1[20];
+	size_t offset;		/* into the filter data being built */
+	uint32_t len;
+};
+
+static void add_changed_path(struct string_list *paths, const char *path)
+{
+	const char *slash;
+
+	string_list_insert(paths, path);
+	for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+		char *dir = xmemdupz(path, slash - path);
+		string_list_insert(paths, dir);
+		free(dir);
+	}
+}
+
+static void compute_filter(struct commit *commit, struct diff_options *opt,
+			   struct strbuf *data, struct filter_entry *e)
+{
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	struct bloom_key key;
+	int i;
+
+	if (commit->parents) {
+		struct commit *parent = commit->parents->item;
+		if (parse_commit(parent))
+			die("unable to parse commit %s",
+			    sha1_to_hex(parent->object.sha1));
+		diff_tree_sha1(parent->tree->object.sha1,
+			       commit->tree->object.sha1, "", opt);
+	} else
+		diff_root_tree_sha1(commit->tree->object.sha1, "", opt);
+	for (i = 0; i < diff_queued_diff.nr; i++)
+		add_changed_path(&paths, diff_queued_diff.queue[i]->two->path);
+	diff_flush(opt);
+
+	e->offset = data->len;
+	if (paths.nr > MAX_FILTER_PATHS) {
+		e->len = 1;
+		strbuf_addch(data, 0xff);
+	} else {
+		e->len = (paths.nr * BITS_PER_PATH + 7) / 8;
+		strbuf_grow(data, e->len);
+		memset(data->buf + e->offset, 0, e->len);
+		strbuf_setlen(data, e->offset + e->len);
+		for (i = 0; i < paths.nr; i++) {
+			fill_bloom_key(paths.items[i].string,
+				       strlen(paths.items[i].string), &key);
+			add_key((unsigned char *)data->buf + e->offset,
+				e->len, &key);
+		}
+	}
+	string_list_clear(&paths, 0);
+}
+
+static int filter_entry_cmp(const void *a_, const void *b_)
+{
+	const struct filter_entry *a = a_, *b = b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static struct lock_file bloom_lock;
+
+int write_bloom_filters(int show_progress)
+{
+	const char *argv[] = { NULL, "--all", NULL };
+	struct filter_entry *entries = NULL;
+	int nr = 0, alloc = 0, i;
+	struct strbuf data = STRBUF_INIT, out = STRBUF_INIT;
+	struct progress *progress = NULL;
+	struct diff_options opt;
+	struct rev_info revs;
+	struct commit *commit;
+	struct bloom_file *old;
+	unsigned char hdr[HEADER_SIZE], be[4], sha1[20];
+	uint32_t fanout[256], end;
+	git_SHA_CTX ctx;
+	char *path;
+	int fd;
+
+	path = bloom_file_path();
+	if (history_is_rewritten()) {
+		warning("not writing changed-path filters, as history is "
+			"rewritten by grafts, replace refs or a shallow clone");
+		close_bloom_file();
+		if (unlink(path) && errno != ENOENT)
+			warning("unable to remove '%s': %s", path, strerror(errno));
+		free(path);
+		return 0;
+	}
+
+	diff_setup(&opt);
+	DIFF_OPT_SET(&opt, RECURSIVE);
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+
+	save_commit_buffer = 0;
+	init_revisions(&revs, NULL);
+	setup_revisions(2, argv, &revs, NULL);
+	if (prepare_revision_walk(&revs)) {
+		free(path);
+		return error("revision walk setup failed");
+	}
+	if (show_progress)
+		progress = start_progress("Computing changed paths", 0);
+	old = get_bloom_file();
+	while ((commit = get_revision(&revs))) {
+		struct filter_entry *e;
+		const unsigned char *filter;
+		uint32_t len;
+
+		ALLOC_GROW(entries, nr + 1, alloc);
+		e = &entries[nr++];
+		hashcpy(e->sha1, commit->object.sha1);
+		if (old && find_filter(old, e->sha1, &filter, &len)) {
+			e->offset = data.len;
+			e->len = len;
+			strbuf_add(&data, filter, len);
+		} else
+			compute_filter(commit, &opt, &data, e);
+		display_progress(progress, nr);
+	}
+	stop_progress(&progress);
+	qsort(entries, nr, sizeof(*entries), filter_entry_cmp);
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < nr; i++)
+		fanout[entries[i].sha1[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+	memcpy(hdr, BLOOM_SIGNATURE, 4);
+	put_be32(hdr + 4, BLOOM_VERSION);
+	put_be32(hdr + 8, BLOOM_KEY_HASHES);
+	strbuf_add(&out, hdr, sizeof(hdr));
+	for (i = 0; i < 256; i++) {
+		put_be32(be, fanout[i]);
+		strbuf_add(&out, be, 4);
+	}
+	for (i = 0; i < nr; i++)
+		strbuf_add(&out, entries[i].sha1, 20);
+	for (i = 0, end = 0; i < nr; i++) {
+		end += entries[i].len;
+		put_be32(be, end);
+		strbuf_add(&out, be, 4);
+	}
+	for (i = 0; i < nr; i++)
+		strbuf_add(&out, data.buf + entries[i].offset, entries[i].len);
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, out.buf, out.len);
+	git_SHA1_Final(sha1, &ctx);
+	strbuf_add(&out, sha1, 20);
+	strbuf_release(&data);
+	free(entries);
+
+	close_bloom_file();
+	if (safe_create_leading_directories(path) < 0) {
+		error("unable to create directory for '%s'", path);
+		goto fail;
+	}
+	fd = hold_lock_file_for_update(&bloom_lock, path, 0);
+	if (fd < 0) {
+		unable_to_lock_error(path, errno);
+		goto fail;
+	}
+	if (write_in_full(fd, out.buf, out.len) != out.len) {
+		rollback_lock_file(&bloom_lock);
+		error("unable to write '%s': %s", path, strerror(errno));
+		goto fail;
+	}
+	if (commit_lock_file(&bloom_lock)) {
+		error("unable to write '%s': %s", path, strerror(errno));
+		goto fail;
+	}
+	strbuf_release(&out);
+	free(path);
+	return 0;
+
+fail:
+	strbuf_release(&out);
+	free(path);
+	return -1;
+}
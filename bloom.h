@@ -0,0 +1,41 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+/*
+ * Changed-path Bloom filters.
+ *
+ * For each commit, "git write-bloom-filters" records in
+ * $GIT_OBJECT_DIRECTORY/info/bloom-filters a Bloom filter of the
+ * paths that differ between the commit and its first parent (or the
+ * empty tree for a root commit), including all their leading
+ * directories.  A path-limited history walk can then tell that a
+ * commit did not touch a path without diffing its trees.
+ *
+ * The filters are only used when the history is not rewritten by
+ * grafts, replace refs or a shallow clone, as they describe the
+ * parents that were seen when they were written.
+ */
+
+#define BLOOM_KEY_HASHES 7
+
+struct bloom_key {
+	uint32_t hash[BLOOM_KEY_HASHES];
+};
+
+extern void fill_bloom_key(const char *path, int len, struct bloom_key *key);
+
+/*
+ * Returns 0 if no path given by "keys" changed between the commit
+ * and its first parent, 1 if one may have, or -1 if there is no
+ * filter for the commit.
+ */
+extern int bloom_filter_may_contain(const unsigned char *commit_sha1,
+				    const struct bloom_key *keys, int nr);
+
+/*
+ * Write filters for all commits reachable from refs, reusing the
+ * ones that were already written.  Returns 0 or an error().
+ */
+extern int write_bloom_filters(int show_progress);
+
+#endif /* BLOOM_H */
@@ -29,6 +29,7 @@ static int run_remote_archiver(int argc, const char **argv,
 {
 	char buf[LARGE_PACKET_MAX];
 	int fd[2], i, len, rv;
+	struct packet_reader reader;
 	struct transport *transport;
 	struct remote *_remote;
 
@@ -53,7 +54,8 @@ static int run_remote_archiver(int argc, const char **argv,
 		packet_write(fd[1], "argument %s\n", argv[i]);
 	packet_flush(fd[1]);
 
-	len = packet_read_line(fd[0], buf, sizeof(buf));
+	packet_reader_init(&reader, fd[0]);
+	len = packet_reader_read_line(&reader, buf, sizeof(buf));
 	if (!len)
 		die(_("git archive: expected ACK/NAK, got EOF"));
 	if (buf[len-1] == '\n')
@@ -66,12 +68,12 @@ static int run_remote_archiver(int argc, const char **argv,
 		die(_("git archive: protocol error"));
 	}
 
-	len = packet_read_line(fd[0], buf, sizeof(buf));
+	len = packet_reader_read_line(&reader, buf, sizeof(buf));
 	if (len)
 		die(_("git archive: expected a flush"));
 
 	/* Now, start reading from fd[0] and spit it out to stdout */
-	rv = recv_sideband("archive", fd[0], 1);
+	rv = recv_sideband("archive", &reader, 1);
 	rv |= transport_disconnect(transport);
 
 	return !!rv;
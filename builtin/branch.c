@@ -259,6 +259,7 @@ struct ref_list {
 	int index, alloc, maxwidth, verbose, abbrev;
 	struct ref_item *list;
 	struct commit_list *with_commit;
+	struct contains_cache contains;
 	int kinds;
 };
 
@@ -340,7 +341,9 @@ static int append_ref(const char *refname, const unsigned char *sha1, int flags,
 		}
 
 		/* Filter with with_commit if specified */
-		if (!is_descendant_of(commit, ref_list->with_commit))
+		if (ref_list->with_commit &&
+		    !commit_contains(commit, ref_list->with_commit,
+				     &ref_list->contains))
 			return 0;
 
 		if (merge_filter != NO_FILTER)
@@ -376,6 +379,7 @@ static void free_ref_list(struct ref_list *ref_list)
 		free(ref_list->list[i].dest);
 	}
 	free(ref_list->list);
+	clear_contains_cache(&ref_list->contains);
 }
 
 static int ref_cmp(const void *r1, const void *r2)
@@ -532,7 +536,10 @@ static void show_detached(struct ref_list *ref_list)
 {
 	struct commit *head_commit = lookup_commit_reference_gently(head_sha1, 1);
 
-	if (head_commit && is_descendant_of(head_commit, ref_list->with_commit)) {
+	if (head_commit &&
+	    (!ref_list->with_commit ||
+	     commit_contains(head_commit, ref_list->with_commit,
+			     &ref_list->contains))) {
 		struct ref_item item;
 		item.name = xstrdup(_("(no branch)"));
 		item.width = utf8_strwidth(item.name);
@@ -562,7 +569,11 @@ static int print_ref_list(int kinds, int detached, int verbose, int abbrev, stru
 	cb.ref_list = &ref_list;
 	cb.pattern = pattern;
 	cb.ret = 0;
-	for_each_rawref(append_ref, &cb);
+	/* only read the namespaces we list, not e.g. refs/tags/ */
+	if (kinds & REF_LOCAL_BRANCH)
+		for_each_rawref_in("refs/heads/", append_ref, &cb);
+	if (kinds & REF_REMOTE_BRANCH)
+		for_each_rawref_in("refs/remotes/", append_ref, &cb);
 	if (merge_filter != NO_FILTER) {
 		struct commit *filter;
 		filter = lookup_commit_reference_gently(merge_filter_ref, 0);
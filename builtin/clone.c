@@ -23,6 +23,9 @@
 #include "branch.h"
 #include "remote.h"
 #include "run-command.h"
+#include "list-objects-filter.h"
+#include "fetch-object.h"
+#include "sha1-array.h"
 
 /*
  * Overall FIXMEs:
@@ -39,7 +42,7 @@ static const char * const builtin_clone_usage[] = {
 
 static int option_no_checkout, option_bare, option_mirror, option_single_branch = -1;
 static int option_local = -1, option_no_hardlinks, option_shared, option_recursive;
-static char *option_template, *option_depth;
+static char *option_template, *option_depth, *option_filter;
 static char *option_origin = NULL;
 static char *option_branch = NULL;
 static const char *real_git_dir;
@@ -92,6 +95,8 @@ static struct option builtin_clone_options[] = {
 		   N_("path to git-upload-pack on the remote")),
 	OPT_STRING(0, "depth", &option_depth, N_("depth"),
 		    N_("create a shallow clone of that depth")),
+	OPT_STRING(0, "filter", &option_filter, N_("filter-spec"),
+		   N_("create a partial clone without the objects the filter excludes")),
 	OPT_BOOL(0, "single-branch", &option_single_branch,
 		    N_("clone only one branch, HEAD or --branch")),
 	OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
@@ -534,6 +539,41 @@ static void update_head(const struct ref *our, const struct ref *remote,
 	}
 }
 
+static int collect_missing_blob(const unsigned char *sha1,
+				const char *base, int baselen,
+				const char *pathname, unsigned mode,
+				int stage, void *context)
+{
+	struct sha1_array *missing = context;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+	if (S_ISREG(mode) || S_ISLNK(mode)) {
+		if (!has_sha1_file(sha1))
+			sha1_array_append(missing, sha1);
+	}
+	return 0;
+}
+
+/*
+ * Fetch the blobs a partial clone left out but the checkout needs in
+ * one go, rather than one at a time as the checkout reads them.
+ */
+static void prefetch_missing_blobs(struct tree *tree)
+{
+	struct sha1_array missing = SHA1_ARRAY_INIT;
+	struct pathspec pathspec;
+
+	init_pathspec(&pathspec, NULL);
+	read_tree_recursive(tree, "", 0, 0, &pathspec,
+			    collect_missing_blob, &missing);
+	if (missing.nr &&
+	    fetch_objects((const unsigned char (*)[20])missing.sha1, missing.nr))
+		warning(_("unable to fetch missing blobs before checkout"));
+	free_pathspec(&pathspec);
+	sha1_array_clear(&missing);
+}
+
 static int checkout(void)
 {
 	unsigned char sha1[20];
@@ -577,6 +617,8 @@ static int checkout(void)
 	opts.dst_index = &the_index;
 
 	tree = parse_tree_indirect(sha1);
+	if (promisor_remote())
+		prefetch_missing_blobs(tree);
 	parse_tree(tree);
 	init_tree_desc(&t, tree->buffer, tree->size);
 	unpack_trees(1, &t, &opts);
@@ -722,6 +764,18 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	is_local = option_local != 0 && path && !is_bundle;
 	if (is_local && option_depth)
 		warning(_("--depth is ignored in local clones; use file:// instead."));
+	if (option_filter) {
+		struct list_objects_filter_options filter_options;
+
+		memset(&filter_options, 0, sizeof(filter_options));
+		if (parse_list_objects_filter(&filter_options, option_filter))
+			die(_("invalid filter '%s'"), option_filter);
+		list_objects_filter_release(&filter_options);
+		if (is_local) {
+			warning(_("--filter is ignored in local clones; use file:// instead."));
+			option_filter = NULL;
+		}
+	}
 
 	if (argc == 2)
 		dir = xstrdup(argv[1]);
@@ -807,6 +861,15 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	git_config_set(key.buf, repo);
 	strbuf_reset(&key);
 
+	if (option_filter) {
+		strbuf_addf(&key, "remote.%s.promisor", option_origin);
+		git_config_set(key.buf, "true");
+		strbuf_reset(&key);
+		strbuf_addf(&key, "remote.%s.partialclonefilter", option_origin);
+		git_config_set(key.buf, option_filter);
+		strbuf_reset(&key);
+	}
+
 	if (option_reference.nr)
 		setup_reference();
 
@@ -827,6 +890,10 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		if (option_depth)
 			transport_set_option(transport, TRANS_OPT_DEPTH,
 					     option_depth);
+		if (option_filter)
+			transport_set_option(transport,
+					     TRANS_OPT_LIST_OBJECTS_FILTER,
+					     option_filter);
 		if (option_single_branch)
 			transport_set_option(transport, TRANS_OPT_FOLLOWTAGS, "1");
 
@@ -11,12 +11,15 @@
 #include "run-command.h"
 #include "transport.h"
 #include "version.h"
+#include "decorate.h"
+#include "list-objects-filter.h"
 
 static int transfer_unpack_limit = -1;
 static int fetch_unpack_limit = -1;
 static int unpack_limit = 100;
 static int prefer_ofs_delta = 1;
 static int no_done;
+static int negotiation_skipping;
 static int fetch_fsck_objects = -1;
 static int transfer_fsck_objects = -1;
 static int agent_supported;
@@ -27,6 +30,7 @@ static struct fetch_pack_args args = {
 static const char fetch_pack_usage[] =
 "git fetch-pack [--all] [--stdin] [--quiet|-q] [--keep|-k] [--thin] "
 "[--include-tag] [--upload-pack=<git-upload-pack>] [--depth=<n>] "
+"[--filter=<filter-spec>] [--no-dependents] "
 "[--no-progress] [-v] [<host>:]<directory> [<refs>...]";
 
 #define COMPLETE	(1U << 0)
@@ -34,6 +38,8 @@ static const char fetch_pack_usage[] =
 #define COMMON_REF	(1U << 2)
 #define SEEN		(1U << 3)
 #define POPPED		(1U << 4)
+#define SKIPPED		(1U << 5)
+#define BACKFILL	(1U << 6)
 
 static int marked;
 
@@ -44,7 +50,21 @@ static int marked;
 #define MAX_IN_VAIN 256
 
 static struct commit_list *rev_list;
-static int non_common_revs, multi_ack, use_sideband;
+static struct packet_reader reader;
+static int non_common_revs, multi_ack, use_sideband, use_filter;
+
+/*
+ * With the "skipping" negotiation algorithm, each line of history
+ * leaves out a growing number of commits between two "have"s as long
+ * as nothing is found in common.  "ttl" counts the commits still to be
+ * skipped before the next one is sent, and "original_ttl" is the
+ * distance that was used for the current stretch.
+ */
+struct skip_info {
+	unsigned ttl, original_ttl;
+};
+static struct decoration skip_infos;
+static struct commit_list *skipped;
 
 static void rev_list_push(struct commit *commit, int mark)
 {
@@ -78,10 +98,103 @@ static int clear_marks(const char *refname, const unsigned char *sha1, int flag,
 
 	if (o && o->type == OBJ_COMMIT)
 		clear_commit_marks((struct commit *)o,
-				   COMMON | COMMON_REF | SEEN | POPPED);
+				   COMMON | COMMON_REF | SEEN | POPPED |
+				   SKIPPED | BACKFILL);
 	return 0;
 }
 
+static void clear_skip_infos(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < skip_infos.size; i++)
+		free(skip_infos.hash[i].decoration);
+	free(skip_infos.hash);
+	memset(&skip_infos, 0, sizeof(skip_infos));
+	free_commit_list(skipped);
+	skipped = NULL;
+}
+
+/*
+ * Decide whether the commit we are about to send should be skipped,
+ * and if so remember it so that it can be backfilled later.  Root
+ * commits and backfilled commits are always sent.
+ */
+static int skip_commit(struct commit *commit)
+{
+	struct skip_info *info = lookup_decoration(&skip_infos, &commit->object);
+
+	if (!info || !info->ttl || !commit->parents ||
+	    (commit->object.flags & BACKFILL))
+		return 0;
+	commit->object.flags |= SKIPPED;
+	commit_list_insert(commit, &skipped);
+	return 1;
+}
+
+static void pass_skip_info(struct commit *commit, struct commit *parent,
+			   int sent)
+{
+	struct skip_info *info = lookup_decoration(&skip_infos, &commit->object);
+	struct skip_info *pinfo;
+	unsigned ttl, original_ttl;
+
+	if (parent->object.flags & POPPED)
+		return;
+	if (!sent) {
+		ttl = info->ttl - 1;
+		original_ttl = info->original_ttl;
+	} else {
+		original_ttl = info ? info->original_ttl * 3 / 2 + 1 : 1;
+		ttl = original_ttl;
+	}
+
+	pinfo = lookup_decoration(&skip_infos, &parent->object);
+	if (!pinfo) {
+		pinfo = xmalloc(sizeof(*pinfo));
+		add_decoration(&skip_infos, &parent->object, pinfo);
+	} else if (pinfo->ttl <= ttl)
+		return;
+	pinfo->ttl = ttl;
+	pinfo->original_ttl = original_ttl;
+}
+
+/*
+ * Once something we have is known to be common, send the commits we
+ * skipped right above it after all, so that the other side learns
+ * where exactly our histories diverge.
+ */
+static void backfill_skipped(void)
+{
+	struct commit_list **pp = &skipped;
+
+	while (*pp) {
+		struct commit_list *entry = *pp;
+		struct commit *commit = entry->item;
+		struct commit_list *parents;
+		int in_gap = 0;
+
+		if (!(commit->object.flags & COMMON)) {
+			for (parents = commit->parents; parents; parents = parents->next) {
+				unsigned flags = parents->item->object.flags;
+				if ((flags & COMMON) ||
+				    ((flags & BACKFILL) && !(flags & POPPED)))
+					in_gap = 1;
+			}
+			if (!in_gap) {
+				pp = &entry->next;
+				continue;
+			}
+			commit->object.flags &= ~(SKIPPED | POPPED);
+			commit->object.flags |= BACKFILL;
+			commit_list_insert_by_date(commit, &rev_list);
+			non_common_revs++;
+		}
+		*pp = entry->next;
+		free(entry);
+	}
+}
+
 /*
    This function marks a rev and its ancestors as common.
    In some cases, it is desirable to mark only the ancestors (for example
@@ -127,11 +240,17 @@ static const unsigned char *get_rev(void)
 	while (commit == NULL) {
 		unsigned int mark;
 		struct commit_list *parents;
+		int skip = 0;
 
 		if (rev_list == NULL || non_common_revs == 0)
 			return NULL;
 
+		/*
+		 * Dequeue before pushing the parents, which may sort
+		 * before us if their dates are skewed.
+		 */
 		commit = rev_list->item;
+		rev_list = rev_list->next;
 		if (!commit->object.parsed)
 			parse_commit(commit);
 		parents = commit->parents;
@@ -151,7 +270,12 @@ static const unsigned char *get_rev(void)
 			/* send "have", also for its ancestors */
 			mark = SEEN;
 
+		if (negotiation_skipping && mark == SEEN)
+			skip = skip_commit(commit);
+
 		while (parents) {
+			if (negotiation_skipping && mark == SEEN)
+				pass_skip_info(commit, parents->item, !skip);
 			if (!(parents->item->object.flags & SEEN))
 				rev_list_push(parents->item, mark);
 			if (mark & COMMON)
@@ -159,7 +283,8 @@ static const unsigned char *get_rev(void)
 			parents = parents->next;
 		}
 
-		rev_list = rev_list->next;
+		if (skip)
+			commit = NULL;
 	}
 
 	return commit->object.sha1;
@@ -173,7 +298,7 @@ enum ack_type {
 	ACK_ready
 };
 
-static void consume_shallow_list(int fd)
+static void consume_shallow_list(void)
 {
 	if (args.stateless_rpc && args.depth > 0) {
 		/* If we sent a depth we will get back "duplicate"
@@ -181,7 +306,7 @@ static void consume_shallow_list(int fd)
 		 * is a block of have lines exchanged.
 		 */
 		char line[1000];
-		while (packet_read_line(fd, line, sizeof(line))) {
+		while (packet_reader_read_line(&reader, line, sizeof(line))) {
 			if (!prefixcmp(line, "shallow "))
 				continue;
 			if (!prefixcmp(line, "unshallow "))
@@ -221,10 +346,10 @@ static int write_shallow_commits(struct strbuf *out, int use_pack_protocol)
 	return data.count;
 }
 
-static enum ack_type get_ack(int fd, unsigned char *result_sha1)
+static enum ack_type get_ack(unsigned char *result_sha1)
 {
 	static char line[1000];
-	int len = packet_read_line(fd, line, sizeof(line));
+	int len = packet_reader_read_line(&reader, line, sizeof(line));
 
 	if (!len)
 		die("git fetch-pack: expected ACK/NAK, got EOF");
@@ -289,8 +414,10 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 
 	if (args.stateless_rpc && multi_ack == 1)
 		die("--stateless-rpc requires multi_ack_detailed");
-	if (marked)
+	if (marked) {
 		for_each_ref(clear_marks, NULL);
+		clear_skip_infos();
+	}
 	marked = 1;
 
 	for_each_ref(rev_list_insert_ref, NULL);
@@ -348,6 +475,8 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 		write_shallow_commits(&req_buf, 1);
 	if (args.depth > 0)
 		packet_buf_write(&req_buf, "deepen %d", args.depth);
+	if (use_filter)
+		packet_buf_write(&req_buf, "filter %s", args.filter_spec);
 	packet_buf_flush(&req_buf);
 	state_len = req_buf.len;
 
@@ -356,7 +485,7 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 		unsigned char sha1[20];
 
 		send_request(fd[1], &req_buf);
-		while (packet_read_line(fd[0], line, sizeof(line))) {
+		while (packet_reader_read_line(&reader, line, sizeof(line))) {
 			if (!prefixcmp(line, "shallow ")) {
 				if (get_sha1_hex(line + 8, sha1))
 					die("invalid shallow line: %s", line);
@@ -390,13 +519,14 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 
 	flushes = 0;
 	retval = -1;
-	while ((sha1 = get_rev())) {
+	/* with --no-dependents we want the objects, not what they need */
+	while (!args.no_dependents && (sha1 = get_rev())) {
 		packet_buf_write(&req_buf, "have %s\n", sha1_to_hex(sha1));
 		if (args.verbose)
 			fprintf(stderr, "have %s\n", sha1_to_hex(sha1));
 		in_vain++;
 		if (flush_at <= ++count) {
-			int ack;
+			int ack, got_common = 0;
 
 			packet_buf_flush(&req_buf);
 			send_request(fd[1], &req_buf);
@@ -411,9 +541,9 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 			if (!args.stateless_rpc && count == INITIAL_FLUSH)
 				continue;
 
-			consume_shallow_list(fd[0]);
+			consume_shallow_list();
 			do {
-				ack = get_ack(fd[0], result_sha1);
+				ack = get_ack(result_sha1);
 				if (args.verbose && ack)
 					fprintf(stderr, "got ack %d %s\n", ack,
 							sha1_to_hex(result_sha1));
@@ -445,6 +575,7 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 					retval = 0;
 					in_vain = 0;
 					got_continue = 1;
+					got_common = 1;
 					if (ack == ACK_ready) {
 						rev_list = NULL;
 						got_ready = 1;
@@ -454,6 +585,8 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 				}
 			} while (ack);
 			flushes--;
+			if (negotiation_skipping && got_common && !got_ready)
+				backfill_skipped();
 			if (got_continue && MAX_IN_VAIN < in_vain) {
 				if (args.verbose)
 					fprintf(stderr, "giving up\n");
@@ -474,9 +607,9 @@ done:
 	}
 	strbuf_release(&req_buf);
 
-	consume_shallow_list(fd[0]);
+	consume_shallow_list();
 	while (flushes || multi_ack) {
-		int ack = get_ack(fd[0], result_sha1);
+		int ack = get_ack(result_sha1);
 		if (ack) {
 			if (args.verbose)
 				fprintf(stderr, "got ack (%d) %s\n", ack,
@@ -577,6 +710,21 @@ static void filter_refs(struct ref **refs, struct string_list *sought)
 		}
 	}
 
+	/* ask for objects given by their full names directly */
+	for (sought_pos = 0; sought_pos < sought->nr; sought_pos++) {
+		struct string_list_item *item = &sought->items[sought_pos];
+		unsigned char sha1[20];
+
+		if (item->util || strlen(item->string) != 40 ||
+		    get_sha1_hex(item->string, sha1))
+			continue;
+		ref = alloc_ref(item->string);
+		hashcpy(ref->old_sha1, sha1);
+		*newtail = ref;
+		newtail = &ref->next;
+		item->util = "matched";
+	}
+
 	filter_string_list(sought, 0, non_matching_ref, NULL);
 	*refs = newlist;
 }
@@ -667,16 +815,14 @@ static int everything_local(struct ref **refs, struct string_list *sought)
 
 static int sideband_demux(int in, int out, void *data)
 {
-	int *xd = data;
-
-	int ret = recv_sideband("fetch-pack", xd[0], out);
+	int ret = recv_sideband("fetch-pack", &reader, out);
 	close(out);
 	return ret;
 }
 
 static int get_pack(int xd[2], char **pack_lockfile)
 {
-	struct async demux;
+	struct async demux, relay;
 	const char *argv[20];
 	char keep_arg[256];
 	char hdr_arg[256];
@@ -685,20 +831,26 @@ static int get_pack(int xd[2], char **pack_lockfile)
 	struct child_process cmd;
 
 	memset(&demux, 0, sizeof(demux));
-	if (use_sideband) {
+	if (args.pack_fd) {
+		/* the caller demultiplexed the response for us */
+		if (!use_sideband)
+			die("fetch-pack: --pack-fd requires side-band");
+		demux.out = args.pack_fd;
+	}
+	else if (use_sideband) {
 		/* xd[] is talking with upload-pack; subprocess reads from
 		 * xd[0], spits out band#2 to stderr, and feeds us band#1
 		 * through demux->out.
 		 */
 		demux.proc = sideband_demux;
-		demux.data = xd;
 		demux.out = -1;
 		if (start_async(&demux))
 			die("fetch-pack: unable to fork off sideband"
 			    " demultiplexer");
+		enlarge_pipe_buffer(demux.out);
 	}
 	else
-		demux.out = xd[0];
+		demux.out = packet_reader_handoff(&reader, &relay);
 
 	memset(&cmd, 0, sizeof(cmd));
 	cmd.argv = argv;
@@ -761,8 +913,10 @@ static int get_pack(int xd[2], char **pack_lockfile)
 
 	if (finish_command(&cmd))
 		die("%s failed", argv[0]);
-	if (use_sideband && finish_async(&demux))
+	if (demux.proc && finish_async(&demux))
 		die("error in sideband demultiplexer");
+	if (!use_sideband && relay.proc && finish_async(&relay))
+		die("error relaying pack data");
 	return 0;
 }
 
@@ -817,6 +971,14 @@ static struct ref *do_fetch_pack(int fd[2],
 			fprintf(stderr, "Server supports ofs-delta\n");
 	} else
 		prefer_ofs_delta = 0;
+	if (args.filter_spec) {
+		if (server_supports("filter")) {
+			if (args.verbose)
+				fprintf(stderr, "Server supports filter\n");
+			use_filter = 1;
+		} else
+			warning("filtering not recognized by server, ignoring");
+	}
 
 	if ((agent_feature = server_feature_value("agent", &agent_len))) {
 		agent_supported = 1;
@@ -872,6 +1034,19 @@ static int fetch_pack_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "fetch.negotiationalgorithm")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "skipping"))
+			negotiation_skipping = 1;
+		else if (!strcmp(value, "default"))
+			negotiation_skipping = 0;
+		else
+			return error("unknown fetch negotiation algorithm '%s'",
+				     value);
+		return 0;
+	}
+
 	return git_default_config(var, value, cb);
 }
 
@@ -902,6 +1077,7 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 	struct child_process *conn;
 
 	packet_trace_identity("fetch-pack");
+	fetch_if_missing = 0;
 
 	for (i = 1; i < argc && *argv[i] == '-'; i++) {
 		const char *arg = argv[i];
@@ -955,11 +1131,29 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 			args.stateless_rpc = 1;
 			continue;
 		}
+		if (!prefixcmp(arg, "--pack-fd=")) {
+			args.pack_fd = strtol(arg + 10, NULL, 0);
+			continue;
+		}
 		if (!strcmp("--lock-pack", arg)) {
 			args.lock_pack = 1;
 			pack_lockfile_ptr = &pack_lockfile;
 			continue;
 		}
+		if (!prefixcmp(arg, "--filter=")) {
+			struct list_objects_filter_options filter;
+
+			memset(&filter, 0, sizeof(filter));
+			if (parse_list_objects_filter(&filter, arg + 9))
+				usage(fetch_pack_usage);
+			list_objects_filter_release(&filter);
+			args.filter_spec = arg + 9;
+			continue;
+		}
+		if (!strcmp("--no-dependents", arg)) {
+			args.no_dependents = 1;
+			continue;
+		}
 		usage(fetch_pack_usage);
 	}
 
@@ -980,8 +1174,9 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 			 * from stdin, until we get a flush packet
 			 */
 			static char line[1000];
+			packet_reader_init(&reader, 0);
 			for (;;) {
-				int n = packet_read_line(0, line, sizeof(line));
+				int n = packet_reader_read_line(&reader, line, sizeof(line));
 				if (!n)
 					break;
 				if (line[n-1] == '\n')
@@ -1003,11 +1198,22 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 		fd[0] = 0;
 		fd[1] = 1;
 	} else {
+		/* we only ever match the full names we were given */
+		struct strbuf ref_prefixes = STRBUF_INIT;
+		for (i = 0; !args.fetch_all && i < sought.nr; i++) {
+			if (i)
+				strbuf_addch(&ref_prefixes, ' ');
+			strbuf_addstr(&ref_prefixes, sought.items[i].string);
+		}
 		conn = git_connect(fd, dest, args.uploadpack,
+				   ref_prefixes.len ? ref_prefixes.buf : NULL,
 				   args.verbose ? CONNECT_VERBOSE : 0);
+		strbuf_release(&ref_prefixes);
 	}
 
-	get_remote_heads(fd[0], &ref, 0, NULL);
+	if (!args.stateless_rpc || !args.stdin_refs)
+		packet_reader_init(&reader, fd[0]);
+	get_remote_heads(&reader, &ref, 0, NULL);
 
 	ref = fetch_pack(&args, fd, conn, ref, dest,
 			 &sought, pack_lockfile_ptr);
@@ -1048,8 +1254,10 @@ struct ref *fetch_pack(struct fetch_pack_args *my_args,
 {
 	struct stat st;
 	struct ref *ref_cpy;
+	int save_fetch_if_missing = fetch_if_missing;
 
 	fetch_pack_setup();
+	packet_reader_init(&reader, fd[0]);
 	if (&args != my_args)
 		memcpy(&args, my_args, sizeof(args));
 	if (args.depth > 0) {
@@ -1066,7 +1274,10 @@ struct ref *fetch_pack(struct fetch_pack_args *my_args,
 		packet_flush(fd[1]);
 		die("no matching remote head");
 	}
+	/* what we do not have yet is what we are fetching */
+	fetch_if_missing = 0;
 	ref_cpy = do_fetch_pack(fd, ref, sought, pack_lockfile);
+	fetch_if_missing = save_fetch_if_missing;
 
 	if (args.depth > 0) {
 		struct cache_time mtime;
@@ -15,6 +15,7 @@
 #include "submodule.h"
 #include "connected.h"
 #include "argv-array.h"
+#include "list-objects-filter.h"
 
 static const char * const builtin_fetch_usage[] = {
 	N_("git fetch [<options>] [<repository> [<refspec>...]]"),
@@ -34,6 +35,7 @@ static int all, append, dry_run, force, keep, multiple, prune, update_head_ok, v
 static int progress = -1, recurse_submodules = RECURSE_SUBMODULES_DEFAULT;
 static int tags = TAGS_DEFAULT;
 static const char *depth;
+static const char *filter;
 static const char *upload_pack;
 static struct strbuf default_rla = STRBUF_INIT;
 static struct transport *transport;
@@ -82,6 +84,8 @@ static struct option builtin_fetch_options[] = {
 	OPT_BOOL(0, "progress", &progress, N_("force progress reporting")),
 	OPT_STRING(0, "depth", &depth, N_("depth"),
 		   N_("deepen history of shallow clone")),
+	OPT_STRING(0, "filter", &filter, N_("filter-spec"),
+		   N_("omit objects the filter excludes (partial clone)")),
 	{ OPTION_STRING, 0, "submodule-prefix", &submodule_prefix, N_("dir"),
 		   N_("prepend this to submodule path output"), PARSE_OPT_HIDDEN },
 	{ OPTION_STRING, 0, "recurse-submodules-default",
@@ -145,6 +149,41 @@ static void find_non_local_tags(struct transport *transport,
 			struct ref **head,
 			struct ref ***tail);
 
+/*
+ * Tell the other side which refs we may be interested in, so that it
+ * can leave the others out of its advertisement.  This mirrors the
+ * choice of refspecs get_ref_map() makes below.
+ */
+static void set_ref_prefixes(struct transport *transport,
+			     struct refspec *refs, int ref_count, int tags)
+{
+	static struct strbuf prefixes = STRBUF_INIT;
+	struct remote *remote = transport->remote;
+
+	strbuf_reset(&prefixes);
+	if (ref_count || tags == TAGS_SET)
+		refspec_ref_prefixes(refs, ref_count, &prefixes);
+	else {
+		struct branch *branch = branch_get(NULL);
+		int i;
+
+		if (remote)
+			refspec_ref_prefixes(remote->fetch,
+					     remote->fetch_refspec_nr, &prefixes);
+		if (remote && branch_has_merge_config(branch) &&
+		    !strcmp(branch->remote_name, remote->name))
+			for (i = 0; i < branch->merge_nr; i++)
+				expand_ref_prefix(&prefixes,
+						  branch->merge[i]->src);
+		if (!prefixes.len)
+			strbuf_addstr(&prefixes, "HEAD");
+	}
+	if (tags != TAGS_UNSET)
+		strbuf_addstr(&prefixes, prefixes.len ? " refs/tags/" : "refs/tags/");
+
+	transport_set_option(transport, TRANS_OPT_REFPREFIX, prefixes.buf);
+}
+
 static struct ref *get_ref_map(struct transport *transport,
 			       struct refspec *refs, int ref_count, int tags,
 			       int *autotags)
@@ -153,8 +192,10 @@ static struct ref *get_ref_map(struct transport *transport,
 	struct ref *rm;
 	struct ref *ref_map = NULL;
 	struct ref **tail = &ref_map;
+	const struct ref *remote_refs;
 
-	const struct ref *remote_refs = transport_get_remote_refs(transport);
+	set_ref_prefixes(transport, refs, ref_count, tags);
+	remote_refs = transport_get_remote_refs(transport);
 
 	if (ref_count || tags == TAGS_SET) {
 		for (i = 0; i < ref_count; i++) {
@@ -242,6 +283,7 @@ static int s_update_ref(const char *action,
 static int update_local_ref(struct ref *ref,
 			    const char *remote,
 			    const struct ref *remote_ref,
+			    int fast_forward,
 			    struct strbuf *display)
 {
 	struct commit *current = NULL, *updated;
@@ -323,7 +365,7 @@ static int update_local_ref(struct ref *ref,
 		return r;
 	}
 
-	if (in_merge_bases(current, updated)) {
+	if (fast_forward) {
 		char quickref[83];
 		int r;
 		strcpy(quickref, find_unique_abbrev(current->object.sha1, DEFAULT_ABBREV));
@@ -376,6 +418,54 @@ static int iterate_ref_map(void *cb_data, unsigned char sha1[20])
 	return 0;
 }
 
+/*
+ * Tell for each entry of ref_map whether storing it in its local ref
+ * is a fast-forward.  All of them are checked in one walk, which is
+ * much cheaper than a merge-base walk for each when there are many.
+ */
+static char *find_fast_forwards(struct ref *ref_map)
+{
+	struct ref *rm;
+	struct commit **olds, **news;
+	char *fast_forward, *result;
+	int *pos, i, nr = 0, count = 0;
+
+	for (rm = ref_map; rm; rm = rm->next)
+		count++;
+	fast_forward = xcalloc(count, 1);
+	olds = xmalloc(count * sizeof(*olds));
+	news = xmalloc(count * sizeof(*news));
+	pos = xmalloc(count * sizeof(*pos));
+
+	for (rm = ref_map, i = 0; rm; rm = rm->next, i++) {
+		struct commit *old, *new;
+
+		if (!rm->peer_ref ||
+		    is_null_sha1(rm->peer_ref->old_sha1) ||
+		    !hashcmp(rm->peer_ref->old_sha1, rm->old_sha1) ||
+		    !prefixcmp(rm->peer_ref->name, "refs/tags/"))
+			continue;
+		old = lookup_commit_reference_gently(rm->peer_ref->old_sha1, 1);
+		new = lookup_commit_reference_gently(rm->old_sha1, 1);
+		if (!old || !new)
+			continue;
+		olds[nr] = old;
+		news[nr] = new;
+		pos[nr++] = i;
+	}
+
+	result = xmalloc(nr);
+	in_merge_bases_batch(nr, olds, news, result);
+	for (i = 0; i < nr; i++)
+		fast_forward[pos[i]] = result[i];
+
+	free(result);
+	free(pos);
+	free(news);
+	free(olds);
+	return fast_forward;
+}
+
 static int store_updated_refs(const char *raw_url, const char *remote_name,
 		struct ref *ref_map)
 {
@@ -386,7 +476,8 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 	const char *what, *kind;
 	struct ref *rm;
 	char *url, *filename = dry_run ? "/dev/null" : git_path("FETCH_HEAD");
-	int want_merge;
+	char *fast_forward;
+	int want_merge, pos;
 
 	fp = fopen(filename, "a");
 	if (!fp)
@@ -403,13 +494,15 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 		goto abort;
 	}
 
+	fast_forward = find_fast_forwards(ref_map);
+
 	/*
 	 * The first pass writes objects to be merged and then the
 	 * second pass writes the rest, in order to allow using
 	 * FETCH_HEAD as a refname to refer to the ref to be merged.
 	 */
 	for (want_merge = 1; 0 <= want_merge; want_merge--) {
-		for (rm = ref_map; rm; rm = rm->next) {
+		for (rm = ref_map, pos = 0; rm; rm = rm->next, pos++) {
 			struct ref *ref = NULL;
 
 			commit = lookup_commit_reference_gently(rm->old_sha1, 1);
@@ -475,7 +568,8 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 
 			strbuf_reset(&note);
 			if (ref) {
-				rc |= update_local_ref(ref, what, rm, &note);
+				rc |= update_local_ref(ref, what, rm,
+						       fast_forward[pos], &note);
 				free(ref);
 			} else
 				strbuf_addf(&note, "* %-*s %-*s -> FETCH_HEAD",
@@ -499,6 +593,7 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 		error(_("some local refs could not be updated; try running\n"
 		      " 'git remote prune %s' to remove any old, conflicting "
 		      "branches"), remote_name);
+	free(fast_forward);
 
  abort:
 	strbuf_release(&note);
@@ -543,15 +638,24 @@ static int fetch_refs(struct transport *transport, struct ref *ref_map)
 
 static int prune_refs(struct refspec *refs, int ref_count, struct ref *ref_map)
 {
-	int result = 0;
+	int result = 0, nr = 0;
 	struct ref *ref, *stale_refs = get_stale_heads(refs, ref_count, ref_map);
+	const char **refnames;
 	const char *dangling_msg = dry_run
 		? _("   (%s will become dangling)")
 		: _("   (%s has become dangling)");
 
+	/* delete them all at once, so packed-refs is rewritten only once */
+	for (ref = stale_refs; ref; ref = ref->next)
+		nr++;
+	refnames = xmalloc(nr * sizeof(*refnames));
+	for (nr = 0, ref = stale_refs; ref; ref = ref->next)
+		refnames[nr++] = ref->name;
+	if (!dry_run && nr)
+		result = delete_refs(refnames, nr);
+	free(refnames);
+
 	for (ref = stale_refs; ref; ref = ref->next) {
-		if (!dry_run)
-			result |= delete_ref(ref->name, NULL, 0);
 		if (verbosity >= 0) {
 			fprintf(stderr, " x %-*s %-*s -> %s\n",
 				TRANSPORT_SUMMARY(_("[deleted]")),
@@ -920,6 +1024,13 @@ static int fetch_one(struct remote *remote, int argc, const char **argv)
 		set_option(TRANS_OPT_KEEP, "yes");
 	if (depth)
 		set_option(TRANS_OPT_DEPTH, depth);
+	if (filter) {
+		if (!remote->promisor)
+			die(_("--filter can only be used with a promisor remote"));
+		set_option(TRANS_OPT_LIST_OBJECTS_FILTER, filter);
+	} else if (remote->promisor && remote->partial_clone_filter)
+		set_option(TRANS_OPT_LIST_OBJECTS_FILTER,
+			   remote->partial_clone_filter);
 
 	if (argc > 0) {
 		int j = 0;
@@ -962,6 +1073,9 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 
 	packet_trace_identity("fetch");
 
+	/* objects a partial clone lacks are not something to fetch first */
+	fetch_if_missing = 0;
+
 	/* Record the command line for the reflog */
 	strbuf_addstr(&default_rla, "fetch");
 	for (i = 1; i < argc; i++)
@@ -970,6 +1084,17 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 	argc = parse_options(argc, argv, prefix,
 			     builtin_fetch_options, builtin_fetch_usage, 0);
 
+	if (filter) {
+		struct list_objects_filter_options filter_options;
+
+		memset(&filter_options, 0, sizeof(filter_options));
+		if (parse_list_objects_filter(&filter_options, filter))
+			die(_("invalid filter '%s'"), filter);
+		list_objects_filter_release(&filter_options);
+		if (all || multiple)
+			die(_("--filter can only be used when fetching from a single remote"));
+	}
+
 	if (recurse_submodules != RECURSE_SUBMODULES_OFF) {
 		if (recurse_submodules_default) {
 			int arg = parse_fetch_recurse_submodules_arg("--recurse-submodules-default", recurse_submodules_default);
@@ -36,6 +36,7 @@ struct refinfo {
 	int flag;
 	const char *symref;
 	struct atom_value *value;
+	int populated; /* value[0..populated) have been computed */
 };
 
 static struct {
@@ -89,7 +90,13 @@ static struct {
  */
 static const char **used_atom;
 static cmp_type *used_atom_type;
-static int used_atom_cnt, sort_atom_limit, need_tagged, need_symref;
+static int used_atom_cnt, sort_atom_limit, need_symref;
+
+/*
+ * The grab_*() functions below only fill the atoms in
+ * used_atom[grab_from..grab_to); see populate_value().
+ */
+static int grab_from, grab_to;
 
 /*
  * Used to parse format string and sort specifiers
@@ -140,8 +147,6 @@ static int parse_atom(const char *atom, const char *ep)
 				  (sizeof(*used_atom_type) * used_atom_cnt));
 	used_atom[at] = xmemdupz(atom, ep - atom);
 	used_atom_type[at] = valid_atom[i].cmp_type;
-	if (*atom == '*')
-		need_tagged = 1;
 	if (!strcmp(used_atom[at], "symref"))
 		need_symref = 1;
 	return at;
@@ -210,7 +215,7 @@ static void grab_common_values(struct atom_value *val, int deref, struct object
 {
 	int i;
 
-	for (i = 0; i < used_atom_cnt; i++) {
+	for (i = grab_from; i < grab_to; i++) {
 		const char *name = used_atom[i];
 		struct atom_value *v = &val[i];
 		if (!!deref != (*name == '*'))
@@ -243,7 +248,7 @@ static void grab_tag_values(struct atom_value *val, int deref, struct object *ob
 	int i;
 	struct tag *tag = (struct tag *) obj;
 
-	for (i = 0; i < used_atom_cnt; i++) {
+	for (i = grab_from; i < grab_to; i++) {
 		const char *name = used_atom[i];
 		struct atom_value *v = &val[i];
 		if (!!deref != (*name == '*'))
@@ -280,7 +285,7 @@ static void grab_commit_values(struct atom_value *val, int deref, struct object
 	int i;
 	struct commit *commit = (struct commit *) obj;
 
-	for (i = 0; i < used_atom_cnt; i++) {
+	for (i = grab_from; i < grab_to; i++) {
 		const char *name = used_atom[i];
 		struct atom_value *v = &val[i];
 		if (!!deref != (*name == '*'))
@@ -420,7 +425,7 @@ static void grab_person(const char *who, struct atom_value *val, int deref, stru
 	int wholen = strlen(who);
 	const char *wholine = NULL;
 
-	for (i = 0; i < used_atom_cnt; i++) {
+	for (i = grab_from; i < grab_to; i++) {
 		const char *name = used_atom[i];
 		struct atom_value *v = &val[i];
 		if (!!deref != (*name == '*'))
@@ -458,7 +463,7 @@ static void grab_person(const char *who, struct atom_value *val, int deref, stru
 		wholine = find_wholine(who, wholen, buf, sz);
 	if (!wholine)
 		return;
-	for (i = 0; i < used_atom_cnt; i++) {
+	for (i = grab_from; i < grab_to; i++) {
 		const char *name = used_atom[i];
 		struct atom_value *v = &val[i];
 		if (!!deref != (*name == '*'))
@@ -524,7 +529,7 @@ static void grab_sub_body_contents(struct atom_value *val, int deref, struct obj
 	const char *subpos = NULL, *bodypos = NULL, *sigpos = NULL;
 	unsigned long sublen = 0, bodylen = 0, nonsiglen = 0, siglen = 0;
 
-	for (i = 0; i < used_atom_cnt; i++) {
+	for (i = grab_from; i < grab_to; i++) {
 		const char *name = used_atom[i];
 		struct atom_value *v = &val[i];
 		if (!!deref != (*name == '*'))
@@ -566,7 +571,7 @@ static void grab_sub_body_contents(struct atom_value *val, int deref, struct obj
 static void fill_missing_values(struct atom_value *val)
 {
 	int i;
-	for (i = 0; i < used_atom_cnt; i++) {
+	for (i = grab_from; i < grab_to; i++) {
 		struct atom_value *v = &val[i];
 		if (v->s == NULL)
 			v->s = "";
@@ -614,17 +619,56 @@ static inline char *copy_advance(char *dst, const char *src)
 }
 
 /*
- * Parse the object referred by ref, and grab needed value.
+ * The type and size of an object can be had without reading it.
  */
-static void populate_value(struct refinfo *ref)
+static void grab_object_info(struct refinfo *ref)
+{
+	int i;
+	enum object_type type;
+	unsigned long size;
+
+	type = sha1_object_info(ref->objectname, &size);
+	if (type < 0)
+		die("missing object %s for %s",
+		    sha1_to_hex(ref->objectname), ref->refname);
+	for (i = grab_from; i < grab_to; i++) {
+		const char *name = used_atom[i];
+		struct atom_value *v = &ref->value[i];
+		if (!strcmp(name, "objecttype"))
+			v->s = typename(type);
+		else if (!strcmp(name, "objectsize")) {
+			char *s = xmalloc(40);
+			sprintf(s, "%lu", size);
+			v->ul = size;
+			v->s = s;
+		}
+	}
+}
+
+/*
+ * Compute the values of the atoms used_atom[ref->populated..upto) for
+ * ref.  The atoms used for sorting come first, so that sorting does
+ * not have to look at anything that is only needed for output, and
+ * only the refs that are shown pay for the rest.  The object is only
+ * read if one of these atoms needs more than its type and size, and
+ * the object a tag points at only if a "*" atom asks for it.
+ */
+static void populate_value(struct refinfo *ref, int upto)
 {
 	void *buf;
 	struct object *obj;
 	int eaten, i;
+	int need_obj = 0, need_info = 0, need_tagged = 0;
 	unsigned long size;
 	const unsigned char *tagged;
 
-	ref->value = xcalloc(sizeof(struct atom_value), used_atom_cnt);
+	if (!ref->value)
+		ref->value = xcalloc(sizeof(struct atom_value), used_atom_cnt);
+	if (upto <= ref->populated)
+		return;
+	grab_from = ref->populated;
+	grab_to = upto;
+	ref->populated = upto;
 
 	if (need_symref && (ref->flag & REF_ISSYMREF) && !ref->symref) {
 		unsigned char unused1[20];
@@ -634,7 +678,7 @@ static void populate_value(struct refinfo *ref)
 	}
 
 	/* Fill in specials first */
-	for (i = 0; i < used_atom_cnt; i++) {
+	for (i = grab_from; i < grab_to; i++) {
 		const char *name = used_atom[i];
 		struct atom_value *v = &ref->value[i];
 		int deref = 0;
@@ -646,7 +690,18 @@ static void populate_value(struct refinfo *ref)
 			name++;
 		}
 
-		if (!prefixcmp(name, "refname"))
+		if (!deref && !strcmp(name, "objectname")) {
+			char *s = xmalloc(41);
+			strcpy(s, sha1_to_hex(ref->objectname));
+			v->s = s;
+			continue;
+		}
+		else if (!deref && !strcmp(name, "objectname:short")) {
+			v->s = xstrdup(find_unique_abbrev(ref->objectname,
+							  DEFAULT_ABBREV));
+			continue;
+		}
+		else if (!prefixcmp(name, "refname"))
 			refname = ref->refname;
 		else if (!prefixcmp(name, "symref"))
 			refname = ref->symref ? ref->symref : "";
@@ -701,14 +756,24 @@ static void populate_value(struct refinfo *ref)
 		}
 	}
 
-	for (i = 0; i < used_atom_cnt; i++) {
-		struct atom_value *v = &ref->value[i];
-		if (v->s == NULL)
-			goto need_obj;
+	for (i = grab_from; i < grab_to; i++) {
+		const char *name = used_atom[i];
+		if (ref->value[i].s)
+			continue;
+		if (*name == '*')
+			need_tagged = 1;
+		else if (!strcmp(name, "objecttype") ||
+			 !strcmp(name, "objectsize"))
+			need_info = 1;
+		else
+			need_obj = 1;
+	}
+	if (!need_obj && !need_tagged) {
+		if (need_info)
+			grab_object_info(ref);
+		goto done;
 	}
-	return;
 
- need_obj:
 	buf = get_obj(ref->objectname, &obj, &size, &eaten);
 	if (!buf)
 		die("missing object %s for %s",
@@ -726,7 +791,7 @@ static void populate_value(struct refinfo *ref)
 	 * object, we are done.
 	 */
 	if (!need_tagged || (obj->type != OBJ_TAG))
-		return;
+		goto done;
 
 	/*
 	 * If it is a tag object, see if we use a value that derefs
@@ -750,6 +815,9 @@ static void populate_value(struct refinfo *ref)
 	grab_values(ref->value, 1, obj, buf, size);
 	if (!eaten)
 		free(buf);
+
+ done:
+	fill_missing_values(ref->value);
 }
 
 /*
@@ -758,10 +826,9 @@ static void populate_value(struct refinfo *ref)
  */
 static void get_value(struct refinfo *ref, int atom, struct atom_value **v)
 {
-	if (!ref->value) {
-		populate_value(ref);
-		fill_missing_values(ref->value);
-	}
+	if (ref->populated <= atom)
+		populate_value(ref, atom < sort_atom_limit ?
+			       sort_atom_limit : used_atom_cnt);
 	*v = &ref->value[atom];
 }
 
@@ -769,6 +836,8 @@ struct grab_ref_cbdata {
 	struct refinfo **grab_array;
 	const char **grab_pattern;
 	int grab_cnt;
+	struct commit_list *with_commit;
+	struct contains_cache contains;
 };
 
 /*
@@ -801,6 +870,13 @@ static int grab_single_ref(const char *refname, const unsigned char *sha1, int f
 			return 0;
 	}
 
+	if (cb->with_commit) {
+		struct commit *commit = lookup_commit_reference_gently(sha1, 1);
+		if (!commit ||
+		    !commit_contains(commit, cb->with_commit, &cb->contains))
+			return 0;
+	}
+
 	/*
 	 * We do not open the object yet; sort may only need refname
 	 * to do its job and the resulting list may yet to be pruned
@@ -821,12 +897,12 @@ static int grab_single_ref(const char *refname, const unsigned char *sha1, int f
 
 static int cmp_ref_sort(struct ref_sort *s, struct refinfo *a, struct refinfo *b)
 {
-	struct atom_value *va, *vb;
+	/* the sort keys have been computed by sort_refs() */
+	struct atom_value *va = &a->value[s->atom];
+	struct atom_value *vb = &b->value[s->atom];
 	int cmp;
 	cmp_type cmp_type = used_atom_type[s->atom];
 
-	get_value(a, s->atom, &va);
-	get_value(b, s->atom, &vb);
 	switch (cmp_type) {
 	case FIELD_STR:
 		cmp = strcmp(va->s, vb->s);
@@ -855,13 +931,61 @@ static int compare_refs(const void *a_, const void *b_)
 		if (cmp)
 			return cmp;
 	}
-	return 0;
+	/* keep refs with equal keys in refname order */
+	return strcmp(a->refname, b->refname);
+}
+
+static void sift_down(struct refinfo **heap, int root, int nr)
+{
+	for (;;) {
+		int child = 2 * root + 1;
+		struct refinfo *tmp;
+
+		if (nr <= child)
+			return;
+		if (child + 1 < nr &&
+		    compare_refs(&heap[child], &heap[child + 1]) < 0)
+			child++;
+		if (compare_refs(&heap[root], &heap[child]) >= 0)
+			return;
+		tmp = heap[root];
+		heap[root] = heap[child];
+		heap[child] = tmp;
+		root = child;
+	}
 }
 
-static void sort_refs(struct ref_sort *sort, struct refinfo **refs, int num_refs)
+/*
+ * Sort refs; if only the first "count" of them are wanted (count is
+ * non-zero), only those are put in order at the beginning of the
+ * array, by keeping the best ones seen so far in a heap whose top is
+ * the worst of them.
+ */
+static void sort_refs(struct ref_sort *sort, struct refinfo **refs,
+		      int num_refs, int count)
 {
+	int i;
+
 	ref_sort = sort;
-	qsort(refs, num_refs, sizeof(struct refinfo *), compare_refs);
+	for (i = 0; i < num_refs; i++)
+		populate_value(refs[i], sort_atom_limit);
+
+	if (!count || num_refs <= count) {
+		qsort(refs, num_refs, sizeof(struct refinfo *), compare_refs);
+		return;
+	}
+
+	for (i = count / 2 - 1; 0 <= i; i--)
+		sift_down(refs, i, count);
+	for (i = count; i < num_refs; i++) {
+		if (compare_refs(&refs[i], &refs[0]) < 0) {
+			struct refinfo *tmp = refs[0];
+			refs[0] = refs[i];
+			refs[i] = tmp;
+			sift_down(refs, 0, count);
+		}
+	}
+	qsort(refs, count, sizeof(struct refinfo *), compare_refs);
 }
 
 static void print_value(struct refinfo *ref, int atom, int quote_style)
@@ -988,6 +1112,7 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 	int maxcount = 0, quote_style = 0;
 	struct refinfo **refs;
 	struct grab_ref_cbdata cbdata;
+	struct commit_list *with_commit = NULL;
 
 	struct option opts[] = {
 		OPT_BIT('s', "shell", &quote_style,
@@ -1004,6 +1129,12 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 		OPT_STRING(  0 , "format", &format, N_("format"), N_("format to use for the output")),
 		OPT_CALLBACK(0 , "sort", sort_tail, N_("key"),
 			    N_("field name to sort on"), &opt_parse_sort),
+		{
+			OPTION_CALLBACK, 0, "contains", &with_commit, N_("commit"),
+			N_("print only refs that contain the commit"),
+			PARSE_OPT_LASTARG_DEFAULT,
+			parse_opt_with_commit, (intptr_t)"HEAD",
+		},
 		OPT_END(),
 	};
 
@@ -1016,23 +1147,42 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 		error("more than one quoting style?");
 		usage_with_options(for_each_ref_usage, opts);
 	}
-	if (verify_format(format))
-		usage_with_options(for_each_ref_usage, opts);
 
+	/*
+	 * Parse the sort keys before the format, so that they come first
+	 * in used_atom; see populate_value().
+	 */
 	if (!sort)
 		sort = default_sort();
 	sort_atom_limit = used_atom_cnt;
+	if (verify_format(format))
+		usage_with_options(for_each_ref_usage, opts);
 
 	/* for warn_ambiguous_refs */
 	git_config(git_default_config, NULL);
 
 	memset(&cbdata, 0, sizeof(cbdata));
 	cbdata.grab_pattern = argv;
-	for_each_rawref(grab_single_ref, &cbdata);
+	cbdata.with_commit = with_commit;
+	if (argv[0] && !argv[1]) {
+		/* only look at the part of the hierarchy the pattern can match */
+		struct strbuf base = STRBUF_INIT;
+		const char *special = strpbrk(argv[0], "?*[\\");
+		const char *slash;
+
+		strbuf_add(&base, argv[0],
+			   special ? special - argv[0] : strlen(argv[0]));
+		slash = strrchr(base.buf, '/');
+		strbuf_setlen(&base, slash ? slash - base.buf + 1 : 0);
+		for_each_rawref_in(base.buf, grab_single_ref, &cbdata);
+		strbuf_release(&base);
+	} else
+		for_each_rawref(grab_single_ref, &cbdata);
+	clear_contains_cache(&cbdata.contains);
 	refs = cbdata.grab_array;
 	num_refs = cbdata.grab_cnt;
 
-	sort_refs(sort, refs, num_refs);
+	sort_refs(sort, refs, num_refs, maxcount);
 
 	if (!maxcount || num_refs < maxcount)
 		maxcount = num_refs;
@@ -24,6 +24,7 @@ static const char * const builtin_gc_usage[] = {
 };
 
 static int pack_refs = 1;
+static int bloom_filters;
 static int aggressive_window = 250;
 static int gc_auto_threshold = 6700;
 static int gc_auto_pack_limit = 50;
@@ -34,6 +35,7 @@ static struct argv_array reflog = ARGV_ARRAY_INIT;
 static struct argv_array repack = ARGV_ARRAY_INIT;
 static struct argv_array prune = ARGV_ARRAY_INIT;
 static struct argv_array rerere = ARGV_ARRAY_INIT;
+static struct argv_array write_bloom = ARGV_ARRAY_INIT;
 
 static int gc_config(const char *var, const char *value, void *cb)
 {
@@ -44,6 +46,10 @@ static int gc_config(const char *var, const char *value, void *cb)
 			pack_refs = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "gc.bloomfilters")) {
+		bloom_filters = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "gc.aggressivewindow")) {
 		aggressive_window = git_config_int(var, value);
 		return 0;
@@ -191,6 +197,7 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	argv_array_pushl(&repack, "repack", "-d", "-l", NULL);
 	argv_array_pushl(&prune, "prune", "--expire", NULL );
 	argv_array_pushl(&rerere, "rerere", "gc", NULL);
+	argv_array_pushl(&write_bloom, "write-bloom-filters", NULL);
 
 	git_config(gc_config, NULL);
 
@@ -208,8 +215,10 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 		if (aggressive_window > 0)
 			argv_array_pushf(&repack, "--window=%d", aggressive_window);
 	}
-	if (quiet)
+	if (quiet) {
 		argv_array_push(&repack, "-q");
+		argv_array_push(&write_bloom, "--no-progress");
+	}
 
 	if (auto_gc) {
 		/*
@@ -245,6 +254,9 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	if (run_command_v_opt(rerere.argv, RUN_GIT_CMD))
 		return error(FAILED_RUN, rerere.argv[0]);
 
+	if (bloom_filters && run_command_v_opt(write_bloom.argv, RUN_GIT_CMD))
+		return error(FAILED_RUN, write_bloom.argv[0]);
+
 	if (auto_gc && too_many_loose_objects())
 		warning(_("There are too many unreachable loose objects; "
 			"run 'git prune' to remove them."));
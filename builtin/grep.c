@@ -199,6 +199,7 @@ static void start_threads(struct grep_opt *opt)
 	pthread_cond_init(&cond_add, NULL);
 	pthread_cond_init(&cond_write, NULL);
 	pthread_cond_init(&cond_result, NULL);
+	init_zstream_pool_threads();
 	grep_use_locks = 1;
 
 	for (i = 0; i < ARRAY_SIZE(todo); i++) {
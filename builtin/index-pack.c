@@ -13,7 +13,7 @@
 #include "thread-utils.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] [--report-external] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -77,6 +77,7 @@ static int nr_threads;
 
 static int from_stdin;
 static int strict;
+static int report_external;
 static int verbose;
 
 static struct progress *progress;
@@ -131,6 +132,7 @@ static void init_thread(void)
 	pthread_mutex_init(&counter_mutex, NULL);
 	pthread_mutex_init(&work_mutex, NULL);
 	pthread_key_create(&key, NULL);
+	init_zstream_pool_threads();
 	thread_data = xcalloc(nr_threads, sizeof(*thread_data));
 	threads_active = 1;
 }
@@ -202,6 +204,29 @@ static void check_objects(void)
 		check_object(get_indexed_object(i));
 }
 
+/*
+ * Objects that are linked to but whose content did not come from the
+ * pack are the ones the pack depends on: list them, one per line and
+ * terminated by an empty line, so that the caller can make sure they
+ * are available without walking the whole history.
+ */
+static void show_external_objects(void)
+{
+	struct strbuf out = STRBUF_INIT;
+	unsigned i, max;
+
+	max = get_max_object_index();
+	for (i = 0; i < max; i++) {
+		struct object *obj = get_indexed_object(i);
+		if (obj && (obj->flags & FLAG_LINK) &&
+		    !(obj->flags & FLAG_CHECKED))
+			strbuf_addf(&out, "%s\n", sha1_to_hex(obj->sha1));
+	}
+	strbuf_addch(&out, '\n');
+	write_or_die(1, out.buf, out.len);
+	strbuf_release(&out);
+}
+
 
 /* Discard current buffer used content. */
 static void flush(void)
@@ -722,7 +747,7 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 		free(has_data);
 	}
 
-	if (strict) {
+	if (strict || report_external) {
 		read_lock();
 		if (type == OBJ_BLOB) {
 			struct blob *blob = lookup_blob(sha1);
@@ -745,7 +770,7 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 			obj = parse_object_buffer(sha1, type, size, buf, &eaten);
 			if (!obj)
 				die(_("invalid %s"), typename(type));
-			if (fsck_object(obj, 1, fsck_error_function))
+			if (strict && fsck_object(obj, 1, fsck_error_function))
 				die(_("Error in object"));
 			if (fsck_walk(obj, mark_link, NULL))
 				die(_("Not all child objects of %s are reachable"), sha1_to_hex(obj->sha1));
@@ -805,6 +830,35 @@ static void *get_base_data(struct base_data *c)
 			c->size = obj->size;
 			get_thread_data()->base_cache_used += c->size;
 			prune_base_data(c);
+		} else if (delta_nr > 1) {
+			/*
+			 * The intermediate parents would most likely be
+			 * pruned again right away, since we are here
+			 * because the cache is full; fold their deltas
+			 * and only rebuild the node we were asked for.
+			 */
+			struct combined_delta cd = COMBINED_DELTA_INIT;
+			struct base_data *bottom = delta[delta_nr - 1]->base;
+			int i;
+
+			for (i = 0; i < delta_nr; i++) {
+				obj = delta[i]->obj;
+				if (combine_delta_push(&cd, get_data_from_pack(obj),
+						       obj->size))
+					bad_object(obj->idx.offset,
+						   _("failed to apply delta"));
+			}
+			c = delta[0];
+			c->data = combined_delta_apply(&cd,
+					get_base_data(bottom), bottom->size,
+					&c->size);
+			combined_delta_release(&cd);
+			if (!c->data)
+				bad_object(c->obj->idx.offset,
+					   _("failed to apply delta"));
+			get_thread_data()->base_cache_used += c->size;
+			prune_base_data(c);
+			delta_nr = 0;
 		}
 		for (; delta_nr > 0; delta_nr--) {
 			void *base, *raw;
@@ -1301,11 +1355,17 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 
 	if (!from_stdin) {
 		printf("%s\n", sha1_to_hex(sha1));
+		if (report_external) {
+			fflush(stdout);
+			show_external_objects();
+		}
 	} else {
 		char buf[48];
 		int len = snprintf(buf, sizeof(buf), "%s\t%s\n",
 				   report, sha1_to_hex(sha1));
 		write_or_die(1, buf, len);
+		if (report_external)
+			show_external_objects();
 
 		/*
 		 * Let's just mimic git-unpack-objects here and write
@@ -1475,6 +1535,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		usage(index_pack_usage);
 
 	read_replace_refs = 0;
+	fetch_if_missing = 0;
 
 	reset_pack_idx_option(&opts);
 	git_config(git_index_pack_config, &opts);
@@ -1491,6 +1552,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				fix_thin_pack = 1;
 			} else if (!strcmp(arg, "--strict")) {
 				strict = 1;
+			} else if (!strcmp(arg, "--report-external")) {
+				report_external = 1;
 			} else if (!strcmp(arg, "--verify")) {
 				verify = 1;
 			} else if (!strcmp(arg, "--verify-stat")) {
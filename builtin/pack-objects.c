@@ -14,6 +14,8 @@
 #include "diff.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter.h"
+#include "fetch-object.h"
 #include "progress.h"
 #include "refs.h"
 #include "streaming.h"
@@ -47,6 +49,10 @@ struct object_entry {
 				       * objects against.
 				       */
 	unsigned char no_try_delta;
+	unsigned char in_many_packs; /* in_pack is not the only pack having it */
+	unsigned char delta_from_other_pack; /* reused delta found by
+					      * find_delta_in_other_packs()
+					      */
 	unsigned char tagged; /* near the very tip of refs */
 	unsigned char filled; /* assigned write-order */
 };
@@ -77,6 +83,7 @@ static unsigned long pack_size_limit;
 static int depth = 50;
 static int delta_search_threads;
 static int pack_to_stdout;
+static int pipeline, search_in_background;
 static int num_preferred_base;
 static struct progress *progress_state;
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
@@ -88,6 +95,9 @@ static unsigned long cache_max_small_delta_size = 1000;
 
 static unsigned long window_memory_limit = 0;
 
+static struct sha1file *write_pipelined_head(off_t *offset,
+						struct progress *progress);
+
 /*
  * The object names in objects array are hashed with this hashtable,
  * to help looking up the entry by object name.
@@ -132,7 +142,7 @@ static unsigned long do_compress(void **pptr, unsigned long size)
 	unsigned long maxsize;
 
 	memset(&stream, 0, sizeof(stream));
-	git_deflate_init(&stream, pack_compression_level);
+	git_deflate_init_pooled(&stream, pack_compression_level);
 	maxsize = git_deflate_bound(&stream, size);
 
 	in = *pptr;
@@ -628,7 +638,19 @@ static void add_family_to_write_order(struct object_entry **wo,
 	add_descendants_to_write_order(wo, endp, root);
 }
 
-static struct object_entry **compute_write_order(void)
+static inline int is_commit_or_tag(struct object_entry *e)
+{
+	return e->type == OBJ_COMMIT || e->type == OBJ_TAG;
+}
+
+/*
+ * With head_only, stop at the first object that is not a commit or a
+ * tag.  The result is then a prefix of the full write order that can
+ * be computed while the delta search is still busy with the trees and
+ * blobs, and so must not touch their delta_child/delta_sibling links.
+ */
+static struct object_entry **compute_write_order(int head_only,
+						 unsigned int *nr)
 {
 	unsigned int i, wo_end, last_untagged;
 
@@ -637,6 +659,8 @@ static struct object_entry **compute_write_order(void)
 	for (i = 0; i < nr_objects; i++) {
 		objects[i].tagged = 0;
 		objects[i].filled = 0;
+		if (head_only)
+			continue;
 		objects[i].delta_child = NULL;
 		objects[i].delta_sibling = NULL;
 	}
@@ -646,7 +670,7 @@ static struct object_entry **compute_write_order(void)
 	 * Make sure delta_sibling is sorted in the original
 	 * recency order.
 	 */
-	for (i = nr_objects; i > 0;) {
+	for (i = nr_objects; !head_only && i > 0;) {
 		struct object_entry *e = &objects[--i];
 		if (!e->delta)
 			continue;
@@ -667,6 +691,8 @@ static struct object_entry **compute_write_order(void)
 	for (i = wo_end = 0; i < nr_objects; i++) {
 		if (objects[i].tagged)
 			break;
+		if (head_only && !is_commit_or_tag(&objects[i]))
+			goto done;
 		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
 	last_untagged = i;
@@ -675,19 +701,23 @@ static struct object_entry **compute_write_order(void)
 	 * Then fill all the tagged tips.
 	 */
 	for (; i < nr_objects; i++) {
-		if (objects[i].tagged)
-			add_to_write_order(wo, &wo_end, &objects[i]);
+		if (!objects[i].tagged)
+			continue;
+		if (head_only && !is_commit_or_tag(&objects[i]))
+			goto done;
+		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
 
 	/*
 	 * And then all remaining commits and tags.
 	 */
 	for (i = last_untagged; i < nr_objects; i++) {
-		if (objects[i].type != OBJ_COMMIT &&
-		    objects[i].type != OBJ_TAG)
+		if (!is_commit_or_tag(&objects[i]))
 			continue;
 		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
+	if (head_only)
+		goto done;
 
 	/*
 	 * And then all the trees.
@@ -709,36 +739,50 @@ static struct object_entry **compute_write_order(void)
 	if (wo_end != nr_objects)
 		die("ordered %u objects, expected %"PRIu32, wo_end, nr_objects);
 
+done:
+	*nr = wo_end;
 	return wo;
 }
 
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
-	struct sha1file *f;
+	struct sha1file *f = NULL;
 	off_t offset;
 	uint32_t nr_remaining = nr_result;
 	time_t last_mtime = 0;
 	struct object_entry **write_order;
+	unsigned int nr_order;
 
-	if (progress > pack_to_stdout)
-		progress_state = start_progress("Writing objects", nr_result);
 	written_list = xmalloc(nr_objects * sizeof(*written_list));
-	write_order = compute_write_order();
+	nr_written = 0;
+	if (search_in_background) {
+		/* progress_state still shows the search until it is done */
+		struct progress *writing = NULL;
+
+		if (progress > pack_to_stdout)
+			writing = start_progress("Writing objects", nr_result);
+		f = write_pipelined_head(&offset, writing);
+		progress_state = writing;
+	} else if (progress > pack_to_stdout)
+		progress_state = start_progress("Writing objects", nr_result);
+	write_order = compute_write_order(0, &nr_order);
 
 	do {
 		unsigned char sha1[20];
 		char *pack_tmp_name = NULL;
 
-		if (pack_to_stdout)
-			f = sha1fd_throughput(1, "<stdout>", progress_state);
-		else
-			f = create_tmp_packfile(&pack_tmp_name);
+		if (!f) {
+			if (pack_to_stdout)
+				f = sha1fd_throughput(1, "<stdout>", progress_state);
+			else
+				f = create_tmp_packfile(&pack_tmp_name);
 
-		offset = write_pack_header(f, nr_remaining);
-		if (!offset)
-			die_errno("unable to write pack header");
-		nr_written = 0;
+			offset = write_pack_header(f, nr_remaining);
+			if (!offset)
+				die_errno("unable to write pack header");
+			nr_written = 0;
+		}
 		for (; i < nr_objects; i++) {
 			struct object_entry *e = write_order[i];
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
@@ -802,6 +846,7 @@ static void write_pack_file(void)
 			written_list[j]->offset = (off_t)-1;
 		}
 		nr_remaining -= nr_written;
+		f = NULL;
 	} while (nr_remaining && i < nr_objects);
 
 	free(written_list);
@@ -907,7 +952,7 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 	struct object_entry *entry;
 	struct packed_git *p, *found_pack = NULL;
 	off_t found_offset = 0;
-	int ix;
+	int ix, in_many_packs = 0;
 	unsigned hash = name_hash(name);
 
 	ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
@@ -927,6 +972,8 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 	for (p = packed_git; p; p = p->next) {
 		off_t offset = find_pack_entry_one(sha1, p);
 		if (offset) {
+			if (found_pack)
+				in_many_packs = 1;
 			if (!found_pack) {
 				if (!is_pack_valid(p)) {
 					warning("packfile %s cannot be accessed", p->pack_name);
@@ -964,6 +1011,7 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 	if (found_pack) {
 		entry->in_pack = found_pack;
 		entry->in_pack_offset = found_offset;
+		entry->in_many_packs = in_many_packs;
 	}
 
 	if (object_ix_hashsz * 3 <= nr_objects * 4)
@@ -1251,6 +1299,146 @@ static void cleanup_preferred_base(void)
 	done_pbase_paths_num = done_pbase_paths_alloc = 0;
 }
 
+/*
+ * Parse the in-pack header of the object at offset.  For deltas, the
+ * size is that of the delta data, and *base_ref is set to the name of
+ * the base if want_base is set.  Returns -1 if the entry is bogus.
+ */
+static int parse_pack_entry(const unsigned char *sha1,
+			    struct packed_git *p, struct pack_window **w_curs,
+			    off_t offset, int want_base,
+			    enum object_type *type, unsigned long *size,
+			    unsigned char *header_size,
+			    const unsigned char **base_ref)
+{
+	unsigned long used, used_0;
+	unsigned long avail;
+	off_t ofs;
+	unsigned char *buf, c;
+
+	*base_ref = NULL;
+	buf = use_pack(p, w_curs, offset, &avail);
+	used = unpack_object_header_buffer(buf, avail, type, size);
+	if (used == 0)
+		return -1;
+
+	switch (*type) {
+	default:
+		*header_size = used;
+		if (*type < OBJ_COMMIT || *type > OBJ_BLOB)
+			return -1;
+		return 0;
+	case OBJ_REF_DELTA:
+		if (want_base)
+			*base_ref = use_pack(p, w_curs, offset + used, NULL);
+		*header_size = used + 20;
+		return 0;
+	case OBJ_OFS_DELTA:
+		buf = use_pack(p, w_curs, offset + used, NULL);
+		used_0 = 0;
+		c = buf[used_0++];
+		ofs = c & 127;
+		while (c & 128) {
+			ofs += 1;
+			if (!ofs || MSB(ofs, 7))
+				return error("delta base offset overflow in pack for %s",
+					     sha1_to_hex(sha1));
+			c = buf[used_0++];
+			ofs = (ofs << 7) + (c & 127);
+		}
+		ofs = offset - ofs;
+		if (ofs <= 0 || ofs >= offset)
+			return error("delta base offset out of bound for %s",
+				     sha1_to_hex(sha1));
+		if (want_base) {
+			struct revindex_entry *revidx;
+			revidx = find_pack_revindex(p, ofs);
+			if (!revidx)
+				return -1;
+			*base_ref = nth_packed_object_sha1(p, revidx->nr);
+		}
+		*header_size = used + used_0;
+		return 0;
+	}
+}
+
+/*
+ * Would making entry a delta against base (whose own delta may have
+ * been decided already) create a cycle, or, if max_depth is not zero,
+ * a chain deeper than that?
+ */
+static int unusable_delta_base(struct object_entry *entry,
+			       struct object_entry *base, int max_depth)
+{
+	int chain = 0;
+
+	for (; base; base = base->delta) {
+		if (base == entry)
+			return 1;
+		if (max_depth && ++chain > max_depth)
+			return 1;
+	}
+	return 0;
+}
+
+static void reuse_delta_from(struct object_entry *entry,
+			     struct object_entry *base_entry)
+{
+	entry->type = entry->in_pack_type;
+	entry->delta = base_entry;
+	entry->delta_size = entry->size;
+	entry->delta_sibling = base_entry->delta_child;
+	base_entry->delta_child = entry;
+}
+
+/*
+ * The object we found in entry->in_pack cannot be reused as a delta,
+ * but another pack may have it as a delta against an object we are
+ * packing anyway.  Reusing that one is cheaper than searching for a
+ * new delta, and makes for a smaller pack than storing it whole.
+ */
+static int find_delta_in_other_packs(struct object_entry *entry)
+{
+	struct packed_git *p;
+
+	for (p = packed_git; p; p = p->next) {
+		struct pack_window *w_curs = NULL;
+		const unsigned char *base_ref;
+		struct object_entry *base_entry;
+		enum object_type type;
+		unsigned long size;
+		unsigned char header_size;
+		off_t offset;
+
+		if (p == entry->in_pack ||
+		    (local && !p->pack_local) ||
+		    (ignore_packed_keep && p->pack_local && p->pack_keep))
+			continue;
+		offset = find_pack_entry_one(entry->idx.sha1, p);
+		if (!offset || !is_pack_valid(p))
+			continue;
+		if (parse_pack_entry(entry->idx.sha1, p, &w_curs, offset, 1,
+				     &type, &size, &header_size, &base_ref) ||
+		    !base_ref ||
+		    !(base_entry = locate_object_entry(base_ref)) ||
+		    unusable_delta_base(entry, base_entry, depth)) {
+			unuse_pack(&w_curs);
+			continue;
+		}
+		unuse_pack(&w_curs);
+
+		entry->in_pack = p;
+		entry->in_pack_offset = offset;
+		entry->in_pack_type = type;
+		entry->in_pack_header_size = header_size;
+		entry->size = size;
+		entry->delta_from_other_pack = 1;
+		reuse_delta_from(entry, base_entry);
+		return 1;
+	}
+	return 0;
+}
+
 static void check_object(struct object_entry *entry)
 {
 	if (entry->in_pack) {
@@ -1258,21 +1446,16 @@ static void check_object(struct object_entry *entry)
 		struct pack_window *w_curs = NULL;
 		const unsigned char *base_ref = NULL;
 		struct object_entry *base_entry;
-		unsigned long used, used_0;
-		unsigned long avail;
-		off_t ofs;
-		unsigned char *buf, c;
-
-		buf = use_pack(p, &w_curs, entry->in_pack_offset, &avail);
+		int want_base = reuse_delta && !entry->preferred_base;
 
 		/*
 		 * We want in_pack_type even if we do not reuse delta
 		 * since non-delta representations could still be reused.
 		 */
-		used = unpack_object_header_buffer(buf, avail,
-						   &entry->in_pack_type,
-						   &entry->size);
-		if (used == 0)
+		if (parse_pack_entry(entry->idx.sha1, p, &w_curs,
+				     entry->in_pack_offset, want_base,
+				     &entry->in_pack_type, &entry->size,
+				     &entry->in_pack_header_size, &base_ref))
 			goto give_up;
 
 		/*
@@ -1280,55 +1463,18 @@ static void check_object(struct object_entry *entry)
 		 * reuse it or not.  Otherwise let's find out as cheaply as
 		 * possible what the actual type and size for this object is.
 		 */
-		switch (entry->in_pack_type) {
-		default:
+		if (entry->in_pack_type != OBJ_REF_DELTA &&
+		    entry->in_pack_type != OBJ_OFS_DELTA) {
 			/* Not a delta hence we've already got all we need. */
-			entry->type = entry->in_pack_type;
-			entry->in_pack_header_size = used;
-			if (entry->type < OBJ_COMMIT || entry->type > OBJ_BLOB)
-				goto give_up;
 			unuse_pack(&w_curs);
+			entry->type = entry->in_pack_type;
+			if (want_base && entry->in_many_packs)
+				find_delta_in_other_packs(entry);
 			return;
-		case OBJ_REF_DELTA:
-			if (reuse_delta && !entry->preferred_base)
-				base_ref = use_pack(p, &w_curs,
-						entry->in_pack_offset + used, NULL);
-			entry->in_pack_header_size = used + 20;
-			break;
-		case OBJ_OFS_DELTA:
-			buf = use_pack(p, &w_curs,
-				       entry->in_pack_offset + used, NULL);
-			used_0 = 0;
-			c = buf[used_0++];
-			ofs = c & 127;
-			while (c & 128) {
-				ofs += 1;
-				if (!ofs || MSB(ofs, 7)) {
-					error("delta base offset overflow in pack for %s",
-					      sha1_to_hex(entry->idx.sha1));
-					goto give_up;
-				}
-				c = buf[used_0++];
-				ofs = (ofs << 7) + (c & 127);
-			}
-			ofs = entry->in_pack_offset - ofs;
-			if (ofs <= 0 || ofs >= entry->in_pack_offset) {
-				error("delta base offset out of bound for %s",
-				      sha1_to_hex(entry->idx.sha1));
-				goto give_up;
-			}
-			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
-					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
-			}
-			entry->in_pack_header_size = used + used_0;
-			break;
 		}
 
-		if (base_ref && (base_entry = locate_object_entry(base_ref))) {
+		if (base_ref && (base_entry = locate_object_entry(base_ref)) &&
+		    !unusable_delta_base(entry, base_entry, 0)) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1339,14 +1485,14 @@ static void check_object(struct object_entry *entry)
 			 * deltify other objects against, in order to avoid
 			 * circular deltas.
 			 */
-			entry->type = entry->in_pack_type;
-			entry->delta = base_entry;
-			entry->delta_size = entry->size;
-			entry->delta_sibling = base_entry->delta_child;
-			base_entry->delta_child = entry;
+			reuse_delta_from(entry, base_entry);
 			unuse_pack(&w_curs);
 			return;
 		}
+		unuse_pack(&w_curs);
+		if (want_base && entry->in_many_packs &&
+		    find_delta_in_other_packs(entry))
+			return;
 
 		if (entry->type) {
 			/*
@@ -1354,11 +1500,12 @@ static void check_object(struct object_entry *entry)
 			 * final object type is.  Let's extract the actual
 			 * object size from the delta header.
 			 */
+			p = entry->in_pack;
 			entry->size = get_size_from_delta(p, &w_curs,
 					entry->in_pack_offset + entry->in_pack_header_size);
+			unuse_pack(&w_curs);
 			if (entry->size == 0)
 				goto give_up;
-			unuse_pack(&w_curs);
 			return;
 		}
 
@@ -1397,6 +1544,42 @@ static int pack_offset_sort(const void *_a, const void *_b)
 			(a->in_pack_offset > b->in_pack_offset);
 }
 
+/*
+ * find_delta_in_other_packs() checked the chain below the base as far
+ * as it was known, but the base may have been given a delta of its
+ * own afterwards.  Now that all deltas to reuse are known, send the
+ * ones that ended up deeper than --depth back to the delta search.
+ */
+static void drop_deep_deltas_from_other_packs(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++) {
+		struct object_entry *entry = objects + i;
+		struct object_entry *base, **p;
+		int chain = 0;
+
+		if (!entry->delta_from_other_pack)
+			continue;
+		for (base = entry->delta; base; base = base->delta)
+			chain++;
+		if (chain <= depth)
+			continue;
+
+		base = entry->delta;
+		for (p = &base->delta_child; *p != entry; p = &(*p)->delta_sibling)
+			; /* nothing */
+		*p = entry->delta_sibling;
+		entry->delta = NULL;
+		entry->delta_sibling = NULL;
+		entry->delta_size = 0;
+		entry->delta_from_other_pack = 0;
+		entry->type = sha1_object_info(entry->idx.sha1, &entry->size);
+		if (big_file_threshold < entry->size)
+			entry->no_try_delta = 1;
+	}
+}
+
 static void get_object_details(void)
 {
 	uint32_t i;
@@ -1413,6 +1596,7 @@ static void get_object_details(void)
 		if (big_file_threshold < entry->size)
 			entry->no_try_delta = 1;
 	}
+	drop_deep_deltas_from_other_packs();
 
 	free(sorted_by_offset);
 }
@@ -1849,6 +2033,7 @@ static void init_threaded_search(void)
 	pthread_mutex_init(&cache_mutex, NULL);
 	pthread_mutex_init(&progress_mutex, NULL);
 	pthread_cond_init(&progress_cond, NULL);
+	init_zstream_pool_threads();
 	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
 }
 
@@ -1898,13 +2083,10 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	struct thread_params *p;
 	int i, ret, active_threads = 0;
 
-	init_threaded_search();
-
 	if (!delta_search_threads)	/* --threads=0 means autodetect */
 		delta_search_threads = online_cpus();
 	if (delta_search_threads <= 1) {
 		find_deltas(list, &list_size, window, depth, processed);
-		cleanup_threaded_search();
 		return;
 	}
 	if (progress > pack_to_stdout)
@@ -2019,14 +2201,133 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			active_threads--;
 		}
 	}
-	cleanup_threaded_search();
 	free(p);
 }
 
+/*
+ * With --pipeline, the delta search runs in this thread while the
+ * main thread starts sending the pack out.
+ */
+static struct background_search {
+	pthread_t thread;
+	struct object_entry **list;
+	unsigned list_size;
+	int window, depth;
+	unsigned nr_deltas, nr_done;
+} background_search;
+
+static void *background_find_deltas(void *arg)
+{
+	struct background_search *bs = arg;
+
+	ll_find_deltas(bs->list, bs->list_size,
+		       bs->window, bs->depth, &bs->nr_done);
+	return NULL;
+}
+
+static void start_background_search(struct object_entry **list,
+				    unsigned list_size, int window, int depth,
+				    unsigned nr_deltas)
+{
+	struct background_search *bs = &background_search;
+	int ret;
+
+	bs->list = list;
+	bs->list_size = list_size;
+	bs->window = window;
+	bs->depth = depth;
+	bs->nr_deltas = nr_deltas;
+	bs->nr_done = 0;
+	ret = pthread_create(&bs->thread, NULL, background_find_deltas, bs);
+	if (ret)
+		die("unable to create thread: %s", strerror(ret));
+	search_in_background = 1;
+}
+
+static void finish_background_search(void)
+{
+	struct background_search *bs = &background_search;
+
+	if (!search_in_background)
+		return;
+	pthread_join(bs->thread, NULL);
+	search_in_background = 0;
+	stop_progress(&progress_state);
+	cleanup_threaded_search();
+	if (bs->nr_done != bs->nr_deltas)
+		die("inconsistency with delta count");
+	free(bs->list);
+}
+
 #else
+#define init_threaded_search()		(void)0
+#define cleanup_threaded_search()	(void)0
 #define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, w, d, p)
+#define start_background_search(l, s, w, d, n)	die("BUG: no threads support")
+#define finish_background_search()	(void)0
 #endif
 
+/*
+ * Write the deltas we reuse as they are and that are based on "base",
+ * which is out already or is one the other side has.  The search does
+ * not touch them, nor their delta_child/delta_sibling links.
+ */
+static void write_reused_deltas(struct sha1file *f, struct object_entry *base,
+				off_t *offset)
+{
+	struct object_entry *child;
+
+	for (child = base->delta_child; child; child = child->delta_sibling) {
+		enum write_one_status status;
+
+		read_lock();
+		status = write_one(f, child, offset);
+		read_unlock();
+		if (status == WRITE_ONE_WRITTEN)
+			write_reused_deltas(f, child, offset);
+	}
+}
+
+/*
+ * Send out the pack header and the commits and tags that head the
+ * write order while the trees and blobs are still being deltified.
+ * Commits and tags are kept out of the search in this mode, so what
+ * we write here is final.  So are the deltas we reuse, once their
+ * base is out.  The search is finished before returning.
+ */
+static struct sha1file *write_pipelined_head(off_t *offset,
+					     struct progress *progress)
+{
+	struct sha1file *f = sha1fd_throughput(1, "<stdout>", progress);
+	struct object_entry **write_order;
+	unsigned int i, nr_order;
+
+	*offset = write_pack_header(f, nr_result);
+	if (!*offset)
+		die_errno("unable to write pack header");
+
+	read_lock();
+	write_order = compute_write_order(1, &nr_order);
+	read_unlock();
+	for (i = 0; i < nr_order; i++) {
+		read_lock();
+		write_one(f, write_order[i], offset);
+		read_unlock();
+	}
+	free(write_order);
+
+	for (i = 0; i < nr_objects; i++) {
+		struct object_entry *e = &objects[i];
+
+		if (e->preferred_base || e->idx.offset > 1)
+			write_reused_deltas(f, e, offset);
+	}
+	sha1flush(f);
+
+	finish_background_search();
+	return f;
+}
+
 static int add_ref_tag(const char *path, const unsigned char *sha1, int flag, void *cb_data)
 {
 	unsigned char peeled[20];
@@ -2078,6 +2379,14 @@ static void prepare_pack(int window, int depth)
 		if (entry->no_try_delta)
 			continue;
 
+		/*
+		 * Commits and tags go out first while the search is
+		 * still running when pipelining; they rarely delta well
+		 * anyway.
+		 */
+		if (pipeline && is_commit_or_tag(entry))
+			continue;
+
 		if (!entry->preferred_base) {
 			nr_deltas++;
 			if (entry->type < 0)
@@ -2102,7 +2411,14 @@ static void prepare_pack(int window, int depth)
 			progress_state = start_progress("Compressing objects",
 							nr_deltas);
 		qsort(delta_list, n, sizeof(*delta_list), type_size_sort);
+		init_threaded_search();
+		if (pipeline) {
+			start_background_search(delta_list, n, window+1, depth,
+						nr_deltas);
+			return;
+		}
 		ll_find_deltas(delta_list, n, window+1, depth, &nr_done);
+		cleanup_threaded_search();
 		stop_progress(&progress_state);
 		if (nr_done != nr_deltas)
 			die("inconsistency with delta count");
@@ -2153,6 +2469,10 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 #endif
 		return 0;
 	}
+	if (!strcmp(k, "pack.pipeline")) {
+		pipeline = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
 		if (pack_idx_opts.version > 2)
@@ -2196,6 +2516,14 @@ static void read_object_list_from_stdin(void)
 
 #define OBJECT_ADDED (1u<<20)
 
+static struct list_objects_filter_options filter_options;
+
+/*
+ * In a partial clone, blobs the filter left out are legitimately
+ * missing; leave them out of the pack, too.
+ */
+static int allow_missing_blobs;
+
 static void show_commit(struct commit *commit, void *data)
 {
 	add_object_entry(commit->object.sha1, OBJ_COMMIT, NULL, 0);
@@ -2206,8 +2534,13 @@ static void show_object(struct object *obj,
 			const struct name_path *path, const char *last,
 			void *data)
 {
-	char *name = path_name(path, last);
+	char *name;
+
+	if (allow_missing_blobs && obj->type == OBJ_BLOB &&
+	    !has_sha1_file(obj->sha1))
+		return;
 
+	name = path_name(path, last);
 	add_preferred_base_object(name);
 	add_object_entry(obj->sha1, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
@@ -2359,6 +2692,8 @@ static void get_object_list(int ac, const char **av)
 	init_revisions(&revs, NULL);
 	save_commit_buffer = 0;
 	setup_revisions(ac, av, &revs, NULL);
+	if (allow_missing_blobs)
+		revs.ignore_missing_links = 1;
 
 	while (fgets(line, sizeof(line), stdin) != NULL) {
 		int len = strlen(line);
@@ -2380,7 +2715,8 @@ static void get_object_list(int ac, const char **av)
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(revs.commits, &revs, show_edge);
-	traverse_commit_list(&revs, show_commit, show_object, NULL);
+	traverse_commit_list_filtered(&revs, &filter_options,
+				      show_commit, show_object, NULL);
 
 	if (keep_unreachable)
 		add_objects_in_unpacked_packs(&revs);
@@ -2435,6 +2771,18 @@ static int option_parse_ulong(const struct option *opt,
 	{ OPTION_CALLBACK, (s), (l), (v), "n", (h),	\
 	  PARSE_OPT_NONEG, option_parse_ulong }
 
+static int option_parse_filter(const struct option *opt,
+			       const char *arg, int unset)
+{
+	if (unset) {
+		list_objects_filter_release(opt->value);
+		return 0;
+	}
+	if (parse_list_objects_filter(opt->value, arg))
+		die(_("invalid filter '%s'"), arg);
+	return 0;
+}
+
 int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
 	int use_internal_rev_list = 0;
@@ -2476,6 +2824,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use OFS_DELTA objects")),
 		OPT_INTEGER(0, "threads", &delta_search_threads,
 			    N_("use threads when searching for best delta matches")),
+		OPT_BOOL(0, "pipeline", &pipeline,
+			 N_("start sending the pack while searching for deltas")),
 		OPT_BOOL(0, "non-empty", &non_empty,
 			 N_("do not create an empty pack output")),
 		OPT_BOOL(0, "revs", &use_internal_rev_list,
@@ -2498,6 +2848,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		{ OPTION_CALLBACK, 0, "unpack-unreachable", NULL, N_("time"),
 		  N_("unpack unreachable objects newer than <time>"),
 		  PARSE_OPT_OPTARG, option_parse_unpack_unreachable },
+		{ OPTION_CALLBACK, 0, "filter", &filter_options,
+		  N_("filter-spec"),
+		  N_("omit objects the filter excludes (requires --revs)"),
+		  0, option_parse_filter },
 		OPT_BOOL(0, "thin", &thin,
 			 N_("create thin packs")),
 		OPT_BOOL(0, "honor-pack-keep", &ignore_packed_keep,
@@ -2510,6 +2864,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	};
 
 	read_replace_refs = 0;
+	fetch_if_missing = 0;
 
 	reset_pack_idx_option(&pack_idx_opts);
 	git_config(git_pack_config, NULL);
@@ -2561,6 +2916,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		pack_size_limit = pack_size_limit_cfg;
 	if (pack_to_stdout && pack_size_limit)
 		die("--max-pack-size cannot be used to build a pack for transfer.");
+	if (!pack_to_stdout)
+		pipeline = 0;
+#ifdef NO_PTHREADS
+	pipeline = 0;
+#endif
 	if (pack_size_limit && pack_size_limit < 1024*1024) {
 		warning("minimum pack size limit is 1 MiB");
 		pack_size_limit = 1024*1024;
@@ -2572,6 +2932,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 
+	if (filter_options.choice && !use_internal_rev_list)
+		die("--filter requires --revs");
+	if (use_internal_rev_list && promisor_remote())
+		allow_missing_blobs = 1;
+
 	if (progress && all_progress_implied)
 		progress = 2;
 
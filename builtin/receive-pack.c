@@ -32,12 +32,17 @@ static int transfer_fsck_objects = -1;
 static int receive_unpack_limit = -1;
 static int transfer_unpack_limit = -1;
 static int unpack_limit = 100;
+static struct packet_reader reader;
 static int report_status;
 static int use_sideband;
 static int quiet;
+static int use_atomic;
 static int prefer_ofs_delta = 1;
 static int auto_update_server_info;
 static int auto_gc = 1;
+static int quick_connectivity_check;
+static struct packed_git *received_pack;
+static struct sha1_array external_objects = SHA1_ARRAY_INIT;
 static const char *head_name;
 static void *head_name_to_free;
 static int sent_capabilities;
@@ -114,6 +119,11 @@ static int receive_pack_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (strcmp(var, "receive.quickconnectivitycheck") == 0) {
+		quick_connectivity_check = git_config_bool(var, value);
+		return 0;
+	}
+
 	return git_default_config(var, value, cb);
 }
 
@@ -124,7 +134,7 @@ static void show_ref(const char *path, const unsigned char *sha1)
 	else
 		packet_write(1, "%s %s%c%s%s agent=%s\n",
 			     sha1_to_hex(sha1), path, 0,
-			     " report-status delete-refs side-band-64k quiet",
+			     " report-status delete-refs side-band-64k quiet atomic",
 			     prefer_ofs_delta ? " ofs-delta" : "",
 			     git_user_agent_sanitized());
 	sent_capabilities = 1;
@@ -179,6 +189,7 @@ struct command {
 		     did_not_exist:1;
 	unsigned char old_sha1[20];
 	unsigned char new_sha1[20];
+	struct ref_update update;
 	char ref_name[FLEX_ARRAY]; /* more */
 };
 
@@ -419,7 +430,6 @@ static const char *update(struct command *cmd)
 	const char *namespaced_name;
 	unsigned char *old_sha1 = cmd->old_sha1;
 	unsigned char *new_sha1 = cmd->new_sha1;
-	struct ref_lock *lock;
 
 	/* only refs/... are allowed */
 	if (prefixcmp(name, "refs/") || check_refname_format(name + 5, 0)) {
@@ -503,33 +513,66 @@ static const char *update(struct command *cmd)
 		return "hook declined";
 	}
 
-	if (is_null_sha1(new_sha1)) {
-		if (!parse_object(old_sha1)) {
-			old_sha1 = NULL;
-			if (ref_exists(name)) {
-				rp_warning("Allowing deletion of corrupt ref.");
-			} else {
-				rp_warning("Deleting a non-existent ref.");
-				cmd->did_not_exist = 1;
-			}
+	/* the ref itself is updated later, together with the others */
+	cmd->update.ref_name = namespaced_name;
+	hashcpy(cmd->update.new_sha1, new_sha1);
+	hashcpy(cmd->update.old_sha1, old_sha1);
+	cmd->update.have_old = 1;
+	if (is_null_sha1(new_sha1) && !parse_object(old_sha1)) {
+		cmd->update.have_old = 0;
+		if (ref_exists(name)) {
+			rp_warning("Allowing deletion of corrupt ref.");
+		} else {
+			rp_warning("Deleting a non-existent ref.");
+			cmd->did_not_exist = 1;
 		}
-		if (delete_ref(namespaced_name, old_sha1, 0)) {
-			rp_error("failed to delete %s", name);
-			return "failed to delete";
-		}
-		return NULL; /* good */
 	}
-	else {
-		lock = lock_any_ref_for_update(namespaced_name, old_sha1, 0);
-		if (!lock) {
-			rp_error("failed to lock %s", name);
-			return "failed to lock";
+	return NULL; /* good */
+}
+
+/*
+ * Update all the refs that passed the checks in update() as one
+ * batch, so that packed-refs is rewritten at most once.  With
+ * "atomic", either all of them are updated or none is.
+ */
+static void update_all(struct command *commands)
+{
+	struct command *cmd;
+	struct ref_update **updates = NULL;
+	int nr = 0, alloc = 0, failed = 0;
+
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (cmd->skip_update)
+			continue;
+		if (cmd->error_string) {
+			failed = 1;
+			continue;
 		}
-		if (write_ref_sha1(lock, new_sha1, "push")) {
-			return "failed to write"; /* error() already called */
+		ALLOC_GROW(updates, nr + 1, alloc);
+		updates[nr++] = &cmd->update;
+	}
+
+	if (use_atomic && failed)
+		goto atomic_failure;
+	if (update_refs("push", updates, nr, use_atomic ? UPDATE_REFS_ATOMIC : 0)) {
+		for (cmd = commands; cmd; cmd = cmd->next) {
+			if (cmd->skip_update || cmd->error_string ||
+			    !cmd->update.error)
+				continue;
+			rp_error("%s %s", cmd->update.error, cmd->ref_name);
+			cmd->error_string = cmd->update.error;
 		}
-		return NULL; /* good */
+		if (use_atomic)
+			goto atomic_failure;
 	}
+	free(updates);
+	return;
+
+atomic_failure:
+	for (cmd = commands; cmd; cmd = cmd->next)
+		if (!cmd->skip_update && !cmd->error_string)
+			cmd->error_string = "atomic push failure";
+	free(updates);
 }
 
 static char update_post_hook[] = "hooks/post-update";
@@ -688,6 +731,31 @@ static int iterate_receive_command_list(void *cb_data, unsigned char sha1[20])
 	return -1; /* end of list */
 }
 
+/*
+ * When index-pack told us which existing objects the received pack
+ * links to, the new history is connected as long as all of them are
+ * here and every new ref value came with the pack; there is no need
+ * to walk all the way to our existing refs to find that out.
+ */
+static int received_objects_connected(struct command *commands)
+{
+	struct command *cmd;
+	int i;
+
+	if (!received_pack)
+		return 0;
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (is_null_sha1(cmd->new_sha1))
+			continue;
+		if (!find_pack_entry_one(cmd->new_sha1, received_pack))
+			return 0;
+	}
+	for (i = 0; i < external_objects.nr; i++)
+		if (!has_sha1_file(external_objects.sha1[i]))
+			return 0;
+	return 1;
+}
+
 static void execute_commands(struct command *commands, const char *unpacker_error)
 {
 	struct command *cmd;
@@ -700,7 +768,8 @@ static void execute_commands(struct command *commands, const char *unpacker_erro
 	}
 
 	cmd = commands;
-	if (check_everything_connected(iterate_receive_command_list,
+	if (!received_objects_connected(commands) &&
+	    check_everything_connected(iterate_receive_command_list,
 				       0, &cmd))
 		set_connectivity_errors(commands);
 
@@ -726,6 +795,8 @@ static void execute_commands(struct command *commands, const char *unpacker_erro
 
 		cmd->error_string = update(cmd);
 	}
+
+	update_all(commands);
 }
 
 static struct command *read_head_info(void)
@@ -739,7 +810,7 @@ static struct command *read_head_info(void)
 		char *refname;
 		int len, reflen;
 
-		len = packet_read_line(0, line, sizeof(line));
+		len = packet_reader_read_line(&reader, line, sizeof(line));
 		if (!len)
 			break;
 		if (line[len-1] == '\n')
@@ -762,6 +833,8 @@ static struct command *read_head_info(void)
 				use_sideband = LARGE_PACKET_MAX;
 			if (parse_feature_request(feature_list, "quiet"))
 				quiet = 1;
+			if (parse_feature_request(feature_list, "atomic"))
+				use_atomic = 1;
 		}
 		cmd = xcalloc(1, sizeof(struct command) + len - 80);
 		hashcpy(cmd->old_sha1, old_sha1);
@@ -773,9 +846,9 @@ static struct command *read_head_info(void)
 	return commands;
 }
 
-static const char *parse_pack_header(struct pack_header *hdr)
+static const char *parse_pack_header(int in, struct pack_header *hdr)
 {
-	switch (read_pack_header(0, hdr)) {
+	switch (read_pack_header(in, hdr)) {
 	case PH_ERROR_EOF:
 		return "eof before pack header was fully read";
 
@@ -795,7 +868,50 @@ static const char *parse_pack_header(struct pack_header *hdr)
 
 static const char *pack_lockfile;
 
-static const char *unpack(int err_fd)
+/*
+ * Read the list of external objects "index-pack --report-external"
+ * gives after the pack name, and find the pack it has just stored.
+ * If anything is amiss, received_pack stays NULL and the connectivity
+ * check falls back to a full walk.
+ */
+static void read_external_objects(int fd)
+{
+	FILE *fp = xfdopen(fd, "r");
+	struct strbuf line = STRBUF_INIT;
+	struct packed_git *p;
+	int complete = 0;
+
+	while (strbuf_getline(&line, fp, '\n') != EOF) {
+		unsigned char sha1[20];
+
+		if (!line.len) {
+			complete = 1;
+			break;
+		}
+		if (line.len != 40 || get_sha1_hex(line.buf, sha1))
+			break;
+		sha1_array_append(&external_objects, sha1);
+	}
+	fclose(fp);
+
+	if (!complete || !pack_lockfile)
+		return;
+
+	strbuf_reset(&line);
+	strbuf_addstr(&line, pack_lockfile);
+	strbuf_setlen(&line, line.len - strlen(".keep"));
+	strbuf_addstr(&line, ".pack");
+	reprepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!strcmp(p->pack_name, line.buf)) {
+			received_pack = p;
+			break;
+		}
+	}
+	strbuf_release(&line);
+}
+
+static const char *unpack_from(int in, int err_fd)
 {
 	struct pack_header hdr;
 	const char *hdr_err;
@@ -806,9 +922,12 @@ static const char *unpack(int err_fd)
 			    ? transfer_fsck_objects
 			    : 0);
 
-	hdr_err = parse_pack_header(&hdr);
-	if (hdr_err)
+	hdr_err = parse_pack_header(in, &hdr);
+	if (hdr_err) {
+		if (in != reader.fd)
+			close(in);
 		return hdr_err;
+	}
 	snprintf(hdr_arg, sizeof(hdr_arg),
 			"--pack_header=%"PRIu32",%"PRIu32,
 			ntohl(hdr.hdr_version), ntohl(hdr.hdr_entries));
@@ -826,6 +945,7 @@ static const char *unpack(int err_fd)
 		unpacker[i++] = NULL;
 		memset(&child, 0, sizeof(child));
 		child.argv = unpacker;
+		child.in = in;
 		child.no_stdout = 1;
 		child.err = err_fd;
 		child.git_cmd = 1;
@@ -834,7 +954,7 @@ static const char *unpack(int err_fd)
 			return NULL;
 		return "unpack-objects abnormal exit";
 	} else {
-		const char *keeper[7];
+		const char *keeper[8];
 		int s, status, i = 0;
 		char keep_arg[256];
 		struct child_process ip;
@@ -848,11 +968,14 @@ static const char *unpack(int err_fd)
 		if (fsck_objects)
 			keeper[i++] = "--strict";
 		keeper[i++] = "--fix-thin";
+		if (quick_connectivity_check)
+			keeper[i++] = "--report-external";
 		keeper[i++] = hdr_arg;
 		keeper[i++] = keep_arg;
 		keeper[i++] = NULL;
 		memset(&ip, 0, sizeof(ip));
 		ip.argv = keeper;
+		ip.in = in;
 		ip.out = -1;
 		ip.err = err_fd;
 		ip.git_cmd = 1;
@@ -861,16 +984,35 @@ static const char *unpack(int err_fd)
 			return "index-pack fork failed";
 		}
 		pack_lockfile = index_pack_lockfile(ip.out);
-		close(ip.out);
+		if (quick_connectivity_check)
+			read_external_objects(ip.out);
+		else
+			close(ip.out);
 		status = finish_command(&ip);
 		if (!status) {
 			reprepare_packed_git();
 			return NULL;
 		}
+		received_pack = NULL;
 		return "index-pack abnormal exit";
 	}
 }
 
+/*
+ * The pack follows the commands on the same stream, and reading the
+ * commands may already have buffered the beginning of it.
+ */
+static const char *unpack(int err_fd)
+{
+	struct async relay;
+	int in = packet_reader_handoff(&reader, &relay);
+	const char *ret = unpack_from(in, err_fd);
+
+	if (relay.proc && finish_async(&relay) && !ret)
+		ret = "error relaying pack data";
+	return ret;
+}
+
 static const char *unpack_with_sideband(void)
 {
 	struct async muxer;
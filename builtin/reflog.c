@@ -337,6 +337,48 @@ static int expire_reflog_ent(unsigned char *osha1, unsigned char *nsha1,
 	return 0;
 }
 
+/*
+ * Append the entries of log_file from offset ofs on to the new log as
+ * they are: they are all recent enough to be kept.
+ */
+static int copy_reflog_tail(const char *log_file, long ofs,
+			    struct expire_reflog_cb *cb)
+{
+	struct stat st;
+	const char *map, *last;
+	size_t size;
+	int fd, ret = 0;
+
+	fd = open(log_file, O_RDONLY);
+	if (fd < 0)
+		return error("cannot open %s: %s", log_file, strerror(errno));
+	if (fstat(fd, &st)) {
+		close(fd);
+		return error("cannot stat %s: %s", log_file, strerror(errno));
+	}
+	size = xsize_t(st.st_size);
+	if (size <= ofs) {
+		close(fd);
+		return 0;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (fflush(cb->newlog) ||
+	    write_in_full(fileno(cb->newlog), map + ofs, size - ofs) < 0)
+		ret = error("cannot write new log: %s", strerror(errno));
+
+	/* remember the new value of the last entry for --updateref */
+	last = map + size - 1;
+	while (map + ofs < last && last[-1] != '\n')
+		last--;
+	if (map + size - last < 82 || get_sha1_hex(last + 41, cb->last_kept_sha1))
+		ret = error("%s: corrupt last entry", log_file);
+
+	munmap((void *)map, size);
+	return ret;
+}
+
 static int push_tip_to_list(const char *refname, const unsigned char *sha1, int flags, void *cb_data)
 {
 	struct commit_list **list = cb_data;
@@ -358,6 +400,7 @@ static int expire_reflog(const char *ref, const unsigned char *sha1, int unused,
 	char *log_file, *newlog_path = NULL;
 	struct commit *tip_commit;
 	struct commit_list *tips;
+	long tail = -1;
 	int status = 0;
 
 	memset(&cb, 0, sizeof(cb));
@@ -408,7 +451,21 @@ static int expire_reflog(const char *ref, const unsigned char *sha1, int unused,
 		mark_reachable(&cb);
 	}
 
-	for_each_reflog_ent(ref, expire_reflog_ent, &cb);
+	/*
+	 * Entries too recent for either kind of expiry are kept as they
+	 * are.  Unless each entry has to be looked at, find where they
+	 * start and copy them in bulk.
+	 */
+	if (!cmd->stalefix && !cmd->rewrite && !cmd->recno && !cmd->verbose)
+		tail = reflog_offset_by_date(ref, cmd->expire_total > cmd->expire_unreachable ?
+					     cmd->expire_total : cmd->expire_unreachable);
+	if (tail < 0) {
+		for_each_reflog_ent(ref, expire_reflog_ent, &cb);
+	} else {
+		for_each_reflog_ent_before(ref, tail, expire_reflog_ent, &cb);
+		if (cb.newlog)
+			status |= copy_reflog_tail(log_file, tail, &cb);
+	}
 
 	if (cb.unreachable_expire_kind != UE_ALWAYS) {
 		if (cb.unreachable_expire_kind == UE_HEAD) {
@@ -426,6 +483,8 @@ static int expire_reflog(const char *ref, const unsigned char *sha1, int unused,
 			status |= error("%s: %s", strerror(errno),
 					newlog_path);
 			unlink(newlog_path);
+		} else if (status) {
+			unlink(newlog_path);
 		} else if (cmd->updateref &&
 			(write_in_full(lock->lock_fd,
 				sha1_to_hex(cb.last_kept_sha1), 40) != 40 ||
@@ -1285,12 +1285,19 @@ static int prune_remote(const char *remote, int dry_run)
 		       : _("(no URL)"));
 	}
 
+	if (!dry_run && states.stale.nr) {
+		const char **refnames;
+
+		refnames = xmalloc(states.stale.nr * sizeof(*refnames));
+		for (i = 0; i < states.stale.nr; i++)
+			refnames[i] = states.stale.items[i].util;
+		result = delete_refs(refnames, states.stale.nr);
+		free(refnames);
+	}
+
 	for (i = 0; i < states.stale.nr; i++) {
 		const char *refname = states.stale.items[i].util;
 
-		if (!dry_run)
-			result |= delete_ref(refname, NULL, 0);
-
 		if (dry_run)
 			printf_ln(_(" * [would prune] %s"),
 			       abbrev_ref(refname, "refs/remotes/"));
@@ -7,6 +7,7 @@
 #include "log-tree.h"
 #include "graph.h"
 #include "bisect.h"
+#include "list-objects-filter.h"
 
 static const char rev_list_usage[] =
 "git rev-list [OPTION] <commit-id>... [ -- paths... ]\n"
@@ -35,6 +36,8 @@ static const char rev_list_usage[] =
 "    --parents\n"
 "    --children\n"
 "    --objects | --objects-edge\n"
+"    --filter=<filter-spec>\n"
+"    --missing=(error|allow-any)\n"
 "    --unpacked\n"
 "    --header | --pretty\n"
 "    --abbrev=<n> | --no-abbrev\n"
@@ -179,7 +182,8 @@ static void finish_object(struct object *obj,
 			  void *cb_data)
 {
 	struct rev_list_info *info = cb_data;
-	if (obj->type == OBJ_BLOB && !has_sha1_file(obj->sha1))
+	if (obj->type == OBJ_BLOB && !info->revs->ignore_missing_links &&
+	    !has_sha1_file(obj->sha1))
 		die("missing blob object '%s'", sha1_to_hex(obj->sha1));
 	if (info->revs->verify_objects && !obj->parsed && obj->type != OBJ_COMMIT)
 		parse_object(obj->sha1);
@@ -309,6 +313,7 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 {
 	struct rev_info revs;
 	struct rev_list_info info;
+	struct list_objects_filter_options filter_options;
 	int i;
 	int bisect_list = 0;
 	int bisect_show_vars = 0;
@@ -316,6 +321,7 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 
 	git_config(git_default_config, NULL);
 	init_revisions(&revs, prefix);
+	memset(&filter_options, 0, sizeof(filter_options));
 	revs.abbrev = DEFAULT_ABBREV;
 	revs.commit_format = CMIT_FMT_UNSPECIFIED;
 	argc = setup_revisions(argc, argv, &revs, NULL);
@@ -354,6 +360,20 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			bisect_show_vars = 1;
 			continue;
 		}
+		if (!prefixcmp(arg, "--filter=")) {
+			if (parse_list_objects_filter(&filter_options, arg + 9))
+				usage(rev_list_usage);
+			continue;
+		}
+		if (!strcmp(arg, "--missing=error")) {
+			revs.ignore_missing_links = 0;
+			continue;
+		}
+		if (!strcmp(arg, "--missing=allow-any")) {
+			revs.ignore_missing_links = 1;
+			fetch_if_missing = 0;
+			continue;
+		}
 		usage(rev_list_usage);
 
 	}
@@ -396,7 +416,8 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			return show_bisect_vars(&info, reaches, all);
 	}
 
-	traverse_commit_list(&revs, show_commit, show_object, &info);
+	traverse_commit_list_filtered(&revs, &filter_options,
+				      show_commit, show_object, &info);
 
 	if (revs.count) {
 		if (revs.left_right && revs.cherry_mark)
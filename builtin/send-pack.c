@@ -11,7 +11,7 @@
 #include "version.h"
 
 static const char send_pack_usage[] =
-"git send-pack [--all | --mirror] [--dry-run] [--force] [--receive-pack=<git-receive-pack>] [--verbose] [--thin] [<host>:]<directory> [<ref>...]\n"
+"git send-pack [--all | --mirror] [--dry-run] [--atomic] [--force] [--receive-pack=<git-receive-pack>] [--verbose] [--thin] [<host>:]<directory> [<ref>...]\n"
 "  --all and explicit <ref> specification are mutually exclusive.";
 
 static struct send_pack_args args;
@@ -112,9 +112,13 @@ static int pack_objects(int fd, struct ref *refs, struct extra_have_objects *ext
 static int receive_status(int in, struct ref *refs)
 {
 	struct ref *hint;
+	struct packet_reader reader;
 	char line[1000];
 	int ret = 0;
-	int len = packet_read_line(in, line, sizeof(line));
+	int len;
+
+	packet_reader_init(&reader, in);
+	len = packet_reader_read_line(&reader, line, sizeof(line));
 	if (len < 10 || memcmp(line, "unpack ", 7))
 		return error("did not receive remote status");
 	if (memcmp(line, "unpack ok\n", 10)) {
@@ -128,7 +132,7 @@ static int receive_status(int in, struct ref *refs)
 	while (1) {
 		char *refname;
 		char *msg;
-		len = packet_read_line(in, line, sizeof(line));
+		len = packet_reader_read_line(&reader, line, sizeof(line));
 		if (!len)
 			break;
 		if (len < 3 ||
@@ -207,6 +211,11 @@ static void print_helper_status(struct ref *ref)
 			res = "error";
 			break;
 
+		case REF_STATUS_ATOMIC_PUSH_FAILED:
+			res = "error";
+			msg = "atomic push failed";
+			break;
+
 		case REF_STATUS_EXPECTING_REPORT:
 		default:
 			continue;
@@ -230,14 +239,40 @@ static void print_helper_status(struct ref *ref)
 static int sideband_demux(int in, int out, void *data)
 {
 	int *fd = data, ret;
+	struct packet_reader reader;
 #ifdef NO_PTHREADS
 	close(fd[1]);
 #endif
-	ret = recv_sideband("send-pack", fd[0], out);
+	packet_reader_init(&reader, fd[0]);
+	ret = recv_sideband("send-pack", &reader, out);
 	close(out);
 	return ret;
 }
 
+/*
+ * With --atomic, a ref we cannot push makes us push none of them.
+ */
+static int atomic_push_failure(struct send_pack_args *args,
+			       struct ref *remote_refs,
+			       struct ref *failing_ref)
+{
+	struct ref *ref;
+
+	for (ref = remote_refs; ref; ref = ref->next) {
+		if (!ref->peer_ref && !args->send_mirror)
+			continue;
+		switch (ref->status) {
+		case REF_STATUS_NONE:
+		case REF_STATUS_OK:
+			ref->status = REF_STATUS_ATOMIC_PUSH_FAILED;
+			break;
+		default:
+			; /* already rejected or up to date */
+		}
+	}
+	return error(_("atomic push failed for ref %s"), failing_ref->name);
+}
+
 int send_pack(struct send_pack_args *args,
 	      int fd[], struct child_process *conn,
 	      struct ref *remote_refs,
@@ -253,6 +288,7 @@ int send_pack(struct send_pack_args *args,
 	int use_sideband = 0;
 	int quiet_supported = 0;
 	int agent_supported = 0;
+	int atomic_supported = 0;
 	unsigned cmds_sent = 0;
 	int ret;
 	struct async demux;
@@ -270,6 +306,11 @@ int send_pack(struct send_pack_args *args,
 		quiet_supported = 1;
 	if (server_supports("agent"))
 		agent_supported = 1;
+	if (server_supports("atomic"))
+		atomic_supported = 1;
+
+	if (args->atomic && !atomic_supported)
+		die(_("the receiving end does not support --atomic push"));
 
 	if (!remote_refs) {
 		fprintf(stderr, "No refs in common and none specified; doing nothing.\n"
@@ -281,6 +322,16 @@ int send_pack(struct send_pack_args *args,
 	 * Finally, tell the other end!
 	 */
 	new_refs = 0;
+	for (ref = remote_refs; args->atomic && ref; ref = ref->next) {
+		if (!ref->peer_ref && !args->send_mirror)
+			continue;
+		if (ref->status == REF_STATUS_REJECT_NONFASTFORWARD ||
+		    (ref->deletion && !allow_deleting_refs)) {
+			if (!args->stateless_rpc)
+				packet_flush(out);
+			return atomic_push_failure(args, remote_refs, ref);
+		}
+	}
 	for (ref = remote_refs; ref; ref = ref->next) {
 		if (!ref->peer_ref && !args->send_mirror)
 			continue;
@@ -310,13 +361,15 @@ int send_pack(struct send_pack_args *args,
 			int quiet = quiet_supported && (args->quiet || !args->progress);
 
 			if (!cmds_sent && (status_report || use_sideband ||
-					   quiet || agent_supported)) {
+					   quiet || agent_supported ||
+					   args->atomic)) {
 				packet_buf_write(&req_buf,
-						 "%s %s %s%c%s%s%s%s%s",
+						 "%s %s %s%c%s%s%s%s%s%s",
 						 old_hex, new_hex, ref->name, 0,
 						 status_report ? " report-status" : "",
 						 use_sideband ? " side-band-64k" : "",
 						 quiet ? " quiet" : "",
+						 args->atomic ? " atomic" : "",
 						 agent_supported ? " agent=" : "",
 						 agent_supported ? git_user_agent_sanitized() : ""
 						);
@@ -412,6 +465,7 @@ int cmd_send_pack(int argc, const char **argv, const char *prefix)
 	int fd[2];
 	struct child_process *conn;
 	struct extra_have_objects extra_have;
+	struct packet_reader reader;
 	struct ref *remote_refs, *local_refs;
 	int ret;
 	int helper_status = 0;
@@ -446,6 +500,10 @@ int cmd_send_pack(int argc, const char **argv, const char *prefix)
 				args.dry_run = 1;
 				continue;
 			}
+			if (!strcmp(arg, "--atomic")) {
+				args.atomic = 1;
+				continue;
+			}
 			if (!strcmp(arg, "--mirror")) {
 				args.send_mirror = 1;
 				continue;
@@ -519,13 +577,14 @@ int cmd_send_pack(int argc, const char **argv, const char *prefix)
 		fd[0] = 0;
 		fd[1] = 1;
 	} else {
-		conn = git_connect(fd, dest, receivepack,
+		conn = git_connect(fd, dest, receivepack, NULL,
 			args.verbose ? CONNECT_VERBOSE : 0);
 	}
 
 	memset(&extra_have, 0, sizeof(extra_have));
 
-	get_remote_heads(fd[0], &remote_refs, REF_NORMAL, &extra_have);
+	packet_reader_init(&reader, fd[0]);
+	get_remote_heads(&reader, &remote_refs, REF_NORMAL, &extra_have);
 
 	transport_verify_remote_names(nr_refspecs, refspecs);
 
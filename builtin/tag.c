@@ -31,6 +31,7 @@ struct tag_filter {
 	const char **patterns;
 	int lines;
 	struct commit_list *with_commit;
+	struct contains_cache contains;
 };
 
 static struct sha1_array points_at;
@@ -65,48 +66,6 @@ static const unsigned char *match_points_at(const char *refname,
 	return NULL;
 }
 
-static int in_commit_list(const struct commit_list *want, struct commit *c)
-{
-	for (; want; want = want->next)
-		if (!hashcmp(want->item->object.sha1, c->object.sha1))
-			return 1;
-	return 0;
-}
-
-static int contains_recurse(struct commit *candidate,
-			    const struct commit_list *want)
-{
-	struct commit_list *p;
-
-	/* was it previously marked as containing a want commit? */
-	if (candidate->object.flags & TMP_MARK)
-		return 1;
-	/* or marked as not possibly containing a want commit? */
-	if (candidate->object.flags & UNINTERESTING)
-		return 0;
-	/* or are we it? */
-	if (in_commit_list(want, candidate))
-		return 1;
-
-	if (parse_commit(candidate) < 0)
-		return 0;
-
-	/* Otherwise recurse and mark ourselves for future traversals. */
-	for (p = candidate->parents; p; p = p->next) {
-		if (contains_recurse(p->item, want)) {
-			candidate->object.flags |= TMP_MARK;
-			return 1;
-		}
-	}
-	candidate->object.flags |= UNINTERESTING;
-	return 0;
-}
-
-static int contains(struct commit *candidate, const struct commit_list *want)
-{
-	return contains_recurse(candidate, want);
-}
-
 static void show_tag_lines(const unsigned char *sha1, int lines)
 {
 	int i;
@@ -158,7 +117,8 @@ static int show_reference(const char *refname, const unsigned char *sha1,
 			commit = lookup_commit_reference_gently(sha1, 1);
 			if (!commit)
 				return 0;
-			if (!contains(commit, filter->with_commit))
+			if (!commit_contains(commit, filter->with_commit,
+					     &filter->contains))
 				return 0;
 		}
 
@@ -180,13 +140,14 @@ static int show_reference(const char *refname, const unsigned char *sha1,
 static int list_tags(const char **patterns, int lines,
 			struct commit_list *with_commit)
 {
-	struct tag_filter filter;
+	struct tag_filter filter = { NULL, 0, NULL, CONTAINS_CACHE_INIT };
 
 	filter.patterns = patterns;
 	filter.lines = lines;
 	filter.with_commit = with_commit;
 
 	for_each_tag_ref(show_reference, (void *) &filter);
+	clear_contains_cache(&filter.contains);
 
 	return 0;
 }
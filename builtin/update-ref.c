@@ -6,19 +6,134 @@
 static const char * const git_update_ref_usage[] = {
 	N_("git update-ref [options] -d <refname> [<oldval>]"),
 	N_("git update-ref [options]    <refname> <newval> [<oldval>]"),
+	N_("git update-ref [options] --stdin"),
 	NULL
 };
 
+static struct ref_update **updates;
+static int updates_alloc;
+static int updates_count;
+
+static struct ref_update *update_alloc(const char *refname, int flags)
+{
+	struct ref_update *update = xcalloc(1, sizeof(*update));
+
+	update->ref_name = xstrdup(refname);
+	update->flags = flags;
+	ALLOC_GROW(updates, updates_count + 1, updates_alloc);
+	updates[updates_count++] = update;
+	return update;
+}
+
+static void parse_value(const char *arg, unsigned char *sha1, const char *line)
+{
+	if (!*arg)
+		hashclr(sha1); /* empty means "does not exist" */
+	else if (get_sha1(arg, sha1))
+		die("invalid value '%s' in: %s", arg, line);
+}
+
+/*
+ * Each line is "update <ref> <newvalue> [<oldvalue>]",
+ * "create <ref> <newvalue>", "delete <ref> [<oldvalue>]" or
+ * "option no-deref", which applies to the next command only.
+ */
+static void parse_cmd(struct strbuf *line, int *flags)
+{
+	struct strbuf **words = strbuf_split_buf(line->buf, line->len, ' ', 0);
+	const char *cmd, *args[3];
+	struct ref_update *update;
+	int nr;
+
+	for (nr = 0; words[nr]; nr++) {
+		if (nr > 3)
+			die("too many arguments in: %s", line->buf);
+		strbuf_trim(words[nr]);
+		if (nr)
+			args[nr - 1] = words[nr]->buf;
+	}
+	if (!nr)
+		die("empty command in input");
+	nr--;
+	cmd = words[0]->buf;
+
+	if (!strcmp(cmd, "option")) {
+		if (nr != 1 || strcmp(args[0], "no-deref"))
+			die("unknown option in: %s", line->buf);
+		*flags |= REF_NODEREF;
+		goto done;
+	}
+
+	if (nr < 1 || check_refname_format(args[0], REFNAME_ALLOW_ONELEVEL))
+		die("invalid ref in: %s", line->buf);
+	update = update_alloc(args[0], *flags);
+	*flags = 0;
+
+	if (!strcmp(cmd, "update") && (nr == 2 || nr == 3)) {
+		parse_value(args[1], update->new_sha1, line->buf);
+		if (is_null_sha1(update->new_sha1))
+			die("update needs a new value in: %s", line->buf);
+		if (nr == 3) {
+			parse_value(args[2], update->old_sha1, line->buf);
+			update->have_old = 1;
+		}
+	} else if (!strcmp(cmd, "create") && nr == 2) {
+		parse_value(args[1], update->new_sha1, line->buf);
+		if (is_null_sha1(update->new_sha1))
+			die("create needs a new value in: %s", line->buf);
+		update->have_old = 1;
+	} else if (!strcmp(cmd, "delete") && (nr == 1 || nr == 2)) {
+		if (nr == 2) {
+			parse_value(args[1], update->old_sha1, line->buf);
+			if (is_null_sha1(update->old_sha1))
+				die("delete needs an old value in: %s", line->buf);
+			update->have_old = 1;
+		}
+	} else {
+		die("unknown command in: %s", line->buf);
+	}
+
+done:
+	strbuf_list_free(words);
+}
+
+static void update_refs_stdin(const char *msg)
+{
+	struct strbuf line = STRBUF_INIT;
+	int flags = 0;
+
+	while (strbuf_getline(&line, stdin, '\n') != EOF) {
+		if (!line.len)
+			continue;
+		parse_cmd(&line, &flags);
+	}
+	strbuf_release(&line);
+	if (flags)
+		die("option without a command at end of input");
+
+	/* all or nothing */
+	if (update_refs(msg, updates, updates_count, UPDATE_REFS_ATOMIC)) {
+		int i;
+		for (i = 0; i < updates_count; i++)
+			if (updates[i]->error)
+				die("%s: %s", updates[i]->ref_name,
+				    updates[i]->error);
+		die("cannot update the refs");
+	}
+}
+
 int cmd_update_ref(int argc, const char **argv, const char *prefix)
 {
 	const char *refname, *oldval, *msg = NULL;
 	unsigned char sha1[20], oldsha1[20];
-	int delete = 0, no_deref = 0, flags = 0;
+	int delete = 0, no_deref = 0, read_stdin = 0, flags = 0;
 	struct option options[] = {
 		OPT_STRING( 'm', NULL, &msg, N_("reason"), N_("reason of the update")),
 		OPT_BOOLEAN('d', NULL, &delete, N_("delete the reference")),
 		OPT_BOOLEAN( 0 , "no-deref", &no_deref,
 					N_("update <refname> not the one it points to")),
+		OPT_BOOLEAN( 0 , "stdin", &read_stdin,
+					N_("read updates from stdin")),
 		OPT_END(),
 	};
 
@@ -28,6 +143,13 @@ int cmd_update_ref(int argc, const char **argv, const char *prefix)
 	if (msg && !*msg)
 		die("Refusing to perform update with empty message.");
 
+	if (read_stdin) {
+		if (delete || no_deref || argc > 0)
+			usage_with_options(git_update_ref_usage, options);
+		update_refs_stdin(msg);
+		return 0;
+	}
+
 	if (delete) {
 		if (argc < 1 || argc > 2)
 			usage_with_options(git_update_ref_usage, options);
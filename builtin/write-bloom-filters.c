@@ -0,0 +1,26 @@
+#include "builtin.h"
+#include "parse-options.h"
+#include "bloom.h"
+
+static char const * const write_bloom_filters_usage[] = {
+	N_("git write-bloom-filters [--[no-]progress]"),
+	NULL
+};
+
+int cmd_write_bloom_filters(int argc, const char **argv, const char *prefix)
+{
+	int show_progress = -1;
+	struct option opts[] = {
+		OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
+		OPT_END(),
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, opts,
+			     write_bloom_filters_usage, 0);
+	if (argc)
+		usage_with_options(write_bloom_filters_usage, opts);
+	if (show_progress < 0)
+		show_progress = isatty(2);
+	return !!write_bloom_filters(show_progress);
+}
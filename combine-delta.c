@@ -0,0 +1,232 @@
+/*
+ * combine-delta.c: fold a chain of deltas into a single one
+ *
+ * Applying a chain of N deltas one after the other materializes N-1
+ * intermediate objects that are thrown away right after use.  Instead,
+ * we decode the topmost delta into a list of copy/insert operations and
+ * rewrite every copy through the delta below it, so that in the end the
+ * operations refer only to the bottom base or to literal data held by
+ * the deltas themselves.  The result is then applied to the base once.
+ */
+
+#include "cache.h"
+#include "delta.h"
+
+static void append_op(struct delta_op **ops, int *nr, int *alloc,
+		      unsigned long off, const unsigned char *data,
+		      unsigned long len)
+{
+	struct delta_op *last = *nr ? &(*ops)[*nr - 1] : NULL;
+
+	if (!len)
+		return;
+	if (last && !data && !last->data && last->off + last->len == off) {
+		last->len += len;
+		return;
+	}
+	if (last && data && last->data && last->data + last->len == data) {
+		last->len += len;
+		return;
+	}
+	ALLOC_GROW(*ops, *nr + 1, *alloc);
+	last = &(*ops)[(*nr)++];
+	last->pos = *nr > 1 ? last[-1].pos + last[-1].len : 0;
+	last->len = len;
+	last->off = off;
+	last->data = data;
+}
+
+/*
+ * Decode a delta into operations, with the same validation as
+ * patch_delta() performs while applying it.
+ */
+static int parse_delta(const void *delta_buf, unsigned long delta_size,
+		       unsigned long *src_size, unsigned long *dst_size,
+		       struct delta_op **ops, int *nr, int *alloc)
+{
+	const unsigned char *data, *top;
+	unsigned long size;
+
+	if (delta_size < DELTA_SIZE_MIN)
+		return error("delta too short");
+
+	data = delta_buf;
+	top = (const unsigned char *) delta_buf + delta_size;
+	*src_size = get_delta_hdr_size(&data, top);
+	*dst_size = size = get_delta_hdr_size(&data, top);
+
+	while (data < top) {
+		unsigned char cmd = *data++;
+		if (cmd & 0x80) {
+			unsigned long cp_off = 0, cp_size = 0;
+			if (cmd & 0x01) cp_off = *data++;
+			if (cmd & 0x02) cp_off |= (*data++ << 8);
+			if (cmd & 0x04) cp_off |= (*data++ << 16);
+			if (cmd & 0x08) cp_off |= ((unsigned) *data++ << 24);
+			if (cmd & 0x10) cp_size = *data++;
+			if (cmd & 0x20) cp_size |= (*data++ << 8);
+			if (cmd & 0x40) cp_size |= (*data++ << 16);
+			if (cp_size == 0) cp_size = 0x10000;
+			if (unsigned_add_overflows(cp_off, cp_size) ||
+			    cp_off + cp_size > *src_size ||
+			    cp_size > size)
+				break;
+			append_op(ops, nr, alloc, cp_off, NULL, cp_size);
+			size -= cp_size;
+		} else if (cmd) {
+			if (cmd > size || cmd > top - data)
+				break;
+			append_op(ops, nr, alloc, 0, data, cmd);
+			data += cmd;
+			size -= cmd;
+		} else {
+			return error("unexpected delta opcode 0");
+		}
+	}
+
+	if (data != top || size != 0)
+		return error("delta replay has gone wild");
+	return 0;
+}
+
+int combine_delta_push(struct combined_delta *cd,
+		       void *delta_buf, unsigned long delta_size)
+{
+	struct delta_op *lower = NULL, *ops = NULL;
+	int lower_nr = 0, lower_alloc = 0, nr = 0, alloc = 0, i;
+	unsigned long src_size, dst_size;
+
+	ALLOC_GROW(cd->buf, cd->buf_nr + 1, cd->buf_alloc);
+	cd->buf[cd->buf_nr++] = delta_buf;
+
+	if (cd->buf_nr == 1) {
+		if (parse_delta(delta_buf, delta_size, &src_size, &dst_size,
+				&cd->op, &cd->nr, &cd->alloc))
+			return -1;
+		cd->src_size = src_size;
+		cd->dst_size = dst_size;
+		return 0;
+	}
+
+	if (parse_delta(delta_buf, delta_size, &src_size, &dst_size,
+			&lower, &lower_nr, &lower_alloc))
+		goto bad;
+	if (dst_size != cd->src_size) {
+		error("delta chain mismatch: base is %lu bytes, expected %lu",
+		      dst_size, cd->src_size);
+		goto bad;
+	}
+
+	for (i = 0; i < cd->nr; i++) {
+		const struct delta_op *op = &cd->op[i];
+		unsigned long off, end;
+		int lo, hi;
+
+		if (op->data) {
+			append_op(&ops, &nr, &alloc, 0, op->data, op->len);
+			continue;
+		}
+
+		/* find the lower operation producing byte op->off */
+		off = op->off;
+		end = off + op->len;
+		lo = 0;
+		hi = lower_nr;
+		while (hi - lo > 1) {
+			int mi = lo + (hi - lo) / 2;
+			if (lower[mi].pos <= off)
+				lo = mi;
+			else
+				hi = mi;
+		}
+
+		for (; off < end; lo++) {
+			const struct delta_op *l = &lower[lo];
+			unsigned long skip = off - l->pos;
+			unsigned long len = l->len - skip;
+
+			if (len > end - off)
+				len = end - off;
+			if (l->data)
+				append_op(&ops, &nr, &alloc, 0, l->data + skip, len);
+			else
+				append_op(&ops, &nr, &alloc, l->off + skip, NULL, len);
+			off += len;
+		}
+	}
+
+	free(lower);
+	free(cd->op);
+	cd->op = ops;
+	cd->nr = nr;
+	cd->alloc = alloc;
+	cd->src_size = src_size;
+	return 0;
+
+bad:
+	free(lower);
+	free(ops);
+	return -1;
+}
+
+unsigned long combined_delta_read(const struct combined_delta *cd,
+				  const void *src_buf, unsigned long pos,
+				  void *buf, unsigned long sz)
+{
+	unsigned long filled = 0;
+	int lo = 0, hi = cd->nr;
+
+	if (pos >= cd->dst_size)
+		return 0;
+	while (hi - lo > 1) {
+		int mi = lo + (hi - lo) / 2;
+		if (cd->op[mi].pos <= pos)
+			lo = mi;
+		else
+			hi = mi;
+	}
+
+	for (; filled < sz && lo < cd->nr; lo++) {
+		const struct delta_op *op = &cd->op[lo];
+		unsigned long skip = pos - op->pos;
+		unsigned long len = op->len - skip;
+		const unsigned char *from;
+
+		if (len > sz - filled)
+			len = sz - filled;
+		if (op->data)
+			from = op->data;
+		else
+			from = (const unsigned char *)src_buf + op->off;
+		memcpy((char *)buf + filled, from + skip, len);
+		filled += len;
+		pos += len;
+	}
+	return filled;
+}
+
+void *combined_delta_apply(const struct combined_delta *cd,
+			   const void *src_buf, unsigned long src_size,
+			   unsigned long *dst_size)
+{
+	void *dst_buf;
+
+	if (src_size != cd->src_size)
+		return NULL;
+
+	dst_buf = xmallocz(cd->dst_size);
+	combined_delta_read(cd, src_buf, 0, dst_buf, cd->dst_size);
+	*dst_size = cd->dst_size;
+	return dst_buf;
+}
+
+void combined_delta_release(struct combined_delta *cd)
+{
+	int i;
+
+	for (i = 0; i < cd->buf_nr; i++)
+		free(cd->buf[i]);
+	free(cd->buf);
+	free(cd->op);
+	memset(cd, 0, sizeof(*cd));
+}
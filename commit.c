@@ -8,6 +8,7 @@
 #include "notes.h"
 #include "gpg-interface.h"
 #include "mergesort.h"
+#include "decorate.h"
 
 static struct commit_extra_header *read_commit_extra_header_lines(const char *buf, size_t len, const char **);
 
@@ -851,6 +852,122 @@ int is_descendant_of(struct commit *commit, struct commit_list *with_commit)
 	return 0;
 }
 
+/*
+ * The answers commit_contains() remembers in its cache.
+ */
+static char contains_yes, contains_no;
+
+/* Allow some clock skew between the want commits and their descendants */
+#define CONTAINS_CUTOFF_SLOP 86400 /* one day */
+
+static int contains_test(struct commit *candidate,
+			 const struct commit_list *want,
+			 struct contains_cache *cache, unsigned long cutoff)
+{
+	void *memo = lookup_decoration(&cache->memo, &candidate->object);
+	const struct commit_list *p;
+
+	if (memo)
+		return memo == &contains_yes;
+	for (p = want; p; p = p->next) {
+		if (p->item == candidate) {
+			add_decoration(&cache->memo, &candidate->object,
+				       &contains_yes);
+			return 1;
+		}
+	}
+	/* older than all of the want commits, it cannot reach them */
+	if (parse_commit(candidate) || candidate->date < cutoff) {
+		add_decoration(&cache->memo, &candidate->object, &contains_no);
+		return 0;
+	}
+	return -1;
+}
+
+struct contains_stack_entry {
+	struct commit *commit;
+	struct commit_list *parents;
+};
+
+/*
+ * Does "candidate" reach (or is it) one of the commits in "want"?
+ *
+ * The history of the candidate is walked depth first, without
+ * recursion, and the answer for every commit it walks is remembered
+ * in "cache".  The same cache can be passed to many calls with the
+ * same "want" list; the commits the candidates have in common are then
+ * only walked once, so that asking about all tags or branches costs
+ * about one walk of the history they cover.  Commits older than the
+ * oldest want commit (minus a day to allow for clock skew) are not
+ * walked at all.
+ */
+int commit_contains(struct commit *candidate, const struct commit_list *want,
+		    struct contains_cache *cache)
+{
+	struct contains_stack_entry *stack = NULL;
+	int nr = 0, alloc = 0, ret;
+	unsigned long cutoff = ULONG_MAX;
+	const struct commit_list *p;
+
+	for (p = want; p; p = p->next) {
+		if (parse_commit(p->item))
+			continue;
+		if (p->item->date < cutoff)
+			cutoff = p->item->date;
+	}
+	if (cutoff == ULONG_MAX)
+		cutoff = 0;
+	else
+		cutoff = (cutoff < CONTAINS_CUTOFF_SLOP) ?
+			0 : cutoff - CONTAINS_CUTOFF_SLOP;
+
+	ret = contains_test(candidate, want, cache, cutoff);
+	if (0 <= ret)
+		return ret;
+
+	ALLOC_GROW(stack, nr + 1, alloc);
+	stack[nr].commit = candidate;
+	stack[nr].parents = candidate->parents;
+	nr++;
+	while (nr) {
+		struct contains_stack_entry *entry = &stack[nr - 1];
+		struct commit *parent;
+
+		if (!entry->parents) {
+			add_decoration(&cache->memo, &entry->commit->object,
+				       &contains_no);
+			nr--;
+			continue;
+		}
+		parent = entry->parents->item;
+		switch (contains_test(parent, want, cache, cutoff)) {
+		case 1:
+			add_decoration(&cache->memo, &entry->commit->object,
+				       &contains_yes);
+			nr--;
+			break;
+		case 0:
+			entry->parents = entry->parents->next;
+			break;
+		default:
+			ALLOC_GROW(stack, nr + 1, alloc);
+			stack[nr].commit = parent;
+			stack[nr].parents = parent->parents;
+			nr++;
+			break;
+		}
+	}
+	free(stack);
+	return contains_test(candidate, want, cache, cutoff);
+}
+
+void clear_contains_cache(struct contains_cache *cache)
+{
+	free(cache->memo.hash);
+	cache->memo.hash = NULL;
+	cache->memo.size = cache->memo.nr = 0;
+}
+
 /*
  * Is "commit" an ancestor of (i.e. reachable from) the "reference"?
  */
@@ -871,6 +988,171 @@ int in_merge_bases(struct commit *commit, struct commit *reference)
 	return ret;
 }
 
+/*
+ * in_merge_bases_batch() gives each commit it walks a bitmap of the
+ * new tips it was reached from, one bit per tip.  Adds the bits in
+ * "from" to those of "commit"; returns 1 if any of them was new.
+ */
+static int add_tip_bits(struct decoration *bits, struct commit *commit,
+			const uint32_t *from, int words)
+{
+	uint32_t *to = lookup_decoration(bits, &commit->object);
+	int i, changed = 0;
+
+	if (!to) {
+		to = xcalloc(words, sizeof(*to));
+		add_decoration(bits, &commit->object, to);
+	}
+	for (i = 0; i < words; i++) {
+		if (from[i] & ~to[i]) {
+			to[i] |= from[i];
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+static int has_tip_bit(struct decoration *bits, struct commit *commit,
+		       int tip)
+{
+	uint32_t *map = lookup_decoration(bits, &commit->object);
+
+	return map && (map[tip / 32] & (1u << (tip % 32)));
+}
+
+struct batch_pair {
+	unsigned long date;
+	int pair;
+};
+
+static int batch_pair_cmp(const void *a_, const void *b_)
+{
+	const struct batch_pair *a = a_, *b = b_;
+
+	if (a->date != b->date)
+		return a->date < b->date ? -1 : 1;
+	return a->pair - b->pair;
+}
+
+/*
+ * Set "result[i]" to whether "olds[i]" is an ancestor of (or the same
+ * as) "news[i]", like in_merge_bases(olds[i], news[i]) would.
+ *
+ * Instead of one merge-base walk per pair, all new tips are walked
+ * down together, in date order, and every commit collects the bits of
+ * all the tips it was reached from.  Bits only travel along parent
+ * links, so an old commit that has the bit of its own new tip is an
+ * ancestor of it, whatever other tips reach it too.  The walk stops
+ * once every pair is answered that way, or what is left to walk is
+ * older than the oldest unanswered old commit.  The pairs left over,
+ * which are not fast-forwards or were missed because of clock skew,
+ * get the thorough in_merge_bases() check.
+ */
+void in_merge_bases_batch(int nr, struct commit **olds, struct commit **news,
+			  char *result)
+{
+	struct decoration tips = { "in_merge_bases_batch tips" };
+	struct decoration bits = { "in_merge_bases_batch" };
+	struct commit_list *list = NULL;
+	struct batch_pair *order;
+	int *tip, i, ntips = 0, words, nr_order = 0, next = 0, slow = 0;
+	uint32_t *own;
+
+	tip = xmalloc(nr * sizeof(*tip));
+	for (i = 0; i < nr; i++) {
+		void *t;
+
+		result[i] = olds[i] == news[i];
+		if (result[i] || parse_commit(olds[i]) || parse_commit(news[i])) {
+			tip[i] = -1;
+			continue;
+		}
+		t = lookup_decoration(&tips, &news[i]->object);
+		if (!t) {
+			t = (void *)(intptr_t)++ntips;
+			add_decoration(&tips, &news[i]->object, t);
+		}
+		tip[i] = (intptr_t)t - 1;
+	}
+	free(tips.hash);
+
+	words = (ntips + 31) / 32;
+	own = xcalloc(words ? words : 1, sizeof(*own));
+	order = xmalloc(nr * sizeof(*order));
+	for (i = 0; i < nr; i++) {
+		if (tip[i] < 0)
+			continue;
+		if (!(news[i]->object.flags & PARENT2)) {
+			memset(own, 0, words * sizeof(*own));
+			own[tip[i] / 32] = 1u << (tip[i] % 32);
+			add_tip_bits(&bits, news[i], own, words);
+			news[i]->object.flags |= PARENT2;
+			commit_list_insert_by_date(news[i], &list);
+		}
+		order[nr_order].date = olds[i]->date;
+		order[nr_order++].pair = i;
+	}
+	free(own);
+	qsort(order, nr_order, sizeof(*order), batch_pair_cmp);
+
+	while (list) {
+		struct commit *commit;
+		struct commit_list *parents;
+		uint32_t *map;
+
+		/* skip the answered pairs with the oldest old commits */
+		while (next < nr_order &&
+		       has_tip_bit(&bits, olds[order[next].pair],
+				   tip[order[next].pair]))
+			next++;
+		if (next == nr_order || list->item->date < order[next].date)
+			break;
+
+		commit = pop_commit(&list);
+		/* queued more than once after its bits changed */
+		if (commit->object.flags & STALE)
+			continue;
+		commit->object.flags |= STALE;
+		map = lookup_decoration(&bits, &commit->object);
+
+		for (parents = commit->parents; parents; parents = parents->next) {
+			struct commit *p = parents->item;
+
+			if (!add_tip_bits(&bits, p, map, words))
+				continue;
+			if (parse_commit(p))
+				continue;
+			/* walk it (again) to pass the new bits on */
+			p->object.flags = (p->object.flags | PARENT2) & ~STALE;
+			commit_list_insert_by_date(p, &list);
+		}
+	}
+	free_commit_list(list);
+
+	for (i = 0; i < nr; i++) {
+		if (!result[i] && tip[i] >= 0)
+			result[i] = has_tip_bit(&bits, olds[i], tip[i]);
+	}
+	for (i = 0; i < nr; i++) {
+		clear_commit_marks(news[i], PARENT2 | STALE);
+		clear_commit_marks(olds[i], PARENT2 | STALE);
+	}
+	for (i = 0; i < bits.size; i++)
+		free(bits.hash[i].decoration);
+	free(bits.hash);
+	free(order);
+	free(tip);
+
+	for (i = 0; i < nr; i++) {
+		if (!result[i]) {
+			result[i] = in_merge_bases(olds[i], news[i]);
+			slow++;
+		}
+	}
+	trace_printf("in_merge_bases_batch: %d of %d checked one by one\n",
+		     slow, nr);
+}
+
 struct commit_list *reduce_heads(struct commit_list *heads)
 {
 	struct commit_list *p;
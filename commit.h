@@ -173,6 +173,22 @@ extern struct commit_list *get_shallow_commits(struct object_array *heads,
 int is_descendant_of(struct commit *, struct commit_list *);
 int in_merge_bases(struct commit *, struct commit *);
 
+/*
+ * Remembers, for a series of commit_contains() calls that all use the
+ * same "want" list, which commits do and do not reach one of them.
+ */
+struct contains_cache {
+	struct decoration memo;
+};
+#define CONTAINS_CACHE_INIT { { "contains" } }
+
+extern int commit_contains(struct commit *candidate,
+			   const struct commit_list *want,
+			   struct contains_cache *cache);
+extern void clear_contains_cache(struct contains_cache *cache);
+extern void in_merge_bases_batch(int nr, struct commit **olds,
+				 struct commit **news, char *result);
+
 extern int interactive_add(int argc, const char **argv, const char *prefix, int patch);
 extern int run_add_interactive(const char *revision, const char *patch_mode,
 			       const char **pathspec);
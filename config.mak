@@ -0,0 +1,5 @@
+NO_TCLTK=1
+NO_GETTEXT=1
+NO_OPENSSL=1
+NO_PYTHON=1
+NO_PERL=1
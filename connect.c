@@ -62,7 +62,8 @@ static void die_initial_contact(int got_at_least_one_head)
 /*
  * Read all the refs from the other end
  */
-struct ref **get_remote_heads(int in, struct ref **list,
+struct ref **get_remote_heads(struct packet_reader *reader,
+			      struct ref **list,
 			      unsigned int flags,
 			      struct extra_have_objects *extra_have)
 {
@@ -76,7 +77,7 @@ struct ref **get_remote_heads(int in, struct ref **list,
 		char *name;
 		int len, name_len;
 
-		len = packet_read(in, buffer, sizeof(buffer));
+		len = packet_reader_read(reader, buffer, sizeof(buffer));
 		if (len < 0)
 			die_initial_contact(got_at_least_one_head);
 
@@ -495,8 +496,28 @@ static struct child_process no_fork;
  * will hopefully be changed in a libification effort, to return NULL when
  * the connection failed).
  */
+/*
+ * Ask git-daemon to only advertise the refs matching the given space
+ * separated prefixes.  They go after an empty field, which daemons that
+ * do not know about them skip; they are left out altogether when they
+ * would not fit in the request line.
+ */
+static void git_daemon_request(int fd, const char *prog, const char *path,
+			       const char *host, const char *ref_prefixes)
+{
+	size_t len = strlen(prog) + strlen(path) + strlen(host) + 8;
+
+	if (ref_prefixes && *ref_prefixes &&
+	    len + strlen(ref_prefixes) + 13 < 996)
+		packet_write(fd, "%s %s%chost=%s%c%cref-prefix=%s%c",
+			     prog, path, 0, host, 0, 0, ref_prefixes, 0);
+	else
+		packet_write(fd, "%s %s%chost=%s%c", prog, path, 0, host, 0);
+}
+
 struct child_process *git_connect(int fd[2], const char *url_orig,
-				  const char *prog, int flags)
+				  const char *prog, const char *ref_prefixes,
+				  int flags)
 {
 	char *url;
 	char *host, *path;
@@ -594,13 +615,12 @@ struct child_process *git_connect(int fd[2], const char *url_orig,
 		 * Separate original protocol components prog and path
 		 * from extended host header with a NUL byte.
 		 *
-		 * Note: Do not add any other headers here!  Doing so
-		 * will cause older git-daemon servers to crash.
+		 * Note: Do not add any other headers right after the
+		 * host!  Doing so will cause older git-daemon servers
+		 * to crash.
 		 */
-		packet_write(fd[1],
-			     "%s %s%chost=%s%c",
-			     prog, path, 0,
-			     target_host, 0);
+		git_daemon_request(fd[1], prog, path, target_host,
+				   ref_prefixes);
 		free(target_host);
 		free(url);
 		if (free_path)
@@ -2,6 +2,7 @@
 #include "run-command.h"
 #include "sigchain.h"
 #include "connected.h"
+#include "fetch-object.h"
 
 /*
  * If we feed all the commits we want to verify to this command
@@ -10,7 +11,8 @@
  *
  * and if it does not error out, that means everything reachable from
  * these commits locally exists and is connected to our existing refs.
- * Note that this does _not_ validate the individual objects.
+ * Note that this does _not_ validate the individual objects.  In a
+ * partial clone, objects the filter left out are not required either.
  *
  * Returns 0 if everything is connected, non-zero otherwise.
  */
@@ -18,7 +20,8 @@ int check_everything_connected(sha1_iterate_fn fn, int quiet, void *cb_data)
 {
 	struct child_process rev_list;
 	const char *argv[] = {"rev-list", "--objects",
-			      "--stdin", "--not", "--all", NULL, NULL};
+			      "--stdin", "--not", "--all", NULL, NULL, NULL};
+	int ac = 5;
 	char commit[41];
 	unsigned char sha1[20];
 	int err = 0;
@@ -27,7 +30,9 @@ int check_everything_connected(sha1_iterate_fn fn, int quiet, void *cb_data)
 		return err;
 
 	if (quiet)
-		argv[5] = "--quiet";
+		argv[ac++] = "--quiet";
+	if (promisor_remote())
+		argv[ac++] = "--missing=allow-any";
 
 	memset(&rev_list, 0, sizeof(rev_list));
 	rev_list.argv = argv;
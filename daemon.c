@@ -4,6 +4,7 @@
 #include "run-command.h"
 #include "strbuf.h"
 #include "string-list.h"
+#include "argv-array.h"
 
 #ifndef HOST_NAME_MAX
 #define HOST_NAME_MAX 256
@@ -25,6 +26,7 @@ static int informative_errors;
 static const char daemon_usage[] =
 "git daemon [--verbose] [--syslog] [--export-all]\n"
 "           [--timeout=<n>] [--init-timeout=<n>] [--max-connections=<n>]\n"
+"           [--max-per-address=<n>] [--max-waiting=<n>] [--wait-timeout=<n>]\n"
 "           [--strict-paths] [--base-path=<path>] [--base-path-relaxed]\n"
 "           [--user-path | --user-path=<path>]\n"
 "           [--interpolated-path=<path>]\n"
@@ -50,6 +52,9 @@ static int base_path_relaxed;
 /* Flag indicating client sent extra args. */
 static int saw_extended_args;
 
+/* Space separated ref prefixes the client is interested in, if any */
+static char *ref_prefixes;
+
 /* If defined, ~user notation is allowed and the string is inserted
  * after ~user/.  E.g. a request to git://host/~alice/frotz would
  * go to /home/alice/pub_git/frotz with --user-path=pub_git.
@@ -93,6 +98,15 @@ static void logerror(const char *err, ...)
 	va_end(params);
 }
 
+__attribute__((format (printf, 1, 2)))
+static void lognotice(const char *err, ...)
+{
+	va_list params;
+	va_start(params, err);
+	logreport(LOG_NOTICE, err, params);
+	va_end(params);
+}
+
 __attribute__((format (printf, 1, 2)))
 static void loginfo(const char *err, ...)
 {
@@ -427,14 +441,24 @@ static int run_service_command(const char **argv)
 
 static int upload_pack(void)
 {
-	/* Timeout as string */
-	char timeout_buf[64];
-	const char *argv[] = { "upload-pack", "--strict", NULL, ".", NULL };
-
-	argv[2] = timeout_buf;
-
-	snprintf(timeout_buf, sizeof timeout_buf, "--timeout=%u", timeout);
-	return run_service_command(argv);
+	struct argv_array argv = ARGV_ARRAY_INIT;
+	const char *prefix = ref_prefixes;
+	int ret;
+
+	argv_array_pushl(&argv, "upload-pack", "--strict", NULL);
+	argv_array_pushf(&argv, "--timeout=%u", timeout);
+	while (prefix && *prefix) {
+		int len = strcspn(prefix, " ");
+		if (len)
+			argv_array_pushf(&argv, "--ref-prefix=%.*s", len, prefix);
+		prefix += len;
+		if (*prefix)
+			prefix++;
+	}
+	argv_array_push(&argv, ".");
+	ret = run_service_command(argv.argv);
+	argv_array_clear(&argv);
+	return ret;
 }
 
 static int upload_archive(void)
@@ -514,6 +538,21 @@ static void parse_host_and_port(char *hostport, char **host,
 	}
 }
 
+/*
+ * Parameters after an empty field are skipped by older daemons, so
+ * clients can send them without knowing who they talk to.
+ */
+static void parse_extra_params(char *param, char *end)
+{
+	while (param < end) {
+		if (!prefixcmp(param, "ref-prefix=")) {
+			free(ref_prefixes);
+			ref_prefixes = xstrdup(param + 11);
+		}
+		param += strlen(param) + 1;
+	}
+}
+
 /*
  * Read the host as supplied by the client connection.
  */
@@ -547,6 +586,8 @@ static void parse_host_arg(char *extra_args, int buflen)
 		if (extra_args < end && *extra_args)
 			die("Invalid request");
 	}
+	if (extra_args < end && !*extra_args)
+		parse_extra_params(extra_args + 1, end);
 
 	/*
 	 * Locate canonical hostname and its IP address.
@@ -629,7 +670,9 @@ static int execute(void)
 	free(canon_hostname);
 	free(ip_address);
 	free(tcp_port);
+	free(ref_prefixes);
 	hostname = canon_hostname = ip_address = tcp_port = NULL;
+	ref_prefixes = NULL;
 
 	if (len != pktlen)
 		parse_host_arg(line + len + 1, pktlen - len - 1);
@@ -674,6 +717,9 @@ static int addrcmp(const struct sockaddr_storage *s1,
 }
 
 static int max_connections = 32;
+static int max_per_address;
+static int max_waiting = 32;
+static int wait_timeout = 60;
 
 static unsigned int live_children;
 
@@ -683,6 +729,24 @@ static struct child {
 	struct sockaddr_storage address;
 } *firstborn;
 
+/*
+ * Connections we accepted but cannot serve yet, because we are at
+ * "max_connections" or their address is at "max_per_address".
+ */
+static struct waiting {
+	struct waiting *next;
+	int fd;
+	struct sockaddr_storage address;
+	socklen_t addrlen;
+	time_t since;
+} *waiting;
+
+static unsigned int nr_waiting;
+
+static struct {
+	unsigned long accepted, waited, dropped;
+} stats;
+
 static void add_child(struct child_process *cld, struct sockaddr *addr, socklen_t addrlen)
 {
 	struct child *newborn, **cradle;
@@ -698,24 +762,15 @@ static void add_child(struct child_process *cld, struct sockaddr *addr, socklen_
 	*cradle = newborn;
 }
 
-/*
- * This gets called if the number of connections grows
- * past "max_connections".
- *
- * We kill the newest connection from a duplicate IP.
- */
-static void kill_some_child(void)
+static unsigned int live_children_from(const struct sockaddr_storage *addr)
 {
-	const struct child *blanket, *next;
-
-	if (!(blanket = firstborn))
-		return;
+	const struct child *blanket;
+	unsigned int nr = 0;
 
-	for (; (next = blanket->next); blanket = next)
-		if (!addrcmp(&blanket->address, &next->address)) {
-			kill(blanket->cld.pid, SIGTERM);
-			break;
-		}
+	for (blanket = firstborn; blanket; blanket = blanket->next)
+		if (!addrcmp(&blanket->address, addr))
+			nr++;
+	return nr;
 }
 
 static void check_dead_children(void)
@@ -740,23 +795,12 @@ static void check_dead_children(void)
 }
 
 static char **cld_argv;
-static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
+static void spawn_child(int incoming, struct sockaddr *addr, socklen_t addrlen)
 {
 	struct child_process cld = { NULL };
 	char addrbuf[300] = "REMOTE_ADDR=", portbuf[300];
 	char *env[] = { addrbuf, portbuf, NULL };
 
-	if (max_connections && live_children >= max_connections) {
-		kill_some_child();
-		sleep(1);  /* give it some time to die */
-		check_dead_children();
-		if (live_children >= max_connections) {
-			close(incoming);
-			logerror("Too many children, dropping connection");
-			return;
-		}
-	}
-
 	if (addr->sa_family == AF_INET) {
 		struct sockaddr_in *sin_addr = (void *) addr;
 		inet_ntop(addr->sa_family, &sin_addr->sin_addr, addrbuf + 12,
@@ -790,13 +834,142 @@ static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 	close(incoming);
 }
 
+/*
+ * Serve as many waiting connections as the limits allow.  The one
+ * whose address has the fewest children running goes first, and among
+ * those the one that has waited longest, so that a single busy client
+ * cannot starve the others.  Running children are never killed to
+ * make room.
+ */
+static void admit_waiting(void)
+{
+	while (waiting) {
+		struct waiting **best = NULL, **pos, *w;
+		unsigned int best_nr = 0;
+
+		if (max_connections && live_children >= max_connections)
+			return;
+		for (pos = &waiting; *pos; pos = &(*pos)->next) {
+			unsigned int nr = live_children_from(&(*pos)->address);
+			if (max_per_address && nr >= max_per_address)
+				continue;
+			if (!best || nr < best_nr) {
+				best = pos;
+				best_nr = nr;
+			}
+		}
+		if (!best)
+			return;
+
+		w = *best;
+		*best = w->next;
+		nr_waiting--;
+		spawn_child(w->fd, (struct sockaddr *)&w->address, w->addrlen);
+		free(w);
+	}
+}
+
+/*
+ * Drop connections that have waited for "wait_timeout" seconds.  They are
+ * kept in the order they arrived, so the oldest one is first.
+ */
+static void expire_waiting(void)
+{
+	time_t now = time(NULL);
+
+	while (wait_timeout && waiting && now - waiting->since >= wait_timeout) {
+		struct waiting *w = waiting;
+		waiting = w->next;
+		nr_waiting--;
+		stats.dropped++;
+		close(w->fd);
+		free(w);
+		logerror("Connection waited for %d seconds, dropping it",
+			 wait_timeout);
+	}
+}
+
+/* How long poll() may sleep before expire_waiting() has work to do */
+static int poll_timeout(void)
+{
+	time_t left;
+
+	if (!wait_timeout || !waiting)
+		return -1;
+	left = waiting->since + wait_timeout - time(NULL);
+	return left > 0 ? left * 1000 : 0;
+}
+
+static int can_admit(const struct sockaddr_storage *addr)
+{
+	if (max_connections && live_children >= max_connections)
+		return 0;
+	return !max_per_address || live_children_from(addr) < max_per_address;
+}
+
+static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
+{
+	struct waiting *w, **pos;
+	long flags;
+
+	stats.accepted++;
+	if (nr_waiting >= max_waiting &&
+	    !can_admit((struct sockaddr_storage *)addr)) {
+		stats.dropped++;
+		close(incoming);
+		logerror("Too many waiting connections, dropping connection");
+		return;
+	}
+
+	/* do not leak it into the children we spawn while it waits */
+	flags = fcntl(incoming, F_GETFD, 0);
+	if (flags >= 0)
+		fcntl(incoming, F_SETFD, flags | FD_CLOEXEC);
+
+	w = xcalloc(1, sizeof(*w));
+	w->fd = incoming;
+	memcpy(&w->address, addr, addrlen);
+	w->addrlen = addrlen;
+	w->since = time(NULL);
+	for (pos = &waiting; *pos; pos = &(*pos)->next)
+		; /* find the tail */
+	*pos = w;
+	nr_waiting++;
+
+	admit_waiting();
+
+	for (pos = &waiting; *pos; pos = &(*pos)->next) {
+		if (*pos == w) {
+			stats.waited++;
+			loginfo("Connection has to wait, %u waiting", nr_waiting);
+			break;
+		}
+	}
+}
+
+/*
+ * The signal handlers write a byte to this pipe, which service_loop()
+ * polls along with the listening sockets.  Merely interrupting poll()
+ * is not enough: a signal that arrives after the loop has looked for
+ * dead children but before it enters poll() would only be noticed
+ * with the next connection, leaving the waiting ones stuck on a quiet
+ * daemon.
+ */
+static int signal_pipe[2] = { -1, -1 };
+
+static void wake_service_loop(void)
+{
+	int saved_errno = errno;
+
+	if (signal_pipe[1] >= 0)
+		(void)write(signal_pipe[1], "", 1);
+	errno = saved_errno;
+}
+
 static void child_handler(int signo)
 {
-	/*
-	 * Otherwise empty handler because systemcalls will get interrupted
-	 * upon signal receipt
-	 * SysV needs the handler to be rearmed
-	 */
+	wake_service_loop();
+	/* SysV needs the handler to be rearmed */
 	signal(SIGCHLD, child_handler);
 }
 
@@ -996,26 +1169,80 @@ static void socksetup(struct string_list *listen_addr, int listen_port, struct s
 	}
 }
 
+static void log_stats(void)
+{
+	const struct child *blanket, *prev = NULL;
+
+	lognotice("%u connections running (max %d), %u waiting (max %d)",
+		  live_children, max_connections, nr_waiting, max_waiting);
+	lognotice("%lu accepted, %lu had to wait, %lu dropped",
+		  stats.accepted, stats.waited, stats.dropped);
+
+	/* children from the same address are next to each other */
+	for (blanket = firstborn; blanket; prev = blanket, blanket = blanket->next) {
+		struct sockaddr *sa = (struct sockaddr *)&blanket->address;
+
+		if (prev && !addrcmp(&prev->address, &blanket->address))
+			continue;
+		lognotice("%s: %u running",
+			  ip2str(sa->sa_family, sa, sizeof(blanket->address)),
+			  live_children_from(&blanket->address));
+	}
+}
+
+static volatile sig_atomic_t stats_requested;
+
+#ifndef NO_POSIX_GOODIES
+static void stats_handler(int signo)
+{
+	stats_requested = 1;
+	wake_service_loop();
+	signal(signo, stats_handler);
+}
+#endif
+
 static int service_loop(struct socketlist *socklist)
 {
 	struct pollfd *pfd;
 	int i;
 
-	pfd = xcalloc(socklist->nr, sizeof(struct pollfd));
+	pfd = xcalloc(socklist->nr + 1, sizeof(struct pollfd));
 
 	for (i = 0; i < socklist->nr; i++) {
 		pfd[i].fd = socklist->list[i];
 		pfd[i].events = POLLIN;
 	}
 
+	if (pipe(signal_pipe) < 0)
+		die_errno("unable to create signal pipe");
+	for (i = 0; i < 2; i++) {
+		int flags = fcntl(signal_pipe[i], F_GETFL, 0);
+		if (flags >= 0)
+			fcntl(signal_pipe[i], F_SETFL, flags | O_NONBLOCK);
+		flags = fcntl(signal_pipe[i], F_GETFD, 0);
+		if (flags >= 0)
+			fcntl(signal_pipe[i], F_SETFD, flags | FD_CLOEXEC);
+	}
+	pfd[socklist->nr].fd = signal_pipe[0];
+	pfd[socklist->nr].events = POLLIN;
+
 	signal(SIGCHLD, child_handler);
+#ifndef NO_POSIX_GOODIES
+	signal(SIGUSR1, stats_handler);
+#endif
 
 	for (;;) {
 		int i;
 
 		check_dead_children();
+		admit_waiting();
+		expire_waiting();
+		if (stats_requested) {
+			stats_requested = 0;
+			log_stats();
+		}
 
-		if (poll(pfd, socklist->nr, -1) < 0) {
+		if (poll(pfd, socklist->nr + 1, poll_timeout()) < 0) {
 			if (errno != EINTR) {
 				logerror("Poll failed, resuming: %s",
 				      strerror(errno));
@@ -1024,6 +1251,12 @@ static int service_loop(struct socketlist *socklist)
 			continue;
 		}
 
+		if (pfd[socklist->nr].revents & POLLIN) {
+			char buf[64];
+			while (read(signal_pipe[0], buf, sizeof(buf)) > 0)
+				; /* drain; the next round does the work */
+		}
+
 		for (i = 0; i < socklist->nr; i++) {
 			if (pfd[i].revents & POLLIN) {
 				union {
@@ -1233,6 +1466,24 @@ int main(int argc, char **argv)
 				max_connections = 0;	        /* unlimited */
 			continue;
 		}
+		if (!prefixcmp(arg, "--max-per-address=")) {
+			max_per_address = atoi(arg+18);
+			if (max_per_address < 0)
+				max_per_address = 0;	        /* unlimited */
+			continue;
+		}
+		if (!prefixcmp(arg, "--max-waiting=")) {
+			max_waiting = atoi(arg+14);
+			if (max_waiting < 0)
+				max_waiting = 0;
+			continue;
+		}
+		if (!prefixcmp(arg, "--wait-timeout=")) {
+			wait_timeout = atoi(arg+15);
+			if (wait_timeout < 0)
+				wait_timeout = 0;	        /* unlimited */
+			continue;
+		}
 		if (!strcmp(arg, "--strict-paths")) {
 			strict_paths = 1;
 			continue;
@@ -79,6 +79,45 @@ extern void *patch_delta(const void *src_buf, unsigned long src_size,
 			 const void *delta_buf, unsigned long delta_size,
 			 unsigned long *dst_size);
 
+/*
+ * combined_delta: a chain of deltas folded into a single delta
+ *
+ * Feed the deltas with combine_delta_push() starting with the one
+ * producing the wanted object and walking down the chain, i.e. each
+ * delta pushed must produce the source of the previously pushed one.
+ * The delta buffers are taken over and freed by
+ * combined_delta_release().  combined_delta_apply() then recreates the
+ * wanted object from the base at the bottom of the chain without
+ * materializing any of the intermediate objects, and
+ * combined_delta_read() produces sz bytes of it starting at pos, so
+ * that callers can stream it out through a small buffer.
+ */
+struct delta_op {
+	unsigned long pos;		/* offset in the target */
+	unsigned long len;
+	unsigned long off;		/* copy: offset in the source */
+	const unsigned char *data;	/* insert: literal data, NULL for copy */
+};
+
+struct combined_delta {
+	struct delta_op *op;
+	int nr, alloc;
+	unsigned long src_size, dst_size;
+	void **buf;
+	int buf_nr, buf_alloc;
+};
+#define COMBINED_DELTA_INIT { NULL, 0, 0, 0, 0, NULL, 0, 0 }
+
+extern int combine_delta_push(struct combined_delta *cd,
+			      void *delta_buf, unsigned long delta_size);
+extern unsigned long combined_delta_read(const struct combined_delta *cd,
+					 const void *src_buf, unsigned long pos,
+					 void *buf, unsigned long sz);
+extern void *combined_delta_apply(const struct combined_delta *cd,
+				  const void *src_buf, unsigned long src_size,
+				  unsigned long *dst_size);
+extern void combined_delta_release(struct combined_delta *cd);
+
 /* the smallest possible delta size is 4 bytes */
 #define DELTA_SIZE_MIN	4
 
@@ -0,0 +1,92 @@
+#include "cache.h"
+#include "remote.h"
+#include "run-command.h"
+#include "argv-array.h"
+#include "fetch-object.h"
+
+static int find_promisor(struct remote *remote, void *data)
+{
+	struct remote **found = data;
+
+	if (!remote->promisor || !remote->url_nr)
+		return 0;
+	*found = remote;
+	return 1;
+}
+
+struct remote *promisor_remote(void)
+{
+	static struct remote *promisor;
+	static int initialized;
+
+	if (!initialized) {
+		for_each_remote(find_promisor, &promisor);
+		initialized = 1;
+	}
+	return promisor;
+}
+
+int fetch_objects(const unsigned char (*sha1)[20], int nr)
+{
+	struct remote *remote = promisor_remote();
+	struct argv_array args = ARGV_ARRAY_INIT;
+	struct child_process fetch;
+	struct strbuf line = STRBUF_INIT;
+	char *lockfile = NULL;
+	FILE *out;
+	int i, ret = 0;
+
+	if (!remote)
+		return -1;
+
+	argv_array_pushl(&args, "fetch-pack", "--stdin", "--quiet",
+			 "--no-progress", "--lock-pack", "--no-dependents",
+			 NULL);
+	if (remote->uploadpack)
+		argv_array_pushf(&args, "--upload-pack=%s", remote->uploadpack);
+	if (remote->partial_clone_filter)
+		argv_array_pushf(&args, "--filter=%s",
+				 remote->partial_clone_filter);
+	argv_array_push(&args, remote->url[0]);
+
+	memset(&fetch, 0, sizeof(fetch));
+	fetch.argv = args.argv;
+	fetch.git_cmd = 1;
+	fetch.in = -1;
+	fetch.out = -1;
+	if (start_command(&fetch)) {
+		argv_array_clear(&args);
+		return error("unable to run fetch-pack");
+	}
+
+	for (i = 0; i < nr; i++) {
+		strbuf_reset(&line);
+		strbuf_addf(&line, "%s\n", sha1_to_hex(sha1[i]));
+		if (write_in_full(fetch.in, line.buf, line.len) < 0) {
+			ret = error("unable to write to fetch-pack: %s",
+				    strerror(errno));
+			break;
+		}
+	}
+	close(fetch.in);
+
+	out = xfdopen(fetch.out, "r");
+	while (strbuf_getline(&line, out, '\n') != EOF) {
+		if (!prefixcmp(line.buf, "lock ")) {
+			free(lockfile);
+			lockfile = xstrdup(line.buf + 5);
+		}
+	}
+	fclose(out);
+
+	if (finish_command(&fetch))
+		ret = -1;
+	if (lockfile) {
+		unlink_or_warn(lockfile);
+		free(lockfile);
+	}
+	strbuf_release(&line);
+	argv_array_clear(&args);
+	reprepare_packed_git();
+	return ret;
+}
@@ -0,0 +1,21 @@
+#ifndef FETCH_OBJECT_H
+#define FETCH_OBJECT_H
+
+struct remote;
+
+/*
+ * Return the remote that a partial clone fetches the objects its
+ * filter left out from (remote.<name>.promisor), or NULL if this
+ * repository is not a partial clone.
+ */
+extern struct remote *promisor_remote(void);
+
+/*
+ * Fetch the named objects from the promisor remote, without the
+ * history leading to them; trees come with whatever of their contents
+ * the remote's partialCloneFilter lets through.  Returns 0 if the
+ * fetch succeeded.
+ */
+extern int fetch_objects(const unsigned char (*sha1)[20], int nr);
+
+#endif
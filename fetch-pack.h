@@ -5,8 +5,14 @@
 
 struct fetch_pack_args {
 	const char *uploadpack;
+	const char *filter_spec;
 	int unpacklimit;
 	int depth;
+	/*
+	 * With stateless_rpc, the caller may demultiplex the side-band
+	 * itself and hand band #1 over on this descriptor.
+	 */
+	int pack_fd;
 	unsigned quiet:1,
 		keep_pack:1,
 		lock_pack:1,
@@ -16,13 +22,15 @@ struct fetch_pack_args {
 		verbose:1,
 		no_progress:1,
 		include_tag:1,
-		stateless_rpc:1;
+		stateless_rpc:1,
+		no_dependents:1;
 };
 
 /*
  * sought contains the full names of remote references that should be
- * updated from.  On return, the names that were found on the remote
- * will have been removed from the list.  The util members of the
+ * updated from; a full object name asks for that object directly, which
+ * the remote has to allow.  On return, the names that were found on the
+ * remote will have been removed from the list.  The util members of the
  * string_list_items are used internally; they must be NULL on entry
  * (and will be NULL on exit).
  */
@@ -12,6 +12,8 @@
 static const char content_type[] = "Content-Type";
 static const char content_length[] = "Content-Length";
 static const char last_modified[] = "Last-Modified";
+static const char content_range[] = "Content-Range";
+static const char etag_hdr[] = "ETag";
 static int getanyfile = 1;
 
 static struct string_list *query_params;
@@ -152,20 +154,127 @@ static void select_getanyfile(void)
 		forbidden("Unsupported service: getanyfile");
 }
 
+static int etag_matches(const char *etag)
+{
+	const char *if_none_match = getenv("HTTP_IF_NONE_MATCH");
+
+	if (!if_none_match)
+		return 0;
+	return !strcmp(if_none_match, "*") || strstr(if_none_match, etag);
+}
+
 static void send_strbuf(const char *type, struct strbuf *buf)
 {
+	unsigned char sha1[20];
+	char etag[43];
+	git_SHA_CTX ctx;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, buf->buf, buf->len);
+	git_SHA1_Final(sha1, &ctx);
+	sprintf(etag, "\"%s\"", sha1_to_hex(sha1));
+
+	if (etag_matches(etag)) {
+		http_status(304, "Not Modified");
+		hdr_str(etag_hdr, etag);
+		end_headers();
+		return;
+	}
+
+	hdr_str(etag_hdr, etag);
 	hdr_int(content_length, buf->len);
 	hdr_str(content_type, type);
 	end_headers();
 	safe_write(1, buf->buf, buf->len);
 }
 
+/*
+ * Parse the Range header, of which we only honor a single range of
+ * bytes.  Returns 1 and fills [*first, *last] if the range can be
+ * served, -1 if it is out of the file, and 0 if the header should be
+ * ignored and the whole file sent.
+ */
+static int parse_range(const char *range, off_t size,
+		       off_t *first, off_t *last)
+{
+	uintmax_t a, b;
+	char *end;
+
+	if (!range || prefixcmp(range, "bytes=") || strchr(range, ','))
+		return 0;
+	range += 6;
+
+	if (*range == '-') {
+		b = strtoumax(range + 1, &end, 10);
+		if (end == range + 1 || *end)
+			return 0;
+		if (!b || !size)
+			return -1;
+		*first = b < (uintmax_t)size ? size - b : 0;
+		*last = size - 1;
+		return 1;
+	}
+
+	a = strtoumax(range, &end, 10);
+	if (end == range || *end != '-')
+		return 0;
+	range = end + 1;
+	if (!*range)
+		b = size - 1;
+	else {
+		b = strtoumax(range, &end, 10);
+		if (*end || b < a)
+			return 0;
+		if (b >= (uintmax_t)size)
+			b = size - 1;
+	}
+	if (a >= (uintmax_t)size)
+		return -1;
+	*first = a;
+	*last = b;
+	return 1;
+}
+
+static void send_file_data(int fd, const char *p, off_t offset, off_t len)
+{
+	char buf[8192];
+
+#ifdef HAVE_SENDFILE
+	while (len > 0) {
+		ssize_t n = sendfile(1, fd, &offset, xsize_t(len));
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno == EINVAL || errno == ENOSYS)
+				break; /* fall back to read/write below */
+			die_errno("Cannot send '%s'", p);
+		}
+		if (!n)
+			return;
+		len -= n;
+	}
+#endif
+
+	if (len && lseek(fd, offset, SEEK_SET) < 0)
+		die_errno("Cannot seek in '%s'", p);
+	while (len > 0) {
+		ssize_t n = xread(fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+		if (n < 0)
+			die_errno("Cannot read '%s'", p);
+		if (!n)
+			break;
+		safe_write(1, buf, n);
+		len -= n;
+	}
+}
+
 static void send_local_file(const char *the_type, const char *name)
 {
 	const char *p = git_path("%s", name);
-	size_t buf_alloc = 8192;
-	char *buf = xmalloc(buf_alloc);
-	int fd;
+	const char *if_range = getenv("HTTP_IF_RANGE");
+	struct strbuf etag = STRBUF_INIT, date = STRBUF_INIT;
+	off_t first = 0, last;
+	int fd, range = 0;
 	struct stat sb;
 
 	fd = open(p, O_RDONLY);
@@ -173,22 +282,46 @@ static void send_local_file(const char *the_type, const char *name)
 		not_found("Cannot open '%s': %s", p, strerror(errno));
 	if (fstat(fd, &sb) < 0)
 		die_errno("Cannot stat '%s'", p);
+	last = sb.st_size - 1;
+
+	strbuf_addf(&etag, "\"%"PRIxMAX"-%lx\"",
+		    (uintmax_t)sb.st_size, (unsigned long)sb.st_mtime);
+	strbuf_addstr(&date, show_date(sb.st_mtime, 0, DATE_RFC2822));
+
+	/* a range only applies to the version of the file the client has */
+	if (!if_range || !strcmp(if_range, etag.buf) ||
+	    !strcmp(if_range, date.buf))
+		range = parse_range(getenv("HTTP_RANGE"), sb.st_size,
+				    &first, &last);
+
+	if (range < 0) {
+		http_status(416, "Requested Range Not Satisfiable");
+		format_write(1, "%s: bytes */%"PRIuMAX"\r\n",
+			     content_range, (uintmax_t)sb.st_size);
+		end_headers();
+		close(fd);
+		strbuf_release(&etag);
+		strbuf_release(&date);
+		return;
+	}
+	if (range) {
+		http_status(206, "Partial Content");
+		format_write(1, "%s: bytes %"PRIuMAX"-%"PRIuMAX"/%"PRIuMAX"\r\n",
+			     content_range, (uintmax_t)first, (uintmax_t)last,
+			     (uintmax_t)sb.st_size);
+	}
 
-	hdr_int(content_length, sb.st_size);
+	hdr_int(content_length, last - first + 1);
 	hdr_str(content_type, the_type);
-	hdr_date(last_modified, sb.st_mtime);
+	hdr_str(last_modified, date.buf);
+	hdr_str(etag_hdr, etag.buf);
+	hdr_str("Accept-Ranges", "bytes");
 	end_headers();
 
-	for (;;) {
-		ssize_t n = xread(fd, buf, buf_alloc);
-		if (n < 0)
-			die_errno("Cannot read '%s'", p);
-		if (!n)
-			break;
-		safe_write(1, buf, n);
-	}
+	send_file_data(fd, p, first, last - first + 1);
 	close(fd);
-	free(buf);
+	strbuf_release(&etag);
+	strbuf_release(&date);
 }
 
 static void get_text_file(char *name)
@@ -384,9 +517,8 @@ static void get_info_refs(char *arg)
 	hdr_nocache();
 
 	if (service_name) {
-		const char *argv[] = {NULL /* service name */,
-			"--stateless-rpc", "--advertise-refs",
-			".", NULL};
+		struct argv_array argv = ARGV_ARRAY_INIT;
+		const char *prefix = get_parameter("ref-prefix");
 		struct rpc_service *svc = select_service(service_name);
 
 		strbuf_addf(&buf, "application/x-git-%s-advertisement",
@@ -397,8 +529,20 @@ static void get_info_refs(char *arg)
 		packet_write(1, "# service=git-%s\n", svc->name);
 		packet_flush(1);
 
-		argv[0] = svc->name;
-		run_service(argv);
+		argv_array_pushl(&argv, svc->name,
+				 "--stateless-rpc", "--advertise-refs", NULL);
+		while (prefix && *prefix && !strcmp(svc->name, "upload-pack")) {
+			int len = strcspn(prefix, " ");
+			if (len)
+				argv_array_pushf(&argv, "--ref-prefix=%.*s",
+						 len, prefix);
+			prefix += len;
+			if (*prefix)
+				prefix++;
+		}
+		argv_array_push(&argv, ".");
+		run_service(argv.argv);
+		argv_array_clear(&argv);
 
 	} else {
 		select_getanyfile();
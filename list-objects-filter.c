@@ -0,0 +1,37 @@
+#include "cache.h"
+#include "list-objects-filter.h"
+
+int parse_list_objects_filter(struct list_objects_filter_options *filter,
+			      const char *arg)
+{
+	const char *v;
+	char *end;
+
+	list_objects_filter_release(filter);
+
+	if (!strcmp(arg, "blob:none")) {
+		filter->choice = LOFC_BLOB_NONE;
+	} else if (!prefixcmp(arg, "blob:limit=")) {
+		v = arg + strlen("blob:limit=");
+		if (!git_parse_ulong(v, &filter->blob_limit))
+			return error("invalid blob size limit in filter '%s'", arg);
+		filter->choice = LOFC_BLOB_LIMIT;
+	} else if (!prefixcmp(arg, "tree:")) {
+		v = arg + strlen("tree:");
+		filter->tree_depth = strtoul(v, &end, 10);
+		if (!*v || *end || !isdigit(*v))
+			return error("invalid tree depth in filter '%s'", arg);
+		filter->choice = LOFC_TREE_DEPTH;
+	} else {
+		return error("invalid object filter '%s'", arg);
+	}
+
+	filter->filter_spec = xstrdup(arg);
+	return 0;
+}
+
+void list_objects_filter_release(struct list_objects_filter_options *filter)
+{
+	free(filter->filter_spec);
+	memset(filter, 0, sizeof(*filter));
+}
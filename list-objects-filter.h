@@ -0,0 +1,40 @@
+#ifndef LIST_OBJECTS_FILTER_H
+#define LIST_OBJECTS_FILTER_H
+
+/*
+ * An object filter lets traverse_commit_list_filtered() omit blobs and
+ * trees a partial clone does not want.  It is spelled as one of
+ *
+ *   blob:none        omit all blobs
+ *   blob:limit=<n>   omit blobs of <n> bytes or more ("k", "m" and "g"
+ *                    suffixes are accepted)
+ *   tree:<depth>     omit trees and blobs <depth> or more levels below
+ *                    the root tree; "tree:0" omits all of them
+ *
+ * Trees and blobs that were asked for by name, rather than reached
+ * from a commit or another tree, are never omitted themselves.
+ */
+enum list_objects_filter_choice {
+	LOFC_DISABLED = 0,
+	LOFC_BLOB_NONE,
+	LOFC_BLOB_LIMIT,
+	LOFC_TREE_DEPTH
+};
+
+struct list_objects_filter_options {
+	/* the filter as given, to pass it on to another process */
+	char *filter_spec;
+	enum list_objects_filter_choice choice;
+	unsigned long blob_limit;
+	unsigned long tree_depth;
+};
+
+/*
+ * Parse "arg" into "filter".  Returns 0 on success, or an error() when
+ * the filter is not understood.
+ */
+extern int parse_list_objects_filter(struct list_objects_filter_options *filter,
+				     const char *arg);
+extern void list_objects_filter_release(struct list_objects_filter_options *filter);
+
+#endif
@@ -7,13 +7,79 @@
 #include "tree-walk.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter.h"
+#include "decorate.h"
+
+struct filter_context {
+	const struct list_objects_filter_options *options;
+	/* shallowest depth each tree was walked at, plus one */
+	struct decoration tree_depth;
+};
+
+/*
+ * "depth" counts the levels below the root tree; objects that were
+ * named explicitly are passed with a negative depth and are never
+ * omitted.
+ */
+static int filter_omits_blob(struct filter_context *filter,
+			     struct blob *blob, int depth)
+{
+	unsigned long size;
+
+	if (!filter || depth < 0)
+		return 0;
+	switch (filter->options->choice) {
+	case LOFC_BLOB_NONE:
+		return 1;
+	case LOFC_BLOB_LIMIT:
+		if (sha1_object_info(blob->object.sha1, &size) < 0)
+			return 0;
+		return size >= filter->options->blob_limit;
+	case LOFC_TREE_DEPTH:
+		return depth >= filter->options->tree_depth;
+	default:
+		return 0;
+	}
+}
+
+static int filter_omits_tree(struct filter_context *filter, int depth)
+{
+	return filter && depth >= 0 &&
+		filter->options->choice == LOFC_TREE_DEPTH &&
+		depth >= filter->options->tree_depth;
+}
+
+/*
+ * With a tree depth filter, a tree first reached deep down may show
+ * up again closer to the root, where more of its entries are wanted.
+ * Remember how deep each tree was walked, and tell whether it has to
+ * be walked (again) at "depth".
+ */
+static int filter_walks_tree(struct filter_context *filter,
+			     struct tree *tree, int depth)
+{
+	intptr_t seen;
+
+	if (!filter || filter->options->choice != LOFC_TREE_DEPTH)
+		return !(tree->object.flags & SEEN);
+	if (depth < 0)
+		depth = 0;
+	seen = (intptr_t)lookup_decoration(&filter->tree_depth, &tree->object);
+	if (seen && seen - 1 <= depth)
+		return 0;
+	add_decoration(&filter->tree_depth, &tree->object,
+		       (void *)(intptr_t)(depth + 1));
+	return 1;
+}
 
 static void process_blob(struct rev_info *revs,
 			 struct blob *blob,
 			 show_object_fn show,
 			 struct name_path *path,
 			 const char *name,
-			 void *cb_data)
+			 void *cb_data,
+			 struct filter_context *filter,
+			 int depth)
 {
 	struct object *obj = &blob->object;
 
@@ -23,6 +89,8 @@ static void process_blob(struct rev_info *revs,
 		die("bad blob object");
 	if (obj->flags & (UNINTERESTING | SEEN))
 		return;
+	if (filter_omits_blob(filter, blob, depth))
+		return;
 	obj->flags |= SEEN;
 	show(obj, path, name, cb_data);
 }
@@ -65,7 +133,9 @@ static void process_tree(struct rev_info *revs,
 			 struct name_path *path,
 			 struct strbuf *base,
 			 const char *name,
-			 void *cb_data)
+			 void *cb_data,
+			 struct filter_context *filter,
+			 int depth)
 {
 	struct object *obj = &tree->object;
 	struct tree_desc desc;
@@ -74,17 +144,26 @@ static void process_tree(struct rev_info *revs,
 	enum interesting match = revs->diffopt.pathspec.nr == 0 ?
 		all_entries_interesting: entry_not_interesting;
 	int baselen = base->len;
+	int entry_depth = (depth < 0 ? 0 : depth) + 1;
 
 	if (!revs->tree_objects)
 		return;
 	if (!obj)
 		die("bad tree object");
-	if (obj->flags & (UNINTERESTING | SEEN))
+	if (obj->flags & UNINTERESTING)
+		return;
+	if (filter_omits_tree(filter, depth))
+		return;
+	if (!filter_walks_tree(filter, tree, depth))
+		return;
+	if (revs->ignore_missing_links && !has_sha1_file(obj->sha1))
 		return;
 	if (parse_tree(tree) < 0)
 		die("bad tree object %s", sha1_to_hex(obj->sha1));
-	obj->flags |= SEEN;
-	show(obj, path, name, cb_data);
+	if (!(obj->flags & SEEN)) {
+		obj->flags |= SEEN;
+		show(obj, path, name, cb_data);
+	}
 	me.up = path;
 	me.elem = name;
 	me.elem_len = strlen(name);
@@ -111,7 +190,7 @@ static void process_tree(struct rev_info *revs,
 			process_tree(revs,
 				     lookup_tree(entry.sha1),
 				     show, &me, base, entry.path,
-				     cb_data);
+				     cb_data, filter, entry_depth);
 		else if (S_ISGITLINK(entry.mode))
 			process_gitlink(revs, entry.sha1,
 					show, &me, entry.path,
@@ -120,11 +199,12 @@ static void process_tree(struct rev_info *revs,
 			process_blob(revs,
 				     lookup_blob(entry.sha1),
 				     show, &me, entry.path,
-				     cb_data);
+				     cb_data, filter, entry_depth);
 	}
 	strbuf_setlen(base, baselen);
 	free(tree->buffer);
 	tree->buffer = NULL;
+	tree->object.parsed = 0;
 }
 
 static void mark_edge_parents_uninteresting(struct commit *commit,
@@ -170,9 +250,28 @@ void traverse_commit_list(struct rev_info *revs,
 			  show_object_fn show_object,
 			  void *data)
 {
-	int i;
+	traverse_commit_list_filtered(revs, NULL, show_commit, show_object, data);
+}
+
+void traverse_commit_list_filtered(struct rev_info *revs,
+				   const struct list_objects_filter_options *options,
+				   show_commit_fn show_commit,
+				   show_object_fn show_object,
+				   void *data)
+{
+	int i, nr_named;
 	struct commit *commit;
 	struct strbuf base;
+	struct filter_context ctx, *filter = NULL;
+
+	if (options && options->choice != LOFC_DISABLED) {
+		memset(&ctx, 0, sizeof(ctx));
+		ctx.options = options;
+		filter = &ctx;
+	}
+
+	/* what is pending now was named explicitly, not reached from a commit */
+	nr_named = revs->pending.nr;
 
 	strbuf_init(&base, PATH_MAX);
 	while ((commit = get_revision(revs)) != NULL) {
@@ -197,12 +296,14 @@ void traverse_commit_list(struct rev_info *revs,
 		}
 		if (obj->type == OBJ_TREE) {
 			process_tree(revs, (struct tree *)obj, show_object,
-				     NULL, &base, name, data);
+				     NULL, &base, name, data,
+				     filter, i < nr_named ? -1 : 0);
 			continue;
 		}
 		if (obj->type == OBJ_BLOB) {
 			process_blob(revs, (struct blob *)obj, show_object,
-				     NULL, name, data);
+				     NULL, name, data,
+				     filter, i < nr_named ? -1 : 0);
 			continue;
 		}
 		die("unknown pending object %s (%s)",
@@ -214,5 +315,7 @@ void traverse_commit_list(struct rev_info *revs,
 		revs->pending.alloc = 0;
 		revs->pending.objects = NULL;
 	}
+	if (filter)
+		free(ctx.tree_depth.hash);
 	strbuf_release(&base);
 }
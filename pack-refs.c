@@ -2,6 +2,8 @@
 #include "refs.h"
 #include "tag.h"
 #include "pack-refs.h"
+#include "reftable.h"
+#include "dir.h"
 
 struct ref_to_prune {
 	struct ref_to_prune *next;
@@ -13,6 +15,9 @@ struct pack_refs_cb_data {
 	unsigned int flags;
 	struct ref_to_prune *ref_to_prune;
 	FILE *refs_file;
+	/* refs to write to a ref table, when refs_file is NULL */
+	struct ref_record *records;
+	int nr, alloc;
 };
 
 static int do_not_prune(int flags)
@@ -27,7 +32,8 @@ static int handle_one_ref(const char *path, const unsigned char *sha1,
 			  int flags, void *cb_data)
 {
 	struct pack_refs_cb_data *cb = cb_data;
-	int is_tag_ref;
+	unsigned char peeled[20];
+	int is_tag_ref, has_peeled = 0;
 
 	/* Do not pack the symbolic refs */
 	if ((flags & REF_ISSYMREF))
@@ -38,14 +44,32 @@ static int handle_one_ref(const char *path, const unsigned char *sha1,
 	if (!(cb->flags & PACK_REFS_ALL) && !is_tag_ref && !(flags & REF_ISPACKED))
 		return 0;
 
-	fprintf(cb->refs_file, "%s %s\n", sha1_to_hex(sha1), path);
 	if (is_tag_ref) {
 		struct object *o = parse_object(sha1);
 		if (o->type == OBJ_TAG) {
 			o = deref_tag(o, path, 0);
-			if (o)
-				fprintf(cb->refs_file, "^%s\n",
-					sha1_to_hex(o->sha1));
+			if (o) {
+				hashcpy(peeled, o->sha1);
+				has_peeled = 1;
+			}
+		}
+	}
+
+	if (cb->refs_file) {
+		fprintf(cb->refs_file, "%s %s\n", sha1_to_hex(sha1), path);
+		if (has_peeled)
+			fprintf(cb->refs_file, "^%s\n", sha1_to_hex(peeled));
+	} else {
+		struct ref_record *rec;
+
+		ALLOC_GROW(cb->records, cb->nr + 1, cb->alloc);
+		rec = &cb->records[cb->nr++];
+		memset(rec, 0, sizeof(*rec));
+		rec->refname = xstrdup(path);
+		hashcpy(rec->sha1, sha1);
+		if (has_peeled) {
+			hashcpy(rec->peeled, peeled);
+			rec->has_peeled = 1;
 		}
 	}
 
@@ -113,22 +137,50 @@ static void prune_refs(struct ref_to_prune *r)
 
 static struct lock_file packed;
 
+/*
+ * Write the packed refs as a single ref table, replacing whatever
+ * tables there were.  The packed-refs file, if the refs were kept there
+ * until now, is removed.
+ */
+static void pack_refs_to_table(struct pack_refs_cb_data *cbdata)
+{
+	char *dir = xstrdup(git_path("reftable"));
+	int i;
+
+	for_each_ref(handle_one_ref, cbdata);
+	if (ref_stack_replace(dir, cbdata->records, cbdata->nr))
+		die("failed to write the ref tables");
+	unlink_or_warn(git_path("packed-refs"));
+	rollback_lock_file(&packed);
+
+	for (i = 0; i < cbdata->nr; i++)
+		free((char *)cbdata->records[i].refname);
+	free(cbdata->records);
+	free(dir);
+}
+
 int pack_refs(unsigned int flags)
 {
-	int fd;
+	int fd, in_table;
 	struct pack_refs_cb_data cbdata;
 
 	memset(&cbdata, 0, sizeof(cbdata));
 	cbdata.flags = flags;
 
+	in_table = file_exists(git_path("reftable/tables.list"));
 	fd = hold_lock_file_for_update(&packed, git_path("packed-refs"),
 				       LOCK_DIE_ON_ERROR);
+	if (flags & PACK_REFS_TABLE || (in_table && !(flags & PACK_REFS_TEXT))) {
+		pack_refs_to_table(&cbdata);
+		prune_refs(cbdata.ref_to_prune);
+		return 0;
+	}
 	cbdata.refs_file = fdopen(fd, "w");
 	if (!cbdata.refs_file)
 		die_errno("unable to create ref-pack file structure");
 
-	/* perhaps other traits later as well */
-	fprintf(cbdata.refs_file, "# pack-refs with: peeled \n");
+	/* for_each_ref() goes in order, hence "sorted" */
+	fprintf(cbdata.refs_file, "# pack-refs with: peeled sorted \n");
 
 	for_each_ref(handle_one_ref, &cbdata);
 	if (ferror(cbdata.refs_file))
@@ -143,6 +195,8 @@ int pack_refs(unsigned int flags)
 	packed.fd = -1;
 	if (commit_lock_file(&packed) < 0)
 		die_errno("unable to overwrite old ref-pack file");
+	if (in_table && ref_stack_remove(git_path("reftable")))
+		die("unable to remove the ref tables");
 	prune_refs(cbdata.ref_to_prune);
 	return 0;
 }
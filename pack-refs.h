@@ -5,9 +5,16 @@
  * Flags for controlling behaviour of pack_refs()
  * PACK_REFS_PRUNE: Prune loose refs after packing
  * PACK_REFS_ALL:   Pack _all_ refs, not just tags and already packed refs
+ * PACK_REFS_TABLE: Keep packed refs in ref tables (see reftable.h)
+ * PACK_REFS_TEXT:  Keep packed refs in the packed-refs file
+ *
+ * Without PACK_REFS_TABLE or PACK_REFS_TEXT, packed refs are written
+ * where they are kept now.
  */
 #define PACK_REFS_PRUNE 0x0001
 #define PACK_REFS_ALL   0x0002
+#define PACK_REFS_TABLE 0x0004
+#define PACK_REFS_TEXT  0x0008
 
 /*
  * Write a packed-refs file for the current repository.
@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "pkt-line.h"
+#include "run-command.h"
 
 static const char *packet_trace_prefix = "git";
 static const char trace_key[] = "GIT_TRACE_PACKET";
@@ -150,7 +151,7 @@ static int safe_read(int fd, void *buffer, unsigned size, int return_line_fail)
 	return ret;
 }
 
-static int packet_length(const char *linelen)
+int packet_length(const char *linelen)
 {
 	int n;
 	int len = 0;
@@ -211,6 +212,144 @@ int packet_read_line(int fd, char *buffer, unsigned size)
 	return packet_read_internal(fd, buffer, size, 0);
 }
 
+void packet_reader_init(struct packet_reader *reader, int fd)
+{
+	reader->fd = fd;
+	reader->pos = reader->len = 0;
+}
+
+/*
+ * Make sure at least "want" bytes are buffered, reading as much as the
+ * descriptor has available.  Returns the number of bytes buffered,
+ * which is less than "want" only at EOF.
+ */
+static unsigned reader_fill(struct packet_reader *reader, unsigned want)
+{
+	if (reader->len - reader->pos >= want)
+		return reader->len - reader->pos;
+
+	if (reader->pos + want > sizeof(reader->buf)) {
+		memmove(reader->buf, reader->buf + reader->pos,
+			reader->len - reader->pos);
+		reader->len -= reader->pos;
+		reader->pos = 0;
+	}
+	while (reader->len - reader->pos < want) {
+		ssize_t ret = xread(reader->fd, reader->buf + reader->len,
+				    sizeof(reader->buf) - reader->len);
+		if (ret < 0)
+			die_errno("read error");
+		if (!ret)
+			break;
+		reader->len += ret;
+	}
+	return reader->len - reader->pos;
+}
+
+static int packet_reader_read_internal(struct packet_reader *reader,
+				       char *buffer, unsigned size,
+				       int return_line_fail)
+{
+	int len;
+
+	if (reader_fill(reader, 4) < 4)
+		goto hung_up;
+	len = packet_length(reader->buf + reader->pos);
+	if (len < 0)
+		die("protocol error: bad line length character: %.4s",
+		    reader->buf + reader->pos);
+	reader->pos += 4;
+	if (!len) {
+		packet_trace("0000", 4, 0);
+		return 0;
+	}
+	len -= 4;
+	if (len >= size)
+		die("protocol error: bad line length %d", len);
+	if (reader_fill(reader, len) < len)
+		goto hung_up;
+	memcpy(buffer, reader->buf + reader->pos, len);
+	reader->pos += len;
+	buffer[len] = 0;
+	packet_trace(buffer, len, 0);
+	return len;
+
+hung_up:
+	if (return_line_fail)
+		return -1;
+	die("The remote end hung up unexpectedly");
+}
+
+int packet_reader_read(struct packet_reader *reader, char *buffer, unsigned size)
+{
+	return packet_reader_read_internal(reader, buffer, size, 1);
+}
+
+int packet_reader_read_line(struct packet_reader *reader, char *buffer, unsigned size)
+{
+	return packet_reader_read_internal(reader, buffer, size, 0);
+}
+
+static int relay_buffered(int in, int out, void *data)
+{
+	struct packet_reader *reader = data;
+	int ret = 0;
+
+	if (write_in_full(out, reader->buf + reader->pos,
+			  reader->len - reader->pos) < 0) {
+		close(out);
+		return error("unable to relay buffered data: %s",
+			     strerror(errno));
+	}
+	reader->pos = reader->len = 0;
+
+	for (;;) {
+		struct pollfd pfd[2];
+		ssize_t n;
+
+		pfd[0].fd = reader->fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = out;
+		pfd[1].events = 0;
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = error("poll failed: %s", strerror(errno));
+			break;
+		}
+		/* whoever reads the stream has stopped listening */
+		if (pfd[1].revents & (POLLERR | POLLHUP))
+			break;
+		if (!pfd[0].revents)
+			continue;
+		n = xread(reader->fd, reader->buf, sizeof(reader->buf));
+		if (n < 0)
+			ret = error("read error: %s", strerror(errno));
+		if (n <= 0)
+			break;
+		if (write_in_full(out, reader->buf, n) < 0) {
+			ret = error("unable to relay data: %s", strerror(errno));
+			break;
+		}
+	}
+	close(out);
+	return ret;
+}
+
+int packet_reader_handoff(struct packet_reader *reader, struct async *relay)
+{
+	memset(relay, 0, sizeof(*relay));
+	if (reader->pos == reader->len)
+		return reader->fd;
+
+	relay->proc = relay_buffered;
+	relay->data = reader;
+	relay->out = -1;
+	if (start_async(relay))
+		die("unable to fork off relay for buffered data");
+	return relay->out;
+}
+
 int packet_get_line(struct strbuf *out,
 	char **src_buf, size_t *src_len)
 {
@@ -15,6 +15,48 @@ void packet_buf_write(struct strbuf *buf, const char *fmt, ...) __attribute__((f
 int packet_read_line(int fd, char *buffer, unsigned size);
 int packet_read(int fd, char *buffer, unsigned size);
 int packet_get_line(struct strbuf *out, char **src_buf, size_t *src_len);
+
+/*
+ * Parse the four hex digits that start a packet; returns the length
+ * they encode (including the digits themselves), or -1.
+ */
+int packet_length(const char *linelen);
+
+/*
+ * Buffered packet reader.  Reading a packet straight from a descriptor
+ * costs one read(2) for the length and another for the payload; the
+ * reader instead pulls in whatever the descriptor has to offer and
+ * parses packets out of its buffer.
+ *
+ * It may therefore consume data beyond the last packet it returned.
+ * When the stream continues with something other than packets (e.g. a
+ * pack without side-band), use packet_reader_handoff() to get a
+ * descriptor that yields the buffered data followed by the rest of
+ * the stream.
+ */
+#define PACKET_READER_BUFSIZE 65536
+
+struct packet_reader {
+	int fd;
+	unsigned pos, len;
+	char buf[PACKET_READER_BUFSIZE];
+};
+
+struct async;
+
+void packet_reader_init(struct packet_reader *reader, int fd);
+int packet_reader_read_line(struct packet_reader *reader, char *buffer, unsigned size);
+int packet_reader_read(struct packet_reader *reader, char *buffer, unsigned size);
+
+/*
+ * Return the descriptor to read the rest of the stream from.  If the
+ * reader has nothing buffered, that is reader->fd itself and relay->proc
+ * is left NULL.  Otherwise an async relay is started that writes the
+ * buffered data and then copies from reader->fd until EOF or until the
+ * other end of the returned descriptor is closed; the caller must
+ * finish_async(relay) when done.
+ */
+int packet_reader_handoff(struct packet_reader *reader, struct async *relay);
 ssize_t safe_write(int, const void *, ssize_t);
 
 #endif
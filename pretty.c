@@ -529,8 +529,13 @@ static int mailmap_name(char *email, int email_len, char *name, int name_len)
 	return mail_map->nr && map_user(mail_map, email, email_len, name, name_len);
 }
 
-static size_t format_person_part(struct strbuf *sb, char part,
-				 const char *msg, int len, enum date_mode dmode)
+/*
+ * Format part of an ident line that has been split with
+ * split_ident_line(), or of a bogus one if "s" is NULL.
+ */
+static size_t format_ident_part(struct strbuf *sb, char part,
+				const struct ident_split *s,
+				enum date_mode dmode)
 {
 	/* currently all placeholders have same length */
 	const int placeholder_len = 2;
@@ -538,16 +543,15 @@ static size_t format_person_part(struct strbuf *sb, char part,
 	unsigned long date = 0;
 	char person_name[1024];
 	char person_mail[1024];
-	struct ident_split s;
 	const char *name_start, *name_end, *mail_start, *mail_end;
 
-	if (split_ident_line(&s, msg, len) < 0)
+	if (!s)
 		goto skip;
 
-	name_start = s.name_begin;
-	name_end = s.name_end;
-	mail_start = s.mail_begin;
-	mail_end = s.mail_end;
+	name_start = s->name_begin;
+	name_end = s->name_end;
+	mail_start = s->mail_begin;
+	mail_end = s->mail_end;
 
 	if (part == 'N' || part == 'E') { /* mailmap lookup */
 		snprintf(person_name, sizeof(person_name), "%.*s",
@@ -569,19 +573,19 @@ static size_t format_person_part(struct strbuf *sb, char part,
 		return placeholder_len;
 	}
 
-	if (!s.date_begin)
+	if (!s->date_begin)
 		goto skip;
 
-	date = strtoul(s.date_begin, NULL, 10);
+	date = strtoul(s->date_begin, NULL, 10);
 
 	if (part == 't') {	/* date, UNIX timestamp */
-		strbuf_add(sb, s.date_begin, s.date_end - s.date_begin);
+		strbuf_add(sb, s->date_begin, s->date_end - s->date_begin);
 		return placeholder_len;
 	}
 
 	/* parse tz */
-	tz = strtoul(s.tz_begin + 1, NULL, 10);
-	if (*s.tz_begin == '-')
+	tz = strtoul(s->tz_begin + 1, NULL, 10);
+	if (*s->tz_begin == '-')
 		tz = -tz;
 
 	switch (part) {
@@ -612,6 +616,16 @@ skip:
 	return 0; /* unknown placeholder */
 }
 
+static size_t format_person_part(struct strbuf *sb, char part,
+				 const char *msg, int len, enum date_mode dmode)
+{
+	struct ident_split s;
+
+	if (split_ident_line(&s, msg, len) < 0)
+		return format_ident_part(sb, part, NULL, dmode);
+	return format_ident_part(sb, part, &s, dmode);
+}
+
 struct chunk {
 	size_t off;
 	size_t len;
@@ -639,6 +653,12 @@ struct format_commit_context {
 	size_t subject_off;
 	size_t body_off;
 
+	/* The author and committer lines, split once for all placeholders */
+	struct ident_split author_ident;
+	struct ident_split committer_ident;
+	unsigned author_ident_valid:1;
+	unsigned committer_ident_valid:1;
+
 	/* The following ones are relative to the result struct strbuf. */
 	struct chunk abbrev_commit_hash;
 	struct chunk abbrev_tree_hash;
@@ -688,6 +708,14 @@ static void parse_commit_header(struct format_commit_context *context)
 		i = eol;
 	}
 	context->message_off = i;
+	context->author_ident_valid =
+		!split_ident_line(&context->author_ident,
+				  msg + context->author.off,
+				  context->author.len);
+	context->committer_ident_valid =
+		!split_ident_line(&context->committer_ident,
+				  msg + context->committer.off,
+				  context->committer.len);
 	context->commit_header_parsed = 1;
 }
 
@@ -1071,13 +1099,13 @@ static size_t format_commit_one(struct strbuf *sb, const char *placeholder,
 
 	switch (placeholder[0]) {
 	case 'a':	/* author ... */
-		return format_person_part(sb, placeholder[1],
-				   msg + c->author.off, c->author.len,
-				   c->pretty_ctx->date_mode);
+		return format_ident_part(sb, placeholder[1],
+				c->author_ident_valid ? &c->author_ident : NULL,
+				c->pretty_ctx->date_mode);
 	case 'c':	/* committer ... */
-		return format_person_part(sb, placeholder[1],
-				   msg + c->committer.off, c->committer.len,
-				   c->pretty_ctx->date_mode);
+		return format_ident_part(sb, placeholder[1],
+				c->committer_ident_valid ? &c->committer_ident : NULL,
+				c->pretty_ctx->date_mode);
 	case 'e':	/* encoding */
 		strbuf_add(sb, msg + c->encoding.off, c->encoding.len);
 		return 1;
@@ -1179,6 +1207,145 @@ void userformat_find_requirements(const char *fmt, struct userformat_want *w)
 	strbuf_release(&dummy);
 }
 
+/*
+ * A user format, compiled into a list of steps, each of which is
+ * either literal text or a placeholder, so that formatting many
+ * commits does not have to parse the format string again for each of
+ * them.
+ *
+ * The format is compiled while the first commit is formatted with it,
+ * by recording how strbuf_expand() goes through it, including how
+ * much of the format each placeholder consumed.  That mostly depends
+ * on the format alone, but not always: %aN on a commit whose author
+ * line does not parse consumes nothing and is shown literally.  So
+ * each placeholder is checked to consume the same as when it was
+ * recorded, and a commit for which one does not is formatted without
+ * the compiled steps.  Placeholders whose output does not depend on
+ * the commit (%n, %x.., %C...) become literal text.
+ */
+struct format_step {
+	unsigned literal:1;
+	size_t off, len; /* in the literal buffer, or in the format */
+};
+
+struct compiled_format {
+	char *format;
+	int show_notes;
+	struct format_step *step;
+	int nr, alloc;
+	struct strbuf literal;
+};
+
+static struct compiled_format compiled_format = { NULL, 0, NULL, 0, 0, STRBUF_INIT };
+
+static void add_literal_step(struct compiled_format *cf,
+			     const char *text, size_t len)
+{
+	struct format_step *step;
+
+	if (!len)
+		return;
+	if (cf->nr && cf->step[cf->nr - 1].literal) {
+		/* extend the previous one */
+		step = &cf->step[cf->nr - 1];
+	} else {
+		ALLOC_GROW(cf->step, cf->nr + 1, cf->alloc);
+		step = &cf->step[cf->nr++];
+		step->literal = 1;
+		step->off = cf->literal.len;
+		step->len = 0;
+	}
+	strbuf_add(&cf->literal, text, len);
+	step->len += len;
+}
+
+struct format_recorder {
+	struct compiled_format *cf;
+	struct format_commit_context *context;
+	size_t literal_start; /* output since then is literal text */
+};
+
+static size_t record_format_item(struct strbuf *sb, const char *placeholder,
+				 void *context)
+{
+	struct format_recorder *r = context;
+	struct compiled_format *cf = r->cf;
+	size_t start, consumed;
+
+	add_literal_step(cf, sb->buf + r->literal_start,
+			 sb->len - r->literal_start);
+	start = sb->len;
+	r->literal_start = start;
+	consumed = format_commit_item(sb, placeholder, r->context);
+
+	if (consumed &&
+	    (*placeholder == 'n' || *placeholder == 'x' || *placeholder == 'C')) {
+		add_literal_step(cf, sb->buf + start, sb->len - start);
+	} else {
+		struct format_step *step;
+		ALLOC_GROW(cf->step, cf->nr + 1, cf->alloc);
+		step = &cf->step[cf->nr++];
+		step->literal = 0;
+		step->off = placeholder - cf->format;
+		step->len = consumed;
+	}
+	/* if nothing was consumed, the '%' and what follows are literal */
+	r->literal_start = sb->len;
+	return consumed;
+}
+
+static void expand_commit_format(struct strbuf *sb, const char *format,
+				 struct format_commit_context *context)
+{
+	struct compiled_format *cf = &compiled_format;
+	int show_notes = context->pretty_ctx->show_notes;
+	size_t start = sb->len;
+	size_t width = context->width, indent1 = context->indent1,
+		indent2 = context->indent2, wrap_start = context->wrap_start;
+	int i;
+
+	if (!cf->format || cf->show_notes != show_notes ||
+	    strcmp(cf->format, format)) {
+		struct format_recorder r;
+
+		free(cf->format);
+		cf->format = xstrdup(format);
+		cf->show_notes = show_notes;
+		cf->nr = 0;
+		strbuf_reset(&cf->literal);
+
+		r.cf = cf;
+		r.context = context;
+		r.literal_start = sb->len;
+		strbuf_expand(sb, cf->format, record_format_item, &r);
+		add_literal_step(cf, sb->buf + r.literal_start,
+				 sb->len - r.literal_start);
+		return;
+	}
+
+	for (i = 0; i < cf->nr; i++) {
+		struct format_step *step = &cf->step[i];
+		if (step->literal)
+			strbuf_add(sb, cf->literal.buf + step->off, step->len);
+		else if (format_commit_item(sb, cf->format + step->off,
+					    context) != step->len)
+			break;
+	}
+	if (i == cf->nr)
+		return;
+
+	/* start over, undoing what refers to the discarded output */
+	strbuf_setlen(sb, start);
+	context->width = width;
+	context->indent1 = indent1;
+	context->indent2 = indent2;
+	context->wrap_start = wrap_start;
+	memset(&context->abbrev_commit_hash, 0, sizeof(struct chunk));
+	memset(&context->abbrev_tree_hash, 0, sizeof(struct chunk));
+	memset(&context->abbrev_parent_hashes, 0, sizeof(struct chunk));
+	strbuf_expand(sb, format, format_commit_item, context);
+}
+
 void format_commit_message(const struct commit *commit,
 			   const char *format, struct strbuf *sb,
 			   const struct pretty_print_context *pretty_ctx)
@@ -1202,7 +1369,7 @@ void format_commit_message(const struct commit *commit,
 		free(enc);
 	}
 
-	strbuf_expand(sb, format, format_commit_item, &context);
+	expand_commit_format(sb, format, &context);
 	rewrap_message_tail(sb, &context, 0, 0, 0);
 
 	if (context.message != commit->buffer)
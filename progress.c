@@ -36,6 +36,7 @@ struct progress {
 };
 
 static volatile sig_atomic_t progress_update;
+static int progress_meters; /* sharing the interval timer */
 
 static void progress_interval(int signum)
 {
@@ -47,6 +48,8 @@ static void set_progress_signal(void)
 	struct sigaction sa;
 	struct itimerval v;
 
+	if (progress_meters++)
+		return;
 	progress_update = 0;
 
 	memset(&sa, 0, sizeof(sa));
@@ -64,6 +67,9 @@ static void set_progress_signal(void)
 static void clear_progress_signal(void)
 {
 	struct itimerval v = {{0,},};
+
+	if (--progress_meters)
+		return;
 	setitimer(ITIMER_REAL, &v, NULL);
 	signal(SIGALRM, SIG_IGN);
 	progress_update = 0;
@@ -263,7 +269,8 @@ void stop_progress_msg(struct progress **p_progress, const char *msg)
 		if (buf != bufp)
 			free(bufp);
 	}
-	clear_progress_signal();
+	if (progress->delay != -1)
+		clear_progress_signal();
 	free(progress->throughput);
 	free(progress);
 }
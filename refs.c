@@ -3,6 +3,8 @@
 #include "object.h"
 #include "tag.h"
 #include "dir.h"
+#include "reftable.h"
+#include "string-list.h"
 
 /*
  * Make sure "ref" is something reasonable to have under ".git/refs/";
@@ -529,11 +531,25 @@ static int do_one_ref(const char *base, each_ref_fn fn, int trim,
 	return retval;
 }
 
+/*
+ * Return true iff the directory named dirname (with its trailing
+ * slash) might hold references whose names start with base, so that
+ * iterating over base needs to read it.
+ */
+static int dir_may_hold(const char *dirname, const char *base)
+{
+	for (; *dirname && *base; dirname++, base++)
+		if (*dirname != *base)
+			return 0;
+	return 1;
+}
+
 /*
  * Call fn for each reference in dir that has index in the range
  * offset <= index < dir->nr.  Recurse into subdirectories that are in
- * that index range, sorting them before iterating.  This function
- * does not sort dir itself; it should be sorted beforehand.
+ * that index range and might hold references starting with base,
+ * sorting them before iterating.  This function does not sort dir
+ * itself; it should be sorted beforehand.
  */
 static int do_for_each_ref_in_dir(struct ref_dir *dir, int offset,
 				  const char *base,
@@ -545,7 +561,10 @@ static int do_for_each_ref_in_dir(struct ref_dir *dir, int offset,
 		struct ref_entry *entry = dir->entries[i];
 		int retval;
 		if (entry->flag & REF_DIR) {
-			struct ref_dir *subdir = get_ref_dir(entry);
+			struct ref_dir *subdir;
+			if (!dir_may_hold(entry->name, base))
+				continue;
+			subdir = get_ref_dir(entry);
 			sort_ref_dir(subdir);
 			retval = do_for_each_ref_in_dir(subdir, 0,
 							base, fn, trim, flags, cb_data);
@@ -592,15 +611,18 @@ static int do_for_each_ref_in_dirs(struct ref_dir *dir1,
 		if (cmp == 0) {
 			if ((e1->flag & REF_DIR) && (e2->flag & REF_DIR)) {
 				/* Both are directories; descend them in parallel. */
-				struct ref_dir *subdir1 = get_ref_dir(e1);
-				struct ref_dir *subdir2 = get_ref_dir(e2);
+				struct ref_dir *subdir1, *subdir2;
+				i1++;
+				i2++;
+				if (!dir_may_hold(e1->name, base))
+					continue;
+				subdir1 = get_ref_dir(e1);
+				subdir2 = get_ref_dir(e2);
 				sort_ref_dir(subdir1);
 				sort_ref_dir(subdir2);
 				retval = do_for_each_ref_in_dirs(
 						subdir1, subdir2,
 						base, fn, trim, flags, cb_data);
-				i1++;
-				i2++;
 			} else if (!(e1->flag & REF_DIR) && !(e2->flag & REF_DIR)) {
 				/* Both are references; ignore the one from dir1. */
 				retval = do_one_ref(base, fn, trim, flags, cb_data, e2);
@@ -620,7 +642,10 @@ static int do_for_each_ref_in_dirs(struct ref_dir *dir1,
 				i2++;
 			}
 			if (e->flag & REF_DIR) {
-				struct ref_dir *subdir = get_ref_dir(e);
+				struct ref_dir *subdir;
+				if (!dir_may_hold(e->name, base))
+					continue;
+				subdir = get_ref_dir(e);
 				sort_ref_dir(subdir);
 				retval = do_for_each_ref_in_dir(
 						subdir, 0,
@@ -677,23 +702,53 @@ static int name_conflict_fn(const char *existingrefname, const unsigned char *sh
 
 /*
  * Return true iff a reference named refname could be created without
- * conflicting with the name of an existing reference in array.  If
+ * conflicting with the name of an existing reference in dir.  If
  * oldrefname is non-NULL, ignore potential conflicts with oldrefname
  * (e.g., because oldrefname is scheduled for deletion in the same
- * operation).
+ * operation).  Only the directories on the way to refname and the
+ * one named refname are looked at, so that loose references elsewhere
+ * are not read.
  */
 static int is_refname_available(const char *refname, const char *oldrefname,
 				struct ref_dir *dir)
 {
 	struct name_conflict_cb data;
+	struct strbuf name = STRBUF_INIT;
+	struct ref_dir *subdir;
+	const char *slash;
+
 	data.refname = refname;
 	data.oldrefname = oldrefname;
 	data.conflicting_refname = NULL;
 
-	sort_ref_dir(dir);
-	if (do_for_each_ref_in_dir(dir, 0, "", name_conflict_fn,
-				   0, DO_FOR_EACH_INCLUDE_BROKEN,
-				   &data)) {
+	/* a reference named like one of the leading components */
+	for (slash = strchr(refname, '/'); slash; slash = strchr(slash + 1, '/')) {
+		struct ref_entry *entry;
+
+		strbuf_reset(&name);
+		strbuf_add(&name, refname, slash - refname);
+		entry = find_ref(dir, name.buf);
+		if (entry && (!oldrefname || strcmp(oldrefname, entry->name))) {
+			data.conflicting_refname = entry->name;
+			break;
+		}
+	}
+
+	/* references below refname/ */
+	if (!data.conflicting_refname) {
+		strbuf_reset(&name);
+		strbuf_addf(&name, "%s/", refname);
+		subdir = find_containing_dir(dir, name.buf, 0);
+		if (subdir) {
+			sort_ref_dir(subdir);
+			do_for_each_ref_in_dir(subdir, 0, "", name_conflict_fn,
+					       0, DO_FOR_EACH_INCLUDE_BROKEN,
+					       &data);
+		}
+	}
+	strbuf_release(&name);
+
+	if (data.conflicting_refname) {
 		error("'%s' exists; cannot create '%s'",
 		      data.conflicting_refname, refname);
 		return 0;
@@ -701,6 +756,31 @@ static int is_refname_available(const char *refname, const char *oldrefname,
 	return 1;
 }
 
+/*
+ * The packed refs under one prefix, read from the ref tables to
+ * iterate over that prefix without reading all of them.
+ */
+struct packed_subset {
+	struct packed_subset *next;
+	struct ref_entry *refs;
+	char prefix[FLEX_ARRAY];
+};
+
+/* beyond this many prefixes, read all the packed refs instead */
+#define MAX_PACKED_SUBSETS 8
+
+/*
+ * A packed-refs file whose header says that it is sorted, mapped into
+ * memory so that a single ref, or the refs under a prefix, can be
+ * found by binary search without parsing the whole file.
+ */
+struct packed_refs_map {
+	char *map;
+	size_t size;
+	const char *start, *end;	/* the records, after the header */
+	int flag;			/* for the ref_entries made from it */
+};
+
 /*
  * Future: need to be in "struct repository"
  * when doing a full libification.
@@ -709,6 +789,16 @@ static struct ref_cache {
 	struct ref_cache *next;
 	struct ref_entry *loose;
 	struct ref_entry *packed;
+	/*
+	 * The ref tables holding the packed refs, when they are not
+	 * kept in packed-refs; see get_ref_table().
+	 */
+	struct ref_stack *table;
+	int table_checked;
+	/* packed-refs, when it is sorted; see get_packed_map() */
+	struct packed_refs_map *packed_map;
+	int packed_map_checked;
+	struct packed_subset *packed_subsets;
 	/* The submodule name, or "" for the main repo. */
 	char name[FLEX_ARRAY];
 } *ref_cache;
@@ -719,6 +809,21 @@ static void clear_packed_ref_cache(struct ref_cache *refs)
 		free_ref_entry(refs->packed);
 		refs->packed = NULL;
 	}
+	while (refs->packed_subsets) {
+		struct packed_subset *subset = refs->packed_subsets;
+		refs->packed_subsets = subset->next;
+		free_ref_entry(subset->refs);
+		free(subset);
+	}
+	ref_stack_close(refs->table);
+	refs->table = NULL;
+	refs->table_checked = 0;
+	if (refs->packed_map) {
+		munmap(refs->packed_map->map, refs->packed_map->size);
+		free(refs->packed_map);
+		refs->packed_map = NULL;
+	}
+	refs->packed_map_checked = 0;
 }
 
 static void clear_loose_ref_cache(struct ref_cache *refs)
@@ -838,13 +943,221 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 	}
 }
 
+/*
+ * Return the ref tables holding the packed refs of refs, or NULL if
+ * they are kept in the packed-refs file.
+ */
+static struct ref_stack *get_ref_table(struct ref_cache *refs)
+{
+	if (!refs->table_checked) {
+		if (*refs->name)
+			refs->table = ref_stack_open(git_path_submodule(refs->name, "reftable"));
+		else
+			refs->table = ref_stack_open(git_path("reftable"));
+		refs->table_checked = 1;
+	}
+	return refs->table;
+}
+
+static int table_ref_flag(const struct ref_record *rec)
+{
+	/* pack-refs peels the tags it packs, like in packed-refs */
+	if (rec->has_peeled || !prefixcmp(rec->refname, "refs/tags/"))
+		return REF_ISPACKED | REF_KNOWS_PEELED;
+	return REF_ISPACKED;
+}
+
+static int add_table_ref(const struct ref_record *rec, void *cb_data)
+{
+	struct ref_dir *dir = cb_data;
+	struct ref_entry *entry;
+
+	entry = create_ref_entry(rec->refname, rec->sha1,
+				 table_ref_flag(rec), 1);
+	if (rec->has_peeled)
+		hashcpy(entry->u.value.peeled, rec->peeled);
+	add_ref(dir, entry);
+	return 0;
+}
+
+/*
+ * Return packed-refs mapped into memory, or NULL if the packed refs
+ * are in ref tables, or packed-refs is missing or is not known to be
+ * sorted; it then has to be read as a whole.
+ */
+static struct packed_refs_map *get_packed_map(struct ref_cache *refs)
+{
+	static const char header[] = "# pack-refs with:";
+	struct packed_refs_map *m;
+	const char *path, *eol;
+	struct stat st;
+	size_t size;
+	char *map;
+	int fd;
+
+	if (refs->packed_map_checked)
+		return refs->packed_map;
+	refs->packed_map_checked = 1;
+	if (get_ref_table(refs))
+		return NULL;
+
+	if (*refs->name)
+		path = git_path_submodule(refs->name, "packed-refs");
+	else
+		path = git_path("packed-refs");
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	eol = memchr(map, '\n', size);
+	if (!eol || prefixcmp(map, header) || map[size - 1] != '\n' ||
+	    !memmem(map + strlen(header), eol - map - strlen(header) + 1,
+		    " sorted ", 8)) {
+		munmap(map, size);
+		return NULL;
+	}
+	m = xcalloc(1, sizeof(*m));
+	m->map = map;
+	m->size = size;
+	m->start = eol + 1;
+	m->end = map + size;
+	m->flag = REF_ISPACKED;
+	if (memmem(map + strlen(header), eol - map - strlen(header) + 1,
+		   " peeled ", 8))
+		m->flag |= REF_KNOWS_PEELED;
+	refs->packed_map = m;
+	return m;
+}
+
+struct packed_record {
+	const char *sha1_hex;
+	const char *peeled_hex;	/* or NULL */
+	const char *refname;	/* not NUL-terminated */
+	size_t len;
+};
+
+/*
+ * Parse the record at rec, i.e. a ref line and the peeled line that
+ * may follow it, and return the start of the next one.
+ */
+static const char *read_packed_record(const struct packed_refs_map *m,
+				      const char *rec, struct packed_record *r)
+{
+	const char *eol = memchr(rec, '\n', m->end - rec);
+
+	if (eol - rec < 42 || rec[40] != ' ')
+		die("unexpected line in packed-refs: %.*s",
+		    (int)(eol - rec), rec);
+	r->sha1_hex = rec;
+	r->refname = rec + 41;
+	r->len = eol - r->refname;
+	r->peeled_hex = NULL;
+	rec = eol + 1;
+	if (rec < m->end && *rec == '^') {
+		eol = memchr(rec, '\n', m->end - rec);
+		if (eol - rec != 41)
+			die("unexpected line in packed-refs: %.*s",
+			    (int)(eol - rec), rec);
+		r->peeled_hex = rec + 1;
+		rec = eol + 1;
+	}
+	return rec;
+}
+
+static int packed_record_cmp(const struct packed_record *r,
+			     const char *refname, size_t len)
+{
+	int cmp = memcmp(r->refname, refname, r->len < len ? r->len : len);
+	if (cmp)
+		return cmp;
+	return r->len < len ? -1 : r->len > len;
+}
+
+/* Return the first record whose refname is not before refname. */
+static const char *packed_lower_bound(const struct packed_refs_map *m,
+				      const char *refname)
+{
+	const char *lo = m->start, *hi = m->end;
+	size_t len = strlen(refname);
+
+	while (lo < hi) {
+		const char *rec = lo + (hi - lo) / 2, *next;
+		struct packed_record r;
+
+		/* back up to the start of the record around the middle */
+		while (rec > lo && rec[-1] != '\n')
+			rec--;
+		if (*rec == '^' && rec > lo)
+			for (rec--; rec > lo && rec[-1] != '\n'; rec--)
+				;
+		next = read_packed_record(m, rec, &r);
+		if (packed_record_cmp(&r, refname, len) < 0)
+			lo = next;
+		else
+			hi = rec;
+	}
+	return lo;
+}
+
+static void packed_record_value(const struct packed_record *r,
+				struct ref_record *rec)
+{
+	if (get_sha1_hex(r->sha1_hex, rec->sha1) ||
+	    (r->peeled_hex && get_sha1_hex(r->peeled_hex, rec->peeled)))
+		die("unexpected line in packed-refs: %.*s",
+		    (int)(r->refname + r->len - r->sha1_hex), r->sha1_hex);
+	rec->has_peeled = !!r->peeled_hex;
+	if (!rec->has_peeled)
+		hashclr(rec->peeled);
+	rec->deletion = 0;
+}
+
+/* Add the refs in packed-refs whose name starts with prefix to dir. */
+static void add_packed_map_refs(const struct packed_refs_map *m,
+				const char *prefix, struct ref_dir *dir)
+{
+	struct strbuf refname = STRBUF_INIT;
+	size_t prefixlen = strlen(prefix);
+	const char *p = packed_lower_bound(m, prefix);
+
+	while (p < m->end) {
+		struct packed_record r;
+		struct ref_record rec;
+		struct ref_entry *entry;
+
+		p = read_packed_record(m, p, &r);
+		if (r.len < prefixlen || memcmp(r.refname, prefix, prefixlen))
+			break;
+		packed_record_value(&r, &rec);
+		strbuf_reset(&refname);
+		strbuf_add(&refname, r.refname, r.len);
+		entry = create_ref_entry(refname.buf, rec.sha1, m->flag, 1);
+		hashcpy(entry->u.value.peeled, rec.peeled);
+		add_ref(dir, entry);
+	}
+	strbuf_release(&refname);
+}
+
 static struct ref_dir *get_packed_refs(struct ref_cache *refs)
 {
 	if (!refs->packed) {
 		const char *packed_refs_file;
+		struct ref_stack *table = get_ref_table(refs);
 		FILE *f;
 
 		refs->packed = create_dir_entry(refs, "", 0, 0);
+		if (table) {
+			ref_stack_for_each(table, "", add_table_ref,
+					   get_ref_dir(refs->packed));
+			return get_ref_dir(refs->packed);
+		}
 		if (*refs->name)
 			packed_refs_file = git_path_submodule(refs->name, "packed-refs");
 		else
@@ -858,6 +1171,157 @@ static struct ref_dir *get_packed_refs(struct ref_cache *refs)
 	return get_ref_dir(refs->packed);
 }
 
+/*
+ * Return the packed refs, of which only those whose name starts
+ * with prefix are of interest.  With ref tables or a sorted
+ * packed-refs file they are looked up without reading all the
+ * others, unless that was done already.
+ */
+static struct ref_dir *get_packed_refs_under(struct ref_cache *refs,
+					     const char *prefix)
+{
+	struct ref_stack *table = get_ref_table(refs);
+	struct packed_refs_map *map = get_packed_map(refs);
+	struct packed_subset *subset;
+	int len, nr = 0;
+
+	if ((!table && !map) || refs->packed || !*prefix)
+		return get_packed_refs(refs);
+	for (subset = refs->packed_subsets; subset; subset = subset->next) {
+		if (!strcmp(subset->prefix, prefix))
+			return get_ref_dir(subset->refs);
+		nr++;
+	}
+	if (nr >= MAX_PACKED_SUBSETS)
+		return get_packed_refs(refs);
+
+	len = strlen(prefix) + 1;
+	subset = xcalloc(1, sizeof(*subset) + len);
+	memcpy(subset->prefix, prefix, len);
+	subset->refs = create_dir_entry(refs, "", 0, 0);
+	if (table)
+		ref_stack_for_each(table, prefix, add_table_ref,
+				   get_ref_dir(subset->refs));
+	else
+		add_packed_map_refs(map, prefix, get_ref_dir(subset->refs));
+	subset->next = refs->packed_subsets;
+	refs->packed_subsets = subset;
+	return get_ref_dir(subset->refs);
+}
+
+/*
+ * Look refname up in the ref tables or the sorted packed-refs file of
+ * refs, unless all the packed refs have been read already.  Returns 0
+ * if found, filling rec and setting *flag (if not NULL) the way a
+ * ref_entry for it would be flagged, -1 if not found, and 1 if the
+ * caller should look in get_packed_refs() instead.
+ */
+static int read_packed_ref_directly(struct ref_cache *refs, const char *refname,
+				    struct ref_record *rec, int *flag)
+{
+	struct ref_stack *table = get_ref_table(refs);
+	struct packed_refs_map *map = get_packed_map(refs);
+	struct packed_record r;
+	const char *p;
+
+	if (refs->packed)
+		return 1;
+	if (table) {
+		if (ref_stack_read(table, refname, rec))
+			return -1;
+		if (flag) {
+			rec->refname = refname;
+			*flag = table_ref_flag(rec);
+		}
+		return 0;
+	}
+	if (!map)
+		return 1;
+	p = packed_lower_bound(map, refname);
+	if (p == map->end)
+		return -1;
+	read_packed_record(map, p, &r);
+	if (packed_record_cmp(&r, refname, strlen(refname)))
+		return -1;
+	packed_record_value(&r, rec);
+	if (flag)
+		*flag = map->flag;
+	return 0;
+}
+
+/*
+ * Return 1 and the name of the first packed ref under prefix in
+ * "found" if there is one, 0 if there is not, or -1 if that cannot be
+ * told without reading all the packed refs.
+ */
+static int find_packed_ref_under(struct ref_cache *refs, const char *prefix,
+				 struct strbuf *found);
+
+static int find_table_ref(const struct ref_record *rec, void *cb_data)
+{
+	struct strbuf *found = cb_data;
+
+	strbuf_reset(found);
+	strbuf_addstr(found, rec->refname);
+	return 1;
+}
+
+static int find_packed_ref_under(struct ref_cache *refs, const char *prefix,
+				 struct strbuf *found)
+{
+	struct ref_stack *table = get_ref_table(refs);
+	struct packed_refs_map *map = get_packed_map(refs);
+	struct packed_record r;
+	const char *p;
+
+	if (refs->packed)
+		return -1;
+	if (table)
+		return ref_stack_for_each(table, prefix, find_table_ref, found);
+	if (!map)
+		return -1;
+	p = packed_lower_bound(map, prefix);
+	if (p == map->end)
+		return 0;
+	read_packed_record(map, p, &r);
+	if (r.len < strlen(prefix) || prefixcmp(r.refname, prefix))
+		return 0;
+	strbuf_reset(found);
+	strbuf_add(found, r.refname, r.len);
+	return 1;
+}
+
+/*
+ * Like is_refname_available() for the packed refs of refs, but look
+ * the conflicting names up directly, if they can be, instead of
+ * reading all the packed refs.
+ */
+static int is_packed_refname_available(struct ref_cache *refs,
+				       const char *refname)
+{
+	struct strbuf name = STRBUF_INIT;
+	struct ref_record rec;
+	const char *slash;
+	int conflict;
+
+	strbuf_addf(&name, "%s/", refname);
+	conflict = find_packed_ref_under(refs, name.buf, &name);
+	if (conflict < 0) {
+		strbuf_release(&name);
+		return is_refname_available(refname, NULL, get_packed_refs(refs));
+	}
+	for (slash = strchr(refname, '/'); slash && !conflict;
+	     slash = strchr(slash + 1, '/')) {
+		strbuf_reset(&name);
+		strbuf_add(&name, refname, slash - refname);
+		conflict = !read_packed_ref_directly(refs, name.buf, &rec, NULL);
+	}
+	if (conflict)
+		error("'%s' exists; cannot create '%s'", name.buf, refname);
+	strbuf_release(&name);
+	return !conflict;
+}
+
 void add_packed_ref(const char *refname, const unsigned char *sha1)
 {
 	add_ref(get_packed_refs(get_ref_cache(NULL)),
@@ -963,8 +1427,16 @@ static int resolve_gitlink_packed_ref(struct ref_cache *refs,
 				      const char *refname, unsigned char *sha1)
 {
 	struct ref_entry *ref;
-	struct ref_dir *dir = get_packed_refs(refs);
+	struct ref_dir *dir;
+	struct ref_record rec;
+	int ret = read_packed_ref_directly(refs, refname, &rec, NULL);
 
+	if (ret <= 0) {
+		if (!ret)
+			hashcpy(sha1, rec.sha1);
+		return ret;
+	}
+	dir = get_packed_refs(refs);
 	ref = find_ref(dir, refname);
 	if (ref == NULL)
 		return -1;
@@ -1036,8 +1508,19 @@ int resolve_gitlink_ref(const char *path, const char *refname, unsigned char *sh
  */
 static int get_packed_ref(const char *refname, unsigned char *sha1)
 {
-	struct ref_dir *packed = get_packed_refs(get_ref_cache(NULL));
-	struct ref_entry *entry = find_ref(packed, refname);
+	struct ref_cache *refs = get_ref_cache(NULL);
+	struct ref_dir *packed;
+	struct ref_entry *entry;
+	struct ref_record rec;
+	int ret = read_packed_ref_directly(refs, refname, &rec, NULL);
+
+	if (ret <= 0) {
+		if (!ret)
+			hashcpy(sha1, rec.sha1);
+		return ret;
+	}
+	packed = get_packed_refs(refs);
+	entry = find_ref(packed, refname);
 	if (entry) {
 		hashcpy(sha1, entry->u.value.sha1);
 		return 0;
@@ -1213,8 +1696,20 @@ int peel_ref(const char *refname, unsigned char *sha1)
 		return -1;
 
 	if ((flag & REF_ISPACKED)) {
-		struct ref_dir *dir = get_packed_refs(get_ref_cache(NULL));
-		struct ref_entry *r = find_ref(dir, refname);
+		struct ref_cache *refs = get_ref_cache(NULL);
+		struct ref_record rec;
+		struct ref_entry *r;
+		int packed_flag;
+		int ret = read_packed_ref_directly(refs, refname, &rec,
+						   &packed_flag);
+
+		if (!ret && (packed_flag & REF_KNOWS_PEELED)) {
+			hashcpy(sha1, rec.peeled);
+			return 0;
+		}
+		if (ret <= 0)
+			goto fallback;
+		r = find_ref(get_packed_refs(refs), refname);
 
 		if (r != NULL && r->flag & REF_KNOWS_PEELED) {
 			hashcpy(sha1, r->u.value.peeled);
@@ -1273,7 +1768,7 @@ static int do_for_each_ref(const char *submodule, const char *base, each_ref_fn
 			   int trim, int flags, void *cb_data)
 {
 	struct ref_cache *refs = get_ref_cache(submodule);
-	struct ref_dir *packed_dir = get_packed_refs(refs);
+	struct ref_dir *packed_dir = get_packed_refs_under(refs, base ? base : "");
 	struct ref_dir *loose_dir = get_loose_refs(refs);
 	int retval = 0;
 
@@ -1346,6 +1841,11 @@ int for_each_ref_in(const char *prefix, each_ref_fn fn, void *cb_data)
 	return do_for_each_ref(NULL, prefix, fn, strlen(prefix), 0, cb_data);
 }
 
+int for_each_fullref_in(const char *prefix, each_ref_fn fn, void *cb_data)
+{
+	return do_for_each_ref(NULL, prefix, fn, 0, 0, cb_data);
+}
+
 int for_each_ref_in_submodule(const char *submodule, const char *prefix,
 		each_ref_fn fn, void *cb_data)
 {
@@ -1453,6 +1953,12 @@ int for_each_rawref(each_ref_fn fn, void *cb_data)
 			       DO_FOR_EACH_INCLUDE_BROKEN, cb_data);
 }
 
+int for_each_rawref_in(const char *prefix, each_ref_fn fn, void *cb_data)
+{
+	return do_for_each_ref(NULL, prefix, fn, 0,
+			       DO_FOR_EACH_INCLUDE_BROKEN, cb_data);
+}
+
 const char *prettify_refname(const char *name)
 {
 	return name + (
@@ -1472,6 +1978,18 @@ const char *ref_rev_parse_rules[] = {
 	NULL
 };
 
+void expand_ref_prefix(struct strbuf *prefixes, const char *name)
+{
+	const char **p;
+	int len = strlen(name);
+
+	for (p = ref_rev_parse_rules; *p; p++) {
+		if (prefixes->len)
+			strbuf_addch(prefixes, ' ');
+		strbuf_addf(prefixes, *p, len, name);
+	}
+}
+
 int refname_match(const char *abbrev_name, const char *full_name, const char **rules)
 {
 	const char **p;
@@ -1655,7 +2173,7 @@ static struct ref_lock *lock_ref_sha1_basic(const char *refname,
 	 * name is a proper prefix of our refname.
 	 */
 	if (missing &&
-	     !is_refname_available(refname, NULL, get_packed_refs(get_ref_cache(NULL)))) {
+	     !is_packed_refname_available(get_ref_cache(NULL), refname)) {
 		last_errno = ENOTDIR;
 		goto error_return;
 	}
@@ -1708,7 +2226,7 @@ struct ref_lock *lock_any_ref_for_update(const char *refname,
 }
 
 struct repack_without_ref_sb {
-	const char *refname;
+	struct string_list *refnames;
 	int fd;
 };
 
@@ -1719,7 +2237,7 @@ static int repack_without_ref_fn(const char *refname, const unsigned char *sha1,
 	char line[PATH_MAX + 100];
 	int len;
 
-	if (!strcmp(data->refname, refname))
+	if (string_list_has_string(data->refnames, refname))
 		return 0;
 	len = snprintf(line, sizeof(line), "%s %s\n",
 		       sha1_to_hex(sha1), refname);
@@ -1732,48 +2250,127 @@ static int repack_without_ref_fn(const char *refname, const unsigned char *sha1,
 
 static struct lock_file packlock;
 
-static int repack_without_ref(const char *refname)
+/*
+ * Delete refnames from the ref tables by stacking a table that only
+ * holds their deletion records on top of them.
+ */
+static int repack_table_without_refs(struct ref_stack *table,
+				     struct string_list *refnames)
+{
+	struct ref_record *recs;
+	char *dir;
+	int i, nr = 0, ret;
+
+	recs = xcalloc(refnames->nr, sizeof(*recs));
+	for (i = 0; i < refnames->nr; i++) {
+		if (ref_stack_read(table, refnames->items[i].string, &recs[nr]))
+			continue;
+		memset(&recs[nr], 0, sizeof(*recs));
+		recs[nr].refname = refnames->items[i].string;
+		recs[nr].deletion = 1;
+		nr++;
+	}
+	if (!nr) {
+		free(recs);
+		return 0;
+	}
+	if (hold_lock_file_for_update(&packlock, git_path("packed-refs"), 0) < 0) {
+		unable_to_lock_error(git_path("packed-refs"), errno);
+		ret = error("cannot delete '%s' from packed refs",
+			    recs[0].refname);
+		free(recs);
+		return ret;
+	}
+	dir = xstrdup(git_path("reftable"));
+	ret = ref_stack_add(dir, recs, nr);
+	free(dir);
+	free(recs);
+	rollback_lock_file(&packlock);
+	return ret;
+}
+
+/*
+ * Remove the sorted list of refnames from the packed refs, rewriting
+ * them at most once.  Names that are not packed are ignored.
+ */
+static int repack_without_refs(struct string_list *refnames)
 {
 	struct repack_without_ref_sb data;
-	struct ref_dir *packed = get_packed_refs(get_ref_cache(NULL));
-	if (find_ref(packed, refname) == NULL)
+	struct ref_cache *refs = get_ref_cache(NULL);
+	struct ref_stack *table = get_ref_table(refs);
+	struct ref_dir *packed;
+	int i;
+
+	if (table)
+		return repack_table_without_refs(table, refnames);
+	packed = get_packed_refs(refs);
+	for (i = 0; i < refnames->nr; i++)
+		if (find_ref(packed, refnames->items[i].string))
+			break;
+	if (i == refnames->nr)
 		return 0;
-	data.refname = refname;
+	data.refnames = refnames;
 	data.fd = hold_lock_file_for_update(&packlock, git_path("packed-refs"), 0);
 	if (data.fd < 0) {
 		unable_to_lock_error(git_path("packed-refs"), errno);
-		return error("cannot delete '%s' from packed refs", refname);
+		return error("cannot delete '%s' from packed refs",
+			     refnames->items[i].string);
 	}
+	/* the refs are written in order, but without their peeled values */
+	write_or_die(data.fd, "# pack-refs with: sorted \n", 26);
 	do_for_each_ref_in_dir(packed, 0, "", repack_without_ref_fn, 0, 0, &data);
 	return commit_lock_file(&packlock);
 }
 
+static int repack_without_ref(const char *refname)
+{
+	struct string_list refnames = STRING_LIST_INIT_NODUP;
+	int ret;
+
+	string_list_append(&refnames, refname);
+	ret = repack_without_refs(&refnames);
+	string_list_clear(&refnames, 0);
+	return ret;
+}
+
+/*
+ * Remove the loose file of the ref locked by lock, which had the
+ * given flag when it was locked.  The packed ref, if any, is left
+ * for the caller to remove.
+ */
+static int delete_ref_loose(struct ref_lock *lock, int flag, int delopt)
+{
+	const char *path;
+	int err, i = 0, ret = 0;
+
+	if ((flag & REF_ISPACKED) && !(flag & REF_ISSYMREF))
+		return 0;
+	if (!(delopt & REF_NODEREF)) {
+		i = strlen(lock->lk->filename) - 5; /* .lock */
+		lock->lk->filename[i] = 0;
+		path = lock->lk->filename;
+	} else {
+		path = git_path("%s", lock->orig_ref_name);
+	}
+	err = unlink_or_warn(path);
+	if (err && errno != ENOENT)
+		ret = 1;
+
+	if (!(delopt & REF_NODEREF))
+		lock->lk->filename[i] = '.';
+	return ret;
+}
+
 int delete_ref(const char *refname, const unsigned char *sha1, int delopt)
 {
 	struct ref_lock *lock;
-	int err, i = 0, ret = 0, flag = 0;
+	int ret = 0, flag = 0;
 
 	lock = lock_ref_sha1_basic(refname, sha1, 0, &flag);
 	if (!lock)
 		return 1;
-	if (!(flag & REF_ISPACKED) || flag & REF_ISSYMREF) {
-		/* loose */
-		const char *path;
-
-		if (!(delopt & REF_NODEREF)) {
-			i = strlen(lock->lk->filename) - 5; /* .lock */
-			lock->lk->filename[i] = 0;
-			path = lock->lk->filename;
-		} else {
-			path = git_path("%s", refname);
-		}
-		err = unlink_or_warn(path);
-		if (err && errno != ENOENT)
-			ret = 1;
+	ret |= delete_ref_loose(lock, flag, delopt);
 
-		if (!(delopt & REF_NODEREF))
-			lock->lk->filename[i] = '.';
-	}
 	/* removing the loose one could have resurrected an earlier
 	 * packed one.  Also, if it was not loose we need to repack
 	 * without it.
@@ -1786,6 +2383,147 @@ int delete_ref(const char *refname, const unsigned char *sha1, int delopt)
 	return ret;
 }
 
+static int ref_update_cmp(const void *a, const void *b)
+{
+	const struct ref_update *u1 = *(const struct ref_update **)a;
+	const struct ref_update *u2 = *(const struct ref_update **)b;
+	return strcmp(u1->ref_name, u2->ref_name);
+}
+
+int update_refs(const char *action, struct ref_update **updates_orig,
+		int n, int flags)
+{
+	struct ref_update **updates;
+	struct ref_lock **locks;
+	int *types;
+	struct string_list delnames = STRING_LIST_INIT_NODUP;
+	int i, ret = 0;
+
+	if (!n)
+		return 0;
+
+	/* Copy, sort, and reject duplicate refs */
+	updates = xmalloc(n * sizeof(*updates));
+	memcpy(updates, updates_orig, n * sizeof(*updates));
+	qsort(updates, n, sizeof(*updates), ref_update_cmp);
+	locks = xcalloc(n, sizeof(*locks));
+	types = xcalloc(n, sizeof(*types));
+	for (i = 0; i < n; i++)
+		updates[i]->error = NULL;
+	for (i = 1; i < n; i++) {
+		if (strcmp(updates[i - 1]->ref_name, updates[i]->ref_name))
+			continue;
+		error("Multiple updates for ref '%s' not allowed.",
+		      updates[i]->ref_name);
+		updates[i]->error = "multiple updates";
+		ret = -1;
+	}
+	if (ret && (flags & UPDATE_REFS_ATOMIC))
+		goto cleanup;
+
+	/* Lock all refs and verify their old values */
+	for (i = 0; i < n; i++) {
+		struct ref_update *u = updates[i];
+		int delete = is_null_sha1(u->new_sha1);
+
+		if (u->error)
+			continue;
+		if (!check_refname_format(u->ref_name, REFNAME_ALLOW_ONELEVEL))
+			locks[i] = lock_ref_sha1_basic(u->ref_name,
+						       u->have_old ? u->old_sha1 : NULL,
+						       delete ? 0 : u->flags,
+						       &types[i]);
+		/*
+		 * Do not keep one descriptor per ref open until the
+		 * write phase; a large batch would run out of them.
+		 */
+		if (locks[i] && close_ref(locks[i])) {
+			error("Couldn't close %s", locks[i]->lk->filename);
+			unlock_ref(locks[i]);
+			locks[i] = NULL;
+		}
+		if (!locks[i]) {
+			u->error = "failed to lock";
+			ret = -1;
+			if (flags & UPDATE_REFS_ATOMIC)
+				goto cleanup;
+		}
+	}
+
+	/* Write the new values; write_ref_sha1() releases the locks */
+	for (i = 0; i < n; i++) {
+		struct ref_update *u = updates[i];
+
+		if (!locks[i] || is_null_sha1(u->new_sha1))
+			continue;
+		locks[i]->lock_fd = reopen_lock_file(locks[i]->lk);
+		if (locks[i]->lock_fd < 0) {
+			error("Couldn't reopen %s: %s",
+			      locks[i]->lk->filename, strerror(errno));
+			u->error = "failed to write";
+			ret = -1;
+			unlock_ref(locks[i]);
+		} else if (write_ref_sha1(locks[i], u->new_sha1, action)) {
+			u->error = "failed to write";
+			ret = -1;
+		}
+		locks[i] = NULL;
+	}
+
+	/* Delete the loose refs, then all packed ones at once */
+	for (i = 0; i < n; i++) {
+		if (!locks[i])
+			continue;
+		if (delete_ref_loose(locks[i], types[i], updates[i]->flags)) {
+			updates[i]->error = "failed to delete";
+			ret = -1;
+		}
+		string_list_insert(&delnames, locks[i]->ref_name);
+	}
+	if (delnames.nr) {
+		if (repack_without_refs(&delnames)) {
+			for (i = 0; i < n; i++)
+				if (locks[i])
+					updates[i]->error = "failed to delete";
+			ret = -1;
+		}
+		for (i = 0; i < n; i++)
+			if (locks[i])
+				unlink_or_warn(git_path("logs/%s", locks[i]->ref_name));
+		invalidate_ref_cache(NULL);
+	}
+
+cleanup:
+	for (i = 0; i < n; i++)
+		if (locks[i])
+			unlock_ref(locks[i]);
+	string_list_clear(&delnames, 0);
+	free(types);
+	free(locks);
+	free(updates);
+	return ret;
+}
+
+int delete_refs(const char **refnames, int n)
+{
+	struct ref_update *updates, **update_ptrs;
+	int i, ret;
+
+	updates = xcalloc(n, sizeof(*updates));
+	update_ptrs = xmalloc(n * sizeof(*update_ptrs));
+	for (i = 0; i < n; i++) {
+		updates[i].ref_name = refnames[i];
+		update_ptrs[i] = &updates[i];
+	}
+	ret = update_refs(NULL, update_ptrs, n, 0) ? 1 : 0;
+	for (i = 0; i < n; i++)
+		if (updates[i].error)
+			error("%s: %s", updates[i].ref_name, updates[i].error);
+	free(update_ptrs);
+	free(updates);
+	return ret;
+}
+
 /*
  * People using contrib's git-new-workdir have .git/logs/refs ->
  * /some/other/path/.git/logs/refs, and that may live on another device.
@@ -2184,84 +2922,171 @@ static char *ref_msg(const char *line, const char *endp)
 	return xmemdupz(line, ep - line);
 }
 
+static const char *reflog_next_record(const char *rec, const char *logend)
+{
+	const char *eol = memchr(rec, '\n', logend - rec);
+	return eol ? eol + 1 : logend;
+}
+
+static const char *reflog_prev_record(const char *logdata, const char *rec)
+{
+	if (logdata < rec && rec[-1] == '\n')
+		rec--;
+	while (logdata < rec && rec[-1] != '\n')
+		rec--;
+	return rec;
+}
+
+static int count_reflog_records(const char *rec, const char *logend)
+{
+	int nr;
+
+	for (nr = 0; rec < logend; nr++)
+		rec = reflog_next_record(rec, logend);
+	return nr;
+}
+
+/*
+ * Find the last record of the reflog data between logdata and logend
+ * that is not newer than at_time.  Records are appended in time
+ * order, so this is a binary search.  Sets *found to its start, or
+ * to NULL if all records are newer, and returns 0; returns -1 if a
+ * record without a date was met.
+ */
+static int find_reflog_by_date(const char *logdata, const char *logend,
+			       unsigned long at_time, const char **found)
+{
+	const char *lo = logdata, *hi = logend;
+
+	*found = NULL;
+	while (lo < hi) {
+		const char *rec = lo + (hi - lo) / 2;
+		const char *next, *gt;
+
+		while (lo < rec && rec[-1] != '\n')
+			rec--;
+		next = reflog_next_record(rec, logend);
+		gt = memchr(rec, '>', next - rec);
+		if (!gt)
+			return -1;
+		if (strtoul(gt + 1, NULL, 10) <= at_time) {
+			*found = rec;
+			lo = next;
+		} else {
+			hi = rec;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Map the whole reflog file.  Returns -1 if it cannot be opened;
+ * otherwise returns 0 with *map set to NULL if it is empty.
+ */
+static int map_reflog(const char *logfile, void **map, size_t *mapsz)
+{
+	struct stat st;
+	int logfd;
+
+	*map = NULL;
+	*mapsz = 0;
+	logfd = open(logfile, O_RDONLY, 0);
+	if (logfd < 0)
+		return -1;
+	if (!fstat(logfd, &st) && st.st_size) {
+		*mapsz = xsize_t(st.st_size);
+		*map = xmmap(NULL, *mapsz, PROT_READ, MAP_PRIVATE, logfd, 0);
+	}
+	close(logfd);
+	return 0;
+}
+
 int read_ref_at(const char *refname, unsigned long at_time, int cnt,
 		unsigned char *sha1, char **msg,
 		unsigned long *cutoff_time, int *cutoff_tz, int *cutoff_cnt)
 {
 	const char *logfile, *logdata, *logend, *rec, *lastgt, *lastrec;
 	char *tz_c;
-	int logfd, tz, reccnt = 0;
-	struct stat st;
+	int tz, reccnt = 0;
 	unsigned long date;
 	unsigned char logged_sha1[20];
 	void *log_mapped;
 	size_t mapsz;
 
 	logfile = git_path("logs/%s", refname);
-	logfd = open(logfile, O_RDONLY, 0);
-	if (logfd < 0)
+	if (map_reflog(logfile, &log_mapped, &mapsz))
 		die_errno("Unable to read log '%s'", logfile);
-	fstat(logfd, &st);
-	if (!st.st_size)
+	if (!log_mapped)
 		die("Log %s is empty.", logfile);
-	mapsz = xsize_t(st.st_size);
-	log_mapped = xmmap(NULL, mapsz, PROT_READ, MAP_PRIVATE, logfd, 0);
 	logdata = log_mapped;
-	close(logfd);
+	logend = logdata + mapsz;
 
 	lastrec = NULL;
-	rec = logend = logdata + st.st_size;
-	while (logdata < rec) {
-		reccnt++;
-		if (logdata < rec && *(rec-1) == '\n')
-			rec--;
-		lastgt = NULL;
-		while (logdata < rec && *(rec-1) != '\n') {
-			rec--;
-			if (*rec == '>')
-				lastgt = rec;
+	rec = NULL;
+	if (cnt < 0) {
+		/* by date */
+		if (find_reflog_by_date(logdata, logend, at_time, &rec))
+			die("Log %s is corrupt.", logfile);
+		if (rec) {
+			lastrec = reflog_next_record(rec, logend);
+			if (lastrec == logend)
+				lastrec = NULL;
 		}
+		if (cutoff_cnt)
+			reccnt = count_reflog_records(rec ? rec : logdata, logend);
+	} else {
+		/* by count, from the end */
+		const char *cur = logend;
+		while (logdata < cur) {
+			const char *prev = reflog_prev_record(logdata, cur);
+			reccnt++;
+			if (!cnt--) {
+				rec = prev;
+				break;
+			}
+			lastrec = prev;
+			cur = prev;
+		}
+	}
+
+	if (rec) {
+		lastgt = memchr(rec, '>', reflog_next_record(rec, logend) - rec);
 		if (!lastgt)
 			die("Log %s is corrupt.", logfile);
 		date = strtoul(lastgt + 1, &tz_c, 10);
-		if (date <= at_time || cnt == 0) {
-			tz = strtoul(tz_c, NULL, 10);
-			if (msg)
-				*msg = ref_msg(rec, logend);
-			if (cutoff_time)
-				*cutoff_time = date;
-			if (cutoff_tz)
-				*cutoff_tz = tz;
-			if (cutoff_cnt)
-				*cutoff_cnt = reccnt - 1;
-			if (lastrec) {
-				if (get_sha1_hex(lastrec, logged_sha1))
-					die("Log %s is corrupt.", logfile);
-				if (get_sha1_hex(rec + 41, sha1))
-					die("Log %s is corrupt.", logfile);
-				if (hashcmp(logged_sha1, sha1)) {
-					warning("Log %s has gap after %s.",
-						logfile, show_date(date, tz, DATE_RFC2822));
-				}
-			}
-			else if (date == at_time) {
-				if (get_sha1_hex(rec + 41, sha1))
-					die("Log %s is corrupt.", logfile);
+		tz = strtoul(tz_c, NULL, 10);
+		if (msg)
+			*msg = ref_msg(rec, logend);
+		if (cutoff_time)
+			*cutoff_time = date;
+		if (cutoff_tz)
+			*cutoff_tz = tz;
+		if (cutoff_cnt)
+			*cutoff_cnt = reccnt - 1;
+		if (lastrec) {
+			if (get_sha1_hex(lastrec, logged_sha1))
+				die("Log %s is corrupt.", logfile);
+			if (get_sha1_hex(rec + 41, sha1))
+				die("Log %s is corrupt.", logfile);
+			if (hashcmp(logged_sha1, sha1)) {
+				warning("Log %s has gap after %s.",
+					logfile, show_date(date, tz, DATE_RFC2822));
 			}
-			else {
-				if (get_sha1_hex(rec + 41, logged_sha1))
-					die("Log %s is corrupt.", logfile);
-				if (hashcmp(logged_sha1, sha1)) {
-					warning("Log %s unexpectedly ended on %s.",
-						logfile, show_date(date, tz, DATE_RFC2822));
-				}
+		}
+		else if (date == at_time) {
+			if (get_sha1_hex(rec + 41, sha1))
+				die("Log %s is corrupt.", logfile);
+		}
+		else {
+			if (get_sha1_hex(rec + 41, logged_sha1))
+				die("Log %s is corrupt.", logfile);
+			if (hashcmp(logged_sha1, sha1)) {
+				warning("Log %s unexpectedly ended on %s.",
+					logfile, show_date(date, tz, DATE_RFC2822));
 			}
-			munmap(log_mapped, mapsz);
-			return 0;
 		}
-		lastrec = rec;
-		if (cnt > 0)
-			cnt--;
+		munmap(log_mapped, mapsz);
+		return 0;
 	}
 
 	rec = logdata;
@@ -2290,11 +3115,42 @@ int read_ref_at(const char *refname, unsigned long at_time, int cnt,
 	return 1;
 }
 
-int for_each_recent_reflog_ent(const char *refname, each_reflog_ent_fn fn, long ofs, void *cb_data)
+long reflog_offset_by_date(const char *refname, unsigned long timestamp)
+{
+	const char *logdata, *rec;
+	void *log_mapped;
+	size_t mapsz;
+	long ofs;
+
+	if (map_reflog(git_path("logs/%s", refname), &log_mapped, &mapsz))
+		return -1;
+	if (!log_mapped)
+		return 0;
+	logdata = log_mapped;
+	if (!timestamp)
+		ofs = 0;
+	else if (find_reflog_by_date(logdata, logdata + mapsz, timestamp - 1, &rec))
+		ofs = -1;
+	else if (!rec)
+		ofs = 0;
+	else
+		ofs = reflog_next_record(rec, logdata + mapsz) - logdata;
+	munmap(log_mapped, mapsz);
+	return ofs;
+}
+
+/*
+ * Call fn for the entries of the reflog, starting with the first
+ * complete one in the last ofs bytes (or the first one if ofs is 0),
+ * and stopping before the one at offset end if end is not negative.
+ */
+static int do_for_each_reflog_ent(const char *refname, each_reflog_ent_fn fn,
+				  long ofs, long end, void *cb_data)
 {
 	const char *logfile;
 	FILE *logfp;
 	struct strbuf sb = STRBUF_INIT;
+	long pos = 0;
 	int ret = 0;
 
 	logfile = git_path("logs/%s", refname);
@@ -2312,14 +3168,18 @@ int for_each_recent_reflog_ent(const char *refname, each_reflog_ent_fn fn, long
 			strbuf_release(&sb);
 			return -1;
 		}
+		pos = statbuf.st_size - ofs + sb.len;
 	}
 
-	while (!strbuf_getwholeline(&sb, logfp, '\n')) {
+	while ((end < 0 || pos < end) &&
+	       !strbuf_getwholeline(&sb, logfp, '\n')) {
 		unsigned char osha1[20], nsha1[20];
 		char *email_end, *message;
 		unsigned long timestamp;
 		int tz;
 
+		pos += sb.len;
+
 		/* old SP new SP name <email> SP time TAB msg LF */
 		if (sb.len < 83 || sb.buf[sb.len - 1] != '\n' ||
 		    get_sha1_hex(sb.buf, osha1) || sb.buf[40] != ' ' ||
@@ -2348,9 +3208,20 @@ int for_each_recent_reflog_ent(const char *refname, each_reflog_ent_fn fn, long
 	return ret;
 }
 
+int for_each_recent_reflog_ent(const char *refname, each_reflog_ent_fn fn, long ofs, void *cb_data)
+{
+	return do_for_each_reflog_ent(refname, fn, ofs, -1, cb_data);
+}
+
 int for_each_reflog_ent(const char *refname, each_reflog_ent_fn fn, void *cb_data)
 {
-	return for_each_recent_reflog_ent(refname, fn, 0, cb_data);
+	return do_for_each_reflog_ent(refname, fn, 0, -1, cb_data);
+}
+
+int for_each_reflog_ent_before(const char *refname, long end,
+			       each_reflog_ent_fn fn, void *cb_data)
+{
+	return do_for_each_reflog_ent(refname, fn, 0, end, cb_data);
 }
 
 /*
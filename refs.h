@@ -25,6 +25,7 @@ typedef int each_ref_fn(const char *refname, const unsigned char *sha1, int flag
 extern int head_ref(each_ref_fn, void *);
 extern int for_each_ref(each_ref_fn, void *);
 extern int for_each_ref_in(const char *, each_ref_fn, void *);
+extern int for_each_fullref_in(const char *, each_ref_fn, void *);
 extern int for_each_tag_ref(each_ref_fn, void *);
 extern int for_each_branch_ref(each_ref_fn, void *);
 extern int for_each_remote_ref(each_ref_fn, void *);
@@ -50,6 +51,7 @@ static inline const char *has_glob_specials(const char *pattern)
 
 /* can be used to learn about broken ref and symref */
 extern int for_each_rawref(each_ref_fn, void *);
+extern int for_each_rawref_in(const char *prefix, each_ref_fn, void *);
 
 extern void warn_dangling_symref(FILE *fp, const char *msg_fmt, const char *refname);
 
@@ -104,6 +106,16 @@ extern int read_ref_at(const char *refname, unsigned long at_time, int cnt,
 typedef int each_reflog_ent_fn(unsigned char *osha1, unsigned char *nsha1, const char *, unsigned long, int, const char *, void *);
 int for_each_reflog_ent(const char *refname, each_reflog_ent_fn fn, void *cb_data);
 int for_each_recent_reflog_ent(const char *refname, each_reflog_ent_fn fn, long, void *cb_data);
+/* iterate over the reflog entries before the byte offset end */
+int for_each_reflog_ent_before(const char *refname, long end, each_reflog_ent_fn fn, void *cb_data);
+
+/*
+ * Return the offset of the first entry in the reflog of refname that
+ * is not older than timestamp (the size of the log if there is none),
+ * found by binary search since entries are appended in time order.
+ * Returns -1 if the log cannot be read or has an entry without a date.
+ */
+extern long reflog_offset_by_date(const char *refname, unsigned long timestamp);
 
 /*
  * Calls the specified function for each reflog file until it returns nonzero,
@@ -141,6 +153,42 @@ extern int rename_ref(const char *oldref, const char *newref, const char *logmsg
  */
 extern int resolve_gitlink_ref(const char *path, const char *refname, unsigned char *sha1);
 
+/*
+ * One update in a batch given to update_refs().  A null new_sha1
+ * deletes the ref.  If have_old is set, the ref must currently have
+ * the value old_sha1, or not exist if that is null.  flags can be
+ * REF_NODEREF.  update_refs() sets error to a short description
+ * when the update could not be done.
+ */
+struct ref_update {
+	const char *ref_name;
+	unsigned char new_sha1[20];
+	unsigned char old_sha1[20];
+	int flags;
+	int have_old;
+	const char *error;
+};
+
+#define UPDATE_REFS_ATOMIC 0x01
+
+/*
+ * Update a batch of refs: lock them all and verify their old values
+ * first, then write the new values, and remove all the deleted refs
+ * from the packed refs with a single rewrite.  Returns 0 if every
+ * update was done, or -1 after setting the error of those that were
+ * not.  With UPDATE_REFS_ATOMIC, nothing is changed unless all refs
+ * could be locked and verified.  A ref may only appear once.
+ */
+extern int update_refs(const char *action, struct ref_update **updates,
+		       int n, int flags);
+
+/*
+ * Delete the n refs in refnames as one non-atomic batch, reporting
+ * those that could not be deleted.  Like delete_ref(), returns 0 if
+ * all were deleted and 1 otherwise.
+ */
+extern int delete_refs(const char **refnames, int n);
+
 /** lock a ref and then write its file */
 enum action_on_err { MSG_ON_ERR, DIE_ON_ERR, QUIET_ON_ERR };
 int update_ref(const char *action, const char *refname,
@@ -0,0 +1,857 @@
+/*
+ * reftable.c: packed refs kept in a stack of binary tables
+ *
+ * A table file looks like this (integers are in network byte order,
+ * "varint" is the encoding of varint.c):
+ *
+ *   header: "RTBL", a version byte (1) and three reserved zero bytes
+ *   ref blocks
+ *   index block, only if there is more than one ref block
+ *   footer: the header again, the 8-byte offset of the index block
+ *           (0 if there is none) and the CRC32 of these 16 bytes
+ *
+ * A block is a type byte ('r' for refs, 'i' for the index), its 4-byte
+ * total length, the records, the 4-byte offsets (from the start of the
+ * block) of its restart points and finally the 4-byte number of restart
+ * points.  A record is
+ *
+ *   varint   length of the prefix shared with the previous key
+ *   varint   (length of the rest of the key) << 2 | value type
+ *            the rest of the key
+ *            the value
+ *
+ * A record at a restart point shares nothing with the previous key, so
+ * a reader binary searches the restart points and scans forward from
+ * there.  The value of a ref record is nothing for a deletion (type 0),
+ * a sha1 (type 1) or a sha1 followed by the peeled sha1 of an annotated
+ * tag (type 2).  The index has one record per ref block, keyed by the
+ * last refname in the block, whose value is the varint offset of the
+ * block; every index record is a restart point.
+ */
+
+#include "cache.h"
+#include "reftable.h"
+#include "varint.h"
+#include "string-list.h"
+
+#define TABLE_SIGNATURE "RTBL"
+#define TABLE_VERSION 1
+#define TABLE_HEADER_SIZE 8
+#define TABLE_FOOTER_SIZE 20
+#define TABLE_BLOCK_SIZE 4096
+#define TABLE_RESTART_INTERVAL 16
+
+#define REF_DELETION 0
+#define REF_VALUE 1
+#define REF_VALUE_PEELED 2
+
+/*
+ * The topmost tables of the stack are merged as long as the table
+ * below them is at most this many times as large as all of them
+ * together; this keeps the stack logarithmic in depth while most
+ * updates only rewrite a few small tables.
+ */
+#define COMPACTION_FACTOR 2
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, 4);
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+struct block_writer {
+	struct strbuf buf;	/* the whole table so far */
+	size_t start;		/* offset of the current block in buf */
+	uint32_t *restart;
+	int restart_nr, restart_alloc;
+	int entries;		/* records in the current block */
+	struct strbuf last;	/* key of the previous record */
+};
+
+static void block_begin(struct block_writer *w, char type)
+{
+	w->start = w->buf.len;
+	strbuf_addch(&w->buf, type);
+	strbuf_add(&w->buf, "\0\0\0\0", 4);
+	w->restart_nr = 0;
+	w->entries = 0;
+	strbuf_reset(&w->last);
+}
+
+static size_t block_size(struct block_writer *w)
+{
+	return w->buf.len - w->start + 4 * (w->restart_nr + 1);
+}
+
+static void block_add(struct block_writer *w, const char *key, int type,
+		      const unsigned char *value, size_t value_len,
+		      int restart)
+{
+	size_t keylen = strlen(key), prefix = 0;
+	unsigned char varint[16];
+
+	if (restart || !(w->entries % TABLE_RESTART_INTERVAL)) {
+		ALLOC_GROW(w->restart, w->restart_nr + 1, w->restart_alloc);
+		w->restart[w->restart_nr++] = w->buf.len - w->start;
+	} else {
+		while (prefix < w->last.len && prefix < keylen &&
+		       w->last.buf[prefix] == key[prefix])
+			prefix++;
+	}
+	w->entries++;
+	strbuf_add(&w->buf, varint, encode_varint(prefix, varint));
+	strbuf_add(&w->buf, varint,
+		   encode_varint((keylen - prefix) << 2 | type, varint));
+	strbuf_add(&w->buf, key + prefix, keylen - prefix);
+	strbuf_add(&w->buf, value, value_len);
+	strbuf_reset(&w->last);
+	strbuf_add(&w->last, key, keylen);
+}
+
+static void block_finish(struct block_writer *w)
+{
+	unsigned char be[4];
+	int i;
+
+	for (i = 0; i < w->restart_nr; i++) {
+		put_be32(be, w->restart[i]);
+		strbuf_add(&w->buf, be, 4);
+	}
+	put_be32(be, w->restart_nr);
+	strbuf_add(&w->buf, be, 4);
+	put_be32((unsigned char *)w->buf.buf + w->start + 1,
+		 w->buf.len - w->start);
+}
+
+struct index_entry {
+	char *last;
+	size_t offset;
+};
+
+static void encode_table(struct strbuf *out,
+			 const struct ref_record *recs, int nr)
+{
+	struct block_writer w;
+	struct index_entry *index = NULL;
+	int index_nr = 0, index_alloc = 0, i;
+	unsigned char header[TABLE_HEADER_SIZE], footer[TABLE_FOOTER_SIZE];
+	uint64_t index_offset = 0;
+
+	memset(&w, 0, sizeof(w));
+	strbuf_init(&w.buf, 0);
+	strbuf_init(&w.last, 0);
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, TABLE_SIGNATURE, 4);
+	header[4] = TABLE_VERSION;
+	strbuf_add(&w.buf, header, sizeof(header));
+
+	block_begin(&w, 'r');
+	for (i = 0; i < nr; i++) {
+		const struct ref_record *r = &recs[i];
+		unsigned char value[40];
+		size_t value_len = 0;
+		int type = REF_DELETION;
+
+		if (i && strcmp(recs[i - 1].refname, r->refname) >= 0)
+			die("BUG: ref table records out of order at '%s'",
+			    r->refname);
+		if (!r->deletion) {
+			hashcpy(value, r->sha1);
+			value_len = 20;
+			type = REF_VALUE;
+			if (r->has_peeled) {
+				hashcpy(value + 20, r->peeled);
+				value_len = 40;
+				type = REF_VALUE_PEELED;
+			}
+		}
+		if (w.entries &&
+		    block_size(&w) + strlen(r->refname) + value_len + 24 >
+		    TABLE_BLOCK_SIZE) {
+			ALLOC_GROW(index, index_nr + 1, index_alloc);
+			index[index_nr].last = xstrdup(w.last.buf);
+			index[index_nr++].offset = w.start;
+			block_finish(&w);
+			block_begin(&w, 'r');
+		}
+		block_add(&w, r->refname, type, value, value_len, 0);
+	}
+	if (index_nr) {
+		ALLOC_GROW(index, index_nr + 1, index_alloc);
+		index[index_nr].last = xstrdup(w.last.buf);
+		index[index_nr++].offset = w.start;
+	}
+	block_finish(&w);
+
+	if (index_nr > 1) {
+		index_offset = w.buf.len;
+		block_begin(&w, 'i');
+		for (i = 0; i < index_nr; i++) {
+			unsigned char varint[16];
+			block_add(&w, index[i].last, 0, varint,
+				  encode_varint(index[i].offset, varint), 1);
+		}
+		block_finish(&w);
+	}
+	for (i = 0; i < index_nr; i++)
+		free(index[i].last);
+	free(index);
+
+	memcpy(footer, header, sizeof(header));
+	put_be32(footer + 8, index_offset >> 32);
+	put_be32(footer + 12, index_offset & 0xffffffff);
+	put_be32(footer + 16, crc32(0, footer, 16));
+	strbuf_add(&w.buf, footer, sizeof(footer));
+
+	strbuf_release(&w.last);
+	free(w.restart);
+	strbuf_swap(out, &w.buf);
+	strbuf_release(&w.buf);
+}
+
+struct ref_table {
+	char *name;
+	const unsigned char *map;
+	size_t size;
+	size_t refs_end;	/* end of the ref blocks */
+	size_t index_offset;	/* or 0 */
+};
+
+struct ref_stack {
+	int nr, alloc;
+	struct ref_table *table;	/* oldest first */
+};
+
+static NORETURN void corrupt_table(const struct ref_table *t)
+{
+	die("ref table '%s' is corrupt", t->name);
+}
+
+/* Returns -1 if the table does not exist; dies if it is not usable. */
+static int open_table(struct ref_table *t, const char *dir, const char *name)
+{
+	struct strbuf path = STRBUF_INIT;
+	const unsigned char *footer;
+	struct stat st;
+	int fd;
+
+	strbuf_addf(&path, "%s/%s", dir, name);
+	fd = open(path.buf, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			strbuf_release(&path);
+			return -1;
+		}
+		die_errno("unable to open ref table '%s'", path.buf);
+	}
+	if (fstat(fd, &st))
+		die_errno("unable to stat ref table '%s'", path.buf);
+	t->name = strbuf_detach(&path, NULL);
+	t->size = xsize_t(st.st_size);
+	if (t->size < TABLE_HEADER_SIZE + TABLE_FOOTER_SIZE)
+		corrupt_table(t);
+	t->map = xmmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	footer = t->map + t->size - TABLE_FOOTER_SIZE;
+	if (memcmp(t->map, TABLE_SIGNATURE, 4) ||
+	    t->map[4] != TABLE_VERSION ||
+	    memcmp(footer, t->map, TABLE_HEADER_SIZE) ||
+	    crc32(0, footer, 16) != get_be32(footer + 16))
+		corrupt_table(t);
+	t->index_offset = ((uint64_t)get_be32(footer + 8) << 32) |
+		get_be32(footer + 12);
+	t->refs_end = t->index_offset ?
+		t->index_offset : t->size - TABLE_FOOTER_SIZE;
+	if (t->refs_end <= TABLE_HEADER_SIZE ||
+	    t->refs_end > t->size - TABLE_FOOTER_SIZE)
+		corrupt_table(t);
+	return 0;
+}
+
+static void release_tables(struct ref_stack *st)
+{
+	int i;
+
+	for (i = 0; i < st->nr; i++) {
+		munmap((void *)st->table[i].map, st->table[i].size);
+		free(st->table[i].name);
+	}
+	free(st->table);
+	st->table = NULL;
+	st->nr = st->alloc = 0;
+}
+
+static int load_tables(struct ref_stack *st, const char *dir,
+		       const struct string_list *names)
+{
+	int i;
+
+	for (i = 0; i < names->nr; i++) {
+		ALLOC_GROW(st->table, st->nr + 1, st->alloc);
+		if (open_table(&st->table[st->nr], dir,
+			       names->items[i].string)) {
+			release_tables(st);
+			return -1;
+		}
+		st->nr++;
+	}
+	return 0;
+}
+
+/* Returns -1 if there is no stack in dir. */
+static int read_table_list(const char *dir, struct string_list *names)
+{
+	struct strbuf buf = STRBUF_INIT, path = STRBUF_INIT;
+	char *line, *eol;
+
+	strbuf_addf(&path, "%s/tables.list", dir);
+	if (strbuf_read_file(&buf, path.buf, 0) < 0) {
+		if (errno == ENOENT) {
+			strbuf_release(&buf);
+			strbuf_release(&path);
+			return -1;
+		}
+		die_errno("unable to read '%s'", path.buf);
+	}
+	strbuf_release(&path);
+	for (line = buf.buf; *line; line = eol) {
+		eol = strchrnul(line, '\n');
+		if (*eol)
+			*eol++ = '\0';
+		if (*line)
+			string_list_append(names, line);
+	}
+	strbuf_release(&buf);
+	return 0;
+}
+
+struct ref_stack *ref_stack_open(const char *dir)
+{
+	struct ref_stack *st = xcalloc(1, sizeof(*st));
+	int tries;
+
+	for (tries = 0; tries < 5; tries++) {
+		struct string_list names = STRING_LIST_INIT_DUP;
+		int ret;
+
+		if (read_table_list(dir, &names)) {
+			free(st);
+			return NULL;
+		}
+		ret = load_tables(st, dir, &names);
+		string_list_clear(&names, 0);
+		if (!ret)
+			return st;
+		/* a table went away; somebody compacted the stack */
+	}
+	die("unable to read the ref tables in '%s'", dir);
+}
+
+void ref_stack_close(struct ref_stack *st)
+{
+	if (!st)
+		return;
+	release_tables(st);
+	free(st);
+}
+
+struct block {
+	size_t start, records_end, end;
+	const unsigned char *restart;
+	uint32_t restart_nr;
+};
+
+static void read_block(const struct ref_table *t, size_t off, size_t limit,
+		       int type, struct block *b)
+{
+	uint32_t len;
+
+	if (off + 5 > limit || t->map[off] != type)
+		corrupt_table(t);
+	len = get_be32(t->map + off + 1);
+	if (len < 9 || len > limit - off)
+		corrupt_table(t);
+	b->start = off;
+	b->end = off + len;
+	b->restart_nr = get_be32(t->map + b->end - 4);
+	if (b->restart_nr > (len - 9) / 4)
+		corrupt_table(t);
+	b->records_end = b->end - 4 - 4 * b->restart_nr;
+	b->restart = t->map + b->records_end;
+}
+
+/*
+ * Decode the key of the record at *pos on top of the previous key in
+ * "key", and return the value type, leaving *pos at the value.
+ */
+static int decode_key(const struct ref_table *t, const struct block *b,
+		      size_t *pos, struct strbuf *key)
+{
+	const unsigned char *p = t->map + *pos;
+	const unsigned char *end = t->map + b->records_end;
+	uintmax_t prefix, suffix;
+	int type;
+
+	prefix = decode_varint(&p);
+	suffix = decode_varint(&p);
+	type = suffix & 3;
+	suffix >>= 2;
+	if (p > end || prefix > key->len || suffix > end - p)
+		corrupt_table(t);
+	strbuf_setlen(key, prefix);
+	strbuf_add(key, p, suffix);
+	*pos = p + suffix - t->map;
+	return type;
+}
+
+static void decode_ref_value(const struct ref_table *t, const struct block *b,
+			     size_t *pos, int type, struct ref_record *rec)
+{
+	size_t len = type == REF_VALUE_PEELED ? 40 : type == REF_VALUE ? 20 : 0;
+
+	if (type > REF_VALUE_PEELED || len > b->records_end - *pos)
+		corrupt_table(t);
+	rec->deletion = type == REF_DELETION;
+	rec->has_peeled = type == REF_VALUE_PEELED;
+	if (len)
+		hashcpy(rec->sha1, t->map + *pos);
+	else
+		hashclr(rec->sha1);
+	if (rec->has_peeled)
+		hashcpy(rec->peeled, t->map + *pos + 20);
+	else
+		hashclr(rec->peeled);
+	*pos += len;
+}
+
+struct table_iter {
+	const struct ref_table *t;
+	struct block b;
+	size_t pos;
+	int done;
+	int valid;		/* rec holds the current record */
+	struct strbuf key;
+	struct ref_record rec;
+};
+
+static void iter_init(struct table_iter *it, const struct ref_table *t)
+{
+	memset(it, 0, sizeof(*it));
+	it->t = t;
+	strbuf_init(&it->key, 0);
+}
+
+static int iter_next(struct table_iter *it)
+{
+	int type;
+
+	if (it->done)
+		return (it->valid = 0);
+	while (it->pos >= it->b.records_end) {
+		if (it->b.end >= it->t->refs_end) {
+			it->done = 1;
+			return (it->valid = 0);
+		}
+		read_block(it->t, it->b.end, it->t->refs_end, 'r', &it->b);
+		it->pos = it->b.start + 5;
+		strbuf_reset(&it->key);
+	}
+	type = decode_key(it->t, &it->b, &it->pos, &it->key);
+	decode_ref_value(it->t, &it->b, &it->pos, type, &it->rec);
+	it->rec.refname = it->key.buf;
+	return (it->valid = 1);
+}
+
+static int restart_cmp(const struct ref_table *t, const struct block *b,
+		       uint32_t i, const char *want, struct strbuf *scratch,
+		       size_t *pos)
+{
+	*pos = b->start + get_be32(b->restart + 4 * i);
+	if (*pos >= b->records_end)
+		corrupt_table(t);
+	strbuf_reset(scratch);
+	decode_key(t, b, pos, scratch);
+	return strcmp(scratch->buf, want);
+}
+
+/* Make the iterator stand at the first record not before "want". */
+static void iter_seek(struct table_iter *it, const char *want)
+{
+	const struct ref_table *t = it->t;
+	size_t block = TABLE_HEADER_SIZE, pos;
+	uint32_t lo, hi;
+
+	if (t->index_offset) {
+		struct block idx;
+		const unsigned char *p;
+
+		read_block(t, t->index_offset, t->size - TABLE_FOOTER_SIZE,
+			   'i', &idx);
+		/* the first block whose last key is not before want */
+		lo = 0;
+		hi = idx.restart_nr;
+		while (lo < hi) {
+			uint32_t mi = lo + (hi - lo) / 2;
+			if (restart_cmp(t, &idx, mi, want, &it->key, &pos) < 0)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		if (lo == idx.restart_nr) {
+			it->done = 1;
+			it->valid = 0;
+			return;
+		}
+		restart_cmp(t, &idx, lo, want, &it->key, &pos);
+		p = t->map + pos;
+		block = decode_varint(&p);
+		if (p > t->map + idx.records_end)
+			corrupt_table(t);
+	}
+	read_block(t, block, t->refs_end, 'r', &it->b);
+
+	/* the last restart point not after want */
+	lo = 0;
+	hi = it->b.restart_nr;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		if (restart_cmp(t, &it->b, mi, want, &it->key, &pos) <= 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	it->pos = lo ? it->b.start + get_be32(it->b.restart + 4 * (lo - 1))
+		: it->b.start + 5;
+	strbuf_reset(&it->key);
+	it->done = 0;
+	while (iter_next(it))
+		if (strcmp(it->rec.refname, want) >= 0)
+			break;
+}
+
+int ref_stack_read(struct ref_stack *st, const char *refname,
+		   struct ref_record *rec)
+{
+	struct table_iter it;
+	int i, ret = -1;
+
+	for (i = st->nr - 1; i >= 0; i--) {
+		int found;
+
+		iter_init(&it, &st->table[i]);
+		iter_seek(&it, refname);
+		found = it.valid && !strcmp(it.rec.refname, refname);
+		if (found && !it.rec.deletion) {
+			*rec = it.rec;
+			rec->refname = NULL;
+			ret = 0;
+		}
+		strbuf_release(&it.key);
+		if (found)
+			break;
+	}
+	return ret;
+}
+
+/*
+ * Merge the tables from "first" up, newer records shadowing older
+ * ones.  Deletion records are passed to fn only if keep_deletions is
+ * set.
+ */
+static int merged_for_each(struct ref_stack *st, int first, const char *prefix,
+			   int keep_deletions, ref_record_fn fn, void *cb_data)
+{
+	int n = st->nr - first, i, ret = 0;
+	struct table_iter *it = xcalloc(n ? n : 1, sizeof(*it));
+	size_t prefixlen = strlen(prefix);
+
+	for (i = 0; i < n; i++) {
+		iter_init(&it[i], &st->table[first + i]);
+		iter_seek(&it[i], prefix);
+	}
+	while (1) {
+		int best = -1;
+
+		/* the newest table wins a tie */
+		for (i = n - 1; i >= 0; i--)
+			if (it[i].valid &&
+			    (best < 0 ||
+			     strcmp(it[i].rec.refname, it[best].rec.refname) < 0))
+				best = i;
+		if (best < 0 ||
+		    strncmp(it[best].rec.refname, prefix, prefixlen))
+			break;
+		if (keep_deletions || !it[best].rec.deletion) {
+			ret = fn(&it[best].rec, cb_data);
+			if (ret)
+				break;
+		}
+		for (i = 0; i < n; i++)
+			if (i != best && it[i].valid &&
+			    !strcmp(it[i].rec.refname, it[best].rec.refname))
+				iter_next(&it[i]);
+		iter_next(&it[best]);
+	}
+
+	for (i = 0; i < n; i++)
+		strbuf_release(&it[i].key);
+	free(it);
+	return ret;
+}
+
+int ref_stack_for_each(struct ref_stack *st, const char *prefix,
+		       ref_record_fn fn, void *cb_data)
+{
+	return merged_for_each(st, 0, prefix, 0, fn, cb_data);
+}
+
+static struct lock_file list_lock;
+
+static int lock_stack(const char *dir, struct string_list *names)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	if (mkdir(dir, 0777) && errno != EEXIST)
+		return error("unable to create '%s': %s", dir, strerror(errno));
+	adjust_shared_perm(dir);
+	strbuf_addf(&path, "%s/tables.list", dir);
+	if (hold_lock_file_for_update(&list_lock, path.buf, 0) < 0) {
+		unable_to_lock_error(path.buf, errno);
+		strbuf_release(&path);
+		return error("cannot update the ref tables");
+	}
+	strbuf_release(&path);
+	read_table_list(dir, names);
+	return 0;
+}
+
+static int commit_stack(const struct string_list *names)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < names->nr; i++)
+		strbuf_addf(&buf, "%s\n", names->items[i].string);
+	if (write_in_full(list_lock.fd, buf.buf, buf.len) != buf.len) {
+		strbuf_release(&buf);
+		rollback_lock_file(&list_lock);
+		return error("unable to write the list of ref tables");
+	}
+	strbuf_release(&buf);
+	if (commit_lock_file(&list_lock))
+		return error("unable to update the list of ref tables: %s",
+			     strerror(errno));
+	return 0;
+}
+
+static unsigned long next_table_number(const struct string_list *names)
+{
+	unsigned long max = 0;
+	int i;
+
+	for (i = 0; i < names->nr; i++) {
+		unsigned long n = strtoul(names->items[i].string, NULL, 16);
+		if (max < n)
+			max = n;
+	}
+	return max + 1;
+}
+
+static int write_table(const char *dir, const struct string_list *names,
+		       const struct ref_record *recs, int nr,
+		       struct strbuf *name)
+{
+	struct strbuf data = STRBUF_INIT, tmp = STRBUF_INIT, path = STRBUF_INIT;
+	int fd;
+
+	encode_table(&data, recs, nr);
+	strbuf_addf(&tmp, "%s/tmp_table_XXXXXX", dir);
+	fd = git_mkstemp_mode(tmp.buf, 0444);
+	if (fd < 0) {
+		error("unable to create '%s': %s", tmp.buf, strerror(errno));
+		goto fail;
+	}
+	if (write_in_full(fd, data.buf, data.len) != data.len) {
+		error("unable to write '%s': %s", tmp.buf, strerror(errno));
+		close(fd);
+		unlink(tmp.buf);
+		goto fail;
+	}
+	fsync_or_die(fd, tmp.buf);
+	close(fd);
+
+	strbuf_addf(name, "%08lx.ref", next_table_number(names));
+	strbuf_addf(&path, "%s/%s", dir, name->buf);
+	if (rename(tmp.buf, path.buf)) {
+		error("unable to rename '%s' to '%s': %s",
+		      tmp.buf, path.buf, strerror(errno));
+		unlink(tmp.buf);
+		goto fail;
+	}
+	adjust_shared_perm(path.buf);
+	strbuf_release(&data);
+	strbuf_release(&tmp);
+	strbuf_release(&path);
+	return 0;
+
+fail:
+	strbuf_release(&data);
+	strbuf_release(&tmp);
+	strbuf_release(&path);
+	return -1;
+}
+
+struct record_list {
+	struct ref_record *rec;
+	int nr, alloc;
+};
+
+static int collect_record(const struct ref_record *rec, void *cb_data)
+{
+	struct record_list *list = cb_data;
+
+	ALLOC_GROW(list->rec, list->nr + 1, list->alloc);
+	list->rec[list->nr] = *rec;
+	list->rec[list->nr++].refname = xstrdup(rec->refname);
+	return 0;
+}
+
+/*
+ * Merge the tables at the top of the stack listed in names into one,
+ * moving the names of the tables it replaces to "obsolete".
+ */
+static int compact_stack(const char *dir, struct string_list *names,
+			 struct string_list *obsolete)
+{
+	struct ref_stack st;
+	struct record_list list;
+	struct strbuf name = STRBUF_INIT;
+	size_t sum;
+	int first, i, ret = 0;
+
+	memset(&st, 0, sizeof(st));
+	if (load_tables(&st, dir, names))
+		return error("unable to read the ref tables in '%s'", dir);
+
+	first = st.nr - 1;
+	sum = st.table[first].size;
+	while (first > 0 && st.table[first - 1].size <= COMPACTION_FACTOR * sum)
+		sum += st.table[--first].size;
+	if (first == st.nr - 1)
+		goto done;
+
+	memset(&list, 0, sizeof(list));
+	merged_for_each(&st, first, "", first > 0, collect_record, &list);
+	ret = write_table(dir, names, list.rec, list.nr, &name);
+	for (i = 0; i < list.nr; i++)
+		free((char *)list.rec[i].refname);
+	free(list.rec);
+	if (ret)
+		goto done;
+
+	for (i = first; i < names->nr; i++) {
+		string_list_append(obsolete, names->items[i].string);
+		free(names->items[i].string);
+	}
+	names->nr = first;
+	string_list_append(names, name.buf);
+
+done:
+	strbuf_release(&name);
+	release_tables(&st);
+	return ret;
+}
+
+static void remove_tables(const char *dir, const struct string_list *names)
+{
+	struct strbuf path = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < names->nr; i++) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", dir, names->items[i].string);
+		unlink_or_warn(path.buf);
+	}
+	strbuf_release(&path);
+}
+
+int ref_stack_add(const char *dir, struct ref_record *recs, int nr)
+{
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct string_list obsolete = STRING_LIST_INIT_DUP;
+	struct strbuf name = STRBUF_INIT;
+	int ret;
+
+	if (lock_stack(dir, &names))
+		return -1;
+	if (write_table(dir, &names, recs, nr, &name)) {
+		rollback_lock_file(&list_lock);
+		ret = -1;
+		goto done;
+	}
+	string_list_append(&names, name.buf);
+	if (compact_stack(dir, &names, &obsolete))
+		warning("unable to compact the ref tables in '%s'", dir);
+	ret = commit_stack(&names);
+	if (!ret)
+		remove_tables(dir, &obsolete);
+
+done:
+	strbuf_release(&name);
+	string_list_clear(&names, 0);
+	string_list_clear(&obsolete, 0);
+	return ret;
+}
+
+int ref_stack_replace(const char *dir, struct ref_record *recs, int nr)
+{
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct string_list new_names = STRING_LIST_INIT_DUP;
+	struct strbuf name = STRBUF_INIT;
+	int ret;
+
+	if (lock_stack(dir, &names))
+		return -1;
+	if (write_table(dir, &names, recs, nr, &name)) {
+		rollback_lock_file(&list_lock);
+		ret = -1;
+		goto done;
+	}
+	string_list_append(&new_names, name.buf);
+	ret = commit_stack(&new_names);
+	if (!ret)
+		remove_tables(dir, &names);
+
+done:
+	strbuf_release(&name);
+	string_list_clear(&names, 0);
+	string_list_clear(&new_names, 0);
+	return ret;
+}
+
+int ref_stack_remove(const char *dir)
+{
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+
+	if (lock_stack(dir, &names))
+		return -1;
+	/* readers that lose the race fall back to packed-refs */
+	strbuf_addf(&path, "%s/tables.list", dir);
+	unlink_or_warn(path.buf);
+	remove_tables(dir, &names);
+	rollback_lock_file(&list_lock);
+	rmdir(dir);
+	strbuf_release(&path);
+	string_list_clear(&names, 0);
+	return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef REFTABLE_H
+#define REFTABLE_H
+
+/*
+ * Packed refs can be kept in a stack of binary ref tables under
+ * $GIT_DIR/reftable/ instead of the packed-refs text file.  The
+ * file "tables.list" names the tables, oldest first; a ref in a
+ * newer table shadows the same ref in older ones, and a deletion
+ * record hides it altogether.  Tables are never modified once
+ * written: an update adds a small table on top of the stack, and
+ * the stack is compacted as it grows so that it stays a handful of
+ * tables deep.
+ *
+ * A table is a sorted run of prefix-compressed records cut into
+ * blocks, each with restart points for binary search, followed by
+ * an index of the blocks, so that a single ref can be found without
+ * reading the whole table.  See the top of reftable.c for the
+ * layout.
+ */
+
+struct ref_record {
+	const char *refname;
+	unsigned char sha1[20];
+	unsigned char peeled[20];
+	unsigned has_peeled:1,
+		 deletion:1;
+};
+
+struct ref_stack;
+
+/*
+ * Open the stack of tables in the directory "dir".  Returns NULL if
+ * there is none, i.e. packed refs are kept in packed-refs.  Dies if
+ * a table is corrupt.
+ */
+extern struct ref_stack *ref_stack_open(const char *dir);
+extern void ref_stack_close(struct ref_stack *st);
+
+/*
+ * Look up refname.  Returns 0 and fills rec (except for its refname)
+ * if it is found, or -1 if it is not.
+ */
+extern int ref_stack_read(struct ref_stack *st, const char *refname,
+			  struct ref_record *rec);
+
+/*
+ * Call fn on every ref whose name starts with prefix, in order.  The
+ * record, including its refname, is only valid during the call.  A
+ * non-zero return from fn stops the iteration and is returned.
+ */
+typedef int (*ref_record_fn)(const struct ref_record *rec, void *cb_data);
+extern int ref_stack_for_each(struct ref_stack *st, const char *prefix,
+			      ref_record_fn fn, void *cb_data);
+
+/*
+ * Writers.  The records must be sorted by refname, without
+ * duplicates.  ref_stack_add() puts them on top of the stack in "dir"
+ * (creating it if needed) and compacts it if that is due;
+ * ref_stack_replace() replaces the whole stack with a single table.
+ * ref_stack_remove() deletes the stack.  They return 0 on success or
+ * an error().  The caller is expected to hold the packed-refs lock.
+ */
+extern int ref_stack_add(const char *dir, struct ref_record *recs, int nr);
+extern int ref_stack_replace(const char *dir, struct ref_record *recs, int nr);
+extern int ref_stack_remove(const char *dir);
+
+#endif /* REFTABLE_H */
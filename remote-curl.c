@@ -18,6 +18,8 @@ struct options {
 		followtags : 1,
 		dry_run : 1,
 		thin : 1;
+	char *ref_prefixes;
+	char *filter;
 };
 static struct options options;
 
@@ -57,6 +59,16 @@ static int set_option(const char *name, const char *value)
 			return -1;
 		return 0;
 	}
+	else if (!strcmp(name, "refprefix")) {
+		free(options.ref_prefixes);
+		options.ref_prefixes = xstrdup(value);
+		return 0;
+	}
+	else if (!strcmp(name, "filter")) {
+		free(options.filter);
+		options.filter = xstrdup(value);
+		return 0;
+	}
 	else if (!strcmp(name, "dry-run")) {
 		if (!strcmp(value, "true"))
 			options.dry_run = 1;
@@ -110,6 +122,12 @@ static struct discovery* discover_refs(const char *service)
 		else
 			strbuf_addch(&buffer, '&');
 		strbuf_addf(&buffer, "service=%s", service);
+		if (options.ref_prefixes &&
+		    !strcmp(service, "git-upload-pack")) {
+			strbuf_addstr(&buffer, "&ref-prefix=");
+			strbuf_addstr_urlencode(&buffer,
+						options.ref_prefixes, 1);
+		}
 	}
 	refs_url = strbuf_detach(&buffer, NULL);
 
@@ -179,6 +197,7 @@ static struct ref *parse_git_refs(struct discovery *heads, int for_push)
 {
 	struct ref *list = NULL;
 	struct async async;
+	struct packet_reader reader;
 
 	memset(&async, 0, sizeof(async));
 	async.proc = write_discovery;
@@ -187,7 +206,8 @@ static struct ref *parse_git_refs(struct discovery *heads, int for_push)
 
 	if (start_async(&async))
 		die("cannot start thread to parse advertised refs");
-	get_remote_heads(async.out, &list,
+	packet_reader_init(&reader, async.out);
+	get_remote_heads(&reader, &list,
 			for_push ? REF_NORMAL : 0, NULL);
 	close(async.out);
 	if (finish_async(&async))
@@ -274,6 +294,9 @@ static void output_refs(struct ref *refs)
 	free_refs(refs);
 }
 
+/* enough of a packet to tell a negotiation line from side-band data */
+#define PKT_PEEK 10
+
 struct rpc_state {
 	const char *service_name;
 	const char **argv;
@@ -290,6 +313,34 @@ struct rpc_state {
 	struct strbuf result;
 	unsigned gzip_request : 1;
 	unsigned initial_buffer : 1;
+
+	/*
+	 * Once a request went through, the server has accepted our
+	 * credentials and the next requests are sent as the client
+	 * writes them, without gathering them in buf first.
+	 */
+	unsigned stream_request : 1;
+	unsigned request_end : 1;
+	unsigned gzip_end : 1;
+	git_zstream gzip_stream;
+
+	/*
+	 * When pack_fd is set, the client asked for side-band and the
+	 * response is taken apart here: the negotiation lines before
+	 * the pack are passed on to the client, and after them band #1
+	 * goes straight to pack_fd, which the client hands to
+	 * index-pack, and the other bands are shown on stderr.
+	 */
+	int pack_fd;
+	char pkt_head[4 + PKT_PEEK];
+	int pkt_head_len;
+	int pkt_head_want;
+	int pkt_left;		/* payload of the current packet still to come */
+	int pkt_band;		/* its band, 0 for a negotiation line */
+	int band_skip_pf;
+	struct strbuf band_msg;
+	unsigned in_sideband : 1;
+	unsigned remote_error : 1;
 };
 
 static size_t rpc_out(void *ptr, size_t eltsize,
@@ -315,6 +366,41 @@ static size_t rpc_out(void *ptr, size_t eltsize,
 	return avail;
 }
 
+static size_t rpc_out_gzip(void *ptr, size_t eltsize,
+		size_t nmemb, void *buffer_)
+{
+	size_t max = eltsize * nmemb;
+	struct rpc_state *rpc = buffer_;
+	git_zstream *stream = &rpc->gzip_stream;
+
+	stream->next_out = ptr;
+	stream->avail_out = max;
+	while (!rpc->gzip_end && stream->avail_out == max) {
+		int ret;
+
+		if (!stream->avail_in && !rpc->request_end) {
+			if (rpc->pos == rpc->len) {
+				rpc->initial_buffer = 0;
+				rpc->pos = 0;
+				rpc->len = packet_read_line(rpc->out, rpc->buf,
+							    rpc->alloc);
+				if (!rpc->len)
+					rpc->request_end = 1;
+			}
+			stream->next_in = (unsigned char *)rpc->buf + rpc->pos;
+			stream->avail_in = rpc->len - rpc->pos;
+			rpc->pos = rpc->len;
+		}
+
+		ret = git_deflate(stream, rpc->request_end ? Z_FINISH : Z_NO_FLUSH);
+		if (ret == Z_STREAM_END)
+			rpc->gzip_end = 1;
+		else if (ret != Z_OK && ret != Z_BUF_ERROR)
+			die("cannot deflate request; zlib deflate error %d", ret);
+	}
+	return max - stream->avail_out;
+}
+
 #ifndef NO_CURL_IOCTL
 static curlioerr rpc_ioctl(CURL *handle, int cmd, void *clientp)
 {
@@ -338,12 +424,152 @@ static curlioerr rpc_ioctl(CURL *handle, int cmd, void *clientp)
 }
 #endif
 
+static void reset_demux(struct rpc_state *rpc)
+{
+	rpc->pkt_head_len = 0;
+	rpc->pkt_head_want = 4;
+	rpc->pkt_left = 0;
+	rpc->in_sideband = 0;
+	strbuf_reset(&rpc->band_msg);
+}
+
+static int is_negotiation_line(const char *line, int len)
+{
+	static const char *prefix[] = {
+		"ACK ", "NAK", "shallow ", "unshallow ", NULL
+	};
+	int i;
+
+	for (i = 0; prefix[i]; i++) {
+		int n = strlen(prefix[i]);
+		if (n <= len && !memcmp(line, prefix[i], n))
+			return 1;
+	}
+	return 0;
+}
+
+static void end_band_packet(struct rpc_state *rpc)
+{
+	if (rpc->pkt_band > 1) {
+		if (recv_sideband_packet("remote-curl",
+					 rpc->band_msg.buf, rpc->band_msg.len,
+					 -1, &rpc->band_skip_pf))
+			rpc->remote_error = 1;
+		strbuf_reset(&rpc->band_msg);
+	}
+	rpc->pkt_head_len = 0;
+	rpc->pkt_head_want = 4;
+}
+
+/*
+ * Take apart the start of a packet, held in pkt_head: the ACK/NAK
+ * (and shallow) lines of the negotiation go to the client as they
+ * are, and everything after them has to be side-band data, as the
+ * client asked for it.
+ */
+static void demux_packet_head(struct rpc_state *rpc)
+{
+	const char *data = rpc->pkt_head + 4;
+	int len = rpc->pkt_head_len - 4;
+
+	if (!rpc->in_sideband && is_negotiation_line(data, len)) {
+		rpc->pkt_band = 0;
+		write_or_die(rpc->in, rpc->pkt_head, rpc->pkt_head_len);
+		return;
+	}
+
+	rpc->in_sideband = 1;
+	rpc->pkt_band = *data & 0xff;
+	switch (rpc->pkt_band) {
+	case 1:
+		write_or_die(rpc->pack_fd, data + 1, len - 1);
+		break;
+	case 2:
+	case 3:
+		strbuf_add(&rpc->band_msg, data, len);
+		break;
+	default:
+		die("protocol error: bad band #%d", rpc->pkt_band);
+	}
+}
+
+static void demux_rpc_in(struct rpc_state *rpc, const char *ptr, size_t size)
+{
+	while (size) {
+		int n;
+
+		if (rpc->pkt_head_len < rpc->pkt_head_want) {
+			n = rpc->pkt_head_want - rpc->pkt_head_len;
+			if (size < n)
+				n = size;
+			memcpy(rpc->pkt_head + rpc->pkt_head_len, ptr, n);
+			rpc->pkt_head_len += n;
+			ptr += n;
+			size -= n;
+			if (rpc->pkt_head_len < rpc->pkt_head_want)
+				break;
+
+			if (rpc->pkt_head_want == 4) {
+				int len = packet_length(rpc->pkt_head);
+
+				if (len < 0)
+					die("protocol error: bad line length character: %.4s",
+					    rpc->pkt_head);
+				if (0 < len && len < 4)
+					die("protocol error: bad line length %d", len);
+				if (len <= 4) {
+					/*
+					 * A flush after side-band data ends
+					 * the pack; the client is not reading
+					 * any more.
+					 */
+					if (!rpc->in_sideband)
+						write_or_die(rpc->in, rpc->pkt_head, 4);
+					rpc->pkt_head_len = 0;
+					continue;
+				}
+				rpc->pkt_left = len - 4;
+				if (rpc->pkt_left < PKT_PEEK)
+					rpc->pkt_head_want += rpc->pkt_left;
+				else
+					rpc->pkt_head_want += PKT_PEEK;
+				continue;
+			}
+
+			demux_packet_head(rpc);
+			rpc->pkt_left -= rpc->pkt_head_len - 4;
+			if (!rpc->pkt_left)
+				end_band_packet(rpc);
+			continue;
+		}
+
+		n = rpc->pkt_left;
+		if (size < n)
+			n = size;
+		if (!rpc->pkt_band)
+			write_or_die(rpc->in, ptr, n);
+		else if (rpc->pkt_band == 1)
+			write_or_die(rpc->pack_fd, ptr, n);
+		else
+			strbuf_add(&rpc->band_msg, ptr, n);
+		ptr += n;
+		size -= n;
+		rpc->pkt_left -= n;
+
+		if (!rpc->pkt_left)
+			end_band_packet(rpc);
+	}
+}
+
 static size_t rpc_in(char *ptr, size_t eltsize,
 		size_t nmemb, void *buffer_)
 {
 	size_t size = eltsize * nmemb;
 	struct rpc_state *rpc = buffer_;
-	write_or_die(rpc->in, ptr, size);
+	if (rpc->pack_fd)
+		demux_rpc_in(rpc, ptr, size);
+	else
+		write_or_die(rpc->in, ptr, size);
 	return size;
 }
 
@@ -404,9 +630,11 @@ static int post_rpc(struct rpc_state *rpc)
 
 	/* Try to load the entire request, if we can fit it into the
 	 * allocated buffer space we can use HTTP/1.0 and avoid the
-	 * chunked encoding mess.
+	 * chunked encoding mess.  Once the server has taken a request
+	 * from us, there is no need to be able to send one again for
+	 * authentication, and we pass on the rest as it comes.
 	 */
-	while (1) {
+	while (!rpc->stream_request) {
 		size_t left = rpc->alloc - rpc->len;
 		char *buf = rpc->buf + rpc->len;
 		int n;
@@ -442,7 +670,35 @@ static int post_rpc(struct rpc_state *rpc)
 	headers = curl_slist_append(headers, rpc->hdr_accept);
 	headers = curl_slist_append(headers, "Expect:");
 
-	if (large_request) {
+	if (rpc->stream_request) {
+		/* The request body is sent while the client writes it,
+		 * which needs chunked encoding; we compress it on the way
+		 * if we would have done so for the whole request.
+		 */
+		headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
+		rpc->request_end = 0;
+		if (use_gzip) {
+			headers = curl_slist_append(headers, "Content-Encoding: gzip");
+			rpc->initial_buffer = 0;
+			rpc->gzip_end = 0;
+			memset(&rpc->gzip_stream, 0, sizeof(rpc->gzip_stream));
+			git_deflate_init_gzip(&rpc->gzip_stream, Z_BEST_COMPRESSION);
+			curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, rpc_out_gzip);
+		} else {
+			rpc->initial_buffer = 1;
+			curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, rpc_out);
+		}
+		curl_easy_setopt(slot->curl, CURLOPT_INFILE, rpc);
+#ifndef NO_CURL_IOCTL
+		curl_easy_setopt(slot->curl, CURLOPT_IOCTLFUNCTION, rpc_ioctl);
+		curl_easy_setopt(slot->curl, CURLOPT_IOCTLDATA, rpc);
+#endif
+		if (options.verbosity > 1) {
+			fprintf(stderr, "POST %s (streamed%s)\n",
+				rpc->service_name, use_gzip ? ", gzip" : "");
+			fflush(stderr);
+		}
+	} else if (large_request) {
 		/* The request body is large and the size cannot be predicted.
 		 * We must use chunked encoding to send it.
 		 */
@@ -516,9 +772,15 @@ static int post_rpc(struct rpc_state *rpc)
 	curl_easy_setopt(slot->curl, CURLOPT_FILE, rpc);
 
 	do {
+		reset_demux(rpc);
 		err = run_slot(slot);
-	} while (err == HTTP_REAUTH && !large_request && !use_gzip);
-	if (err != HTTP_OK)
+	} while (err == HTTP_REAUTH && !rpc->stream_request &&
+		 !large_request && !use_gzip);
+	if (rpc->stream_request && use_gzip)
+		git_deflate_end_gently(&rpc->gzip_stream);
+	if (err == HTTP_OK)
+		rpc->stream_request = 1;
+	if (err != HTTP_OK || rpc->remote_error)
 		err = -1;
 
 	curl_slist_free_all(headers);
@@ -526,7 +788,8 @@ static int post_rpc(struct rpc_state *rpc)
 	return err;
 }
 
-static int rpc_service(struct rpc_state *rpc, struct discovery *heads)
+static int rpc_service(struct rpc_state *rpc, struct discovery *heads,
+		       int client_pack_fd)
 {
 	const char *svc = rpc->service_name;
 	struct strbuf buf = STRBUF_INIT;
@@ -541,6 +804,8 @@ static int rpc_service(struct rpc_state *rpc, struct discovery *heads)
 	client.argv = rpc->argv;
 	if (start_command(&client))
 		exit(1);
+	if (client_pack_fd >= 0)
+		close(client_pack_fd);
 	if (preamble)
 		write_or_die(client.in, preamble->buf, preamble->len);
 	if (heads)
@@ -551,6 +816,7 @@ static int rpc_service(struct rpc_state *rpc, struct discovery *heads)
 	rpc->in = client.in;
 	rpc->out = client.out;
 	strbuf_init(&rpc->result, 0);
+	strbuf_init(&rpc->band_msg, 0);
 
 	strbuf_addf(&buf, "%s%s", url, svc);
 	rpc->service_url = strbuf_detach(&buf, NULL);
@@ -572,6 +838,10 @@ static int rpc_service(struct rpc_state *rpc, struct discovery *heads)
 
 	close(client.in);
 	client.in = -1;
+	if (rpc->pack_fd) {
+		close(rpc->pack_fd);
+		rpc->pack_fd = 0;
+	}
 	if (!err) {
 		strbuf_read(&rpc->result, client.out, 0);
 	} else {
@@ -589,6 +859,7 @@ static int rpc_service(struct rpc_state *rpc, struct discovery *heads)
 	free(rpc->hdr_content_type);
 	free(rpc->hdr_accept);
 	free(rpc->buf);
+	strbuf_release(&rpc->band_msg);
 	strbuf_release(&buf);
 	return err;
 }
@@ -625,9 +896,10 @@ static int fetch_git(struct discovery *heads,
 {
 	struct rpc_state rpc;
 	struct strbuf preamble = STRBUF_INIT;
-	char *depth_arg = NULL;
+	char *depth_arg = NULL, *filter_arg = NULL, *pack_fd_arg = NULL;
 	int argc = 0, i, err;
-	const char *argv[15];
+	int pack_pipe[2];
+	const char *argv[16];
 
 	argv[argc++] = "fetch-pack";
 	argv[argc++] = "--stateless-rpc";
@@ -649,6 +921,30 @@ static int fetch_git(struct discovery *heads,
 		depth_arg = strbuf_detach(&buf, NULL);
 		argv[argc++] = depth_arg;
 	}
+	if (options.filter) {
+		struct strbuf buf = STRBUF_INIT;
+		strbuf_addf(&buf, "--filter=%s", options.filter);
+		filter_arg = strbuf_detach(&buf, NULL);
+		argv[argc++] = filter_arg;
+	}
+#ifndef WIN32
+	/*
+	 * Rather than copying the pack to fetch-pack, which would copy it
+	 * again to index-pack, take the side-band apart ourselves and write
+	 * the pack into a pipe that fetch-pack passes on to index-pack.
+	 */
+	if ((server_supports("side-band-64k") || server_supports("side-band")) &&
+	    !pipe(pack_pipe)) {
+		struct strbuf buf = STRBUF_INIT;
+		int flags = fcntl(pack_pipe[1], F_GETFD);
+		if (flags >= 0)
+			fcntl(pack_pipe[1], F_SETFD, flags | FD_CLOEXEC);
+		enlarge_pipe_buffer(pack_pipe[1]);
+		strbuf_addf(&buf, "--pack-fd=%d", pack_pipe[0]);
+		pack_fd_arg = strbuf_detach(&buf, NULL);
+		argv[argc++] = pack_fd_arg;
+	}
+#endif
 	argv[argc++] = url;
 	argv[argc++] = NULL;
 
@@ -665,13 +961,17 @@ static int fetch_git(struct discovery *heads,
 	rpc.argv = argv;
 	rpc.stdin_preamble = &preamble;
 	rpc.gzip_request = 1;
+	if (pack_fd_arg)
+		rpc.pack_fd = pack_pipe[1];
 
-	err = rpc_service(&rpc, heads);
+	err = rpc_service(&rpc, heads, pack_fd_arg ? pack_pipe[0] : -1);
 	if (rpc.result.len)
 		safe_write(1, rpc.result.buf, rpc.result.len);
 	strbuf_release(&rpc.result);
 	strbuf_release(&preamble);
 	free(depth_arg);
+	free(filter_arg);
+	free(pack_fd_arg);
 	return err;
 }
 
@@ -786,7 +1086,7 @@ static int push_git(struct discovery *heads, int nr_spec, char **specs)
 	rpc.service_name = "git-receive-pack",
 	rpc.argv = argv;
 
-	err = rpc_service(&rpc, heads);
+	err = rpc_service(&rpc, heads, -1);
 	if (rpc.result.len)
 		safe_write(1, rpc.result.buf, rpc.result.len);
 	strbuf_release(&rpc.result);
@@ -453,6 +453,11 @@ static int handle_config(const char *key, const char *value, void *cb)
 					 key, value);
 	} else if (!strcmp(subkey, ".vcs")) {
 		return git_config_string(&remote->foreign_vcs, key, value);
+	} else if (!strcmp(subkey, ".promisor")) {
+		remote->promisor = git_config_bool(key, value);
+	} else if (!strcmp(subkey, ".partialclonefilter")) {
+		return git_config_string(&remote->partial_clone_filter,
+					 key, value);
 	}
 	return 0;
 }
@@ -664,6 +669,30 @@ void free_refspec(int nr_refspec, struct refspec *refspec)
 	free(refspec);
 }
 
+void refspec_ref_prefixes(const struct refspec *refspec, int nr_refspec,
+			  struct strbuf *prefixes)
+{
+	int i;
+
+	for (i = 0; i < nr_refspec; i++) {
+		const char *src = refspec[i].src;
+
+		if (!src || !*src)
+			continue;
+		if (!refspec[i].pattern) {
+			expand_ref_prefix(prefixes, src);
+			continue;
+		}
+		if (prefixes->len)
+			strbuf_addch(prefixes, ' ');
+		if (*src == '*')
+			/* all that upload-pack would advertise */
+			strbuf_addstr(prefixes, "HEAD refs/");
+		else
+			strbuf_add(prefixes, src, strcspn(src, "*"));
+	}
+}
+
 static int valid_remote_nick(const char *name)
 {
 	if (!name[0] || is_dot_or_dotdot(name))
@@ -44,6 +44,13 @@ struct remote {
 	const char *receivepack;
 	const char *uploadpack;
 
+	/*
+	 * A partial clone fetches objects its filter left out from
+	 * the promisor remote on demand.
+	 */
+	int promisor;
+	const char *partial_clone_filter;
+
 	/*
 	 * for curl remotes only
 	 */
@@ -95,6 +102,13 @@ struct refspec *parse_fetch_refspec(int nr_refspec, const char **refspec);
 
 void free_refspec(int nr_refspec, struct refspec *refspec);
 
+/*
+ * Append to a space separated list the prefixes of the remote refs
+ * that the given fetch refspecs can match.
+ */
+void refspec_ref_prefixes(const struct refspec *refspec, int nr_refspec,
+			  struct strbuf *prefixes);
+
 char *apply_refspecs(struct refspec *refspecs, int nr_refspec,
 		     const char *name);
 
@@ -13,6 +13,7 @@
 #include "decorate.h"
 #include "log-tree.h"
 #include "string-list.h"
+#include "bloom.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -367,6 +368,50 @@ static void file_change(struct diff_options *options,
 	DIFF_OPT_SET(options, HAS_CHANGES);
 }
 
+/*
+ * Changed-path filters can only answer for literal paths; leave
+ * bloom_keys_nr at 0 if the pathspec has anything else in it.
+ */
+static void prepare_bloom_keys(struct rev_info *revs)
+{
+	struct pathspec *ps = &revs->pruning.pathspec;
+	int i;
+
+	revs->bloom_keys_prepared = 1;
+	if (!ps->nr || ps->has_wildcard ||
+	    DIFF_OPT_TST(&revs->pruning, FOLLOW_RENAMES))
+		return;
+	for (i = 0; i < ps->nr; i++) {
+		int len = ps->items[i].len;
+		while (len && ps->items[i].match[len - 1] == '/')
+			len--;
+		if (!len || ps->items[i].use_wildcard)
+			return;
+	}
+	revs->bloom_keys = xcalloc(ps->nr, sizeof(*revs->bloom_keys));
+	for (i = 0; i < ps->nr; i++) {
+		int len = ps->items[i].len;
+		while (ps->items[i].match[len - 1] == '/')
+			len--;
+		fill_bloom_key(ps->items[i].match, len, &revs->bloom_keys[i]);
+	}
+	revs->bloom_keys_nr = ps->nr;
+}
+
+static int bloom_filter_says_same(struct rev_info *revs,
+				  struct commit *parent, struct commit *commit)
+{
+	if (!revs->bloom_keys_prepared)
+		prepare_bloom_keys(revs);
+	if (!revs->bloom_keys_nr)
+		return 0;
+	/* the filters only record changes against the first parent */
+	if (!commit->parents || commit->parents->item != parent)
+		return 0;
+	return !bloom_filter_may_contain(commit->object.sha1,
+					 revs->bloom_keys, revs->bloom_keys_nr);
+}
+
 static int rev_compare_tree(struct rev_info *revs, struct commit *parent, struct commit *commit)
 {
 	struct tree *t1 = parent->tree;
@@ -395,6 +440,9 @@ static int rev_compare_tree(struct rev_info *revs, struct commit *parent, struct
 			return REV_TREE_SAME;
 	}
 
+	if (bloom_filter_says_same(revs, parent, commit))
+		return REV_TREE_SAME;
+
 	tree_difference = REV_TREE_SAME;
 	DIFF_OPT_CLR(&revs->pruning, HAS_CHANGES);
 	if (diff_tree_sha1(t1->object.sha1, t2->object.sha1, "",
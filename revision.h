@@ -22,6 +22,7 @@
 
 struct rev_info;
 struct log_info;
+struct bloom_key;
 struct string_list;
 
 struct rev_cmdline_info {
@@ -78,6 +79,7 @@ struct rev_info {
 			tree_objects:1,
 			blob_objects:1,
 			verify_objects:1,
+			ignore_missing_links:1,
 			edge_hint:1,
 			limited:1,
 			unpacked:1,
@@ -161,6 +163,11 @@ struct rev_info {
 	struct diff_options diffopt;
 	struct diff_options pruning;
 
+	/* changed-path filter keys for prune_data, see bloom.h */
+	struct bloom_key *bloom_keys;
+	int bloom_keys_nr;
+	unsigned int bloom_keys_prepared:1;
+
 	struct reflog_walk_info *reflog_info;
 	struct decoration children;
 	struct decoration merge_simplification;
@@ -700,6 +700,7 @@ int start_async(struct async *async)
 		main_thread_set = 1;
 		main_thread = pthread_self();
 		pthread_key_create(&async_key, NULL);
+		init_zstream_pool_threads();
 		set_die_routine(die_async);
 	}
 
@@ -20,6 +20,7 @@
 #include "sha1-lookup.h"
 #include "bulk-checkin.h"
 #include "streaming.h"
+#include "fetch-object.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -306,6 +307,7 @@ static int link_alt_odb_entry(const char * entry, int len, const char * relative
 	/* add the alternate entry */
 	*alt_odb_tail = ent;
 	alt_odb_tail = &(ent->next);
+	clear_abbrev_cache();
 	ent->next = NULL;
 
 	/* recursively add alternates */
@@ -1004,6 +1006,7 @@ void install_packed_git(struct packed_git *pack)
 
 	pack->next = packed_git;
 	packed_git = pack;
+	clear_abbrev_cache();
 }
 
 static void prepare_packed_git_one(char *objdir, int local)
@@ -1130,6 +1133,7 @@ void prepare_packed_git(void)
 void reprepare_packed_git(void)
 {
 	discard_revindex();
+	clear_abbrev_cache();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
 }
@@ -1353,6 +1357,8 @@ int unpack_sha1_header(git_zstream *stream, unsigned char *map, unsigned long ma
 	stream->avail_in = mapsize;
 	stream->next_out = buffer;
 	stream->avail_out = bufsiz;
+	/* the caller ends the stream whether we succeed or not */
+	git_inflate_init_pooled(stream);
 
 	if (experimental_loose_object(map)) {
 		/*
@@ -1368,14 +1374,12 @@ int unpack_sha1_header(git_zstream *stream, unsigned char *map, unsigned long ma
 		/* Set up the stream for the rest.. */
 		stream->next_in = map;
 		stream->avail_in = mapsize;
-		git_inflate_init(stream);
 
 		/* And generate the fake traditional header */
 		stream->total_out = 1 + snprintf(buffer, bufsiz, "%s %lu",
 						 typename(type), size);
 		return 0;
 	}
-	git_inflate_init(stream);
 	return git_inflate(stream, 0);
 }
 
@@ -1420,6 +1424,7 @@ static void *unpack_sha1_rest(git_zstream *stream, void *buffer, unsigned long s
 	else if (stream->avail_in)
 		error("garbage at end of loose object '%s'",
 		      sha1_to_hex(sha1));
+	git_inflate_end(stream);
 	free(buf);
 	return NULL;
 }
@@ -1482,8 +1487,10 @@ static void *unpack_sha1_file(void *map, unsigned long mapsize, enum object_type
 	char hdr[8192];
 
 	ret = unpack_sha1_header(&stream, map, mapsize, hdr, sizeof(hdr));
-	if (ret < Z_OK || (*type = parse_sha1_header(hdr, size)) < 0)
+	if (ret < Z_OK || (*type = parse_sha1_header(hdr, size)) < 0) {
+		git_inflate_end(&stream);
 		return NULL;
+	}
 
 	return unpack_sha1_rest(&stream, hdr, *size, sha1);
 }
@@ -1684,7 +1691,7 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
 
-	git_inflate_init(&stream);
+	git_inflate_init_pooled(&stream);
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
@@ -1818,6 +1825,117 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 static void *read_object(const unsigned char *sha1, enum object_type *type,
 			 unsigned long *size);
 
+int do_check_packed_object_crc;
+
+int fetch_if_missing = 1;
+
+/*
+ * Fetch an object a partial clone left out.  Asking the promisor
+ * remote again right away for an object it did not send us would
+ * only repeat the failure, so that is refused.
+ */
+static int fetch_missing_object(const unsigned char *sha1)
+{
+	static unsigned char last_fetched[20];
+
+	if (!fetch_if_missing || !promisor_remote())
+		return -1;
+	if (!hashcmp(sha1, last_fetched))
+		return -1;
+	hashcpy(last_fetched, sha1);
+	return fetch_objects((const unsigned char (*)[20])sha1, 1);
+}
+
+static void write_pack_access_log(struct packed_git *p, off_t obj_offset);
+
+/*
+ * Caching every intermediate base along the delta chain of a large
+ * object would only evict the rest of the delta base cache, so such
+ * chains are folded into a single delta and applied to the bottom base
+ * at once instead.
+ */
+static int want_combined_delta(struct packed_git *p, off_t base_offset,
+			       const void *delta_data, unsigned long delta_size)
+{
+	const unsigned char *data = delta_data;
+	const unsigned char *top = data + delta_size;
+	unsigned long size;
+
+	if (delta_size < DELTA_SIZE_MIN || do_check_packed_object_crc)
+		return 0;
+	get_delta_hdr_size(&data, top);
+	size = get_delta_hdr_size(&data, top);
+	return size > delta_base_cache_limit / 4 &&
+		!in_delta_base_cache(p, base_offset);
+}
+
+/*
+ * Fold the deltas found walking down from the pack entry at offset into
+ * cd, until an entry that is not a delta, or whose data is in the delta
+ * base cache anyway, is found.  Returns the offset of that entry, or 0
+ * if the chain could not be read.
+ */
+off_t combine_packed_delta_chain(struct packed_git *p, off_t offset,
+				 struct combined_delta *cd)
+{
+	struct pack_window *w_curs = NULL;
+
+	while (!in_delta_base_cache(p, offset)) {
+		off_t curpos = offset;
+		enum object_type type;
+		unsigned long size;
+		void *data;
+
+		type = unpack_object_header(p, &w_curs, &curpos, &size);
+		if (type != OBJ_OFS_DELTA && type != OBJ_REF_DELTA)
+			break;
+		if (log_pack_access)
+			write_pack_access_log(p, offset);
+		offset = get_delta_base(p, &w_curs, &curpos, type, offset);
+		if (!offset)
+			break;
+		data = unpack_compressed_entry(p, &w_curs, curpos, size);
+		if (!data || combine_delta_push(cd, data, size)) {
+			offset = 0;
+			break;
+		}
+	}
+	unuse_pack(&w_curs);
+	return offset;
+}
+
+static void *unpack_combined_delta(struct packed_git *p, off_t base_offset,
+				   void *delta_data, unsigned long delta_size,
+				   enum object_type *type,
+				   unsigned long *sizep)
+{
+	struct combined_delta cd = COMBINED_DELTA_INIT;
+	void *base, *result = NULL;
+	unsigned long base_size;
+
+	if (combine_delta_push(&cd, delta_data, delta_size))
+		goto out;
+	base_offset = combine_packed_delta_chain(p, base_offset, &cd);
+	if (!base_offset)
+		goto out;
+
+	base = cache_or_unpack_entry(p, base_offset, &base_size, type, 0);
+	if (!base)
+		goto out;
+	result = combined_delta_apply(&cd, base, base_size, sizep);
+	add_delta_base_cache(p, base_offset, base, base_size, *type);
+
+out:
+	/*
+	 * On failure the caller retries the slow way, which knows how to
+	 * recover from a corrupt base, so leave its delta data alone.
+	 */
+	if (!result)
+		cd.buf[0] = NULL;
+	combined_delta_release(&cd);
+	return result;
+}
+
 static void *unpack_delta_entry(struct packed_git *p,
 				struct pack_window **w_curs,
 				off_t curpos,
@@ -1837,7 +1955,23 @@ static void *unpack_delta_entry(struct packed_git *p,
 		      (uintmax_t)curpos, p->pack_name);
 		return NULL;
 	}
+	delta_data = unpack_compressed_entry(p, w_curs, curpos, delta_size);
+	if (!delta_data) {
+		error("failed to unpack compressed delta "
+		      "at offset %"PRIuMAX" from %s",
+		      (uintmax_t)curpos, p->pack_name);
+		return NULL;
+	}
 	unuse_pack(w_curs);
+
+	if (want_combined_delta(p, base_offset, delta_data, delta_size)) {
+		result = unpack_combined_delta(p, base_offset,
+					       delta_data, delta_size,
+					       type, sizep);
+		if (result)
+			return result;
+	}
+
 	base = cache_or_unpack_entry(p, base_offset, &base_size, type, 0);
 	if (!base) {
 		/*
@@ -1849,8 +1983,10 @@ static void *unpack_delta_entry(struct packed_git *p,
 		struct revindex_entry *revidx;
 		const unsigned char *base_sha1;
 		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (!revidx) {
+			free(delta_data);
 			return NULL;
+		}
 		base_sha1 = nth_packed_object_sha1(p, revidx->nr);
 		error("failed to read delta base object %s"
 		      " at offset %"PRIuMAX" from %s",
@@ -1858,18 +1994,12 @@ static void *unpack_delta_entry(struct packed_git *p,
 		      p->pack_name);
 		mark_bad_packed_object(p, base_sha1);
 		base = read_object(base_sha1, type, &base_size);
-		if (!base)
+		if (!base) {
+			free(delta_data);
 			return NULL;
+		}
 	}
 
-	delta_data = unpack_compressed_entry(p, w_curs, curpos, delta_size);
-	if (!delta_data) {
-		error("failed to unpack compressed delta "
-		      "at offset %"PRIuMAX" from %s",
-		      (uintmax_t)curpos, p->pack_name);
-		free(base);
-		return NULL;
-	}
 	result = patch_delta(base, base_size,
 			     delta_data, delta_size,
 			     sizep);
@@ -1898,8 +2028,6 @@ static void write_pack_access_log(struct packed_git *p, off_t obj_offset)
 	fflush(log_file);
 }
 
-int do_check_packed_object_crc;
-
 void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		   enum object_type *type, unsigned long *sizep)
 {
@@ -2144,9 +2272,13 @@ static int sha1_loose_object_info(const unsigned char *sha1, unsigned long *size
 	git_zstream stream;
 	char hdr[32];
 
+	/*
+	 * The caller looks in the packs next, and in a partial clone
+	 * the object may legitimately be missing; no need to complain.
+	 */
 	map = map_sha1_file(sha1, &mapsize);
 	if (!map)
-		return error("unable to find %s", sha1_to_hex(sha1));
+		return -1;
 	if (unpack_sha1_header(&stream, map, mapsize, hdr, sizeof(hdr)) < 0)
 		status = error("unable to unpack %s header",
 			       sha1_to_hex(sha1));
@@ -2184,8 +2316,12 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi)
 
 		/* Not a loose object; someone else may have just packed it. */
 		reprepare_packed_git();
-		if (!find_pack_entry(sha1, &e))
-			return status;
+		if (!find_pack_entry(sha1, &e)) {
+			/* or a partial clone left it out */
+			if (fetch_missing_object(sha1))
+				return status;
+			return sha1_object_info_extended(sha1, oi);
+		}
 	}
 
 	status = packed_object_info(e.p, e.offset, oi->sizep, &rtype);
@@ -2326,6 +2462,9 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 		die("packed object %s (stored in %s) is corrupt",
 		    sha1_to_hex(repl), p->pack_name);
 
+	if (!fetch_missing_object(repl))
+		return read_object(repl, type, size);
+
 	return NULL;
 }
 
@@ -2527,7 +2666,7 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 
 	/* Set it up */
 	memset(&stream, 0, sizeof(stream));
-	git_deflate_init(&stream, zlib_compression_level);
+	git_deflate_init_pooled(&stream, zlib_compression_level);
 	stream.next_out = compressed;
 	stream.avail_out = sizeof(compressed);
 	git_SHA1_Init(&c);
@@ -2572,6 +2711,7 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 				tmp_file, strerror(errno));
 	}
 
+	clear_abbrev_cache();
 	return move_temp_to_file(tmp_file, filename);
 }
 
@@ -71,10 +71,13 @@ static void update_candidates(struct disambiguate_state *ds, const unsigned char
 	/* otherwise, current can be discarded and candidate is still good */
 }
 
-static void find_short_object_filename(int len, const char *hex_pfx, struct disambiguate_state *ds)
+/*
+ * Return the list of object databases, our own followed by the
+ * alternates, so that alt->name/alt->base of each can be used as a
+ * temporary working space while iterating over them.
+ */
+static struct alternate_object_database *all_object_dirs(void)
 {
-	struct alternate_object_database *alt;
-	char hex[40];
 	static struct alternate_object_database *fakeent;
 
 	if (!fakeent) {
@@ -94,9 +97,16 @@ static void find_short_object_filename(int len, const char *hex_pfx, struct disa
 		fakeent->name[-1] = '/';
 	}
 	fakeent->next = alt_odb_list;
+	return fakeent;
+}
+
+static void find_short_object_filename(int len, const char *hex_pfx, struct disambiguate_state *ds)
+{
+	struct alternate_object_database *alt;
+	char hex[40];
 
 	sprintf(hex, "%.2s", hex_pfx);
-	for (alt = fakeent; alt && !ds->ambiguous; alt = alt->next) {
+	for (alt = all_object_dirs(); alt && !ds->ambiguous; alt = alt->next) {
 		struct dirent *de;
 		DIR *dir;
 		sprintf(alt->name, "%.2s/", hex_pfx);
@@ -368,26 +378,189 @@ int for_each_abbrev(const char *prefix, each_abbrev_fn fn, void *cb_data)
 	return ds.ambiguous;
 }
 
+/* The number of leading hex digits a and b have in common */
+static int common_hex_prefix(const unsigned char *a, const unsigned char *b)
+{
+	int i;
+
+	for (i = 0; i < 20; i++)
+		if (a[i] != b[i])
+			return 2 * i + !((a[i] ^ b[i]) & 0xf0);
+	return 40;
+}
+
+/*
+ * Make *len long enough for sha1 to differ from "other", unless it is
+ * the same object.
+ */
+static void extend_abbrev_len(const unsigned char *sha1,
+			      const unsigned char *other, int *len)
+{
+	int common = common_hex_prefix(sha1, other);
+
+	if (common < 40 && *len <= common)
+		*len = common + 1;
+}
+
+/*
+ * A sorted list of object names: a pack index, or the loose objects
+ * in one fan-out directory.
+ */
+struct name_list {
+	struct packed_git *p;
+	const unsigned char *names;
+	uint32_t nr;
+};
+
+static const unsigned char *list_name(const struct name_list *l, uint32_t i)
+{
+	return l->p ? nth_packed_object_sha1(l->p, i) : l->names + 20 * i;
+}
+
+/*
+ * The objects sha1 has the longest prefix in common with are its
+ * neighbours in each sorted list.
+ */
+static void extend_abbrev_len_in_list(const unsigned char *sha1,
+				      const struct name_list *l, int *len)
+{
+	uint32_t first = 0, last = l->nr;
+
+	while (first < last) {
+		uint32_t mid = (first + last) / 2;
+		if (hashcmp(list_name(l, mid), sha1) < 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	/* "first" is the first object that is not smaller than sha1 */
+	if (first < l->nr) {
+		const unsigned char *next = list_name(l, first);
+		if (!hashcmp(next, sha1) && first + 1 < l->nr)
+			next = list_name(l, first + 1);
+		extend_abbrev_len(sha1, next, len);
+	}
+	if (first)
+		extend_abbrev_len(sha1, list_name(l, first - 1), len);
+}
+
+static int pack_name_list(struct packed_git *p, struct name_list *l)
+{
+	if (open_pack_index(p) || !p->num_objects)
+		return -1;
+	l->p = p;
+	l->names = NULL;
+	l->nr = p->num_objects;
+	return 0;
+}
+
+/*
+ * The names of the loose objects in each fan-out directory of all
+ * object databases, read once and kept until clear_abbrev_cache(),
+ * which is called when we add objects, and when we look at the
+ * object store again because someone else may have.
+ */
+static struct loose_names {
+	unsigned char *names;
+	int nr, alloc;
+	unsigned loaded:1;
+} loose_names[256];
+
+static int hashcmp_void(const void *a, const void *b)
+{
+	return hashcmp(a, b);
+}
+
+static struct loose_names *read_loose_names(int subdir)
+{
+	struct loose_names *ln = &loose_names[subdir];
+	struct alternate_object_database *alt;
+	int i, nr;
+
+	if (ln->loaded)
+		return ln;
+	for (alt = all_object_dirs(); alt; alt = alt->next) {
+		struct dirent *de;
+		DIR *dir;
+
+		sprintf(alt->name, "%02x/", subdir);
+		dir = opendir(alt->base);
+		if (!dir)
+			continue;
+		while ((de = readdir(dir)) != NULL) {
+			char hex[41];
+
+			if (strlen(de->d_name) != 38)
+				continue;
+			sprintf(hex, "%02x", subdir);
+			memcpy(hex + 2, de->d_name, 39);
+			ALLOC_GROW(ln->names, 20 * (ln->nr + 1), ln->alloc);
+			if (!get_sha1_hex(hex, ln->names + 20 * ln->nr))
+				ln->nr++;
+		}
+		closedir(dir);
+	}
+
+	/* sort, and drop objects that are in more than one database */
+	qsort(ln->names, ln->nr, 20, hashcmp_void);
+	for (i = nr = 0; i < ln->nr; i++) {
+		if (nr && !hashcmp(ln->names + 20 * (nr - 1), ln->names + 20 * i))
+			continue;
+		hashcpy(ln->names + 20 * nr++, ln->names + 20 * i);
+	}
+	ln->nr = nr;
+	ln->loaded = 1;
+	return ln;
+}
+
+static void loose_name_list(int subdir, struct name_list *l)
+{
+	struct loose_names *ln = read_loose_names(subdir);
+
+	l->p = NULL;
+	l->names = ln->names;
+	l->nr = ln->nr;
+}
+
+void clear_abbrev_cache(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(loose_names); i++) {
+		free(loose_names[i].names);
+		memset(&loose_names[i], 0, sizeof(loose_names[i]));
+	}
+}
+
+/*
+ * Abbreviate sha1 to at least len hex digits, and to as many as are
+ * needed to tell it apart from all other objects (or, if we do not
+ * have it, to tell that it is not any of them).  The objects it has
+ * the longest prefix in common with are found directly: its
+ * neighbours in each pack index and among the loose objects in its
+ * fan-out directory.
+ */
 const char *find_unique_abbrev(const unsigned char *sha1, int len)
 {
-	int status, exists;
 	static char hex[41];
+	struct name_list l;
+	struct packed_git *p;
 
-	exists = has_sha1_file(sha1);
 	memcpy(hex, sha1_to_hex(sha1), 40);
 	if (len == 40 || !len)
 		return hex;
-	while (len < 40) {
-		unsigned char sha1_ret[20];
-		status = get_short_sha1(hex, len, sha1_ret, GET_SHA1_QUIETLY);
-		if (exists
-		    ? !status
-		    : status == SHORT_NAME_NOT_FOUND) {
-			hex[len] = 0;
-			return hex;
-		}
-		len++;
-	}
+	if (len < MINIMUM_ABBREV)
+		len = MINIMUM_ABBREV;
+
+	prepare_alt_odb();
+	prepare_packed_git();
+	loose_name_list(sha1[0], &l);
+	extend_abbrev_len_in_list(sha1, &l, &len);
+	for (p = packed_git; p && len < 40; p = p->next)
+		if (!pack_name_list(p, &l))
+			extend_abbrev_len_in_list(sha1, &l, &len);
+	if (len < 40)
+		hex[len] = 0;
 	return hex;
 }
 
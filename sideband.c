@@ -3,7 +3,7 @@
 
 /*
  * Receive multiplexed output stream over git native protocol.
- * in_stream is the input stream from the remote, which carries data
+ * reader reads the input stream from the remote, which carries data
  * in pkt_line format with band designator.  Demultiplex it into out
  * and err and return error appropriately.  Band #1 carries the
  * primary payload.  Things coming over band #2 is not necessarily
@@ -19,104 +19,145 @@
 
 #define FIX_SIZE 10  /* large enough for any of the above */
 
-int recv_sideband(const char *me, int in_stream, int out)
+static const char *sideband_suffix(void)
+{
+	const char *term = getenv("TERM");
+
+	if (term && strcmp(term, "dumb"))
+		return ANSI_SUFFIX;
+	return DUMB_SUFFIX;
+}
+
+/*
+ * buf holds PREFIX followed by one packet of len bytes, band designator
+ * included, with room for FIX_SIZE more bytes after it.  skip_pf says
+ * whether the last message on band #2 ended in the middle of a line.
+ */
+static int demux_packet(const char *me, char *buf, int len, int out,
+			int *skip_pf)
 {
 	unsigned pf = strlen(PREFIX);
+	const char *suffix;
 	unsigned sf;
+	int band;
+
+	if (len < 1) {
+		fprintf(stderr, "%s: protocol error: no band designator\n", me);
+		return SIDEBAND_PROTOCOL_ERROR;
+	}
+	band = buf[pf] & 0xff;
+	len--;
+	switch (band) {
+	case 3:
+		buf[pf] = ' ';
+		buf[pf+1+len] = '\0';
+		fprintf(stderr, "%s\n", buf);
+		return SIDEBAND_REMOTE_ERROR;
+	case 2:
+		suffix = sideband_suffix();
+		sf = strlen(suffix);
+		buf[pf] = ' ';
+		do {
+			char *b = buf;
+			int brk = 0;
+
+			/*
+			 * If the last buffer didn't end with a line
+			 * break then we should not print a prefix
+			 * this time around.
+			 */
+			if (*skip_pf) {
+				b += pf+1;
+			} else {
+				len += pf+1;
+				brk += pf+1;
+			}
+
+			/* Look for a line break. */
+			for (;;) {
+				brk++;
+				if (brk > len) {
+					brk = 0;
+					break;
+				}
+				if (b[brk-1] == '\n' ||
+				    b[brk-1] == '\r')
+					break;
+			}
+
+			/*
+			 * Let's insert a suffix to clear the end
+			 * of the screen line if a line break was
+			 * found.  Also, if we don't skip the
+			 * prefix, then a non-empty string must be
+			 * present too.
+			 */
+			if (brk > (*skip_pf ? 0 : (pf+1 + 1))) {
+				char save[FIX_SIZE];
+				memcpy(save, b + brk, sf);
+				b[brk + sf - 1] = b[brk - 1];
+				memcpy(b + brk - 1, suffix, sf);
+				fprintf(stderr, "%.*s", brk + sf, b);
+				memcpy(b + brk, save, sf);
+				len -= brk;
+			} else {
+				int l = brk ? brk : len;
+				fprintf(stderr, "%.*s", l, b);
+				len -= l;
+			}
+
+			*skip_pf = !brk;
+			memmove(buf + pf+1, b + brk, len);
+		} while (len);
+		return 0;
+	case 1:
+		safe_write(out, buf + pf+1, len);
+		return 0;
+	default:
+		fprintf(stderr, "%s: protocol error: bad band #%d\n",
+			me, band);
+		return SIDEBAND_PROTOCOL_ERROR;
+	}
+}
+
+int recv_sideband(const char *me, struct packet_reader *reader, int out)
+{
+	unsigned pf = strlen(PREFIX);
 	char buf[LARGE_PACKET_MAX + 2*FIX_SIZE];
-	char *suffix, *term;
 	int skip_pf = 0;
 
 	memcpy(buf, PREFIX, pf);
-	term = getenv("TERM");
-	if (term && strcmp(term, "dumb"))
-		suffix = ANSI_SUFFIX;
-	else
-		suffix = DUMB_SUFFIX;
-	sf = strlen(suffix);
-
 	while (1) {
-		int band, len;
-		len = packet_read_line(in_stream, buf + pf, LARGE_PACKET_MAX);
+		int ret, len;
+		len = packet_reader_read_line(reader, buf + pf, LARGE_PACKET_MAX);
 		if (len == 0)
 			break;
-		if (len < 1) {
-			fprintf(stderr, "%s: protocol error: no band designator\n", me);
-			return SIDEBAND_PROTOCOL_ERROR;
-		}
-		band = buf[pf] & 0xff;
-		len--;
-		switch (band) {
-		case 3:
-			buf[pf] = ' ';
-			buf[pf+1+len] = '\0';
-			fprintf(stderr, "%s\n", buf);
-			return SIDEBAND_REMOTE_ERROR;
-		case 2:
-			buf[pf] = ' ';
-			do {
-				char *b = buf;
-				int brk = 0;
-
-				/*
-				 * If the last buffer didn't end with a line
-				 * break then we should not print a prefix
-				 * this time around.
-				 */
-				if (skip_pf) {
-					b += pf+1;
-				} else {
-					len += pf+1;
-					brk += pf+1;
-				}
-
-				/* Look for a line break. */
-				for (;;) {
-					brk++;
-					if (brk > len) {
-						brk = 0;
-						break;
-					}
-					if (b[brk-1] == '\n' ||
-					    b[brk-1] == '\r')
-						break;
-				}
+		ret = demux_packet(me, buf, len, out, &skip_pf);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
 
-				/*
-				 * Let's insert a suffix to clear the end
-				 * of the screen line if a line break was
-				 * found.  Also, if we don't skip the
-				 * prefix, then a non-empty string must be
-				 * present too.
-				 */
-				if (brk > (skip_pf ? 0 : (pf+1 + 1))) {
-					char save[FIX_SIZE];
-					memcpy(save, b + brk, sf);
-					b[brk + sf - 1] = b[brk - 1];
-					memcpy(b + brk - 1, suffix, sf);
-					fprintf(stderr, "%.*s", brk + sf, b);
-					memcpy(b + brk, save, sf);
-					len -= brk;
-				} else {
-					int l = brk ? brk : len;
-					fprintf(stderr, "%.*s", l, b);
-					len -= l;
-				}
+/*
+ * Like recv_sideband(), but for a single packet the caller has already
+ * read; skip_pf must start out as 0 and be kept across the packets of
+ * one stream.
+ */
+int recv_sideband_packet(const char *me, const char *pkt, int len, int out,
+			 int *skip_pf)
+{
+	unsigned pf = strlen(PREFIX);
+	char buf[LARGE_PACKET_MAX + 2*FIX_SIZE];
 
-				skip_pf = !brk;
-				memmove(buf + pf+1, b + brk, len);
-			} while (len);
-			continue;
-		case 1:
-			safe_write(out, buf + pf+1, len);
-			continue;
-		default:
-			fprintf(stderr, "%s: protocol error: bad band #%d\n",
-				me, band);
-			return SIDEBAND_PROTOCOL_ERROR;
-		}
+	if (len > LARGE_PACKET_MAX) {
+		fprintf(stderr, "%s: protocol error: bad line length %d\n",
+			me, len);
+		return SIDEBAND_PROTOCOL_ERROR;
 	}
-	return 0;
+	memcpy(buf, PREFIX, pf);
+	memcpy(buf + pf, pkt, len);
+	return demux_packet(me, buf, len, out, skip_pf);
 }
 
 /*
@@ -7,7 +7,11 @@
 #define DEFAULT_PACKET_MAX 1000
 #define LARGE_PACKET_MAX 65520
 
-int recv_sideband(const char *me, int in_stream, int out);
+struct packet_reader;
+
+int recv_sideband(const char *me, struct packet_reader *reader, int out);
+int recv_sideband_packet(const char *me, const char *pkt, int len, int out,
+			 int *skip_pf);
 ssize_t send_sideband(int fd, int band, const char *data, ssize_t sz, int packet_max);
 
 #endif
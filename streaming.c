@@ -3,12 +3,14 @@
  */
 #include "cache.h"
 #include "streaming.h"
+#include "delta.h"
 
 enum input_source {
 	stream_error = -1,
 	incore = 0,
 	loose = 1,
-	pack_non_delta = 2
+	pack_non_delta = 2,
+	pack_delta = 3
 };
 
 typedef int (*open_istream_fn)(struct git_istream *,
@@ -41,6 +43,7 @@ struct stream_vtbl {
 static open_method_decl(incore);
 static open_method_decl(loose);
 static open_method_decl(pack_non_delta);
+static open_method_decl(pack_delta);
 static struct git_istream *attach_stream_filter(struct git_istream *st,
 						struct stream_filter *filter);
 
@@ -49,6 +52,7 @@ static open_istream_fn open_istream_tbl[] = {
 	open_istream_incore,
 	open_istream_loose,
 	open_istream_pack_non_delta,
+	open_istream_pack_delta,
 };
 
 #define FILTER_BUFFER (1024*16)
@@ -88,6 +92,12 @@ struct git_istream {
 			off_t pos;
 		} in_pack;
 
+		struct {
+			struct combined_delta cd;
+			void *base;
+			unsigned long read_ptr;
+		} in_delta;
+
 		struct filtered_istream filtered;
 	} u;
 };
@@ -121,8 +131,8 @@ static enum input_source istream_source(const unsigned char *sha1,
 	case OI_LOOSE:
 		return loose;
 	case OI_PACKED:
-		if (!oi->u.packed.is_delta && big_file_threshold < size)
-			return pack_non_delta;
+		if (big_file_threshold < size)
+			return oi->u.packed.is_delta ? pack_delta : pack_non_delta;
 		/* fallthru */
 	default:
 		return incore;
@@ -450,6 +460,69 @@ static open_method_decl(pack_non_delta)
 }
 
 
+/*****************************************************************
+ *
+ * Deltified packed object stream
+ *
+ *****************************************************************/
+
+static read_method_decl(pack_delta)
+{
+	unsigned long read_size;
+
+	read_size = combined_delta_read(&st->u.in_delta.cd,
+					st->u.in_delta.base,
+					st->u.in_delta.read_ptr, buf, sz);
+	st->u.in_delta.read_ptr += read_size;
+	return read_size;
+}
+
+static close_method_decl(pack_delta)
+{
+	combined_delta_release(&st->u.in_delta.cd);
+	free(st->u.in_delta.base);
+	return 0;
+}
+
+static struct stream_vtbl pack_delta_vtbl = {
+	close_istream_pack_delta,
+	read_istream_pack_delta,
+};
+
+/*
+ * Only the base at the bottom of the delta chain and the deltas
+ * themselves are kept in core; the object is produced from them
+ * piecemeal as it is read.
+ */
+static open_method_decl(pack_delta)
+{
+	struct combined_delta *cd = &st->u.in_delta.cd;
+	struct packed_git *p = oi->u.packed.pack;
+	off_t base_offset;
+	unsigned long base_size;
+
+	memset(cd, 0, sizeof(*cd));
+	base_offset = combine_packed_delta_chain(p, oi->u.packed.offset, cd);
+	if (!base_offset || !cd->buf_nr)
+		goto fail;
+	st->u.in_delta.base = unpack_entry(p, base_offset, type, &base_size);
+	if (!st->u.in_delta.base)
+		goto fail;
+	if (base_size != cd->src_size) {
+		free(st->u.in_delta.base);
+		goto fail;
+	}
+	st->u.in_delta.read_ptr = 0;
+	st->size = cd->dst_size;
+	st->vtbl = &pack_delta_vtbl;
+	return 0;
+
+fail:
+	combined_delta_release(cd);
+	return -1;
+}
+
+
 /*****************************************************************
  *
  * In-core stream
@@ -514,6 +587,8 @@ int stream_blob_to_fd(int fd, unsigned const char *sha1, struct stream_filter *f
 		ssize_t wrote, holeto;
 		ssize_t readlen = read_istream(st, buf, sizeof(buf));
 
+		if (readlen < 0)
+			goto close_and_exit;
 		if (!readlen)
 			break;
 		if (can_seek && sizeof(buf) == readlen) {
@@ -0,0 +1,7 @@
+#!/bin/sh
+
+# Print the names of the refs the server advertised, one per line,
+# from GIT_TRACE_PACKET output in the given files.
+advertised_refs () {
+	sed -n -e "s/^packet: *[a-z-]*< [0-9a-f]\{40\} \([^ \\]*\).*/\1/p" "$@"
+}
@@ -33,7 +33,8 @@ start_git_daemon() {
 	{
 		read line <&7
 		echo >&4 "$line"
-		cat <&7 >&4 &
+		# keep a copy for tests that check what was logged
+		tee git_daemon_log <&7 >&4 &
 	} 7<git_daemon_output &&
 
 	# Check expected output
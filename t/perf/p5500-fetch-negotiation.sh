@@ -0,0 +1,61 @@
+#!/bin/sh
+
+test_description='Tests fetch negotiation with many local-only branches'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'setup' '
+	git clone -q --bare . server.git &&
+	(
+		cd server.git &&
+		new=$(echo new | git commit-tree HEAD^{tree} -p HEAD) &&
+		git update-ref refs/heads/perf-new $new
+	) &&
+	head=$(git rev-parse HEAD) &&
+	now=$(date +%s) &&
+	for b in $(test_seq 1 50)
+	do
+		echo "commit refs/heads/perf-local-$b" &&
+		echo "committer C O Mitter <committer@example.com> $now +0000" &&
+		echo "data <<EOF" &&
+		echo "local $b" &&
+		echo "EOF" &&
+		echo "from $head" &&
+		for i in $(test_seq 1 100)
+		do
+			echo "commit refs/heads/perf-local-$b" &&
+			echo "committer C O Mitter <committer@example.com> $(($now + $i)) +0000" &&
+			echo "data <<EOF" &&
+			echo "local $b $i" &&
+			echo "EOF" || return 1
+		done
+	done | git fast-import --quiet
+'
+
+# Fetch the new commit and throw away the pack we got, so that
+# every run negotiates from the same starting point.
+fetch () {
+	git -c fetch.negotiationAlgorithm=$1 \
+		fetch-pack -k server.git refs/heads/perf-new >out &&
+	pack=$(sed -n -e "s/^pack	//p" -e "s/^keep	//p" out) &&
+	rm -f .git/objects/pack/pack-$pack.*
+}
+
+for algo in default skipping
+do
+	test_perf "fetch ($algo)" "
+		fetch $algo
+	"
+
+	test_expect_success "round trips and bytes sent ($algo)" "
+		GIT_TRACE_PACKET=\$(pwd)/trace fetch $algo &&
+		grep 'fetch-pack> ' trace >sent &&
+		echo \"$algo: \$(grep -c 'fetch-pack> 0000' sent) flushes,\" \
+		     \"\$(grep -c 'fetch-pack> have ' sent) haves,\" \
+		     \"\$(sed 's/.*fetch-pack> //' sent | wc -c) bytes\" &&
+		rm -f trace
+	"
+done
+
+test_done
@@ -0,0 +1,21 @@
+#!/bin/sh
+
+test_description='Tests clone and fetch performance over smart HTTP'
+. ./perf-lib.sh
+. "$TEST_DIRECTORY"/lib-httpd.sh
+
+test_perf_default_repo
+start_httpd
+
+test_expect_success 'setup' '
+	git clone -q --bare . "$HTTPD_DOCUMENT_ROOT_PATH/repo.git" &&
+	git --git-dir="$HTTPD_DOCUMENT_ROOT_PATH/repo.git" repack -adq
+'
+
+test_perf 'clone over smart HTTP' '
+	rm -rf clone.git &&
+	git clone -q --bare "$HTTPD_URL/smart/repo.git" clone.git
+'
+
+stop_httpd
+test_done
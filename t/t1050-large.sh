@@ -163,4 +163,34 @@ test_expect_success 'zip achiving, deflate' '
 	git archive --format=zip HEAD >/dev/null
 '
 
+test_expect_success 'stream a deltified large file' '
+	test_create_repo delta &&
+	(
+		cd delta &&
+		test-genrandom "base" $(( 1400 * 1024 )) >base &&
+		cp base grown &&
+		test-genrandom "tail" $(( 200 * 1024 )) >>grown &&
+		# fast-import deltifies against the previous blob even
+		# when it is the smaller one, unlike pack-objects
+		for f in base grown
+		do
+			echo blob &&
+			echo "data $(wc -c <$f)" &&
+			cat $f &&
+			echo || return 1
+		done >input &&
+		GIT_ALLOC_LIMIT=0 git -c core.bigfilethreshold=10m \
+			fast-import <input &&
+		GIT_ALLOC_LIMIT=0 git verify-pack -v \
+			.git/objects/pack/pack-*.idx >verify &&
+		grep "chain length = 1" verify &&
+		grown=$(git hash-object grown) &&
+		git cat-file blob $grown >actual &&
+		cmp grown actual &&
+		git update-index --add --cacheinfo 100644 $grown file &&
+		git checkout file &&
+		cmp grown file
+	)
+'
+
 test_done
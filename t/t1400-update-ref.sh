@@ -284,4 +284,93 @@ test_expect_success \
 	'git cat-file blob master@{2005-05-26 23:42}:F (expect OTHER)' \
 	'test OTHER = $(git cat-file blob "master@{2005-05-26 23:42}:F")'
 
+test_expect_success 'stdin: setup' '
+	A=$(git rev-parse master~1) &&
+	B=$(git rev-parse master) &&
+	for i in 1 2 3 4
+	do
+		git update-ref refs/batch/p$i $A || return 1
+	done &&
+	git pack-refs --all &&
+	git update-ref refs/batch/loose $A
+'
+
+test_expect_success 'stdin: updates, creates and deletes together' '
+	cat >stdin <<-EOF &&
+	update refs/batch/p1 $B $A
+	create refs/batch/new $B
+	delete refs/batch/p2 $A
+	delete refs/batch/p3
+	delete refs/batch/loose
+	EOF
+	git update-ref --stdin <stdin &&
+	test "$(git rev-parse refs/batch/p1)" = $B &&
+	test "$(git rev-parse refs/batch/new)" = $B &&
+	test_must_fail git rev-parse --verify -q refs/batch/p2 &&
+	test_must_fail git rev-parse --verify -q refs/batch/p3 &&
+	test_must_fail git rev-parse --verify -q refs/batch/loose &&
+	! grep refs/batch/p2 .git/packed-refs &&
+	! grep refs/batch/p3 .git/packed-refs &&
+	grep refs/batch/p4 .git/packed-refs
+'
+
+test_expect_success 'stdin: nothing changes if an old value is wrong' '
+	cat >stdin <<-EOF &&
+	update refs/batch/p4 $B $A
+	create refs/batch/new $A
+	EOF
+	test_must_fail git update-ref --stdin <stdin &&
+	test "$(git rev-parse refs/batch/p4)" = $A
+'
+
+test_expect_success 'stdin: a ref may only be updated once' '
+	cat >stdin <<-EOF &&
+	update refs/batch/p4 $B
+	delete refs/batch/p4
+	EOF
+	test_must_fail git update-ref --stdin <stdin &&
+	test "$(git rev-parse refs/batch/p4)" = $A
+'
+
+test_expect_success 'stdin: option no-deref' '
+	git symbolic-ref refs/batch/sym refs/batch/p4 &&
+	cat >stdin <<-EOF &&
+	option no-deref
+	update refs/batch/sym $B
+	EOF
+	git update-ref --stdin <stdin &&
+	test "$(git rev-parse refs/batch/sym)" = $B &&
+	test "$(git rev-parse refs/batch/p4)" = $A &&
+	test_must_fail git symbolic-ref refs/batch/sym
+'
+
+test_expect_success 'stdin: malformed input is rejected' '
+	echo "frobnicate refs/batch/p4" >stdin &&
+	test_must_fail git update-ref --stdin <stdin &&
+	echo "update refs/batch/p4" >stdin &&
+	test_must_fail git update-ref --stdin <stdin &&
+	echo "option no-deref" >stdin &&
+	test_must_fail git update-ref --stdin <stdin &&
+	test "$(git rev-parse refs/batch/p4)" = $A
+'
+
+test_lazy_prereq ULIMIT_FILE_DESCRIPTORS '
+	(ulimit -n 64)
+'
+
+test_expect_success ULIMIT_FILE_DESCRIPTORS 'stdin: batches larger than the descriptor limit' '
+	for i in $(test_seq 600)
+	do
+		echo "create refs/many/b$i $A" || return 1
+	done >stdin &&
+	(ulimit -n 64 && git update-ref --stdin <stdin) &&
+	git for-each-ref refs/many >refs &&
+	test_line_count = 600 refs &&
+	git pack-refs --all &&
+	sed -e "s/^create \([^ ]*\) .*/delete \1/" stdin >stdin.del &&
+	(ulimit -n 64 && git update-ref --stdin <stdin.del) &&
+	git for-each-ref refs/many >refs &&
+	test_line_count = 0 refs
+'
+
 test_done
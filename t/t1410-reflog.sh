@@ -245,4 +245,46 @@ test_expect_success 'gc.reflogexpire=false' '
 
 '
 
+test_expect_success 'setup a long reflog' '
+	A=$(git rev-parse master) &&
+	B=$(git rev-parse master^) &&
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		test_tick &&
+		case $i in
+		*[02468]) new=$A ;;
+		*) new=$B ;;
+		esac &&
+		git update-ref -m "step $i" refs/heads/long $new || return 1
+		if test $i = 10
+		then
+			cutoff=$test_tick
+		fi
+	done &&
+	test_line_count = 20 .git/logs/refs/heads/long
+'
+
+test_expect_success 'reflog entries are found by date' '
+	echo $A >expect &&
+	git rev-parse "long@{$cutoff}" >actual &&
+	test_cmp expect actual &&
+	git rev-parse "long@{$(($cutoff + 30))}" >actual &&
+	test_cmp expect actual &&
+	echo $B >expect &&
+	git rev-parse "long@{$(($cutoff + 60))}" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'expire copies the recent entries as they are' '
+	cp .git/logs/refs/heads/long full &&
+	git reflog expire --verbose --expire=$cutoff \
+		--expire-unreachable=$cutoff refs/heads/long >/dev/null &&
+	cp .git/logs/refs/heads/long expect &&
+	test_line_count = 11 expect &&
+	cp full .git/logs/refs/heads/long &&
+	git reflog expire --expire=$cutoff \
+		--expire-unreachable=$cutoff refs/heads/long &&
+	test_cmp expect .git/logs/refs/heads/long
+'
+
 test_done
@@ -211,6 +211,18 @@ test_expect_success 'rev-list --verify-objects with bad sha1' '
 	grep -q "error: sha1 mismatch 63ffffffffffffffffffffffffffffffffffffff" out
 '
 
+test_expect_success 'garbage in a loose object is reported cleanly' '
+	sha=$(echo garbage | git hash-object -w --stdin) &&
+	file=$(sha1_file $sha) &&
+	test_when_finished "remove_object $sha" &&
+	chmod +w $file &&
+	echo garbage >$file &&
+	test_must_fail git cat-file blob $sha 2>out &&
+	cat out &&
+	grep "unable to unpack $sha header" out &&
+	! grep inflateEnd out
+'
+
 _bz='\0'
 _bz5="$_bz$_bz$_bz$_bz$_bz"
 _bz20="$_bz5$_bz5$_bz5$_bz5"
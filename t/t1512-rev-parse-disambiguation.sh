@@ -261,4 +261,44 @@ test_expect_success 'rev-parse --disambiguate' '
 	test "$(sed -e "s/^\(.........\).*/\1/" actual | sort -u)" = 000000000
 '
 
+test_expect_success 'abbreviations are unique and as short as possible' '
+	git repack -a -d &&
+	git rev-parse --disambiguate=000000000 >objects &&
+	while read sha1
+	do
+		short=$(git rev-parse --short=4 $sha1) &&
+		test "$(git rev-parse --verify -q $short)" = $sha1 &&
+		test_must_fail git rev-parse --verify -q ${short%?} || return 1
+	done <objects
+'
+
+test_expect_success 'abbreviations do not change in bulk' '
+	git cat-file --batch-check <objects >types &&
+	while read sha1 type size
+	do
+		case "$type" in
+		blob) echo "100644 blob $sha1" ;;
+		tree) echo "040000 tree $sha1" ;;
+		commit) echo "160000 commit $sha1" ;;
+		esac
+	done <types >entries &&
+	for i in $(test_seq 100)
+	do
+		awk -v i=$i "{ print \$0 \"\t\" i \"-\" \$3 }" entries ||
+		return 1
+	done >many &&
+	tree=$(git mktree <many) &&
+	git ls-tree --abbrev=4 $tree >actual &&
+	test $(wc -l <actual) -gt 1024 &&
+	while read mode type sha1 name
+	do
+		echo "$(git rev-parse --short=4 $sha1) ${name#*-}" || return 1
+	done <many | sort -u >expect &&
+	while read mode type short name
+	do
+		echo "$short ${name#*-}" || return 1
+	done <actual | sort -u >actual.uniq &&
+	test_cmp expect actual.uniq
+'
+
 test_done
@@ -804,4 +804,16 @@ test_expect_success '--merged catches invalid object names' '
 	test_must_fail git branch --merged 0000000000000000000000000000000000000000
 '
 
+test_expect_success 'renaming finds name conflicts in nested directories' '
+	git branch --no-track nest/a/b/c master &&
+	git branch --no-track nest-x master &&
+	test_must_fail git branch -m nest-x nest/a 2>err &&
+	grep "refs/heads/nest/a/b/c.* exists" err &&
+	test_must_fail git branch -m nest-x nest/a/b/c/d 2>err &&
+	grep "refs/heads/nest/a/b/c.* exists" err &&
+	git branch -m nest/a/b/c nest/a/b/c/d &&
+	git show-ref --verify refs/heads/nest/a/b/c/d &&
+	git branch -D nest/a/b/c/d nest-x
+'
+
 test_done
@@ -95,4 +95,26 @@ test_expect_success 'master: branch --no-merged' '
 
 '
 
+test_expect_success 'branch --contains with branches along one history' '
+
+	git checkout -b chain master &&
+	for i in 1 2 3 4 5
+	do
+		test_commit chain-$i &&
+		git branch b$i || return 1
+	done &&
+	git branch --contains b3 >actual &&
+	{
+		echo "  b3" && echo "  b4" && echo "  b5" && echo "* chain"
+	} >expect &&
+	test_cmp expect actual &&
+	git branch --contains master >actual &&
+	{
+		echo "  b1" && echo "  b2" && echo "  b3" && echo "  b4" &&
+		echo "  b5" && echo "* chain" && echo "  master" && echo "  side"
+	} >expect &&
+	test_cmp expect actual
+
+'
+
 test_done
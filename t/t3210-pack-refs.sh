@@ -118,4 +118,51 @@ test_expect_success 'pack, prune and repack' '
 	test_cmp all-of-them again
 '
 
+test_expect_success 'refs are looked up in a sorted packed-refs' '
+	git init sorted &&
+	(
+		cd sorted &&
+		test_commit one &&
+		git tag -a -m annotated annotated &&
+		one=$(git rev-parse one) &&
+		tag=$(git rev-parse annotated) &&
+		rm -f .git/refs/tags/* &&
+		{
+			echo "# pack-refs with: peeled sorted " &&
+			for i in $(test_seq 100 599)
+			do
+				echo "$one refs/heads/b$i" || return 1
+			done &&
+			echo "$one refs/heads/c/d" &&
+			echo "$tag refs/tags/annotated" &&
+			echo "^$one" &&
+			echo "$one refs/tags/one"
+		} >.git/packed-refs &&
+		test "$(git rev-parse b345)" = $one &&
+		test_must_fail git rev-parse --verify b600 &&
+		test "$(git rev-parse annotated^{})" = $one &&
+		git show-ref -d annotated >actual &&
+		printf "%s refs/tags/annotated\n%s refs/tags/annotated^{}\n" \
+			$tag $one >expect &&
+		test_cmp expect actual &&
+		git for-each-ref --format="%(refname)" refs/tags >actual &&
+		printf "refs/tags/annotated\nrefs/tags/one\n" >expect &&
+		test_cmp expect actual &&
+		test_must_fail git branch b345/x &&
+		test_must_fail git branch c &&
+		git branch b345x
+	)
+'
+
+test_expect_success 'deleting a packed ref keeps packed-refs sorted' '
+	(
+		cd sorted &&
+		git branch -d b345 &&
+		test_must_fail git rev-parse --verify b345 &&
+		test "$(head -n 1 .git/packed-refs)" = "# pack-refs with: sorted " &&
+		git show-ref >actual &&
+		test_line_count = 504 actual
+	)
+'
+
 test_done
@@ -0,0 +1,97 @@
+#!/bin/sh
+
+test_description='git pack-refs --table keeps packed refs in ref tables'
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated &&
+	for b in a b c d/e d/f
+	do
+		git branch $b || return 1
+	done &&
+	git show-ref -d >expect &&
+	git pack-refs --all --table &&
+	test -f .git/reftable/tables.list &&
+	! test -f .git/packed-refs &&
+	! test -f .git/refs/heads/a
+'
+
+test_expect_success 'packed refs are read from the tables' '
+	git show-ref -d >actual &&
+	test_cmp expect actual &&
+	git rev-parse --verify d/e &&
+	test "$(git rev-parse annotated^{})" = "$(git rev-parse two)"
+'
+
+test_expect_success 'iterating over a prefix' '
+	git for-each-ref --format="%(refname)" refs/heads/d >actual &&
+	printf "refs/heads/d/e\nrefs/heads/d/f\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'deleting a packed ref stacks a table' '
+	git branch -d b &&
+	test_line_count = 2 .git/reftable/tables.list &&
+	test_must_fail git rev-parse --verify b &&
+	git rev-parse --verify a
+'
+
+test_expect_success 'name conflicts with packed refs are noticed' '
+	test_must_fail git branch a/x &&
+	test_must_fail git branch d &&
+	git branch b/x
+'
+
+test_expect_success 'many refs, deleted one by one' '
+	git init many &&
+	(
+		cd many &&
+		test_commit base &&
+		head=$(git rev-parse HEAD) &&
+		for i in $(test_seq 1000)
+		do
+			echo "$head refs/heads/branch-$i"
+		done >.git/packed-refs &&
+		git pack-refs --all --table &&
+		git show-ref >expect &&
+		test_line_count = 1002 expect &&
+		test "$(git rev-parse branch-777)" = $head &&
+		for i in $(test_seq 100 150)
+		do
+			git branch -d branch-$i >/dev/null || return 1
+		done &&
+		test_must_fail git rev-parse --verify branch-120 &&
+		git show-ref >actual &&
+		test_line_count = 951 actual &&
+		test $(wc -l <.git/reftable/tables.list) -le 5
+	)
+'
+
+test_expect_success 'pack-refs keeps using the tables' '
+	git branch new &&
+	git pack-refs --all &&
+	test_line_count = 1 .git/reftable/tables.list &&
+	! test -f .git/packed-refs &&
+	git rev-parse --verify new
+'
+
+test_expect_success 'a corrupt table is noticed' '
+	cp -r .git corrupt.git &&
+	table=$(cat corrupt.git/reftable/tables.list) &&
+	chmod +w corrupt.git/reftable/$table &&
+	echo garbage >>corrupt.git/reftable/$table &&
+	test_must_fail git --git-dir=corrupt.git show-ref
+'
+
+test_expect_success 'pack-refs --no-table goes back to packed-refs' '
+	git show-ref -d >expect &&
+	git pack-refs --all --no-table &&
+	! test -d .git/reftable &&
+	test -f .git/packed-refs &&
+	git show-ref -d >actual &&
+	test_cmp expect actual
+'
+
+test_done
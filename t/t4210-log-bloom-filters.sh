@@ -0,0 +1,141 @@
+#!/bin/sh
+
+test_description='path-limited log with changed-path filters'
+
+. ./test-lib.sh
+
+filters=.git/objects/info/bloom-filters
+
+test_expect_success 'setup' '
+	mkdir -p dir/sub other &&
+	test_commit first a &&
+	test_commit b dir/b &&
+	test_commit c dir/sub/c &&
+	test_commit d other/d &&
+	git checkout -b side HEAD^ &&
+	test_commit side-b dir/b &&
+	test_commit side-e dir/sub/e &&
+	git checkout master &&
+	test_commit second a &&
+	test_tick &&
+	git merge -m merge side &&
+	git rm -q dir/sub/c &&
+	test_tick &&
+	git commit -m "remove c" &&
+	git mv other/d dir/d &&
+	test_tick &&
+	git commit -m "move d" &&
+	for i in $(test_seq 600)
+	do
+		echo $i >other/many-$i || return 1
+	done &&
+	git add other &&
+	test_tick &&
+	git commit -m many &&
+	test_commit third a
+'
+
+paths="a dir dir/ dir/b dir/sub dir/sub/c dir/sub/e dir/d other other/d
+other/many-42 missing dir/missing a,dir/sub other,dir/d"
+
+log_all () {
+	for p in $paths
+	do
+		for opts in "" "--full-history" "--simplify-merges" \
+			    "--full-history --parents" "--topo-order --raw"
+		do
+			echo "== $opts -- $p" &&
+			git log --format="%s %p" $opts -- $(echo $p | tr , " ") ||
+			return 1
+		done
+	done
+}
+
+test_expect_success 'log without filters' '
+	test_path_is_missing $filters &&
+	log_all >expect
+'
+
+test_expect_success 'write-bloom-filters' '
+	git write-bloom-filters &&
+	test_path_is_file $filters
+'
+
+test_expect_success 'path-limited log is the same with filters' '
+	log_all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'filters are not used for wildcards' '
+	git log --format=%s -- "dir/*" >actual.glob &&
+	rm $filters &&
+	git log --format=%s -- "dir/*" >expect.glob &&
+	git write-bloom-filters &&
+	test_cmp expect.glob actual.glob
+'
+
+test_expect_success 'filters spare the tree diff' '
+	rm -rf copy &&
+	git clone -q --no-local . copy &&
+	(
+		cd copy &&
+		mv .git/objects/pack/*.pack ../copy.pack &&
+		rm .git/objects/pack/* &&
+		git unpack-objects -q <../copy.pack &&
+		test_commit only-other other/x &&
+		git write-bloom-filters &&
+		tree=$(git rev-parse HEAD^{tree}) &&
+		rm .git/objects/$(echo $tree | sed "s/^../&\//") &&
+		git log --format=%s -- a >actual &&
+		git log --format=%s master@{1} -- a >expect &&
+		test_cmp expect actual &&
+		rm .git/objects/info/bloom-filters &&
+		test_must_fail git log --format=%s -- a
+	)
+'
+
+test_expect_success 'new commits are added to existing filters' '
+	test_commit fourth dir/sub/c &&
+	log_all >expect &&
+	git write-bloom-filters &&
+	log_all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'filters are ignored with grafts' '
+	echo "$(git rev-parse HEAD) $(git rev-parse HEAD~5)" >.git/info/grafts &&
+	git log --format=%s -- a >actual.graft &&
+	mv $filters filters.save &&
+	git log --format=%s -- a >expect.graft &&
+	mv filters.save $filters &&
+	rm .git/info/grafts &&
+	test_cmp expect.graft actual.graft
+'
+
+test_expect_success 'write-bloom-filters removes filters with grafts' '
+	echo "$(git rev-parse HEAD) $(git rev-parse HEAD~5)" >.git/info/grafts &&
+	git write-bloom-filters 2>err &&
+	rm .git/info/grafts &&
+	grep "not writing" err &&
+	test_path_is_missing $filters
+'
+
+test_expect_success 'gc writes filters with gc.bloomFilters' '
+	git gc &&
+	test_path_is_missing $filters &&
+	git config gc.bloomFilters true &&
+	git gc &&
+	test_path_is_file $filters &&
+	log_all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'corrupt filters are ignored' '
+	test_when_finished "rm -f $filters" &&
+	printf "BLMF" >$filters &&
+	log_all >actual 2>err &&
+	test_cmp expect actual &&
+	grep corrupt err
+'
+
+test_done
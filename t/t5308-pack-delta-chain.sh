@@ -0,0 +1,54 @@
+#!/bin/sh
+
+test_description='reading objects through long delta chains'
+. ./test-lib.sh
+
+test_expect_success 'setup deep delta chain' '
+	for i in $(test_seq 1 200)
+	do
+		echo "line $i of a file that will be edited many times"
+	done >file &&
+	for i in $(test_seq 1 30)
+	do
+		sed -e "$((i * 5))s/\$/ (edit $i)/" <file >file.new &&
+		mv file.new file &&
+		cp file expect.$i &&
+		git add file &&
+		test_tick &&
+		git commit -q -m "edit $i" || return 1
+	done &&
+	for i in $(test_seq 1 10)
+	do
+		git checkout -q -b side$i HEAD~$((i * 2)) &&
+		sed -e "$((i * 7))s/\$/ (side $i)/" <file >file.new &&
+		mv file.new file &&
+		git commit -q -a -m "side $i" &&
+		git checkout -q master || return 1
+	done &&
+	git repack -adf --depth=50 --window=50 &&
+	git verify-pack -v .git/objects/pack/pack-*.idx >verify &&
+	grep "chain length = [1-9][0-9]" verify
+'
+
+test_expect_success 'objects read through a combined delta chain' '
+	for i in $(test_seq 1 30)
+	do
+		git -c core.deltaBaseCacheLimit=0 \
+			cat-file blob HEAD~$((30 - i)):file >actual &&
+		test_cmp expect.$i actual || return 1
+	done
+'
+
+test_expect_success 'log -p with a tiny delta base cache' '
+	git log -p >expect &&
+	git -c core.deltaBaseCacheLimit=0 log -p >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index-pack rebuilds evicted bases from folded chains' '
+	pack=$(echo .git/objects/pack/pack-*.pack) &&
+	git -c core.deltaBaseCacheLimit=0 index-pack -o tmp.idx $pack &&
+	cmp ${pack%.pack}.idx tmp.idx
+'
+
+test_done
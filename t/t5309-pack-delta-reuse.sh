@@ -0,0 +1,82 @@
+#!/bin/sh
+
+test_description='pack-objects reuses deltas found in other packs'
+. ./test-lib.sh
+
+make_pack () {
+	git pack-objects "$@" .git/objects/pack/pack
+}
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 100)
+	do
+		echo "line $i"
+	done >big &&
+	sed -e 50q <big >small &&
+	echo "x $(cat big)" >x &&
+	echo "y $(cat big)" >y &&
+	big=$(git hash-object -w big) &&
+	small=$(git hash-object -w small) &&
+	x=$(git hash-object -w x) &&
+	y=$(git hash-object -w y)
+'
+
+test_expect_success 'delta in an older pack is reused' '
+	delta_pack=$(printf "%s\n" $big $small | make_pack) &&
+	test-chmtime =-100 .git/objects/pack/pack-$delta_pack.* &&
+	full_pack=$(echo $small | make_pack) &&
+	git verify-pack -v .git/objects/pack/pack-$full_pack.idx >verify &&
+	! grep "chain length" verify &&
+	printf "%s\n" $big $small |
+	git pack-objects --window=0 --delta-base-offset out >name &&
+	git verify-pack -v out-$(cat name).idx >verify &&
+	grep "^$small .* $big\$" verify &&
+	git index-pack --stdin <out-$(cat name).pack
+'
+
+test_expect_success 'crossing deltas between packs do not form a cycle' '
+	xy=$(printf "%s\n" $x $y | make_pack) &&
+	test-chmtime =-50 .git/objects/pack/pack-$xy.* &&
+	yx=$(printf "%s\n" $y $x $big | make_pack --no-reuse-delta) &&
+	git verify-pack -v .git/objects/pack/pack-$xy.idx >verify &&
+	grep "^$y .* $x\$" verify &&
+	git verify-pack -v .git/objects/pack/pack-$yx.idx >verify &&
+	grep "^$x .* $y\$" verify &&
+	printf "%s\n" $x $y |
+	git pack-objects --window=0 cycle >name 2>err &&
+	! grep "recursive delta" err &&
+	git verify-pack -v cycle-$(cat name).idx >verify &&
+	grep "chain length = 1: 1 object" verify
+'
+
+test_expect_success 'deltas from other packs stay within --depth' '
+	for i in $(test_seq 1 100)
+	do
+		echo "chain $i"
+	done >top &&
+	sed -e 70q <top >mid &&
+	sed -e 40q <top >bottom &&
+	top=$(git hash-object -w top) &&
+	mid=$(git hash-object -w mid) &&
+	bottom=$(git hash-object -w bottom) &&
+	mid_pack=$(printf "%s\n" $top $mid | make_pack) &&
+	git verify-pack -v .git/objects/pack/pack-$mid_pack.idx >verify &&
+	grep "^$mid .* $top\$" verify &&
+	# bottom comes whole and before mid, whose delta is reused
+	new_pack=$(printf "%s\n" $bottom $top $mid | make_pack --window=0) &&
+	rm .git/objects/pack/pack-$mid_pack.* &&
+	git verify-pack -v .git/objects/pack/pack-$new_pack.idx >verify &&
+	grep "^$mid .* $top\$" verify &&
+	! grep "^$bottom .* 1 [0-9a-f]*\$" verify &&
+	old_pack=$(printf "%s\n" $mid $bottom | make_pack --no-reuse-delta) &&
+	test-chmtime =-100 .git/objects/pack/pack-$old_pack.* &&
+	git verify-pack -v .git/objects/pack/pack-$old_pack.idx >verify &&
+	grep "^$bottom .* $mid\$" verify &&
+	printf "%s\n" $top $mid $bottom |
+	git pack-objects --depth=1 deep >name &&
+	git verify-pack -v deep-$(cat name).idx >verify &&
+	! grep "chain length = 2" verify &&
+	git index-pack --stdin <deep-$(cat name).pack
+'
+
+test_done
@@ -0,0 +1,107 @@
+#!/bin/sh
+
+test_description='pack-objects --pipeline'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 200)
+	do
+		echo "line $i"
+	done >file &&
+	for i in $(test_seq 1 10)
+	do
+		echo "change $i" >>file &&
+		cp file copy-$i &&
+		git add file copy-$i &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git tag -a -m "tag" v1 HEAD~5 &&
+	git repack -a -d &&
+	git rev-list --objects --all >objects
+'
+
+pack_and_index () {
+	name=$1 &&
+	shift &&
+	git pack-objects --stdout --no-reuse-delta "$@" <objects >$name.pack &&
+	git index-pack -o $name.idx $name.pack &&
+	git verify-pack -v $name.idx >$name.verify &&
+	sed -n "s/^\([0-9a-f]\{40\}\) \([a-z]*\) .*/\1 \2/p" <$name.verify >$name.order &&
+	cut -d" " -f1 <$name.order | sort >$name.objects
+}
+
+test_expect_success 'pipelined pack has the same objects' '
+	pack_and_index normal &&
+	pack_and_index pipelined --pipeline &&
+	test_cmp normal.objects pipelined.objects &&
+	test_line_count = $(wc -l <objects) normal.objects
+'
+
+test_expect_success 'commits and tags come first and are not deltified' '
+	awk "\$2 == \"commit\" || \$2 == \"tag\" { print NR }" \
+		<pipelined.order >head &&
+	test_line_count = 11 head &&
+	test "$(tail -n 1 head)" = 11 &&
+	awk "NF == 7 { print \$2 }" <pipelined.verify >deltified &&
+	! grep -e commit -e tag deltified &&
+	grep blob deltified
+'
+
+test_expect_success 'pipelining with a single search thread' '
+	pack_and_index single --pipeline --threads=1 &&
+	test_cmp normal.objects single.objects
+'
+
+test_expect_success 'pack.pipeline is honored' '
+	git -c pack.pipeline=true pack-objects --stdout <objects >config.pack &&
+	git index-pack -o config.idx config.pack &&
+	git verify-pack config.idx
+'
+
+test_expect_success 'pipelined pack shows how much was written' '
+	git pack-objects --stdout --pipeline --progress --all-progress \
+		<objects >progress.pack 2>err &&
+	n=$(wc -l <objects) &&
+	grep "Writing objects: 100% ($n/$n), [0-9.]* \(bytes\|KiB\)" err
+'
+
+test_expect_success 'reused deltas against what the other side has go early' '
+	git init thin &&
+	(
+		cd thin &&
+		for i in $(test_seq 1 5)
+		do
+			echo $i >other-$i || return 1
+		done &&
+		# the largest version is the base of the others
+		for n in 100 200 199
+		do
+			for i in $(test_seq 1 $n)
+			do
+				echo "line $i"
+			done >file &&
+			git add file other-* &&
+			test_tick &&
+			git commit -q -m "$n lines" || return 1
+		done &&
+		git repack -a -d &&
+		git branch old HEAD~1 &&
+		printf "HEAD\n^HEAD~1\n" >revs &&
+		git pack-objects --stdout --thin --revs --pipeline \
+			<revs >../thin.pack
+	) &&
+	git init thin-dst &&
+	(
+		cd thin-dst &&
+		git fetch ../thin old &&
+		git index-pack --stdin --fix-thin <../thin.pack >pack &&
+		git verify-pack -v .git/objects/pack/pack-$(cut -f2 <pack).idx |
+		sed -n "s/^[0-9a-f]\{40\} \([a-z]*\) .*/\1/p" >order &&
+		printf "%s\n" commit blob tree >expect &&
+		head -n 3 order >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_done
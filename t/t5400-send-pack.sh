@@ -256,4 +256,22 @@ test_expect_success 'deny pushing to delete current branch' '
 	)
 '
 
+test_expect_success 'receive-pack reads a pack that arrives with the commands' '
+	rm -rf relay.git &&
+	git init --bare relay.git &&
+	git --git-dir=relay.git config receive.unpackLimit 1 &&
+	commit=$(git rev-parse --verify master) &&
+	{
+		printf "0075%s %s refs/heads/relay\0report-status\n0000" \
+			$_z40 $commit &&
+		echo $commit | git pack-objects --revs --stdout
+	} >input &&
+	git receive-pack --stateless-rpc relay.git <input >output &&
+	grep "ok refs/heads/relay" output &&
+	echo $commit >expect &&
+	git --git-dir=relay.git rev-parse --verify relay >actual &&
+	test_cmp expect actual &&
+	git --git-dir=relay.git fsck
+'
+
 test_done
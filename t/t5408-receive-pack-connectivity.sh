@@ -0,0 +1,72 @@
+#!/bin/sh
+
+test_description='receive-pack connectivity check from index-pack report'
+. ./test-lib.sh
+
+test_expect_success setup '
+	echo a >a &&
+	echo b >b &&
+	git add a b &&
+	git commit -m one &&
+	git tag one &&
+	echo a2 >a &&
+	git commit -a -m two &&
+	git tag two &&
+	git init --bare dst.git &&
+	(
+		cd dst.git &&
+		git config receive.unpackLimit 1 &&
+		git config receive.quickConnectivityCheck true
+	) &&
+	git push dst.git one:refs/heads/master
+'
+
+test_expect_success 'index-pack --report-external lists outside links' '
+	printf "two\n^one\n" |
+	git pack-objects --revs --stdout >two.pack &&
+	git init idx &&
+	(
+		cd idx &&
+		git index-pack --stdin --report-external <../two.pack >../out
+	) &&
+	test -z "$(tail -n 1 out)" &&
+	sed -e 1d -e "/^\$/d" out | sort >actual &&
+	git rev-parse one one:b | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'push into pack skips the history walk' '
+	GIT_TRACE="$(pwd)/trace" git push dst.git two:refs/heads/master &&
+	test "$(git --git-dir=dst.git rev-parse master)" = \
+	     "$(git rev-parse two)" &&
+	! grep "rev-list" trace
+'
+
+test_expect_success 'ref outside the pack falls back to a full check' '
+	git checkout -b side one &&
+	echo side >b &&
+	git commit -a -m side &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git push dst.git \
+		side:refs/heads/side one:refs/heads/old &&
+	test "$(git --git-dir=dst.git rev-parse old)" = \
+	     "$(git rev-parse one)" &&
+	grep "rev-list" trace
+'
+
+test_expect_success 'missing external object triggers a full check' '
+	b=$(git rev-parse one:b) &&
+	git init --bare broken.git &&
+	git push broken.git one:refs/heads/master &&
+	(
+		cd broken.git &&
+		git config receive.unpackLimit 1 &&
+		git config receive.quickConnectivityCheck true
+	) &&
+	rm -f broken.git/objects/$(echo $b | sed -e "s|^..|&/|") &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git push broken.git two:refs/heads/master &&
+	grep "rev-list" trace
+'
+
+test_done
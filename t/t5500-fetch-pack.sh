@@ -442,4 +442,110 @@ test_expect_success 'test --all, --depth, and explicit tag' '
 	) >out-adt 2>error-adt
 '
 
+test_expect_success 'setup for skipping negotiation' '
+	git init skip-server &&
+	(
+		cd skip-server &&
+		test_commit base &&
+		test_commit shared
+	) &&
+	git clone skip-server skip-client &&
+	(
+		cd skip-client &&
+		for i in $(test_seq 1 100)
+		do
+			test_commit local-$i || return 1
+		done
+	) &&
+	cp -R skip-client skip-default &&
+	(
+		cd skip-server &&
+		test_commit new
+	)
+'
+
+test_expect_success 'skipping negotiation sends fewer haves' '
+	(
+		cd skip-default &&
+		git fetch-pack -v ../skip-server refs/heads/master >out 2>err &&
+		git cat-file -e $(cut -d" " -f1 out)
+	) &&
+	(
+		cd skip-client &&
+		git -c fetch.negotiationAlgorithm=skipping \
+			fetch-pack -v ../skip-server refs/heads/master >out 2>err &&
+		git cat-file -e $(cut -d" " -f1 out) &&
+		grep "^have $(git rev-parse shared)" err
+	) &&
+	test $(grep -c "^have " skip-client/err) -lt \
+	     $(grep -c "^have " skip-default/err)
+'
+
+test_expect_success 'unknown negotiation algorithm is rejected' '
+	(
+		cd skip-client &&
+		test_must_fail git -c fetch.negotiationAlgorithm=bogus \
+			fetch-pack ../skip-server refs/heads/master
+	)
+'
+
+advertised_refs () {
+	tr "\000" "\012" |
+	sed -n -e "s/^[0-9a-f]\{4\}[0-9a-f]\{40\} //p"
+}
+
+test_expect_success 'upload-pack limits advertisement to --ref-prefix' '
+	git init prefix-server &&
+	(
+		cd prefix-server &&
+		test_commit one &&
+		git branch side &&
+		git tag -a -m annotated annotated &&
+		git upload-pack --advertise-refs --stateless-rpc \
+			--ref-prefix=refs/tags/ . >adv &&
+		advertised_refs <adv >actual &&
+		cat >expect <<-\EOF &&
+		refs/tags/annotated
+		refs/tags/annotated^{}
+		refs/tags/one
+		EOF
+		test_cmp expect actual &&
+		git upload-pack --advertise-refs --stateless-rpc \
+			--ref-prefix=HEAD --ref-prefix=refs/heads/side \
+			--ref-prefix=refs/heads/ . >adv &&
+		advertised_refs <adv >actual &&
+		cat >expect <<-\EOF &&
+		HEAD
+		refs/heads/master
+		refs/heads/side
+		EOF
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'fetch-pack asks only for the refs it wants' '
+	git init prefix-client &&
+	(
+		cd prefix-client &&
+		git fetch-pack ../prefix-server refs/heads/side >out &&
+		git cat-file -e $(cut -d" " -f1 out)
+	)
+'
+
+test_expect_success 'wanting every advertised ref does not pack all refs' '
+	(
+		cd prefix-server &&
+		git checkout -b unadvertised &&
+		test_commit unadvertised &&
+		printf "0032want %s\n00000009done\n" $(git rev-parse side) |
+		git upload-pack --stateless-rpc --ref-prefix=refs/heads/side . >out &&
+		tail -c +9 out >side.pack &&
+		git index-pack side.pack &&
+		git verify-pack -v side.pack >objs &&
+		git rev-parse side >expect &&
+		grep commit objs | cut -d" " -f1 >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
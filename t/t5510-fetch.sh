@@ -486,4 +486,92 @@ test_expect_success 'all boundary commits are excluded' '
 	test_bundle_object_count .git/objects/pack/pack-${pack##pack	}.pack 3
 '
 
+test_expect_success 'fetch tells fast-forwards from other updates' '
+	git init batch-src &&
+	(
+		cd batch-src &&
+		test_commit b-base &&
+		for i in 1 2 3 4 5 6 7 8
+		do
+			git branch ff$i || return 1
+		done &&
+		git branch unrelated &&
+		git checkout -b grows &&
+		test_commit b-one &&
+		git branch rewound
+	) &&
+	git init batch-dst &&
+	(
+		cd batch-dst &&
+		git remote add origin ../batch-src &&
+		git config remote.origin.fetch "refs/heads/*:refs/remotes/origin/*" &&
+		git fetch origin
+	) &&
+	(
+		cd batch-src &&
+		for i in 1 2 3 4 5 6 7 8
+		do
+			git checkout ff$i &&
+			test_commit b-ff$i || return 1
+		done &&
+		git checkout grows &&
+		test_commit b-two &&
+		git branch -f rewound b-base &&
+		tree=$(git rev-parse b-base^{tree}) &&
+		git branch -f unrelated $(echo root | git commit-tree $tree)
+	) &&
+	(
+		cd batch-dst &&
+		test_must_fail env GIT_TRACE="$PWD/trace" git fetch origin 2>err &&
+		grep "in_merge_bases_batch: 2 of 11 checked one by one" trace &&
+		grep "grows .*-> origin/grows$" err &&
+		grep "ff8 .*-> origin/ff8$" err &&
+		grep "rejected.*origin/unrelated.*non-fast-forward" err &&
+		grep "rejected.*origin/rewound.*non-fast-forward" err &&
+		! grep "rejected.*origin/ff" err &&
+		git fetch origin "+refs/heads/*:refs/remotes/origin/*" 2>err &&
+		grep "origin/unrelated.*forced update" err &&
+		grep "origin/rewound.*forced update" err &&
+		! grep "origin/ff" err
+	)
+'
+
+test_expect_success 'fetch tells fast-forwards of shared history in one walk' '
+	git init shared-src &&
+	(
+		cd shared-src &&
+		for i in 1 2 3 4
+		do
+			test_commit s-base$i &&
+			git branch s$i || return 1
+		done
+	) &&
+	git init shared-dst &&
+	(
+		cd shared-dst &&
+		git remote add origin ../shared-src &&
+		git config remote.origin.fetch "refs/heads/*:refs/remotes/origin/*" &&
+		git fetch origin
+	) &&
+	(
+		cd shared-src &&
+		for i in 1 2 3 4
+		do
+			git checkout s$i &&
+			test_commit s-new$i || return 1
+		done &&
+		git checkout master &&
+		git merge s1 s2 s3 s4
+	) &&
+	(
+		cd shared-dst &&
+		GIT_TRACE="$PWD/trace" git fetch origin 2>err &&
+		grep "in_merge_bases_batch: 0 of 5 checked one by one" trace &&
+		for b in master s1 s2 s3 s4
+		do
+			grep "[0-9a-f]\.\.[0-9a-f]* *$b *-> origin/$b$" err || return 1
+		done
+	)
+'
+
 test_done
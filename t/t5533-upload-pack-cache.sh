@@ -0,0 +1,71 @@
+#!/bin/sh
+
+test_description='upload-pack pack cache'
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_commit one &&
+	test_commit two &&
+	git config uploadpack.packCacheSize 1m
+'
+
+test_expect_success 'clone fills the cache' '
+	GIT_TRACE="$(pwd)/trace" git clone --bare "file://$(pwd)" first.git &&
+	grep "pack-objects" trace &&
+	! grep "served cached pack" trace &&
+	ls .git/pack-cache/*.pack >cached &&
+	test_line_count = 1 cached
+'
+
+test_expect_success 'identical clone is served from the cache' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone --bare "file://$(pwd)" second.git &&
+	! grep "pack-objects" trace &&
+	grep "served cached pack" trace &&
+	(
+		cd second.git &&
+		git fsck &&
+		test "$(git rev-parse two)" = "$(cd .. && git rev-parse two)"
+	)
+'
+
+test_expect_success 'moved ref gets a new pack' '
+	test_commit three &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone --bare "file://$(pwd)" third.git &&
+	grep "pack-objects" trace &&
+	test "$(git --git-dir=third.git rev-parse three)" = \
+	     "$(git rev-parse three)"
+'
+
+test_expect_success 'expired packs are not used and get pruned' '
+	for p in .git/pack-cache/*.pack
+	do
+		test-chmtime -600 "$p" || return 1
+	done &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone --bare "file://$(pwd)" fourth.git &&
+	grep "pack-objects" trace &&
+	ls .git/pack-cache/*.pack >cached &&
+	test_line_count = 1 cached
+'
+
+test_expect_success 'fetch with haves bypasses the cache' '
+	test_commit four &&
+	rm -f trace &&
+	(
+		cd fourth.git &&
+		GIT_TRACE="$(pwd)/../trace" git fetch origin master:master
+	) &&
+	grep "pack-objects" trace &&
+	ls .git/pack-cache/*.pack >cached &&
+	test_line_count = 1 cached
+'
+
+test_expect_success 'packs larger than the cache are not kept' '
+	git config uploadpack.packCacheSize 1 &&
+	git clone --bare "file://$(pwd)" fifth.git &&
+	! ls .git/pack-cache/*.pack
+'
+
+test_done
@@ -0,0 +1,94 @@
+#!/bin/sh
+
+test_description='pushing several refs atomically'
+. ./test-lib.sh
+
+mk_repo_pair () {
+	rm -rf upstream downstream &&
+	git init --bare upstream &&
+	git clone upstream downstream &&
+	(
+		cd downstream &&
+		test_commit one &&
+		git branch second &&
+		git push origin master second
+	)
+}
+
+# compare the ref ($1) in upstream with a ref value from downstream ($2)
+test_refs () {
+	(cd upstream && git rev-parse --verify "$1") >expect &&
+	(cd downstream && git rev-parse --verify "$2") >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'atomic push works for a single branch' '
+	mk_repo_pair &&
+	(
+		cd downstream &&
+		test_commit two &&
+		git push --atomic origin master
+	) &&
+	test_refs master master
+'
+
+test_expect_success 'atomic push updates and deletes several refs' '
+	mk_repo_pair &&
+	(
+		cd downstream &&
+		test_commit two &&
+		git branch third &&
+		git push --atomic origin master third :second
+	) &&
+	test_refs master master &&
+	test_refs third master &&
+	test_must_fail git --git-dir=upstream rev-parse --verify -q second
+'
+
+test_expect_success 'atomic push fails if one branch fails locally' '
+	mk_repo_pair &&
+	(
+		cd downstream &&
+		test_commit two &&
+		git checkout -b other second &&
+		test_commit three &&
+		git push origin other:second &&
+		git checkout master &&
+		test_must_fail git push --atomic origin master master:second 2>err &&
+		grep "atomic push failed" err
+	) &&
+	test_refs master master^ &&
+	test_refs second other
+'
+
+test_expect_success 'atomic push fails if one branch is refused remotely' '
+	mk_repo_pair &&
+	(
+		cd downstream &&
+		test_commit two &&
+		git branch third
+	) &&
+	mkdir -p upstream/hooks &&
+	write_script upstream/hooks/update <<-\EOF &&
+	test "$1" != refs/heads/third
+	EOF
+	(
+		cd downstream &&
+		test_must_fail git push --atomic --porcelain origin master third >out
+	) &&
+	grep "^!	refs/heads/master:refs/heads/master	.*atomic push failure" downstream/out &&
+	grep "^!	refs/heads/third:refs/heads/third	.*hook declined" downstream/out &&
+	test_refs master master^ &&
+	test_must_fail git --git-dir=upstream rev-parse --verify -q third
+'
+
+test_expect_success 'without --atomic, the other refs are still pushed' '
+	(
+		cd downstream &&
+		test_must_fail git push origin master third
+	) &&
+	test_refs master master &&
+	test_must_fail git --git-dir=upstream rev-parse --verify -q third
+'
+
+test_done
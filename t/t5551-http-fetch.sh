@@ -11,6 +11,7 @@ fi
 LIB_HTTPD_PORT=${LIB_HTTPD_PORT-'5551'}
 . "$TEST_DIRECTORY"/lib-httpd.sh
 start_httpd
+. "$TEST_DIRECTORY"/lib-advertised-refs.sh
 
 test_expect_success 'setup repository' '
 	echo content >file &&
@@ -98,12 +99,78 @@ test_expect_success 'used upload-pack service' '
 	sed -e "
 		s/^.* \"//
 		s/\"//
+		s/&ref-prefix=[^ ]*//
 		s/ [1-9][0-9]*\$//
 		s/^GET /GET  /
 	" >act <"$HTTPD_ROOT_PATH"/access.log &&
 	test_cmp exp act
 '
 
+test_expect_success 'fetch asks http-backend for the refs it needs' '
+	git push public master:refs/heads/side master:refs/notes/extra &&
+	(cd clone &&
+	 GIT_TRACE_PACKET="$PWD/trace" git fetch origin master &&
+	 advertised_refs trace >actual &&
+	 echo refs/heads/master >expect &&
+	 test_cmp expect actual &&
+	 rm trace &&
+	 GIT_TRACE_PACKET="$PWD/trace" git fetch &&
+	 advertised_refs trace >actual &&
+	 printf "%s\n" refs/heads/master refs/heads/side >expect &&
+	 test_cmp expect actual &&
+	 rm trace &&
+	 GIT_TRACE_PACKET="$PWD/trace" git fetch --no-tags origin \
+		"refs/notes/*:refs/notes/*" &&
+	 advertised_refs trace >actual &&
+	 echo refs/notes/extra >expect &&
+	 test_cmp expect actual &&
+	 git rev-parse --verify refs/notes/extra
+	) &&
+	grep "GET /smart/repo.git/info/refs?service=git-upload-pack&ref-prefix=refs%2fnotes%2f " \
+		"$HTTPD_ROOT_PATH"/access.log
+'
+
+test_expect_success 'clone hands the pack straight to index-pack' '
+	GIT_TRACE="$PWD/trace" git clone --quiet $HTTPD_URL/smart/repo.git direct &&
+	grep "fetch-pack.*--pack-fd=" trace &&
+	(cd direct && git fsck)
+'
+
+test_expect_success 'remote errors are shown while streaming the pack' '
+	git init --bare "$HTTPD_DOCUMENT_ROOT_PATH/corrupt.git" &&
+	git push "$HTTPD_DOCUMENT_ROOT_PATH/corrupt.git" master &&
+	blob=$(git rev-parse master:file) &&
+	loose="$HTTPD_DOCUMENT_ROOT_PATH/corrupt.git/objects/$(echo $blob | sed "s/^../&\//")" &&
+	chmod +w "$loose" &&
+	echo garbage >"$loose" &&
+	test_must_fail git clone --quiet $HTTPD_URL/smart/corrupt.git corrupt 2>err &&
+	grep "remote: aborting due to possible repository corruption" err
+'
+
+test_expect_success 'negotiation is streamed once a request went through' '
+	git clone $HTTPD_URL/smart/repo.git many-haves &&
+	(cd many-haves &&
+	 for i in $(test_seq 100)
+	 do
+		echo $i >local &&
+		git add local &&
+		test_tick &&
+		git commit -q -m local-$i || exit 1
+	 done
+	) &&
+	git checkout -b streamed &&
+	echo streamed >>file &&
+	git commit -a -m streamed &&
+	git push public streamed &&
+	git checkout master &&
+	(cd many-haves && git fetch -vv origin 2>../err) &&
+	grep "POST git-upload-pack ([0-9]* bytes)" err &&
+	grep "POST git-upload-pack (streamed, gzip)" err &&
+	git rev-parse streamed >expect &&
+	git --git-dir=many-haves/.git rev-parse origin/streamed >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'follow redirects (301)' '
 	git clone $HTTPD_URL/smart-redir-perm/repo.git --quiet repo-p
 '
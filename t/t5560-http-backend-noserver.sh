@@ -14,11 +14,15 @@ run_backend() {
 	git http-backend >act.out 2>act.err
 }
 
+headers() {
+	sed -e "/^\r\$/q" act.out
+}
+
 GET() {
 	REQUEST_METHOD="GET" && export REQUEST_METHOD &&
 	run_backend "/repo.git/$1" &&
 	sane_unset REQUEST_METHOD &&
-	if ! grep "Status" act.out >act
+	if ! headers | grep "Status" >act
 	then
 		printf "Status: 200 OK\r\n" >act
 	fi
@@ -32,7 +36,7 @@ POST() {
 	run_backend "/repo.git/$1" "$2" &&
 	sane_unset REQUEST_METHOD &&
 	sane_unset CONTENT_TYPE &&
-	if ! grep "Status" act.out >act
+	if ! headers | grep "Status" >act
 	then
 		printf "Status: 200 OK\r\n" >act
 	fi
@@ -58,6 +62,62 @@ expect_aliased() {
 	unset REQUEST_METHOD
 }
 
+test_expect_success 'http-backend passes ref-prefix to upload-pack' '
+	config http.uploadpack true &&
+	git push public master:refs/heads/other &&
+	GET "info/refs?service=git-upload-pack&ref-prefix=refs/heads/other" \
+		"200 OK" &&
+	grep refs/heads/other act.out &&
+	! grep refs/heads/master act.out
+'
+
+body() {
+	sed -e "1,/^\r\$/d" act.out
+}
+
+test_expect_success 'http-backend serves byte ranges of packs' '
+	config http.getanyfile true &&
+	pack=$(find_file objects/pack/*.pack) &&
+	size=$(wc -c <"repo.git/$pack" | tr -d " ") &&
+
+	HTTP_RANGE=bytes=0-3 && export HTTP_RANGE &&
+	GET "$pack" "206 Partial Content" &&
+	printf "Content-Range: bytes 0-3/$size\r\n" >exp &&
+	headers | grep "^Content-Range" >act &&
+	test_cmp exp act &&
+	printf PACK >exp &&
+	body >act &&
+	test_cmp exp act &&
+
+	HTTP_RANGE=bytes=-20 &&
+	GET "$pack" "206 Partial Content" &&
+	tail -c 20 "repo.git/$pack" >exp &&
+	body >act &&
+	test_cmp exp act &&
+
+	HTTP_RANGE=bytes=$size- &&
+	GET "$pack" "416 Requested Range Not Satisfiable" &&
+
+	HTTP_RANGE=bytes=0-3 &&
+	HTTP_IF_RANGE="\"stale\"" && export HTTP_IF_RANGE &&
+	GET "$pack" "200 OK" &&
+	body >act &&
+	test_cmp "repo.git/$pack" act &&
+	sane_unset HTTP_RANGE HTTP_IF_RANGE
+'
+
+test_expect_success 'http-backend answers If-None-Match for info/refs' '
+	config http.getanyfile true &&
+	GET info/refs "200 OK" &&
+	etag=$(headers | sed -n -e "s/^ETag: \(.*\)\r\$/\1/p") &&
+	test -n "$etag" &&
+	HTTP_IF_NONE_MATCH=$etag && export HTTP_IF_NONE_MATCH &&
+	GET info/refs "304 Not Modified" &&
+	test -z "$(body)" &&
+	GET objects/info/packs "200 OK" &&
+	sane_unset HTTP_IF_NONE_MATCH
+'
+
 test_expect_success 'http-backend blocks bad PATH_INFO' '
 	config http.getanyfile true &&
 
@@ -6,6 +6,7 @@ test_description='test fetching over git protocol'
 LIB_GIT_DAEMON_PORT=${LIB_GIT_DAEMON_PORT-5570}
 . "$TEST_DIRECTORY"/lib-git-daemon.sh
 start_git_daemon
+. "$TEST_DIRECTORY"/lib-advertised-refs.sh
 
 test_expect_success 'setup repository' '
 	echo content >file &&
@@ -36,6 +37,28 @@ test_expect_success 'fetch changes via git protocol' '
 	test_cmp file clone/file
 '
 
+test_expect_success 'fetch asks the daemon for the refs it needs' '
+	git push public master:refs/heads/side master:refs/notes/extra &&
+	(cd clone &&
+	 GIT_TRACE_PACKET="$PWD/trace" git fetch origin master &&
+	 advertised_refs trace >actual &&
+	 echo refs/heads/master >expect &&
+	 test_cmp expect actual &&
+	 rm trace &&
+	 GIT_TRACE_PACKET="$PWD/trace" git fetch &&
+	 advertised_refs trace >actual &&
+	 printf "%s\n" refs/heads/master refs/heads/side >expect &&
+	 test_cmp expect actual &&
+	 rm trace &&
+	 GIT_TRACE_PACKET="$PWD/trace" git fetch --no-tags origin \
+		"refs/notes/*:refs/notes/*" &&
+	 advertised_refs trace >actual &&
+	 echo refs/notes/extra >expect &&
+	 test_cmp expect actual &&
+	 git rev-parse --verify refs/notes/extra
+	)
+'
+
 test_expect_failure 'remote detects correct HEAD' '
 	git push public master:other &&
 	(cd clone &&
@@ -84,6 +107,28 @@ test_expect_success 'fetch notices corrupt idx' '
 	)
 '
 
+# wait until the daemon has logged $1 lines matching $2
+wait_for_log () {
+	for i in $(test_seq 30)
+	do
+		test "$(grep -c "$2" git_daemon_log)" -ge "$1" && return 0
+		sleep 1
+	done
+	echo >&2 "daemon did not log $1 times '$2'"
+	return 1
+}
+
+test_expect_success 'packs served from the cache are logged' '
+	git --git-dir="$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git" \
+		config uploadpack.packCacheSize 1m &&
+	test_when_finished "git --git-dir=\"$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git\" \
+		config --unset uploadpack.packCacheSize" &&
+	git clone --bare "$GIT_DAEMON_URL/repo.git" cache-miss.git &&
+	! grep "served cached pack" git_daemon_log &&
+	git clone --bare "$GIT_DAEMON_URL/repo.git" cache-hit.git &&
+	wait_for_log 1 "served cached pack"
+'
+
 test_remote_error()
 {
 	do_export=YesPlease
@@ -142,5 +187,56 @@ test_expect_success 'push disabled'      "test_remote_error    'service not enab
 test_expect_success 'read access denied' "test_remote_error -x 'no such repository'      fetch repo.git       "
 test_expect_success 'not exported'       "test_remote_error -n 'repository not exported' fetch repo.git       "
 
+# open a connection to the daemon that sends nothing, and so keeps a
+# child busy, until the file $1.stop appears
+hold_connection () {
+	rm -f "$1.stop" &&
+	"$PERL_PATH" -MIO::Socket::INET -e '
+		my $s = IO::Socket::INET->new(PeerAddr => "127.0.0.1:$ARGV[0]")
+			or die "unable to connect: $!";
+		sleep 1 until -e "$ARGV[1].stop";
+	' "$LIB_GIT_DAEMON_PORT" "$1" &
+}
+
+stop_git_daemon
+start_git_daemon --max-connections=1 --max-waiting=1 --wait-timeout=0 \
+	--pid-file="$PWD/daemon.pid"
+
+test_expect_success 'connections wait for a free slot, or are dropped' '
+	: >"$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git/git-daemon-export-ok" &&
+	hold_connection busy &&
+	wait_for_log 1 "Connection from" &&
+	git ls-remote "$GIT_DAEMON_URL/repo.git" >waited &
+	waiter=$! &&
+	wait_for_log 1 "Connection has to wait, 1 waiting" &&
+	test_must_fail git ls-remote "$GIT_DAEMON_URL/repo.git" &&
+	wait_for_log 1 "Too many waiting connections" &&
+	: >busy.stop &&
+	wait $waiter &&
+	grep refs/heads/master waited
+'
+
+test_expect_success 'SIGUSR1 logs the counters' '
+	kill -USR1 $(cat daemon.pid) &&
+	wait_for_log 1 "accepted, .* had to wait, .* dropped" &&
+	grep "3 accepted, 1 had to wait, 1 dropped" git_daemon_log &&
+	grep "connections running (max 1), 0 waiting (max 1)" git_daemon_log
+'
+
+stop_git_daemon
+start_git_daemon --max-connections=0 --max-per-address=1 --wait-timeout=1
+
+test_expect_success 'connections from a busy address wait until they time out' '
+	hold_connection busy &&
+	wait_for_log 1 "Connection from" &&
+	test_must_fail git ls-remote "$GIT_DAEMON_URL/repo.git" &&
+	grep "Connection has to wait, 1 waiting" git_daemon_log &&
+	grep "Connection waited for 1 seconds, dropping it" git_daemon_log &&
+	: >busy.stop &&
+	wait_for_log 1 "Disconnected" &&
+	git ls-remote "$GIT_DAEMON_URL/repo.git" >served &&
+	grep refs/heads/master served
+'
+
 stop_git_daemon
 test_done
@@ -0,0 +1,170 @@
+#!/bin/sh
+
+test_description='partial clone with object filters'
+. ./test-lib.sh
+
+count_packed_blobs () {
+	for i in "$1"/objects/pack/*.idx
+	do
+		git verify-pack -v "$i"
+	done |
+	grep -c " blob "
+}
+
+# tell whether an object is there without fetching it
+has_object () {
+	test -f "$1/objects/$(echo $2 | sed "s/^../&\//")" ||
+	for i in "$1"/objects/pack/*.idx
+	do
+		test -f "$i" && git show-index <"$i"
+	done |
+	grep $2 >/dev/null
+}
+
+test_expect_success setup '
+	git init srv &&
+	(
+		cd srv &&
+		mkdir -p dir/sub &&
+		echo small >small &&
+		printf "%2000s\n" big >big &&
+		echo deep >dir/sub/deep &&
+		git add . &&
+		git commit -m one &&
+		echo small2 >small &&
+		git commit -a -m two &&
+		git config uploadpack.allowFilter true &&
+		git config uploadpack.allowAnySHA1InWant true
+	)
+'
+
+test_expect_success 'rev-list --filter=blob:none omits blobs' '
+	(
+		cd srv &&
+		git rev-list --objects --all --filter=blob:none >objs &&
+		cut -c1-40 objs | git cat-file --batch-check >types &&
+		! grep blob types &&
+		grep tree types
+	)
+'
+
+test_expect_success 'rev-list --filter=blob:limit omits large blobs' '
+	(
+		cd srv &&
+		git rev-list --objects --all --filter=blob:limit=1k >objs &&
+		grep " small$" objs &&
+		grep " dir/sub/deep$" objs &&
+		! grep " big$" objs
+	)
+'
+
+test_expect_success 'rev-list --filter=tree:<depth> omits deep trees' '
+	(
+		cd srv &&
+		git rev-list --objects --all --filter=tree:0 >objs &&
+		cut -c1-40 objs | git cat-file --batch-check >types &&
+		! grep -v commit types &&
+		git rev-list --objects --all --filter=tree:2 >objs &&
+		grep " dir$" objs &&
+		grep " small$" objs &&
+		! grep " dir/sub$" objs &&
+		! grep " dir/sub/deep$" objs
+	)
+'
+
+test_expect_success 'rev-list does not filter objects named explicitly' '
+	(
+		cd srv &&
+		blob=$(git rev-parse HEAD:small) &&
+		git rev-list --objects --filter=blob:none $blob >objs &&
+		grep $blob objs
+	)
+'
+
+test_expect_success 'rev-list rejects an unknown filter' '
+	test_must_fail git --git-dir=srv/.git rev-list --objects --all --filter=bogus
+'
+
+test_expect_success 'pack-objects --filter leaves out blobs' '
+	(
+		cd srv &&
+		echo HEAD | git pack-objects --revs --filter=blob:none filtered &&
+		git verify-pack -v filtered-*.idx >contents &&
+		grep " commit " contents &&
+		! grep " blob " contents &&
+		test_must_fail git pack-objects --filter=blob:none --stdout </dev/null
+	)
+'
+
+test_expect_success 'clone --filter=blob:none' '
+	git clone --no-checkout --filter=blob:none "file://$(pwd)/srv" pc &&
+	test "$(git --git-dir=pc/.git config remote.origin.promisor)" = true &&
+	test "$(git --git-dir=pc/.git config remote.origin.partialclonefilter)" = blob:none &&
+	test "$(count_packed_blobs pc/.git)" = 0
+'
+
+test_expect_success 'missing blobs are fetched on demand' '
+	(
+		cd pc &&
+		git cat-file -p HEAD~1:small >actual &&
+		echo small >expect &&
+		test_cmp expect actual &&
+		git checkout -f master &&
+		echo small2 >expect &&
+		test_cmp expect small &&
+		test_cmp ../srv/big big
+	)
+'
+
+test_expect_success 'checkout after clone fetches the blobs it needs at once' '
+	git clone --filter=blob:none "file://$(pwd)/srv" pc2 &&
+	(
+		cd pc2 &&
+		test_cmp ../srv/dir/sub/deep dir/sub/deep &&
+		has_object .git $(git rev-parse HEAD:small) &&
+		! has_object .git $(git rev-parse HEAD~1:small)
+	)
+'
+
+test_expect_success 'clone --filter=tree:0 fetches trees on demand' '
+	git clone --filter=tree:0 "file://$(pwd)/srv" pc3 &&
+	(
+		cd pc3 &&
+		test_cmp ../srv/dir/sub/deep dir/sub/deep &&
+		old=$(git cat-file commit HEAD~1 | sed -n "s/^tree //p") &&
+		! has_object .git $old
+	)
+'
+
+test_expect_success 'fetch uses the filter of the promisor remote' '
+	(
+		cd srv &&
+		echo new >new &&
+		git add new &&
+		git commit -m three
+	) &&
+	(
+		cd pc &&
+		git fetch origin &&
+		test "$(git rev-parse origin/master)" = "$(git --git-dir=../srv/.git rev-parse HEAD)" &&
+		! has_object .git $(git rev-parse origin/master:new)
+	)
+'
+
+test_expect_success 'fetch --filter needs a promisor remote' '
+	git init plain &&
+	(
+		cd plain &&
+		git remote add origin "file://$(pwd)/../srv" &&
+		test_must_fail git fetch --filter=blob:none origin
+	)
+'
+
+test_expect_success 'server without uploadpack.allowFilter sends everything' '
+	git --git-dir=srv/.git config uploadpack.allowFilter false &&
+	git clone --no-checkout --filter=blob:none "file://$(pwd)/srv" full 2>err &&
+	grep "filtering not recognized" err &&
+	test "$(count_packed_blobs full/.git)" != 0
+'
+
+test_done
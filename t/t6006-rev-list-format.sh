@@ -290,4 +290,34 @@ test_expect_success 'single-character name is parsed correctly' '
 	test_cmp expect actual
 '
 
+test_expect_success 'a format gives the same output for every commit' '
+	fmt="%%h %Z %h%x41%n%-b%Cred%an %ad%Creset %at%%%s%+b%" &&
+	git log --format="$fmt" >actual &&
+	for c in $(git rev-list HEAD)
+	do
+		git log -1 --format="$fmt" $c || return 1
+	done >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a format gives the same output with a malformed author' '
+	tree=$(git rev-parse HEAD^{tree}) &&
+	good=$(echo good | git commit-tree $tree) &&
+	bad=$(printf "tree %s\nparent %s\nauthor no email\ncommitter %s\n\nbad\n" \
+		$tree $good "C O Mitter <committer@example.com> 1112912053 -0500" |
+		git hash-object -t commit -w --stdin) &&
+	top=$(echo top | git commit-tree $tree -p $bad) &&
+	fmt="%h %aN <%aE> %an %cN %w(20,1,2)%s%w(0) %h" &&
+	for start in $top $bad
+	do
+		git log --format="$fmt" $start >actual &&
+		for c in $(git rev-list $start)
+		do
+			git log -1 --format="$fmt" $c || return 1
+		done >expect &&
+		test_cmp expect actual || return 1
+	done &&
+	grep "%aN <%aE>" actual
+'
+
 test_done
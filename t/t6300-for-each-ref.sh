@@ -466,4 +466,63 @@ test_expect_success 'Verify sort with multiple keys' '
 		refs/tags/bogo refs/tags/master > actual &&
 	test_cmp expected actual
 '
+
+test_expect_success 'setup refs with equal sort keys' '
+	for i in 1 2 3 4 5 6 7 8
+	do
+		git tag -m "count $i" count/$i HEAD || return 1
+	done &&
+	git tag -m "count x" count/x HEAD^{tree}
+'
+
+for sort in refname -refname taggerdate -taggerdate objectname -objectname
+do
+	test_expect_success "--count matches a full --sort=$sort" '
+		git for-each-ref --sort=$sort >full &&
+		for n in 1 3 5 20
+		do
+			sed -n "1,${n}p" full >expected &&
+			git for-each-ref --sort=$sort --count=$n >actual &&
+			test_cmp expected actual || return 1
+		done
+	'
+done
+
+test_expect_success '--count with a single pattern and * atoms' '
+	git for-each-ref --format="%(refname) %(*objectname)" \
+		--sort=-refname refs/tags/count >full &&
+	test_line_count = 9 full &&
+	head -n 2 full >expected &&
+	git for-each-ref --format="%(refname) %(*objectname)" \
+		--sort=-refname --count=2 "refs/tags/count/*" >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'setup history for --contains' '
+	test_commit contains-1 &&
+	test_commit contains-2 &&
+	git tag -m "annotated" contains-annotated &&
+	git checkout -b contains-side contains-1 &&
+	test_commit contains-side
+'
+
+test_expect_success '--contains lists refs that reach the commit' '
+	cat >expected <<-\EOF &&
+	refs/tags/contains-1
+	refs/tags/contains-2
+	refs/tags/contains-annotated
+	refs/tags/contains-side
+	EOF
+	git for-each-ref --format="%(refname)" --contains contains-1 \
+		"refs/tags/contains-*" >actual &&
+	test_cmp expected actual &&
+	cat >expected <<-\EOF &&
+	refs/heads/contains-side
+	refs/tags/contains-side
+	EOF
+	git for-each-ref --format="%(refname)" refs/heads refs/tags \
+		--contains >actual &&
+	test_cmp expected actual
+'
+
 test_done
@@ -804,6 +804,9 @@ static int push_refs(struct transport *transport,
 		return 0;
 	}
 
+	if (flags & TRANSPORT_PUSH_ATOMIC)
+		die(_("the remote helper does not support --atomic push"));
+
 	if (data->push)
 		return push_refs_with_push(transport, remote_refs, flags);
 
@@ -12,8 +12,12 @@
 #include "run-command.h"
 #include "sigchain.h"
 #include "version.h"
+#include "string-list.h"
+#include "sha1-array.h"
+#include "dir.h"
+#include "list-objects-filter.h"
 
-static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<n>] <dir>";
+static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<n>] [--ref-prefix=<prefix>...] <dir>";
 
 /* bits #0..7 in revision.h, #8..10 in commit.c */
 #define THEY_HAVE	(1u << 11)
@@ -44,6 +48,15 @@ static int use_sideband;
 static int debug_fd;
 static int advertise_refs;
 static int stateless_rpc;
+static struct packet_reader reader;
+static struct string_list ref_prefixes = STRING_LIST_INIT_DUP;
+static unsigned long pack_cache_size;
+static unsigned long pack_cache_ttl = 300;
+static int allow_filter;
+static int allow_any_sha1_in_want;
+static struct list_objects_filter_options filter_options;
+/* some want is not one of the refs we advertised */
+static int has_non_tip;
 
 static void reset_timeout(void)
 {
@@ -129,17 +142,193 @@ static int do_rev_list(int in, int out, void *user_data)
 		for (i = 0; i < extra_edge_obj.nr; i++)
 			fprintf(pack_pipe, "-%s\n", sha1_to_hex(
 					extra_edge_obj.objects[i].item->sha1));
-	traverse_commit_list(&revs, show_commit, show_object, NULL);
+	traverse_commit_list_filtered(&revs, &filter_options,
+				      show_commit, show_object, NULL);
 	fflush(pack_pipe);
 	fclose(pack_pipe);
 	return 0;
 }
 
+/*
+ * A clone (wants without haves) of refs that have not moved since the
+ * previous one gets the same pack again.  When uploadpack.packCacheSize
+ * is set, such packs are kept in $GIT_DIR/pack-cache, named after the
+ * wanted objects and the options that affect the pack data, and are
+ * replayed as long as they are younger than uploadpack.packCacheTTL.
+ */
+static void hash_want(const unsigned char sha1[20], void *data)
+{
+	git_SHA1_Update(data, sha1, 20);
+}
+
+static int pack_cache_path(struct strbuf *path, int create_full_pack)
+{
+	struct sha1_array wants = SHA1_ARRAY_INIT;
+	struct strbuf opts = STRBUF_INIT;
+	unsigned char key[20];
+	git_SHA_CTX ctx;
+	int i;
+
+	if (!pack_cache_size || have_obj.nr || shallow_nr)
+		return -1;
+
+	for (i = 0; i < want_obj.nr; i++)
+		sha1_array_append(&wants, want_obj.objects[i].item->sha1);
+	git_SHA1_Init(&ctx);
+	sha1_array_for_each_unique(&wants, hash_want, &ctx);
+	strbuf_addf(&opts, "full=%d ofs-delta=%d include-tag=%d",
+		    create_full_pack, use_ofs_delta, use_include_tag);
+	if (filter_options.filter_spec)
+		strbuf_addf(&opts, " filter=%s", filter_options.filter_spec);
+	git_SHA1_Update(&ctx, opts.buf, opts.len);
+	git_SHA1_Final(key, &ctx);
+	sha1_array_clear(&wants);
+	strbuf_release(&opts);
+
+	strbuf_addstr(path, git_path("pack-cache/%s.pack", sha1_to_hex(key)));
+	return 0;
+}
+
+static int send_cached_pack(const char *path)
+{
+	char data[8192];
+	struct stat st;
+	ssize_t sz;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || st.st_mtime + pack_cache_ttl < time(NULL)) {
+		close(fd);
+		return -1;
+	}
+
+	while ((sz = xread(fd, data, sizeof(data))) > 0) {
+		reset_timeout();
+		if (send_client_data(1, data, sz) < 0)
+			die("git upload-pack: unable to send cached pack");
+	}
+	if (sz < 0)
+		die_errno("git upload-pack: unable to read cached pack '%s'",
+			  path);
+	close(fd);
+	if (use_sideband)
+		packet_flush(1);
+	/* in daemon mode, stderr goes to the daemon's log */
+	if (daemon_mode)
+		fprintf(stderr, "served cached pack %s\n", path);
+	trace_printf("upload-pack: served cached pack %s\n", path);
+	return 0;
+}
+
+struct cached_pack {
+	char *path;
+	unsigned long size;
+	time_t mtime;
+};
+
+static int cached_pack_cmp(const void *a_, const void *b_)
+{
+	const struct cached_pack *a = a_, *b = b_;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Drop expired packs (and stale temporary files), then the oldest
+ * ones until the cache fits in uploadpack.packCacheSize again.
+ */
+static void prune_pack_cache(void)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct cached_pack *packs = NULL;
+	int nr = 0, alloc = 0, i;
+	unsigned long total = 0;
+	time_t now = time(NULL);
+	struct dirent *de;
+	size_t baselen;
+	DIR *dir;
+
+	strbuf_addstr(&path, git_path("pack-cache"));
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	baselen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		if (stat(path.buf, &st))
+			continue;
+		if (st.st_mtime + pack_cache_ttl < now) {
+			unlink(path.buf);
+			continue;
+		}
+		if (!has_extension(de->d_name, ".pack"))
+			continue;
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].path = xstrdup(path.buf);
+		packs[nr].size = st.st_size;
+		packs[nr].mtime = st.st_mtime;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	qsort(packs, nr, sizeof(*packs), cached_pack_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total > pack_cache_size) {
+			unlink(packs[i].path);
+			total -= packs[i].size;
+		}
+		free(packs[i].path);
+	}
+	free(packs);
+	strbuf_release(&path);
+}
+
+static int open_pack_cache_tmp(struct strbuf *tmp)
+{
+	int fd;
+
+	strbuf_addstr(tmp, git_path("pack-cache/tmp_pack_XXXXXX"));
+	if (safe_create_leading_directories(tmp->buf))
+		return -1;
+	fd = git_mkstemp_mode(tmp->buf, 0444);
+	if (fd < 0)
+		strbuf_reset(tmp);
+	return fd;
+}
+
+static void drop_pack_cache_tmp(struct strbuf *tmp, int *fd)
+{
+	if (*fd < 0)
+		return;
+	close(*fd);
+	*fd = -1;
+	unlink_or_warn(tmp->buf);
+}
+
 static void create_pack_file(void)
 {
 	struct async rev_list;
 	struct child_process pack_objects;
-	int create_full_pack = (nr_our_refs == want_obj.nr && !have_obj.nr);
+	/*
+	 * "--all" packs every ref we have, not only the ones a
+	 * --ref-prefix restricted advertisement counted as ours, nor
+	 * objects wanted by name.
+	 */
+	int create_full_pack = (nr_our_refs == want_obj.nr && !have_obj.nr &&
+				!ref_prefixes.nr && !has_non_tip);
 	char data[8193], progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
@@ -147,6 +336,17 @@ static void create_pack_file(void)
 	ssize_t sz;
 	const char *argv[10];
 	int arg = 0;
+	struct strbuf cache_path = STRBUF_INIT, cache_tmp = STRBUF_INIT;
+	struct strbuf filter_arg = STRBUF_INIT;
+	int cache_fd = -1;
+
+	if (!pack_cache_path(&cache_path, create_full_pack)) {
+		if (!send_cached_pack(cache_path.buf)) {
+			strbuf_release(&cache_path);
+			return;
+		}
+		cache_fd = open_pack_cache_tmp(&cache_tmp);
+	}
 
 	argv[arg++] = "pack-objects";
 	if (!shallow_nr) {
@@ -164,6 +364,11 @@ static void create_pack_file(void)
 		argv[arg++] = "--delta-base-offset";
 	if (use_include_tag)
 		argv[arg++] = "--include-tag";
+	if (filter_options.filter_spec && !shallow_nr) {
+		strbuf_addf(&filter_arg, "--filter=%s",
+			    filter_options.filter_spec);
+		argv[arg++] = filter_arg.buf;
+	}
 	argv[arg++] = NULL;
 
 	memset(&pack_objects, 0, sizeof(pack_objects));
@@ -272,8 +477,11 @@ static void create_pack_file(void)
 			}
 			sz = xread(pack_objects.out, cp,
 				  sizeof(data) - outsz);
-			if (0 < sz)
-				;
+			if (0 < sz) {
+				if (0 <= cache_fd &&
+				    write_in_full(cache_fd, cp, sz) < 0)
+					drop_pack_cache_tmp(&cache_tmp, &cache_fd);
+			}
 			else if (sz == 0) {
 				close(pack_objects.out);
 				pack_objects.out = -1;
@@ -310,9 +518,21 @@ static void create_pack_file(void)
 	}
 	if (use_sideband)
 		packet_flush(1);
+
+	if (0 <= cache_fd) {
+		if (close(cache_fd) ||
+		    rename(cache_tmp.buf, cache_path.buf))
+			unlink_or_warn(cache_tmp.buf);
+		else
+			prune_pack_cache();
+	}
+	strbuf_release(&cache_path);
+	strbuf_release(&cache_tmp);
+	strbuf_release(&filter_arg);
 	return;
 
  fail:
+	drop_pack_cache_tmp(&cache_tmp, &cache_fd);
 	send_client_data(3, abort_msg, sizeof(abort_msg));
 	die("git upload-pack: %s", abort_msg);
 }
@@ -427,7 +647,7 @@ static int get_common_commits(void)
 	save_commit_buffer = 0;
 
 	for (;;) {
-		int len = packet_read_line(0, line, sizeof(line));
+		int len = packet_reader_read_line(&reader, line, sizeof(line));
 		reset_timeout();
 
 		if (!len) {
@@ -579,7 +799,6 @@ static void receive_needs(void)
 	struct object_array shallows = OBJECT_ARRAY_INIT;
 	static char line[1000];
 	int len, depth = 0;
-	int has_non_tip = 0;
 
 	shallow_nr = 0;
 	if (debug_fd)
@@ -588,7 +807,7 @@ static void receive_needs(void)
 		struct object *o;
 		const char *features;
 		unsigned char sha1_buf[20];
-		len = packet_read_line(0, line, sizeof(line));
+		len = packet_reader_read_line(&reader, line, sizeof(line));
 		reset_timeout();
 		if (!len)
 			break;
@@ -607,6 +826,15 @@ static void receive_needs(void)
 			add_object_array(object, NULL, &shallows);
 			continue;
 		}
+		if (!prefixcmp(line, "filter ")) {
+			if (!allow_filter)
+				die("git upload-pack: filtering is not allowed");
+			if (line[len - 1] == '\n')
+				line[--len] = 0;
+			if (parse_list_objects_filter(&filter_options, line + 7))
+				die("git upload-pack: invalid filter: %s", line);
+			continue;
+		}
 		if (!prefixcmp(line, "deepen ")) {
 			char *end;
 			depth = strtol(line + 7, &end, 0);
@@ -641,6 +869,8 @@ static void receive_needs(void)
 			use_include_tag = 1;
 
 		o = lookup_object(sha1_buf);
+		if (!o && allow_any_sha1_in_want)
+			o = parse_object(sha1_buf);
 		if (!o)
 			die("git upload-pack: not our ref %s",
 			    sha1_to_hex(sha1_buf));
@@ -661,9 +891,16 @@ static void receive_needs(void)
 	 * have been based on the set of older refs advertised
 	 * by another process that handled the initial request.
 	 */
-	if (has_non_tip)
+	if (has_non_tip && !allow_any_sha1_in_want)
 		check_non_tip();
 
+	/*
+	 * A thin pack could use objects as bases that the filter kept
+	 * from the client.
+	 */
+	if (filter_options.choice)
+		use_thin_pack = 0;
+
 	if (!use_sideband && daemon_mode)
 		no_progress = 1;
 
@@ -735,10 +972,11 @@ static int send_ref(const char *refname, const unsigned char *sha1, int flag, vo
 	}
 
 	if (capabilities)
-		packet_write(1, "%s %s%c%s%s agent=%s\n",
+		packet_write(1, "%s %s%c%s%s%s agent=%s\n",
 			     sha1_to_hex(sha1), refname_nons,
 			     0, capabilities,
 			     stateless_rpc ? " no-done" : "",
+			     allow_filter ? " filter" : "",
 			     git_user_agent_sanitized());
 	else
 		packet_write(1, "%s %s\n", sha1_to_hex(sha1), refname_nons);
@@ -767,16 +1005,62 @@ static int mark_our_ref(const char *refname, const unsigned char *sha1, int flag
 	return 0;
 }
 
+/*
+ * Sort the prefixes the client asked for and drop those covered by
+ * another one, so that every ref is visited once and in order.
+ */
+static void clean_ref_prefixes(void)
+{
+	const char *last = NULL;
+	int i, j;
+
+	sort_string_list(&ref_prefixes);
+	for (i = j = 0; i < ref_prefixes.nr; i++) {
+		const char *prefix = ref_prefixes.items[i].string;
+		if (last && !prefixcmp(prefix, last)) {
+			free(ref_prefixes.items[i].string);
+			continue;
+		}
+		last = prefix;
+		ref_prefixes.items[j++] = ref_prefixes.items[i];
+	}
+	ref_prefixes.nr = j;
+}
+
+static void for_each_advertised_ref(each_ref_fn fn)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int i;
+
+	if (!ref_prefixes.nr) {
+		head_ref_namespaced(fn, NULL);
+		for_each_namespaced_ref(fn, NULL);
+		return;
+	}
+
+	for (i = 0; i < ref_prefixes.nr; i++) {
+		const char *prefix = ref_prefixes.items[i].string;
+
+		if (!prefixcmp("HEAD", prefix))
+			head_ref_namespaced(fn, NULL);
+		if (prefixcmp(prefix, "refs/") && prefixcmp("refs/", prefix))
+			continue;
+		strbuf_reset(&buf);
+		strbuf_addf(&buf, "%s%s", get_git_namespace(),
+			    prefixcmp(prefix, "refs/") ? "refs/" : prefix);
+		for_each_fullref_in(buf.buf, fn, NULL);
+	}
+	strbuf_release(&buf);
+}
+
 static void upload_pack(void)
 {
 	if (advertise_refs || !stateless_rpc) {
 		reset_timeout();
-		head_ref_namespaced(send_ref, NULL);
-		for_each_namespaced_ref(send_ref, NULL);
+		for_each_advertised_ref(send_ref);
 		packet_flush(1);
 	} else {
-		head_ref_namespaced(mark_our_ref, NULL);
-		for_each_namespaced_ref(mark_our_ref, NULL);
+		for_each_advertised_ref(mark_our_ref);
 	}
 	if (advertise_refs)
 		return;
@@ -788,6 +1072,27 @@ static void upload_pack(void)
 	}
 }
 
+static int upload_pack_config(const char *var, const char *value, void *unused)
+{
+	if (!strcmp(var, "uploadpack.packcachesize")) {
+		pack_cache_size = git_config_ulong(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "uploadpack.packcachettl")) {
+		pack_cache_ttl = git_config_ulong(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "uploadpack.allowfilter")) {
+		allow_filter = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "uploadpack.allowanysha1inwant")) {
+		allow_any_sha1_in_want = git_config_bool(var, value);
+		return 0;
+	}
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	char *dir;
@@ -817,6 +1122,10 @@ int main(int argc, char **argv)
 			strict = 1;
 			continue;
 		}
+		if (!prefixcmp(arg, "--ref-prefix=")) {
+			string_list_append(&ref_prefixes, arg + 13);
+			continue;
+		}
 		if (!prefixcmp(arg, "--timeout=")) {
 			timeout = atoi(arg+10);
 			daemon_mode = 1;
@@ -837,6 +1146,9 @@ int main(int argc, char **argv)
 
 	if (!enter_repo(dir, strict))
 		die("'%s' does not appear to be a git repository", dir);
+	clean_ref_prefixes();
+	git_config(upload_pack_config, NULL);
+	packet_reader_init(&reader, 0);
 	if (is_repository_shallow())
 		die("attempt to fetch/clone from a shallow repository");
 	if (getenv("GIT_DEBUG_SEND_PACK"))
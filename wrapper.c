@@ -210,6 +210,19 @@ int xdup(int fd)
 	return ret;
 }
 
+/*
+ * Ask for a larger kernel buffer on a pipe that carries bulk data (e.g.
+ * a pack on its way to index-pack), so that the writer does not stall
+ * every 64kB while the reader is busy.  This is only a hint; failure is
+ * not an error.
+ */
+void enlarge_pipe_buffer(int fd)
+{
+#ifdef F_SETPIPE_SZ
+	fcntl(fd, F_SETPIPE_SZ, 1024 * 1024);
+#endif
+}
+
 FILE *xfdopen(int fd, const char *mode)
 {
 	FILE *stream = fdopen(fd, mode);
@@ -3,6 +3,7 @@
  * at init time.
  */
 #include "cache.h"
+#include "thread-utils.h"
 
 static const char *zerr_to_string(int status)
 {
@@ -34,40 +35,192 @@ static inline uInt zlib_buf_cap(unsigned long len)
 	return (ZLIB_BUF_MAX < len) ? ZLIB_BUF_MAX : len;
 }
 
+/* the zlib stream proper, which lives in the pool for pooled streams */
+static inline z_stream *zstream(git_zstream *s)
+{
+	return s->pooled ? s->pooled : &s->z;
+}
+
 static void zlib_pre_call(git_zstream *s)
 {
-	s->z.next_in = s->next_in;
-	s->z.next_out = s->next_out;
-	s->z.total_in = s->total_in;
-	s->z.total_out = s->total_out;
-	s->z.avail_in = zlib_buf_cap(s->avail_in);
-	s->z.avail_out = zlib_buf_cap(s->avail_out);
+	z_stream *z = zstream(s);
+
+	z->next_in = s->next_in;
+	z->next_out = s->next_out;
+	z->total_in = s->total_in;
+	z->total_out = s->total_out;
+	z->avail_in = zlib_buf_cap(s->avail_in);
+	z->avail_out = zlib_buf_cap(s->avail_out);
 }
 
 static void zlib_post_call(git_zstream *s)
 {
+	z_stream *z = zstream(s);
 	unsigned long bytes_consumed;
 	unsigned long bytes_produced;
 
-	bytes_consumed = s->z.next_in - s->next_in;
-	bytes_produced = s->z.next_out - s->next_out;
-	if (s->z.total_out != s->total_out + bytes_produced)
+	bytes_consumed = z->next_in - s->next_in;
+	bytes_produced = z->next_out - s->next_out;
+	if (z->total_out != s->total_out + bytes_produced)
 		die("BUG: total_out mismatch");
-	if (s->z.total_in != s->total_in + bytes_consumed)
+	if (z->total_in != s->total_in + bytes_consumed)
 		die("BUG: total_in mismatch");
 
-	s->total_out = s->z.total_out;
-	s->total_in = s->z.total_in;
-	s->next_in = s->z.next_in;
-	s->next_out = s->z.next_out;
+	s->total_out = z->total_out;
+	s->total_in = z->total_in;
+	s->next_in = z->next_in;
+	s->next_out = z->next_out;
 	s->avail_in -= bytes_consumed;
 	s->avail_out -= bytes_produced;
 }
 
+static const char *zstream_msg(git_zstream *s)
+{
+	const char *msg = zstream(s)->msg;
+	return msg ? msg : "no message";
+}
+
+/*
+ * Setting up a zlib stream allocates and initializes a few hundred
+ * kilobytes of state for deflate, which dominates the cost of
+ * compressing or inflating small objects.  The *_init_pooled()
+ * variants take a stream from a pool instead and merely reset it;
+ * ending such a stream puts it back.
+ *
+ * Each thread has a pool of its own, which goes away with the thread.
+ * A program that starts threads which may use pooled streams must
+ * call init_zstream_pool_threads() from its main thread before it
+ * starts them; until then, all streams come from the pool of the
+ * main thread.
+ */
+#define ZSTREAM_POOL_SIZE 4
+#define ZSTREAM_POOL_INFLATE (-2)	/* any other kind is a deflate level */
+
+struct zstream_pool {
+	struct zstream_pool_entry {
+		z_stream *z;
+		int kind;
+	} entry[ZSTREAM_POOL_SIZE];
+	int nr;
+};
+
+static struct zstream_pool main_zstream_pool;
+
+static void zstream_pool_drop(z_stream *z, int kind)
+{
+	if (kind == ZSTREAM_POOL_INFLATE)
+		inflateEnd(z);
+	else
+		deflateEnd(z);
+	free(z);
+}
+
+#ifndef NO_PTHREADS
+static pthread_key_t zstream_pool_key;
+static int zstream_pool_key_created;
+
+static void free_zstream_pool(void *data)
+{
+	struct zstream_pool *pool = data;
+	int i;
+
+	for (i = 0; i < pool->nr; i++)
+		zstream_pool_drop(pool->entry[i].z, pool->entry[i].kind);
+	free(pool);
+}
+
+void init_zstream_pool_threads(void)
+{
+	if (zstream_pool_key_created)
+		return;
+	pthread_key_create(&zstream_pool_key, free_zstream_pool);
+	pthread_setspecific(zstream_pool_key, &main_zstream_pool);
+	zstream_pool_key_created = 1;
+}
+
+static struct zstream_pool *zstream_pool(void)
+{
+	struct zstream_pool *pool;
+
+	if (!zstream_pool_key_created)
+		return &main_zstream_pool;
+	pool = pthread_getspecific(zstream_pool_key);
+	if (!pool) {
+		pool = xcalloc(1, sizeof(*pool));
+		pthread_setspecific(zstream_pool_key, pool);
+	}
+	return pool;
+}
+#else
+void init_zstream_pool_threads(void)
+{
+}
+
+#define zstream_pool() (&main_zstream_pool)
+#endif
+
+static z_stream *zstream_pool_get(int kind)
+{
+	struct zstream_pool *pool = zstream_pool();
+	int i;
+
+	for (i = pool->nr - 1; i >= 0; i--) {
+		z_stream *z = pool->entry[i].z;
+		if (pool->entry[i].kind != kind)
+			continue;
+		pool->nr--;
+		memmove(pool->entry + i, pool->entry + i + 1,
+			(pool->nr - i) * sizeof(*pool->entry));
+		return z;
+	}
+	return NULL;
+}
+
+static void zstream_pool_put(git_zstream *strm)
+{
+	struct zstream_pool *pool = zstream_pool();
+
+	if (pool->nr == ZSTREAM_POOL_SIZE) {
+		zstream_pool_drop(pool->entry[0].z, pool->entry[0].kind);
+		pool->nr--;
+		memmove(pool->entry, pool->entry + 1,
+			pool->nr * sizeof(*pool->entry));
+	}
+	pool->entry[pool->nr].z = strm->pooled;
+	pool->entry[pool->nr].kind = strm->pool_kind;
+	pool->nr++;
+	strm->pooled = NULL;
+}
+
+static int zstream_pool_take(git_zstream *strm, int kind)
+{
+	z_stream *z = zstream_pool_get(kind);
+	int status;
+
+	strm->pool_kind = kind;
+	if (!z) {
+		strm->pooled = xcalloc(1, sizeof(*strm->pooled));
+		return 0;
+	}
+	strm->pooled = z;
+	zlib_pre_call(strm);
+	if (kind == ZSTREAM_POOL_INFLATE)
+		status = inflateReset(z);
+	else
+		status = deflateReset(z);
+	zlib_post_call(strm);
+	if (status == Z_OK)
+		return 1;
+	zstream_pool_drop(z, kind);
+	strm->pooled = xcalloc(1, sizeof(*strm->pooled));
+	return 0;
+}
+
 void git_inflate_init(git_zstream *strm)
 {
 	int status;
 
+	strm->pooled = NULL;
 	zlib_pre_call(strm);
 	status = inflateInit(&strm->z);
 	zlib_post_call(strm);
@@ -77,6 +230,21 @@ void git_inflate_init(git_zstream *strm)
 	    strm->z.msg ? strm->z.msg : "no message");
 }
 
+void git_inflate_init_pooled(git_zstream *strm)
+{
+	int status;
+
+	if (zstream_pool_take(strm, ZSTREAM_POOL_INFLATE))
+		return;
+	zlib_pre_call(strm);
+	status = inflateInit(strm->pooled);
+	zlib_post_call(strm);
+	if (status == Z_OK)
+		return;
+	die("inflateInit: %s (%s)", zerr_to_string(status),
+	    zstream_msg(strm));
+}
+
 void git_inflate_init_gzip_only(git_zstream *strm)
 {
 	/*
@@ -86,6 +254,7 @@ void git_inflate_init_gzip_only(git_zstream *strm)
 	const int windowBits = 15 + 16;
 	int status;
 
+	strm->pooled = NULL;
 	zlib_pre_call(strm);
 	status = inflateInit2(&strm->z, windowBits);
 	zlib_post_call(strm);
@@ -99,6 +268,10 @@ void git_inflate_end(git_zstream *strm)
 {
 	int status;
 
+	if (strm->pooled) {
+		zstream_pool_put(strm);
+		return;
+	}
 	zlib_pre_call(strm);
 	status = inflateEnd(&strm->z);
 	zlib_post_call(strm);
@@ -115,8 +288,8 @@ int git_inflate(git_zstream *strm, int flush)
 	for (;;) {
 		zlib_pre_call(strm);
 		/* Never say Z_FINISH unless we are feeding everything */
-		status = inflate(&strm->z,
-				 (strm->z.avail_in != strm->avail_in)
+		status = inflate(zstream(strm),
+				 (zstream(strm)->avail_in != strm->avail_in)
 				 ? 0 : flush);
 		if (status == Z_MEM_ERROR)
 			die("inflate: out of memory");
@@ -126,7 +299,7 @@ int git_inflate(git_zstream *strm, int flush)
 		 * Let zlib work another round, while we can still
 		 * make progress.
 		 */
-		if ((strm->avail_out && !strm->z.avail_out) &&
+		if ((strm->avail_out && !zstream(strm)->avail_out) &&
 		    (status == Z_OK || status == Z_BUF_ERROR))
 			continue;
 		break;
@@ -142,7 +315,7 @@ int git_inflate(git_zstream *strm, int flush)
 		break;
 	}
 	error("inflate: %s (%s)", zerr_to_string(status),
-	      strm->z.msg ? strm->z.msg : "no message");
+	      zstream_msg(strm));
 	return status;
 }
 
@@ -152,13 +325,14 @@ int git_inflate(git_zstream *strm, int flush)
 
 unsigned long git_deflate_bound(git_zstream *strm, unsigned long size)
 {
-	return deflateBound(&strm->z, size);
+	return deflateBound(zstream(strm), size);
 }
 
 void git_deflate_init(git_zstream *strm, int level)
 {
 	int status;
 
+	strm->pooled = NULL;
 	zlib_pre_call(strm);
 	status = deflateInit(&strm->z, level);
 	zlib_post_call(strm);
@@ -168,6 +342,21 @@ void git_deflate_init(git_zstream *strm, int level)
 	    strm->z.msg ? strm->z.msg : "no message");
 }
 
+void git_deflate_init_pooled(git_zstream *strm, int level)
+{
+	int status;
+
+	if (zstream_pool_take(strm, level))
+		return;
+	zlib_pre_call(strm);
+	status = deflateInit(strm->pooled, level);
+	zlib_post_call(strm);
+	if (status == Z_OK)
+		return;
+	die("deflateInit: %s (%s)", zerr_to_string(status),
+	    zstream_msg(strm));
+}
+
 void git_deflate_init_gzip(git_zstream *strm, int level)
 {
 	/*
@@ -177,6 +366,7 @@ void git_deflate_init_gzip(git_zstream *strm, int level)
 	const int windowBits = 15 + 16;
 	int status;
 
+	strm->pooled = NULL;
 	zlib_pre_call(strm);
 	status = deflateInit2(&strm->z, level,
 				  Z_DEFLATED, windowBits,
@@ -192,6 +382,11 @@ int git_deflate_abort(git_zstream *strm)
 {
 	int status;
 
+	if (strm->pooled) {
+		zstream_pool_drop(strm->pooled, strm->pool_kind);
+		strm->pooled = NULL;
+		return Z_OK;
+	}
 	zlib_pre_call(strm);
 	status = deflateEnd(&strm->z);
 	zlib_post_call(strm);
@@ -200,7 +395,13 @@ int git_deflate_abort(git_zstream *strm)
 
 void git_deflate_end(git_zstream *strm)
 {
-	int status = git_deflate_abort(strm);
+	int status;
+
+	if (strm->pooled) {
+		zstream_pool_put(strm);
+		return;
+	}
+	status = git_deflate_abort(strm);
 
 	if (status == Z_OK)
 		return;
@@ -212,6 +413,10 @@ int git_deflate_end_gently(git_zstream *strm)
 {
 	int status;
 
+	if (strm->pooled) {
+		zstream_pool_put(strm);
+		return Z_OK;
+	}
 	zlib_pre_call(strm);
 	status = deflateEnd(&strm->z);
 	zlib_post_call(strm);
@@ -226,8 +431,8 @@ int git_deflate(git_zstream *strm, int flush)
 		zlib_pre_call(strm);
 
 		/* Never say Z_FINISH unless we are feeding everything */
-		status = deflate(&strm->z,
-				 (strm->z.avail_in != strm->avail_in)
+		status = deflate(zstream(strm),
+				 (zstream(strm)->avail_in != strm->avail_in)
 				 ? 0 : flush);
 		if (status == Z_MEM_ERROR)
 			die("deflate: out of memory");
@@ -237,7 +442,7 @@ int git_deflate(git_zstream *strm, int flush)
 		 * Let zlib work another round, while we can still
 		 * make progress.
 		 */
-		if ((strm->avail_out && !strm->z.avail_out) &&
+		if ((strm->avail_out && !zstream(strm)->avail_out) &&
 		    (status == Z_OK || status == Z_BUF_ERROR))
 			continue;
 		break;
@@ -253,6 +458,6 @@ int git_deflate(git_zstream *strm, int flush)
 		break;
 	}
 	error("deflate: %s (%s)", zerr_to_string(status),
-	      strm->z.msg ? strm->z.msg : "no message");
+	      zstream_msg(strm));
 	return status;
 }